@@ -0,0 +1,188 @@
+/*
+ * cp_archive.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API defines the archive, a binary image of collected challenge-response
+ * pairs which verifiers map into memory as it is, in place of one queryN.xml
+ * and one responseN.xml per pair. Every field is stored raw, in a fixed width
+ * column, so a pair takes about a third of the space of its XML and no parsing.
+ *
+ * Image layout (host byte order, every offset from the start of the file):
+ *
+ *   cpi_archive_header_t
+ *   segment 0, segment 1, ...      one per append, back to back
+ *
+ * and each segment:
+ *
+ *   cpi_archive_segment_t
+ *   one column per CPI_ARCHIVE_COL_, record_count values each, 8 byte aligned
+ *   uint32_t[record_count]         records of the segment, by putative ID, key ID, then record
+ *
+ * Archives only grow. An append writes a whole segment past the end of the
+ * image, syncs it, then rewrites the header, which alone makes the segment
+ * part of the archive; a segment cut off by a crash is ignored and written
+ * over by the next append.
+ *
+ * The library writes archives ("cpi collect"); test/verify maps and reads them.
+ */
+
+#ifndef CP_ARCHIVE_H
+#define CP_ARCHIVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "cp_interface.h"
+
+#include <stdint.h>
+
+/*! \name archive image */
+/*! \{ */
+#define CPI_ARCHIVE_MAGIC           0x52415043  /*!< "CPAR", as read on the host which built the image */
+#define CPI_ARCHIVE_SEGMENT_MAGIC   0x47535043  /*!< "CPSG", at the start of each segment */
+#define CPI_ARCHIVE_VERSION         1           /*!< image layout version */
+#define CPI_ARCHIVE_ALIGN           8           /*!< alignment of segments, columns and indexes */
+/*! \} */
+
+/*! size of a public key packet, as reported by pkey: 10 bytes of header, the modulus, 2 bytes, and the exponent */
+#define CPI_ARCHIVE_PKEY_SIZE       (10 + CPI_RESULT2_SIZE + 2 + 4)
+
+/*! \name archive record flags */
+/*! \{ */
+#define CPI_ARCHIVE_HAS_SERIAL      0x0001  /*!< serial number was queried */
+#define CPI_ARCHIVE_HAS_PKEY        0x0002  /*!< public key was queried */
+#define CPI_ARCHIVE_HAS_CKEY        0x0004  /*!< current owner key index was queried */
+/*! \} */
+
+/*! \name archive columns, in segment order */
+/*! \{ */
+#define CPI_ARCHIVE_COL_PID         0x00    /*!< putative ID, 16 bytes */
+#define CPI_ARCHIVE_COL_KEY_ID      0x01    /*!< challenged key ID, uint16_t */
+#define CPI_ARCHIVE_COL_FLAGS       0x02    /*!< CPI_ARCHIVE_ flags, uint16_t */
+#define CPI_ARCHIVE_COL_CKEY        0x03    /*!< current owner key index, uint32_t */
+#define CPI_ARCHIVE_COL_SERIAL      0x04    /*!< serial number, CPI_SERIAL_NUMBER_SIZE bytes */
+#define CPI_ARCHIVE_COL_RNDX        0x05    /*!< challenge random data (rn), CPI_RNDX_SIZE bytes */
+#define CPI_ARCHIVE_COL_RM          0x06    /*!< blinding value (rm), CPI_RESULT1_RAND_SIZE bytes */
+#define CPI_ARCHIVE_COL_ENC_OK      0x07    /*!< encrypted owner key, CPI_RESULT1_ENC_OK_SIZE bytes */
+#define CPI_ARCHIVE_COL_SIG         0x08    /*!< blinded signature, CPI_RESULT2_SIZE bytes */
+#define CPI_ARCHIVE_COL_VERS        0x09    /*!< version, CPI_RESULT1_VERS_SIZE bytes */
+#define CPI_ARCHIVE_COL_PKEY        0x0A    /*!< public key packet, CPI_ARCHIVE_PKEY_SIZE bytes */
+#define CPI_ARCHIVE_COL_COUNT       0x0B
+/*! \} */
+
+/*! archive image header */
+typedef struct _cpi_archive_header_t
+{
+    uint32_t magic;                 /*!< CPI_ARCHIVE_MAGIC */
+    uint32_t version;               /*!< CPI_ARCHIVE_VERSION */
+    uint32_t segment_count;         /*!< number of segments */
+    uint32_t record_count;          /*!< number of records, over every segment */
+    uint64_t file_size;             /*!< size of the image, up to the end of the last segment */
+    uint32_t reserved[10];
+}
+cpi_archive_header_t;
+
+/*! archive segment header */
+typedef struct _cpi_archive_segment_t
+{
+    uint32_t magic;                                 /*!< CPI_ARCHIVE_SEGMENT_MAGIC */
+    uint32_t record_count;                          /*!< number of records in the segment */
+    uint32_t first_record;                          /*!< archive record number of the first one */
+    uint32_t reserved;
+    uint64_t size;                                  /*!< size of the segment, header included */
+    uint64_t column_offset[CPI_ARCHIVE_COL_COUNT];  /*!< offset of each column, from the segment */
+    uint64_t index_offset;                          /*!< offset of the index, from the segment */
+}
+cpi_archive_segment_t;
+
+/*! one challenge-response pair */
+typedef struct _cpi_archive_record_t
+{
+    uint8_t  pid[0x10];
+    uint16_t key_id;
+    uint16_t flags;
+    uint32_t ckey;
+    uint8_t  serial[CPI_SERIAL_NUMBER_SIZE];
+    uint8_t  rndx[CPI_RNDX_SIZE];
+    uint8_t  rm[CPI_RESULT1_RAND_SIZE];
+    uint8_t  enc_ok[CPI_RESULT1_ENC_OK_SIZE];
+    uint8_t  sig[CPI_RESULT2_SIZE];
+    uint8_t  vers[CPI_RESULT1_VERS_SIZE];
+    uint8_t  pkey[CPI_ARCHIVE_PKEY_SIZE];
+}
+cpi_archive_record_t;
+
+/*!
+
+ Retrieve the width of an archive column.
+
+  @param column (INP) - CPI_ARCHIVE_COL_ value
+  @return Width in bytes, 0 if there is no such column
+
+ */
+
+int cpi_archive_column_size(int column);
+
+/*!
+
+ Retrieve where the value of a column lies in a record.
+
+  @param p_rec (INP) - Record
+  @param column (INP) - CPI_ARCHIVE_COL_ value
+  @return Pointer into p_rec, null if there is no such column
+
+ */
+
+void *cpi_archive_column(const cpi_archive_record_t *p_rec, int column);
+
+/*!
+
+ Lay out a segment of the specified number of records, filling in its column
+ and index offsets.
+
+  @param p_seg (OUT) - Segment header
+  @param count (INP) - Number of records
+  @return Size of the segment, header included
+
+ */
+
+uint64_t cpi_archive_layout(cpi_archive_segment_t *p_seg, uint32_t count);
+
+/*!
+
+ Append records to an archive, as one segment, creating the archive if need be
+ (a file too short to hold an archive header is taken for one whose creation was
+ cut off, and started over). The records are on disk once this returns; if it
+ fails, or is cut off by a crash, the archive holds what it held before. Appends
+ to the same archive, from any process, take turns (see flock(2)).
+
+  @param path (INP) - Archive path
+  @param records (INP) - Records to append
+  @param count (INP) - Number of records
+  @return CPI_OK for success, CPI_INVALID_PARAM if the file is not an archive, otherwise CPI_ error code
+
+ */
+
+int cpi_archive_append(const char *path, const cpi_archive_record_t *records, uint32_t count);
+
+/*!
+
+ Retrieve the number of records of an archive, as of its last complete append.
+
+  @param path (INP) - Archive path
+  @param p_count (OUT) - Number of records, 0 if there is no archive at path yet
+  @return CPI_OK for success, CPI_INVALID_PARAM if the file is not an archive, otherwise CPI_ error code
+
+ */
+
+int cpi_archive_count(const char *path, uint32_t *p_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * cp_base64.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API defines the base64 encoder and decoder used by the CPI, for the
+ * CP transport as well as for offline tools which process collected
+ * responses in bulk. A scalar implementation is always available; SIMD
+ * engines (SSSE3, AVX2) are selected at runtime when supported.
+ */
+
+#ifndef CP_BASE64_H
+#define CP_BASE64_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "cp_interface.h"
+
+#include <stdint.h>
+
+/*! \name base64 sizes, in bytes */
+/*! \{ */
+#define CPI_B64_ENCODED_SIZE(n)     ((((n) + 2) / 3) * 4)   /*!< encoded length of n raw bytes, excluding null terminator */
+#define CPI_B64_DECODED_SIZE(n)     ((((n) + 3) / 4) * 3)   /*!< upper bound of decoded length of n characters */
+/*! \} */
+
+/*! \name base64 decode flags */
+/*! \{ */
+#define CPI_B64_SKIP_WS             0x0001  /*!< ignore whitespace (space, tab, CR, LF) between characters */
+/*! \} */
+
+/*! \name base64 engines */
+/*! \{ */
+#define CPI_B64_ENGINE_AUTO         0x0000  /*!< best engine supported by this CPU */
+#define CPI_B64_ENGINE_SCALAR       0x0001  /*!< portable table driven engine */
+#define CPI_B64_ENGINE_SSSE3        0x0002  /*!< x86 SSSE3, 16 characters per step */
+#define CPI_B64_ENGINE_AVX2         0x0003  /*!< x86 AVX2, 32 characters per step */
+/*! \} */
+
+/*! base64 stream state, for data which arrives (or is produced) in pieces */
+typedef struct _cpi_b64_state
+{
+    uint8_t  *data;         /*!< destination memory */
+    int       size;         /*!< size of destination memory, in bytes */
+    int       used;         /*!< number of bytes written so far */
+    int       flags;        /*!< CPI_B64_ flags */
+    int       error;        /*!< CPI_ error code, once the stream has failed */
+    int       quad;         /*!< number of characters (decode) or bytes (encode) pending */
+    int       pad;          /*!< number of padding characters seen (decode) */
+    uint8_t   pending[4];   /*!< pending characters (decode) or bytes (encode) */
+}
+cpi_b64_state;
+
+/*!
+
+ Select the engine used by all base64 functions.
+
+  @param engine (INP) - CPI_B64_ENGINE_ value
+  @return CPI_OK for success, CPI_NOTIMPL if the engine is not supported by this CPU or build
+
+*/
+
+int cpi_b64_select(int engine);
+
+/*!
+
+ Retrieve the engine currently in use.
+
+  @return CPI_B64_ENGINE_ value (never CPI_B64_ENGINE_AUTO)
+
+*/
+
+int cpi_b64_engine(void);
+
+/*!
+
+ Base64 encode a buffer.
+
+  @param data (INP) - raw data
+  @param size (INP) - size of raw data, in bytes
+  @param str (OUT) - output string, null terminated if there is room
+  @param p_len (INP/OUT) - size of str on input, number of characters written (excluding null terminator) on return
+  @return CPI_OK for success, CPI_OUT_OF_MEMORY if str is too small
+
+*/
+
+int cpi_b64_encode(const void *data, int size, char *str, int *p_len);
+
+/*!
+
+ Base64 decode a string. Padding is optional, but must be correct when present.
+ Any character outside the base64 alphabet fails the decode, unless it is
+ whitespace and CPI_B64_SKIP_WS is specified.
+
+  @param str (INP) - base64 string
+  @param len (INP) - length of str, in characters
+  @param data (OUT) - raw data
+  @param p_size (INP/OUT) - size of data on input, number of bytes written on return
+  @param flags (INP) - CPI_B64_ flags
+  @return CPI_OK for success, CPI_FAIL for invalid input, CPI_OUT_OF_MEMORY if data is too small
+
+*/
+
+int cpi_b64_decode(const char *str, int len, void *data, int *p_size, int flags);
+
+/*! begin a streaming encode into the specified string memory */
+void cpi_b64_encode_begin(cpi_b64_state *p_state, char *str, int len);
+
+/*! encode the next piece of raw data (returns the stream error, if any) */
+int cpi_b64_encode_update(cpi_b64_state *p_state, const void *data, int size);
+
+/*! finish a streaming encode, null terminating the string if there is room (returns # characters written) */
+int cpi_b64_encode_end(cpi_b64_state *p_state, int *p_len);
+
+/*! begin a streaming decode into the specified memory */
+void cpi_b64_decode_begin(cpi_b64_state *p_state, void *data, int size, int flags);
+
+/*! decode the next piece of a base64 string (returns the stream error, if any) */
+int cpi_b64_decode_update(cpi_b64_state *p_state, const char *str, int len);
+
+/*! finish a streaming decode (returns # bytes written) */
+int cpi_b64_decode_end(cpi_b64_state *p_state, int *p_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,441 @@
+/*
+ * cp_device.hpp
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API defines a header-only C++20 layer over the CPI asynchronous core.
+ * Each operation returns an awaitable which submits the command when it is
+ * awaited, and resumes the awaiting coroutine once the exchange completes.
+ * Results are typed, and live inside the awaitable (and therefore inside the
+ * awaiting coroutine frame), so operations never allocate.
+ *
+ * Resumption is delegated to an executor, which only has to provide
+ * post(std::coroutine_handle<>). The default executor resumes inline, from
+ * within Device::process_events().
+ */
+
+#ifndef CP_DEVICE_HPP
+#define CP_DEVICE_HPP
+
+#include "cp_interface.h"
+
+#include <array>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include <poll.h>
+
+namespace cpi
+{
+
+/*! typed result of a single operation */
+template <class T>
+struct Result
+{
+    /*! CPI_ return code */
+    int status = CPI_FAIL;
+    /*! result value, valid if status is CPI_OK */
+    T value{};
+
+    bool ok() const { return CPI_SUCCESS(status); }
+    explicit operator bool() const { return ok(); }
+};
+
+/*! result of an operation without output */
+template <>
+struct Result<void>
+{
+    /*! CPI_ return code */
+    int status = CPI_FAIL;
+
+    bool ok() const { return CPI_SUCCESS(status); }
+    explicit operator bool() const { return ok(); }
+};
+
+/*! \name typed results */
+/*! \{ */
+using PutativeId      = std::array<uint8_t, 0x10>;
+using VersionData     = std::array<uint8_t, CPI_VERSION_SIZE>;
+using SerialNumber    = std::array<uint8_t, CPI_SERIAL_NUMBER_SIZE>;
+using HardwareVersion = std::array<uint8_t, CPI_HARDWARE_VERSION_SIZE>;
+using RandomData      = std::array<uint8_t, CPI_RNDX_SIZE>;
+/*! \} */
+
+/*! armored public key, as returned by the CP */
+struct PublicKey
+{
+    std::array<char, CPI_MAX_RESULT_SIZE> data;
+    size_t size = 0;
+
+    std::string_view view() const { return std::string_view(data.data(), size); }
+};
+
+/*! challenge result */
+struct Challenge
+{
+    /*! encrypted owner key, "Rm" and version data */
+    std::array<uint8_t, CPI_RESULT1_SIZE> result1;
+    /*! signature */
+    std::array<uint8_t, CPI_RESULT2_SIZE> result2;
+    /*! hash (only on platforms which return it) */
+    std::array<uint8_t, CPI_RESULT3_SIZE> result3;
+    /*! set if result3 was returned */
+    bool has_result3 = false;
+};
+
+/*! format a putative ID in GUID form */
+inline std::array<char, CPI_PUTATIVE_ID_SIZE> format_guid(const PutativeId &id)
+{
+    std::array<char, CPI_PUTATIVE_ID_SIZE> str{};
+
+    std::snprintf(str.data(), str.size(), "%.02X%.02X%.02X%.02X-%.02X%.02X-%.02X%.02X-%.02X%.02X-%.02X%.02X%.02X%.02X%.02X%.02X",
+        id[0x00], id[0x01], id[0x02], id[0x03], id[0x04], id[0x05], id[0x06], id[0x07],
+        id[0x08], id[0x09], id[0x0A], id[0x0B], id[0x0C], id[0x0D], id[0x0E], id[0x0F]);
+
+    return str;
+}
+
+/*! executor which resumes the awaiting coroutine inline */
+struct InlineExecutor
+{
+    void post(std::coroutine_handle<> h) { h.resume(); }
+};
+
+/*! requirements for an executor adapter */
+template <class E>
+concept Executor = requires(E &e, std::coroutine_handle<> h) { e.post(h); };
+
+namespace detail
+{
+
+/*! awaitable for a single command. Binder describes how the typed result maps onto cpi_cmd_t. */
+template <class T, class Binder, Executor E>
+class Operation
+{
+public:
+    template <class... Args>
+    Operation(cpi_t *p_cpi, E *p_executor, Args&&... args) : p_cpi(p_cpi), p_executor(p_executor), binder(static_cast<Args&&>(args)...) { }
+
+    /*! awaitables are used in place, since the CPI keeps a pointer to the command */
+    Operation(const Operation&) = delete;
+    Operation &operator=(const Operation&) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        handle = h;
+
+        std::memset(&cmd, 0, sizeof(cmd));
+
+        binder.bind(cmd, result.value);
+
+        cmd.user_data = this;
+
+        result.status = cpi_submit(p_cpi, &cmd, &Operation::complete);
+
+        /*! resume right away if the command could not be queued */
+        return CPI_SUCCESS(result.status);
+    }
+
+    Result<T> await_resume()
+    {
+        if(result.ok()) { binder.finish(cmd, result.value); }
+
+        return result;
+    }
+
+private:
+    static void complete(cpi_t *, cpi_cmd_t *p_cmd)
+    {
+        Operation *op = static_cast<Operation*>(p_cmd->user_data);
+
+        op->result.status = p_cmd->status;
+        op->p_executor->post(op->handle);
+    }
+
+    cpi_t *p_cpi;
+    E *p_executor;
+    Binder binder;
+    cpi_cmd_t cmd;
+    Result<T> result;
+    std::coroutine_handle<> handle;
+};
+
+/*! awaitable for a command without output */
+template <class Binder, Executor E>
+class Operation<void, Binder, E>
+{
+public:
+    template <class... Args>
+    Operation(cpi_t *p_cpi, E *p_executor, Args&&... args) : p_cpi(p_cpi), p_executor(p_executor), binder(static_cast<Args&&>(args)...) { }
+
+    Operation(const Operation&) = delete;
+    Operation &operator=(const Operation&) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        handle = h;
+
+        std::memset(&cmd, 0, sizeof(cmd));
+
+        binder.bind(cmd);
+
+        cmd.user_data = this;
+
+        result.status = cpi_submit(p_cpi, &cmd, &Operation::complete);
+
+        return CPI_SUCCESS(result.status);
+    }
+
+    Result<void> await_resume() { return result; }
+
+private:
+    static void complete(cpi_t *, cpi_cmd_t *p_cmd)
+    {
+        Operation *op = static_cast<Operation*>(p_cmd->user_data);
+
+        op->result.status = p_cmd->status;
+        op->p_executor->post(op->handle);
+    }
+
+    cpi_t *p_cpi;
+    E *p_executor;
+    Binder binder;
+    cpi_cmd_t cmd;
+    Result<void> result;
+    std::coroutine_handle<> handle;
+};
+
+/*! binder for commands returning fixed size raw data in out[0] */
+template <int Cmd, class T>
+struct RawBinder
+{
+    uint16_t key_id = 0;
+
+    void bind(cpi_cmd_t &cmd, T &value)
+    {
+        cmd.cmd = Cmd;
+        cmd.key_id = key_id;
+        cmd.out[0] = value.data();
+        cmd.out_size[0] = static_cast<int>(value.size());
+    }
+
+    void finish(cpi_cmd_t &, T &) { }
+};
+
+/*! binder for commands returning a number in value */
+template <int Cmd>
+struct ValueBinder
+{
+    void bind(cpi_cmd_t &cmd, uint32_t &) { cmd.cmd = Cmd; cmd.priority = CPI_PRIORITY_URGENT; }
+
+    void finish(cpi_cmd_t &cmd, uint32_t &value) { value = cmd.value; }
+};
+
+/*! binder for the public key */
+struct PublicKeyBinder
+{
+    uint16_t key_id = 0;
+
+    void bind(cpi_cmd_t &cmd, PublicKey &key)
+    {
+        cmd.cmd = CPI_CMD_PKEY;
+        cmd.key_id = key_id;
+        cmd.priority = CPI_PRIORITY_BULK;
+        cmd.out[0] = key.data.data();
+        cmd.out_size[0] = static_cast<int>(key.data.size());
+    }
+
+    /*! the reported size includes the null terminator, when there was room for it */
+    void finish(cpi_cmd_t &, PublicKey &key) { key.size = strnlen(key.data.data(), key.data.size()); }
+};
+
+/*! binder for the challenge */
+struct ChallengeBinder
+{
+    uint16_t key_id = 0;
+    RandomData rand_data{};
+
+    void bind(cpi_cmd_t &cmd, Challenge &chal)
+    {
+        cmd.cmd = CPI_CMD_CHAL;
+        cmd.key_id = key_id;
+        cmd.priority = CPI_PRIORITY_BULK;
+        cmd.rand_data = rand_data.data();
+        cmd.out[0] = chal.result1.data();
+        cmd.out[1] = chal.result2.data();
+        cmd.out[2] = chal.result3.data();
+        cmd.out_size[0] = CPI_RESULT1_SIZE;
+        cmd.out_size[1] = CPI_RESULT2_SIZE;
+        cmd.out_size[2] = CPI_RESULT3_SIZE;
+    }
+
+    /*! result3 is only returned on platforms which provide it */
+    void finish(cpi_cmd_t &, Challenge &chal) { chal.has_result3 = platform_has_result3(); }
+
+    static constexpr bool platform_has_result3()
+    {
+#if defined(CNPLATFORM_falconwing)
+        return true;
+#else
+        return false;
+#endif
+    }
+};
+
+/*! binder for commands without output (classes as for the blocking calls) */
+template <int Cmd>
+struct VoidBinder
+{
+    uint32_t value = 0;
+
+    void bind(cpi_cmd_t &cmd)
+    {
+        cmd.cmd = Cmd;
+        cmd.value = value;
+        cmd.priority = (Cmd == CPI_CMD_ALRM) ? CPI_PRIORITY_URGENT : CPI_PRIORITY_NORMAL;
+    }
+};
+
+}
+
+/*!
+
+  @brief CPI device
+
+  Owns a CPI instance, and exposes each CP command as an awaitable. The caller
+  drives the device by calling process_events() whenever fd() is readable, or
+  by calling poll() from a simple loop.
+
+*/
+
+template <Executor E = InlineExecutor>
+class Device
+{
+public:
+    Device() = default;
+    explicit Device(E executor) : executor(executor) { }
+
+    ~Device() { close(); }
+
+    /*! the CPI keeps pointers into the device, so it stays in place */
+    Device(const Device&) = delete;
+    Device &operator=(const Device&) = delete;
+
+    /*! open the CP at the specified serial device path */
+    int open(const char *serial_device_path)
+    {
+        close();
+
+        int ret = cpi_create(0, &p_cpi);
+
+        if(CPI_FAILED(ret)) { p_cpi = 0; return ret; }
+
+        ret = cpi_init(p_cpi, const_cast<char*>(serial_device_path));
+
+        if(CPI_FAILED(ret)) { close(); }
+
+        return ret;
+    }
+
+    /*! close the CP (outstanding operations are dropped, and never resume) */
+    void close()
+    {
+        if(p_cpi != 0) { cpi_close(p_cpi); p_cpi = 0; }
+    }
+
+    /*! underlying CPI instance */
+    cpi_t *get() const { return p_cpi; }
+
+    /*! descriptor to wait on (see cpi_get_fd) */
+    int fd() const { return cpi_get_fd(p_cpi); }
+
+    /*! advance outstanding operations without blocking (see cpi_process_events) */
+    int process_events() { return cpi_process_events(p_cpi); }
+
+    /*! wait up to timeout_ms (-1 for ever) for events, then process them */
+    int poll(int timeout_ms)
+    {
+        struct pollfd pfd = { fd(), POLLIN, 0 };
+
+        ::poll(&pfd, 1, timeout_ms);
+
+        return process_events();
+    }
+
+    /*! \name operations */
+    /*! \{ */
+
+    auto putative_id(uint16_t key_id = 0)
+    {
+        return detail::Operation<PutativeId, detail::RawBinder<CPI_CMD_PIDX, PutativeId>, E>(p_cpi, &executor, detail::RawBinder<CPI_CMD_PIDX, PutativeId>{ key_id });
+    }
+
+    auto public_key(uint16_t key_id = 0)
+    {
+        return detail::Operation<PublicKey, detail::PublicKeyBinder, E>(p_cpi, &executor, detail::PublicKeyBinder{ key_id });
+    }
+
+    auto version_data()
+    {
+        return detail::Operation<VersionData, detail::RawBinder<CPI_CMD_VERS, VersionData>, E>(p_cpi, &executor);
+    }
+
+    auto time()
+    {
+        return detail::Operation<uint32_t, detail::ValueBinder<CPI_CMD_TIME>, E>(p_cpi, &executor);
+    }
+
+    auto owner_key_index()
+    {
+        return detail::Operation<uint32_t, detail::ValueBinder<CPI_CMD_CKEY>, E>(p_cpi, &executor);
+    }
+
+    auto serial_number()
+    {
+        return detail::Operation<SerialNumber, detail::RawBinder<CPI_CMD_SNUM, SerialNumber>, E>(p_cpi, &executor);
+    }
+
+    auto hardware_version()
+    {
+        return detail::Operation<HardwareVersion, detail::RawBinder<CPI_CMD_HWVR, HardwareVersion>, E>(p_cpi, &executor);
+    }
+
+    auto challenge(uint16_t key_id, const RandomData &rand_data)
+    {
+        return detail::Operation<Challenge, detail::ChallengeBinder, E>(p_cpi, &executor, detail::ChallengeBinder{ key_id, rand_data });
+    }
+
+    auto set_alarm(uint32_t alarm_time)
+    {
+        return detail::Operation<void, detail::VoidBinder<CPI_CMD_ALRM>, E>(p_cpi, &executor, detail::VoidBinder<CPI_CMD_ALRM>{ alarm_time });
+    }
+
+    auto power_down()
+    {
+        return detail::Operation<void, detail::VoidBinder<CPI_CMD_DOWN>, E>(p_cpi, &executor);
+    }
+
+    auto reset()
+    {
+        return detail::Operation<void, detail::VoidBinder<CPI_CMD_RSET>, E>(p_cpi, &executor);
+    }
+
+    /*! \} */
+
+private:
+    cpi_t *p_cpi = 0;
+    E executor{};
+};
+
+}
+
+#endif
@@ -18,11 +18,16 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 
 /*! \name forward declarations */
 /*! \{ */
 struct _cpi_info_t;
 struct _cpi_t;
+struct _cpi_cmd_t;
+struct _cpi_metrics_t;
+struct _cpi_lock_metrics_t;
+struct _cpi_budget_t;
 /*! \} */
 
 /*!
@@ -54,13 +59,36 @@ int cpi_close(struct _cpi_t *p_cpi);
  any other API calls, aside from cpi_create and cpi_close.
 
   @param p_cpi (INP) - CPI instance
-  @param serial_device_path (INP) - Path to proper serial device (e.g. "/dev/ttyS2")
-  @return CPI_OK for success, otherwise CPI_ error code
+  @param serial_device_path (INP) - Path to proper serial device (e.g. "/dev/ttyS2"), or
+                                    to the socket of a CPI daemon (see cpi_serve), in which
+                                    case every command is forwarded to the daemon
+  @return CPI_OK for success, otherwise CPI_ error code (CPI_ACCESS_DENIED if another
+          process still holds the serial device once lock_timeout_ms has expired)
 
  */
 
 int cpi_init(struct _cpi_t *p_cpi, char *serial_device_path);
 
+/*!
+
+ Serve the CP owned by an initialized CPI instance to other processes, through a
+ unix socket, until *p_stop becomes non-zero (checked whenever a signal interrupts
+ the wait). Clients connect with cpi_init(), passing socket_path; their requests
+ are executed in arrival order, one request per client at a time, so that each
+ client gets a fair share of the CP. Requests from different clients share CP
+ sessions whenever they are queued back to back.
+
+  @param p_cpi (INP) - CPI instance, not created with CPI_INFO_THREADED
+  @param socket_path (INP) - Path of the unix socket to create, with mode 0660 (a stale
+                             socket is replaced)
+  @param p_stop (INP) - Stop flag, typically set from a signal handler
+  @return CPI_OK for success, otherwise CPI_ error code (CPI_BUSY if another daemon
+          already serves on socket_path)
+
+ */
+
+int cpi_serve(struct _cpi_t *p_cpi, const char *socket_path, volatile int *p_stop);
+
 /*!
 
  Process the specified XML command, and return the result in XML.
@@ -74,6 +102,23 @@ int cpi_init(struct _cpi_t *p_cpi, char *serial_device_path);
 
 int cpi_process_xml(struct _cpi_t *p_cpi, char *inp_xml_str, char *out_xml_str);
 
+/*!
+
+ Process the specified XML command, and return the result in the specified format.
+ All formats carry the same set of responses as cpi_process_xml.
+
+  @param p_cpi (INP) - CPI instance
+  @param inp_xml_str (INP) - XML input string (null terminated)
+  @param format (INP) - CPI_FORMAT_ value selecting the output format
+  @param out_buff (OUT) - Output buffer. XML and JSON output is null terminated.
+  @param p_out_size (INP/OUT) - Size of out_buff in bytes on input, number of bytes
+                                written (excluding null terminator) on output
+  @return CPI_OK for success, CPI_OUT_OF_MEMORY if out_buff is too small, otherwise CPI_ error code
+
+ */
+
+int cpi_process_query(struct _cpi_t *p_cpi, char *inp_xml_str, int format, void *out_buff, int *p_out_size);
+
 /*!
 
  Get the putative ID of the specified key.
@@ -225,6 +270,235 @@ int cpi_get_hardware_version_data(struct _cpi_t *p_cpi, uint8_t *raw_hard_vers);
 
   int cpi_issue_challenge(struct _cpi_t *p_cpi, uint16_t cpi_key_id, uint8_t *rand_data, uint8_t *result1, uint8_t *result2, uint8_t *result3);
 
+/*!
+
+ Execute a batch of commands in a single CP session. The CP is woken once, and each
+ command is written as soon as the previous response has been read. Entries are
+ executed in order: an entry of another priority class than the one before it waits
+ for the earlier entries to complete, so the class of each entry only sets its place
+ among other callers' commands (see CPI_PRIORITY_). A failed entry does not stop the
+ batch, but after a failure on the link (rather than a FAIL answer from the CP) the
+ next entry starts a new session.
+
+  @param p_cpi (INP) - CPI instance
+  @param cmds (INP/OUT) - Array of commands. Results and per-entry status are written back.
+  @param n (INP) - Number of commands in cmds
+  @return CPI_OK if every entry succeeded, otherwise the CPI_ error code of the first failed entry
+
+ */
+
+int cpi_execute_batch(struct _cpi_t *p_cpi, struct _cpi_cmd_t *cmds, size_t n);
+
+/*!
+
+ Completion callback for cpi_submit(). Called from cpi_process_events() once the
+ command has finished, with p_cmd->status set (from the I/O thread, for instances
+ created with CPI_INFO_THREADED, or the thread reading responses, for those also
+ connected to a CPI daemon). The callback may submit further commands, but
+ must not call any of the blocking APIs on the same instance.
+
+ */
+
+typedef void (*cpi_callback_t)(struct _cpi_t *p_cpi, struct _cpi_cmd_t *p_cmd);
+
+/*!
+
+ Queue a command for asynchronous execution. The command, and its output buffers,
+ must remain valid until its callback has been called. Commands of one priority class
+ are executed in submission order; a command of a more urgent class is sent ahead of any
+ waiting less urgent ones (see CPI_PRIORITY_), so there is no order across classes.
+ Consecutive commands share one CP session, as in cpi_execute_batch().
+ A read-only command identical to one already queued (same command and key ID, with
+ output buffers at least as large) of the same or a more urgent class, which is expected
+ to finish within the new command's deadline, is not sent again: it shares that exchange,
+ and completes right after it with the same result. CHAL, ALRM, DOWN and RSET are never
+ shared, and nothing is shared across them.
+ For instances created with CPI_INFO_THREADED, this may be called from any thread.
+
+  @param p_cpi (INP) - CPI instance
+  @param p_cmd (INP/OUT) - Command, described as for cpi_execute_batch()
+  @param callback (INP) - Completion callback (may be null)
+  @return CPI_OK if the command was queued, otherwise CPI_ error code (the callback is not called).
+          CPI_OUT_OF_MEMORY is returned while CPI_MAX_PENDING commands of the same priority
+          class are waiting, and CPI_BUSY if the command could not complete within its deadline_ms.
+          Shared instances admit commands on the I/O thread, and instances connected to a CPI
+          daemon in the daemon, so they report CPI_BUSY through the callback instead. Those
+          connected to a daemon return CPI_OUT_OF_MEMORY while CPI_MAX_PENDING requests
+          are waiting for the daemon's response.
+
+ */
+
+int cpi_submit(struct _cpi_t *p_cpi, struct _cpi_cmd_t *p_cmd, cpi_callback_t callback);
+
+/*!
+
+ Retrieve a file descriptor which becomes readable whenever cpi_process_events()
+ has work to do. It may be added to poll(), select() or epoll, and must not be
+ read from or closed by the caller.
+
+  @param p_cpi (INP) - CPI instance
+  @return File descriptor (the connection, for instances connected to a CPI
+          daemon), or -1 if the instance is not initialized, or was created with
+          CPI_INFO_THREADED (events are then processed internally)
+
+ */
+
+int cpi_get_fd(struct _cpi_t *p_cpi);
+
+/*!
+
+ Advance outstanding commands as far as possible without blocking, calling the
+ completion callback of each command which finishes.
+
+  @param p_cpi (INP) - CPI instance
+  @return CPI_OK for success, otherwise CPI_ error code (CPI_INVALID_CALL for
+          instances created with CPI_INFO_THREADED)
+
+ */
+
+int cpi_process_events(struct _cpi_t *p_cpi);
+
+/*!
+
+ Retrieve the scheduler metrics of a CPI instance: queue depth, wait time, and
+ admission results, for each priority class. For instances connected to a CPI
+ daemon, the daemon's metrics are returned.
+
+  @param p_cpi (INP) - CPI instance
+  @param p_metrics (OUT) - Metrics
+  @return CPI_OK for success, otherwise CPI_ error code
+
+ */
+
+int cpi_get_metrics(struct _cpi_t *p_cpi, struct _cpi_metrics_t *p_metrics);
+
+/*!
+
+ Retrieve the metrics of the cross-process lock on the serial device used by a
+ CPI instance: processes queued now, grants, timeouts, and wait and hold times.
+ These are shared by every process using the device through the same lock
+ directory (see cpi_info_t), which is created mode 2770 with the group of the
+ device, so that they need only be in that group.
+
+  @param p_cpi (INP) - CPI instance
+  @param p_metrics (OUT) - Metrics
+  @return CPI_OK for success, otherwise CPI_ error code (CPI_NOTIMPL for instances
+          connected to a CPI daemon, or if the lock queue could not be set up,
+          CPI_BUSY if the queue stayed locked by another process)
+
+ */
+
+int cpi_get_lock_metrics(struct _cpi_t *p_cpi, struct _cpi_lock_metrics_t *p_metrics);
+
+/*!
+
+ Set the delay between characters written to the CP. Writing too quickly can
+ leave the CP unable to service requests until it is power cycled, so cpi_init
+ starts from the delay saved for the CP in the pacing profile (see cpi_save_pacing),
+ or from CPI_WRITE_DELAY_US. Whenever an exchange fails on the link (a framing
+ error, a bad acknowledgement or a timeout), the delay is raised, and it then
+ creeps back to this one as exchanges go through, including those the CP answers
+ with FAIL.
+
+  @param p_cpi (INP) - CPI instance
+  @param delay_us (INP) - Delay in microseconds, taking effect from the next exchange
+  @return CPI_OK for success, otherwise CPI_ error code. For instances connected to a
+          CPI daemon, this sets the daemon's delay, for every client, and waits for
+          the daemon to accept it.
+
+ */
+
+int cpi_set_write_delay(struct _cpi_t *p_cpi, uint32_t delay_us);
+
+/*!
+
+ Save the delay between written characters for a CP in a pacing profile, from
+ which cpi_init loads it. Profiles are text files with one line per CP and
+ platform, holding the serial number in hex, the platform name and the delay in
+ microseconds. An existing line for the same CP and platform is replaced.
+
+  @param profile_path (INP) - Pacing profile, created if missing (null for CPI_PACING_PROFILE)
+  @param raw_serial (INP) - CPI_SERIAL_NUMBER_SIZE bytes of serial number
+  @param delay_us (INP) - Delay in microseconds
+  @return CPI_OK for success, otherwise CPI_ error code
+
+ */
+
+int cpi_save_pacing(const char *profile_path, const uint8_t *raw_serial, uint32_t delay_us);
+
+/*!
+
+ Load the authentication budget model of a CP from a budget state file. The CP
+ answers a challenge with AUTHCOUNT (CPI_ACCESS_DENIED) once it has accepted too
+ many within too short a time; the model holds what has been learned of that limit
+ from the CP's answers, and when the latest challenges were accepted, in CP time
+ (see cpi_get_current_time). A CP with no saved state starts from the defaults:
+ one challenge per CPI_BUDGET_WINDOW seconds, with both limits still to learn.
+
+  @param state_path (INP) - Budget state file (null for CPI_BUDGET_STATE)
+  @param raw_serial (INP) - CPI_SERIAL_NUMBER_SIZE bytes of serial number
+  @param p_budget (OUT) - Budget model
+  @return CPI_OK for success, otherwise CPI_ error code (a missing file or line is not an error)
+
+ */
+
+int cpi_load_budget(const char *state_path, const uint8_t *raw_serial, struct _cpi_budget_t *p_budget);
+
+/*!
+
+ Save the authentication budget model of a CP in a budget state file, replacing
+ the CP's line, if any. The file is replaced in one step.
+
+  @param state_path (INP) - Budget state file, created if missing (null for CPI_BUDGET_STATE)
+  @param p_budget (INP) - Budget model
+  @return CPI_OK for success, otherwise CPI_ error code
+
+ */
+
+int cpi_save_budget(const char *state_path, const struct _cpi_budget_t *p_budget);
+
+/*!
+
+ Retrieve how long to wait before the next challenge, according to the budget
+ model. This is 0 while the CP is expected to accept a challenge, and otherwise
+ the time until the oldest challenge that counts against the budget leaves its
+ window. While the limit is still being learned, the wait may be shorter than
+ the model knows to be safe, so that the CP's answer narrows it down.
+
+  @param p_budget (INP/OUT) - Budget model, rebased if the CP has rebooted since its last update
+  @param cur_time (INP) - CP time, as returned by cpi_get_current_time
+  @return Time to wait, in seconds
+
+ */
+
+uint32_t cpi_budget_wait(struct _cpi_budget_t *p_budget, uint32_t cur_time);
+
+/*!
+
+ Update the budget model with the outcome of a challenge issued at the specified
+ CP time. CPI_OK and CPI_ACCESS_DENIED are learned from; other statuses say
+ nothing about the budget, and are ignored.
+
+  @param p_budget (INP/OUT) - Budget model
+  @param cur_time (INP) - CP time at which the challenge was issued
+  @param status (INP) - Status of the challenge
+
+ */
+
+void cpi_budget_update(struct _cpi_budget_t *p_budget, uint32_t cur_time, int status);
+
+/*!
+
+ Retrieve the number of heap allocations made by the CPI library so far. This
+ includes allocations made by the XML parser on behalf of cpi_process_xml, and
+ is intended for benchmarking the steady-state allocation behavior.
+
+  @return Total number of heap allocations since process start
+
+ */
+
+unsigned long cpi_get_alloc_count(void);
+
 /*! 
 
   @brief CPI instance
@@ -239,13 +513,73 @@ typedef struct _cpi_t
     int serial_file;
     /*! initialization flag */
     int is_initialized;
-    /*! temporary buffer */
-    char *tmp_buff; 
-    /*! temporary buffer, for XML parsing */
-    char *tmp_buff_xml;
+    /*! XML parser (XML_Parser), created on first use and reset between documents */
+    void *xml_parser;
+    /*! pending queries and their result storage, for XML processing, created on first use */
+    void *xml_batch;
+    /*! command queue and transport state machine, created by cpi_init */
+    void *async;
+    /*! CPI_INFO_ flags, from cpi_create */
+    int flags;
+    /*! daemon connection state, if cpi_init was given the socket of a CPI daemon */
+    void *remote;
+    /*! cross-process lock state, created by cpi_init */
+    void *lock;
+    /*! time to wait for the serial device, from cpi_create */
+    int lock_timeout_ms;
+    /*! pacing profile loaded by cpi_init, from cpi_create */
+    const char *pacing_profile;
+    /*! directory of the lock queues, from cpi_create */
+    const char *lock_dir;
 }
 cpi_t;
 
+/*! 
+
+  @brief CPI batch command
+
+  This structure describes a single entry for cpi_execute_batch(). Unused fields
+  should be zero. Output buffers are owned by the caller, and receive the same raw
+  data as the equivalent cpi_get_ call:
+
+   - CPI_CMD_PIDX : out[0] receives 16 bytes of raw putative ID
+   - CPI_CMD_PKEY : out[0] receives the null terminated public key string
+   - CPI_CMD_VERS : out[0] receives CPI_VERSION_SIZE bytes
+   - CPI_CMD_TIME, CPI_CMD_CKEY : result is returned in value
+   - CPI_CMD_SNUM : out[0] receives CPI_SERIAL_NUMBER_SIZE bytes
+   - CPI_CMD_HWVR : out[0] receives CPI_HARDWARE_VERSION_SIZE bytes
+   - CPI_CMD_CHAL : out[0..2] receive result1, result2 and (where supported) result3
+   - CPI_CMD_ALRM, CPI_CMD_DOWN, CPI_CMD_RSET : no output
+
+*/
+
+typedef struct _cpi_cmd_t
+{
+    /*! (INP) CPI_CMD_ command code */
+    int cmd;
+    /*! (INP) key ID, for CPI_CMD_PIDX, CPI_CMD_PKEY and CPI_CMD_CHAL */
+    uint16_t key_id;
+    /*! (INP/OUT) alarm time for CPI_CMD_ALRM, result for CPI_CMD_TIME and CPI_CMD_CKEY */
+    uint32_t value;
+    /*! (INP) CPI_RNDX_SIZE bytes of random data, for CPI_CMD_CHAL */
+    uint8_t *rand_data;
+    /*! (OUT) caller-owned output buffers */
+    void *out[3];
+    /*! (INP/OUT) size of each output buffer, number of bytes written on return */
+    int out_size[3];
+    /*! (OUT) CPI_ return code for this entry */
+    int status;
+    /*! (INP) caller context, for use by cpi_submit() callbacks */
+    void *user_data;
+    /*! (INP) CPI_PRIORITY_ class */
+    int priority;
+    /*! (INP) time limit in milliseconds, from submission; a command which is not expected
+     *  to complete in time, or is still waiting once it expires, fails with CPI_BUSY
+     *  without being sent (0 for no limit) */
+    uint32_t deadline_ms;
+}
+cpi_cmd_t;
+
 /*! 
 
   @brief CPI information 
@@ -257,10 +591,33 @@ cpi_t;
 
 typedef struct _cpi_info_t
 {
-    int dummy; /*!< temporary placeholder */
+    int flags; /*!< CPI_INFO_ flags */
+    int lock_timeout_ms; /*!< time cpi_init may wait for other processes to release the
+                          *   serial device, in order of arrival (0 fails right away if
+                          *   the device is in use, -1 waits with no limit) */
+    const char *pacing_profile; /*!< pacing profile cpi_init loads the write delay from (null
+                                 *   for CPI_PACING_PROFILE, "" for none); must stay valid
+                                 *   until cpi_init returns */
+    const char *lock_dir; /*!< directory of the lock queues shared with other processes
+                           *   (null for CPI_LOCK_DIR); must stay valid until cpi_init
+                           *   returns */
 }
 cpi_info_t;
 
+/*! \name CPI instance flags */
+/*! \{ */
+/*! Allow any thread to use the instance. Commands from all threads go through a
+ *  lock-free queue, and are executed in batches by an I/O thread owned by the
+ *  instance; blocking calls wait only for their own commands. The instance must
+ *  not be closed while other threads are still using it. */
+#define CPI_INFO_THREADED           0x0001
+/*! Start each request of a session as soon as the CP has sent the last response
+ *  line of the previous exchange, without waiting for its EOF character or for
+ *  the pacing delay since our last write, and call the previous command's
+ *  callback while the new request is being written. */
+#define CPI_INFO_PIPELINED          0x0002
+/*! \} */
+
 /*! \name CPI sizes, in bytes */
 /*! \{ */
 #define CPI_MAX_RESULT_SIZE         0x1000  /*!< 4096 bytes, @todo finalize this max */
@@ -278,6 +635,150 @@ cpi_info_t;
 #define CPI_RESULT3_SIZE            (416)   /*!< 416 bytes, raw binary data, holds hash result, rounded to nearest block length */
 /*! \} */
 
+/*! \name CPI limits */
+/*! \{ */
+#define CPI_MAX_PENDING             0x0020  /*!< maximum number of commands waiting in each priority class */
+#define CPI_METRICS_BUCKETS         0x0010  /*!< number of wait time histogram buckets in cpi_metrics_t */
+/*! \} */
+
+/*! \name CPI pacing, see cpi_set_write_delay */
+/*! \{ */
+#define CPI_WRITE_DELAY_US          10000               /*!< delay between written characters, for CPs without a profile */
+#define CPI_PACING_PROFILE          "/psp/cpi_pacing"   /*!< default pacing profile */
+/*! \} */
+
+/*! \name CPI cross-process lock, see cpi_get_lock_metrics */
+/*! \{ */
+#define CPI_LOCK_DIR                "/var/run/cpi"      /*!< default directory of the lock queues */
+/*! \} */
+
+/*! \name CPI authentication budget, see cpi_load_budget */
+/*! \{ */
+#define CPI_BUDGET_WINDOW           300                 /*!< window, in seconds, known to be safe for one challenge */
+#define CPI_BUDGET_MAX_CAPACITY     0x0040              /*!< most challenges per window the model tracks */
+#define CPI_BUDGET_STATE            "/psp/cpi_budget"   /*!< default budget state file */
+/*! \} */
+
+/*! \name CPI priority classes, for cpi_cmd_t.priority
+
+  Waiting commands of a more urgent class are always sent first. cpi_get_current_time,
+  cpi_get_owner_key_index and cpi_set_alarm_time use CPI_PRIORITY_URGENT, and
+  cpi_issue_challenge and cpi_get_public_key use CPI_PRIORITY_BULK. */
+/*! \{ */
+#define CPI_PRIORITY_NORMAL     0x00    /*!< Default */
+#define CPI_PRIORITY_URGENT     0x01    /*!< Short, latency sensitive exchanges */
+#define CPI_PRIORITY_BULK       0x02    /*!< Long exchanges, which should not delay others */
+#define CPI_PRIORITY_COUNT      0x03    /*!< Number of priority classes */
+/*! \} */
+
+/*! 
+
+  @brief CPI scheduler metrics
+
+  This structure is filled by cpi_get_metrics(). Arrays are indexed by CPI_PRIORITY_
+  class. Wait time is measured from submission to the start of the exchange.
+
+*/
+
+typedef struct _cpi_metrics_t
+{
+    uint32_t depth[CPI_PRIORITY_COUNT];             /*!< commands waiting now */
+    uint32_t max_depth[CPI_PRIORITY_COUNT];         /*!< most commands waiting at once */
+    uint64_t completed[CPI_PRIORITY_COUNT];         /*!< exchanges completed, successful or not */
+    uint64_t rejected[CPI_PRIORITY_COUNT];          /*!< commands failed with CPI_BUSY, at admission or once expired */
+    uint64_t coalesced;                             /*!< commands which shared an identical command's exchange */
+    uint64_t wait_total_us[CPI_PRIORITY_COUNT];     /*!< total wait time of commands taken off the queue */
+    uint32_t wait_max_us[CPI_PRIORITY_COUNT];       /*!< longest wait time */
+    uint32_t wait_hist[CPI_PRIORITY_COUNT][CPI_METRICS_BUCKETS];   /*!< wait times; bucket b counts waits under 2^b ms, the last bucket all others */
+    uint32_t write_delay_us;                        /*!< current delay between written characters */
+    uint64_t backoffs;                              /*!< exchanges failed on the link, after which the delay was raised */
+}
+cpi_metrics_t;
+
+/*! 
+
+  @brief CPI lock metrics
+
+  This structure is filled by cpi_get_lock_metrics(). Times are in microseconds;
+  histogram bucket b counts durations under 2^b ms, the last bucket all others.
+
+*/
+
+typedef struct _cpi_lock_metrics_t
+{
+    uint32_t waiting;                               /*!< processes queued for the device now */
+    uint32_t acquired;                              /*!< times the device was granted */
+    uint32_t timeouts;                              /*!< processes which gave up waiting */
+    uint32_t recovered;                             /*!< owners and queued processes found dead, and dropped */
+    uint32_t wait_max_us;                           /*!< longest wait before a grant */
+    uint32_t hold_max_us;                           /*!< longest hold */
+    uint32_t wait_hist[CPI_METRICS_BUCKETS];        /*!< wait times, before each grant */
+    uint32_t hold_hist[CPI_METRICS_BUCKETS];        /*!< hold times, from grant to cpi_close */
+}
+cpi_lock_metrics_t;
+
+/*! 
+
+  @brief CPI authentication budget model
+
+  This structure is filled by cpi_load_budget(). The CP is taken to accept a
+  challenge while fewer than capacity challenges were accepted in the last window
+  seconds of CP time. The window is known to lie in (window_lo, window_hi]: a
+  challenge was denied window_lo seconds after the challenge it had to wait for,
+  and accepted window_hi seconds after it. Denied challenges are taken not to
+  count against the budget.
+
+*/
+
+typedef struct _cpi_budget_t
+{
+    uint8_t  raw_serial[CPI_SERIAL_NUMBER_SIZE];    /*!< CP the model belongs to */
+    uint32_t capacity;                              /*!< challenges accepted within one window */
+    uint32_t capacity_known;                        /*!< non-zero once a denial has shown capacity is not higher */
+    uint32_t window_lo;                             /*!< longest window known to be too short, in seconds */
+    uint32_t window_hi;                             /*!< shortest window known to be long enough, in seconds */
+    uint32_t last_time;                             /*!< CP time of the last update, to notice CP reboots */
+    uint32_t log_count;                             /*!< entries in log */
+    uint32_t log[CPI_BUDGET_MAX_CAPACITY];          /*!< CP times of the latest accepted challenges, oldest first */
+    uint64_t accepted;                              /*!< challenges accepted, over the life of the model */
+    uint64_t denied;                                /*!< challenges denied with AUTHCOUNT */
+}
+cpi_budget_t;
+
+/*! \name CPI output formats, for cpi_process_query */
+/*! \{ */
+#define CPI_FORMAT_XML          0x0000  /*!< XML response list, binary data hex encoded */
+#define CPI_FORMAT_JSON         0x0001  /*!< Compact JSON response list, binary data base64 encoded */
+#define CPI_FORMAT_TLV          0x0002  /*!< Binary TLV stream, binary data raw */
+/*! \} */
+
+/*! \name CPI command codes, also used as CPI_FORMAT_TLV record tags */
+/*! \{ */
+#define CPI_CMD_UNKNOWN         0x00    /*!< Unknown query type */
+#define CPI_CMD_PIDX            0x01    /*!< Putative ID, 16 bytes raw */
+#define CPI_CMD_PKEY            0x02    /*!< Public key, raw RFC2440 key packet (TLV) */
+#define CPI_CMD_VERS            0x03    /*!< Version data, CPI_VERSION_SIZE bytes raw */
+#define CPI_CMD_TIME            0x04    /*!< Current time, 4 bytes little endian */
+#define CPI_CMD_CKEY            0x05    /*!< Current owner key index, 4 bytes little endian */
+#define CPI_CMD_SNUM            0x06    /*!< Serial number, CPI_SERIAL_NUMBER_SIZE bytes raw */
+#define CPI_CMD_HWVR            0x07    /*!< Hardware version, CPI_HARDWARE_VERSION_SIZE bytes raw */
+#define CPI_CMD_CHAL            0x08    /*!< Challenge, result1 followed by result2 (and result3, where supported) */
+#define CPI_CMD_ALRM            0x09    /*!< Set alarm time */
+#define CPI_CMD_DOWN            0x0A    /*!< Trigger power down */
+#define CPI_CMD_RSET            0x0B    /*!< Trigger reset */
+/*! \} */
+
+/*! \name CPI_FORMAT_TLV stream layout
+
+  The stream begins with the 4 byte header 'C' 'P' 'I' CPI_TLV_VERSION, followed by one
+  record per query, in query order, and a final CPI_TLV_END record. Each record is a
+  1 byte tag (CPI_CMD_ code), a 1 byte CPI_ return code, a 2 byte little endian value
+  length, and the value itself. Failed queries carry an empty value. */
+/*! \{ */
+#define CPI_TLV_VERSION         0x01    /*!< TLV stream version */
+#define CPI_TLV_END             0xFF    /*!< Tag of the final record */
+/*! \} */
+
 /*! \name CPI return codes */
 /*! \{ */
 #define CPI_OK                  0x0000  /*!< Success! */
@@ -287,11 +788,12 @@ cpi_info_t;
 #define CPI_OUT_OF_MEMORY       0x0004  /*!< Out of memory */
 #define CPI_ACCESS_DENIED       0x0005  /*!< Access denied */
 #define CPI_INVALID_CALL        0x0006  /*!< Invalid call */
+#define CPI_BUSY                0x0007  /*!< Rejected, could not complete within its deadline */
 /*! \} */
 
 /*! \name CPI return code lookup table, for convienence */
 /*! \{ */
-char *CPI_RETURN_CODE_LOOKUP[0x07];
+extern char *CPI_RETURN_CODE_LOOKUP[0x08];
 /*! \} */
 
 /*! \name CPI return code helper functions */
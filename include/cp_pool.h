@@ -0,0 +1,162 @@
+/*
+ * cp_pool.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API defines a pool of CPI instances, for driving many CPs (e.g. the
+ * fixtures of a production line) at once. Each device has its own cpi_t and
+ * transport; all of them are run from a single epoll event loop, and execute
+ * the same plan of commands concurrently.
+ */
+
+#ifndef CP_POOL_H
+#define CP_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "cp_interface.h"
+
+#include <stddef.h>
+
+struct _cpi_pool_t;
+
+/*!
+
+ Completion callback for cpi_pool_execute(). Called once per device, as soon as
+ that device has finished the whole plan (or timed out), with the per-device
+ copy of the plan holding results and status.
+
+ */
+
+typedef void (*cpi_pool_callback_t)(struct _cpi_pool_t *p_pool, int index, struct _cpi_cmd_t *cmds, size_t n, void *user_data);
+
+/*!
+
+ Create an empty CPI pool.
+
+  @param pp_pool (OUT) - Pointer to pool handle
+  @return CPI_OK for success, otherwise CPI_ error code
+
+ */
+
+int cpi_pool_create(struct _cpi_pool_t **pp_pool);
+
+/*!
+
+ Close every device of a CPI pool, and free the pool.
+
+  @param p_pool (INP) - CPI pool
+  @return CPI_OK for success, otherwise CPI_ error code
+
+ */
+
+int cpi_pool_close(struct _cpi_pool_t *p_pool);
+
+/*!
+
+ Open a device, and add it to a CPI pool. Devices are numbered in the order
+ they are added. A device which fails to open is not added.
+
+  @param p_pool (INP) - CPI pool
+  @param serial_device_path (INP) - Serial device path, as for cpi_init()
+  @param p_index (OUT) - Index of the new device (may be null)
+  @return CPI_OK for success, otherwise CPI_ error code from cpi_create() or cpi_init()
+
+ */
+
+int cpi_pool_add(struct _cpi_pool_t *p_pool, const char *serial_device_path, int *p_index);
+
+/*!
+
+ Retrieve the serial device path of a device in a CPI pool.
+
+  @param p_pool (INP) - CPI pool
+  @param index (INP) - Device index
+  @return Serial device path, or null if index is invalid
+
+ */
+
+const char *cpi_pool_get_path(struct _cpi_pool_t *p_pool, int index);
+
+/*!
+
+ Retrieve the CPI instance of a device in a CPI pool. Instances are replaced
+ when a device is reopened after a timeout, and are null while it cannot be.
+
+  @param p_pool (INP) - CPI pool
+  @param index (INP) - Device index
+  @return CPI instance, or null
+
+ */
+
+struct _cpi_t *cpi_pool_get_cpi(struct _cpi_pool_t *p_pool, int index);
+
+/*!
+
+ Execute the same plan of commands on every device of a CPI pool, concurrently.
+ Plan entries are described as for cpi_execute_batch(), except that output
+ buffers are provided by the pool: out and out_size are ignored. CHAL entries
+ without rand_data are given fresh random data, separately for each device.
+
+ A device which has not finished the plan once timeout_ms expires is closed
+ and reopened, and its unfinished entries fail with CPI_FAIL.
+
+  @param p_pool (INP) - CPI pool
+  @param plan (INP) - Array of commands
+  @param n (INP) - Number of commands in plan, at most CPI_MAX_PENDING
+  @param timeout_ms (INP) - Time limit for the plan, in milliseconds (-1 for no limit)
+  @param callback (INP) - Completion callback, called once for each device (may be null)
+  @param user_data (INP) - Caller context, passed to callback
+  @return CPI_OK if every device finished the plan without failure, otherwise
+          the CPI_ error code of the first failure encountered
+
+ */
+
+int cpi_pool_execute(struct _cpi_pool_t *p_pool, const struct _cpi_cmd_t *plan, size_t n, int timeout_ms, cpi_pool_callback_t callback, void *user_data);
+
+/*!
+
+ Write the results of the last plan executed on one device as a response
+ document, as cpi_process_query() would have for the same queries.
+
+  @param p_pool (INP) - CPI pool
+  @param index (INP) - Device index
+  @param format (INP) - CPI_FORMAT_ value
+  @param out_buff (OUT) - Buffer which receives the response document
+  @param p_out_size (INP/OUT) - Size of out_buff on input, number of bytes written on return
+  @return CPI_OK for success, otherwise CPI_ error code (CPI_OUT_OF_MEMORY if out_buff is too small)
+
+ */
+
+int cpi_pool_format(struct _cpi_pool_t *p_pool, int index, int format, void *out_buff, int *p_out_size);
+
+/*!
+
+  @brief CPI pool
+
+  This structure represents a pool of CPI instances.
+
+*/
+
+typedef struct _cpi_pool_t
+{
+    /*! epoll descriptor, watching the event descriptor of every device */
+    int epoll_fd;
+    /*! number of devices */
+    int count;
+    /*! number of device slots allocated */
+    int capacity;
+    /*! per-device state */
+    void *devices;
+}
+cpi_pool_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,356 @@
+/*
+ * calibrate.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements "cpi calibrate", which finds the smallest delay
+ * between written characters that a CP handles reliably, and saves it in the
+ * pacing profile for cpi_init (see cpi_save_pacing).
+ *
+ * Writing too quickly can leave a CP unable to service requests, so the search
+ * only ever steps down by a quarter from a delay which has just worked, runs
+ * many rounds of queries at each step, and checks that the CP answers reliably
+ * at the default delay again after each failed step before going on.
+ */
+
+#include "cp_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/*! default number of rounds of queries at each step */
+#define CALIBRATE_ROUNDS        50
+
+/*! default safety margin added to the smallest reliable delay, in percent */
+#define CALIBRATE_MARGIN        25
+
+/*! the search stops once the smallest reliable and largest unreliable delay are this close, in us */
+#define CALIBRATE_RESOLUTION_US 100
+
+/*! time the CP is left alone between steps, in ms */
+#define CALIBRATE_SETTLE_MS     250
+
+/*! consecutive good rounds at the default delay, for the CP to count as recovered */
+#define CALIBRATE_RECOVER_GOOD  5
+
+/*! rounds at the default delay, after which a CP which has not recovered is given up on */
+#define CALIBRATE_RECOVER_MAX   20
+
+/*! results of one round of queries */
+typedef struct _calibrate_round
+{
+    uint8_t raw_pid[0x10];
+    uint8_t raw_serial[CPI_SERIAL_NUMBER_SIZE];
+    uint8_t raw_vers[CPI_VERSION_SIZE];
+}
+calibrate_round;
+
+/*! calibration settings, and the reference results every round must reproduce */
+typedef struct _calibrate_context
+{
+    cpi_t *p_cpi;
+    uint16_t key_id;
+    int rounds;
+    calibrate_round reference;
+}
+calibrate_context;
+
+/*! print "cpi calibrate" usage screen */
+static void calibrate_usage();
+
+/*! utility function to run one round of queries, with requests of several lengths (returns CPI_ status) */
+static int calibrate_query(calibrate_context *p_context, calibrate_round *p_round)
+{
+    cpi_cmd_t cmds[3] =
+    {
+        { .cmd = CPI_CMD_PIDX, .key_id = p_context->key_id, .out = { p_round->raw_pid }, .out_size = { sizeof(p_round->raw_pid) } },
+        { .cmd = CPI_CMD_SNUM, .out = { p_round->raw_serial }, .out_size = { sizeof(p_round->raw_serial) } },
+        { .cmd = CPI_CMD_VERS, .out = { p_round->raw_vers }, .out_size = { sizeof(p_round->raw_vers) } }
+    };
+
+    int ret = cpi_execute_batch(p_context->p_cpi, cmds, 3), v;
+
+    if(CPI_FAILED(ret)) { return ret; }
+
+    for(v=0;v<3;v++) { if(CPI_FAILED(cmds[v].status)) { return cmds[v].status; } }
+
+    return CPI_OK;
+}
+
+/*! utility function to run one round of queries, and check the results against the reference (returns 1 if good) */
+static int calibrate_check(calibrate_context *p_context)
+{
+    calibrate_round round;
+
+    memset(&round, 0, sizeof(round));
+
+    if(CPI_FAILED(calibrate_query(p_context, &round))) { return 0; }
+
+    return memcmp(&round, &p_context->reference, sizeof(round)) == 0;
+}
+
+/*! utility function to bring the CP back to a known good state at the default delay (returns 0 if it does not recover) */
+static int calibrate_recover(calibrate_context *p_context)
+{
+    int v, good = 0;
+
+    cpi_set_write_delay(p_context->p_cpi, CPI_WRITE_DELAY_US);
+
+    for(v=0;v<CALIBRATE_RECOVER_MAX;v++)
+    {
+        usleep(CALIBRATE_SETTLE_MS*1000);
+
+        if(!calibrate_check(p_context)) { good = 0; continue; }
+
+        if(++good == CALIBRATE_RECOVER_GOOD) { return 1; }
+    }
+
+    return 0;
+}
+
+/*! utility function to run every round of a step at the specified delay (returns 1 if all were good, 0 if not, -1 if the CP did not recover) */
+static int calibrate_step(calibrate_context *p_context, uint32_t delay_us)
+{
+    int v;
+
+    cpi_set_write_delay(p_context->p_cpi, delay_us);
+
+    for(v=0;v<p_context->rounds;v++) { if(!calibrate_check(p_context)) { break; } }
+
+    fprintf(stderr, "  %6u us : %s (%d/%d rounds)\n", delay_us, (v == p_context->rounds) ? "ok" : "failed", v, p_context->rounds);
+
+    if(v == p_context->rounds) { usleep(CALIBRATE_SETTLE_MS*1000); return 1; }
+
+    return calibrate_recover(p_context) ? 0 : -1;
+}
+
+int calibrate_main(int argc, char **argv, const char *serial_device_path)
+{
+    /*! default at failure */
+    int main_ret = 1;
+
+    /*! pacing profile, and whether to update it */
+    const char *profile_path = CPI_PACING_PROFILE;
+    int dry_run = 0;
+
+    /*! smallest delay to try, and margin added to the result */
+    uint32_t floor_us = 0;
+    int margin = CALIBRATE_MARGIN;
+
+    /*! time to wait for other processes to release the CP, in seconds */
+    int lock_wait = 0;
+
+    calibrate_context context;
+
+    int cur_arg = 0;
+
+    memset(&context, 0, sizeof(context));
+
+    context.rounds = CALIBRATE_ROUNDS;
+
+    /*! parse command line */
+    for(cur_arg = 1; cur_arg < argc; cur_arg++)
+    {
+        if(argv[cur_arg][0] != '-')
+        {
+            fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+            continue;
+        }
+
+        switch(argv[cur_arg][1])
+        {
+            case 't':
+                if(++cur_arg < argc) { serial_device_path = argv[cur_arg]; }
+                break;
+
+            case 'k':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%hu", &context.key_id); }
+                break;
+
+            case 'n':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &context.rounds); }
+                break;
+
+            case 'f':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%u", &floor_us); }
+                break;
+
+            case 'm':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &margin); }
+                break;
+
+            case 'p':
+                if(++cur_arg < argc) { profile_path = argv[cur_arg]; }
+                break;
+
+            case 'l':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &lock_wait); }
+                break;
+
+            case 'd':
+                dry_run = 1;
+                break;
+
+            case '-':
+                calibrate_usage();
+                return 0;
+
+            default:
+                fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+                break;
+        }
+    }
+
+    if( (context.rounds < 1) || (margin < 0) || (floor_us >= CPI_WRITE_DELAY_US) )
+    {
+        fprintf(stderr, "Error: invalid rounds, margin or floor\n");
+        calibrate_usage();
+        return 1;
+    }
+
+    /*! start from the default delay, whatever the profile says now */
+    {
+        cpi_info_t cpi_info = { 0, lock_wait*1000, "" };
+
+        int ret = cpi_create(&cpi_info, &context.p_cpi);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: cpi_create failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            return 1;
+        }
+
+        ret = cpi_init(context.p_cpi, (char*)serial_device_path);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: cpi_init failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+
+        /*! a daemon paces the CP itself */
+        if(cpi_set_write_delay(context.p_cpi, CPI_WRITE_DELAY_US) == CPI_NOTIMPL)
+        {
+            fprintf(stderr, "Error: \"%s\" is a daemon socket, calibrate the serial device instead\n", serial_device_path);
+            goto cleanup;
+        }
+    }
+
+    /*! reference results, which must hold up for every round at the default delay */
+    {
+        int ret = calibrate_query(&context, &context.reference);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: CP does not answer (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+
+        fprintf(stderr, "Calibrating \"%s\", %d rounds per step\n", serial_device_path, context.rounds);
+
+        if(calibrate_step(&context, CPI_WRITE_DELAY_US) != 1)
+        {
+            fprintf(stderr, "Error: CP is not reliable at the default delay\n");
+            goto cleanup;
+        }
+    }
+
+    /*! search for the smallest reliable delay */
+    {
+        uint32_t good_us = CPI_WRITE_DELAY_US, bad_us = 0, delay_us = 0;
+
+        int has_bad = 0, ret = 0, v;
+
+        /*! step down by a quarter at a time, so each step stays close to a delay which worked */
+        while(!has_bad && (good_us > floor_us))
+        {
+            delay_us = good_us - good_us/4;
+
+            if( (delay_us < floor_us) || (delay_us == good_us) ) { delay_us = floor_us; }
+
+            ret = calibrate_step(&context, delay_us);
+
+            if(ret < 0) { goto recover_failed; }
+
+            if(ret) { good_us = delay_us; } else { bad_us = delay_us; has_bad = 1; }
+        }
+
+        /*! then narrow down between the smallest good and largest bad delay */
+        while(has_bad && (good_us - bad_us > CALIBRATE_RESOLUTION_US))
+        {
+            delay_us = bad_us + (good_us - bad_us)/2;
+
+            ret = calibrate_step(&context, delay_us);
+
+            if(ret < 0) { goto recover_failed; }
+
+            if(ret) { good_us = delay_us; } else { bad_us = delay_us; }
+        }
+
+        delay_us = good_us + (uint32_t)((uint64_t)good_us*margin/100);
+
+        if(delay_us > CPI_WRITE_DELAY_US) { delay_us = CPI_WRITE_DELAY_US; }
+
+        printf("Serial : ");
+        for(v=0;v<CPI_SERIAL_NUMBER_SIZE;v++) { printf("%.02X", context.reference.raw_serial[v]); }
+        printf("\n");
+
+        if(has_bad) { printf("Delay  : %u us (reliable down to %u us, failed at %u us)\n", delay_us, good_us, bad_us); }
+        else        { printf("Delay  : %u us (reliable down to %u us)\n", delay_us, good_us); }
+
+        if(!dry_run)
+        {
+            ret = cpi_save_pacing(profile_path, context.reference.raw_serial, delay_us);
+
+            if(CPI_FAILED(ret))
+            {
+                fprintf(stderr, "Error: could not save \"%s\" (%s)\n", profile_path, CPI_RETURN_CODE_LOOKUP[ret]);
+                goto cleanup;
+            }
+
+            printf("Saved  : %s\n", profile_path);
+        }
+    }
+
+    main_ret = 0;
+
+    goto cleanup;
+
+recover_failed:
+
+    fprintf(stderr, "Error: CP did not recover at the default delay, it may need to be power cycled\n");
+
+cleanup:
+
+    cpi_close(context.p_cpi);
+
+    return main_ret;
+}
+
+static void calibrate_usage()
+{
+    printf("Usage : cpi calibrate [--help] [-t <CDEV>] [-k <KEYID>] [-n <COUNT>] [-f <USECS>] [-m <PCT>] [-p <FILE>] [-l <SECS>] [-d]\n");
+    printf("\n");
+    printf("Find the smallest delay between written characters that the Crypto Processor\n");
+    printf("handles reliably, and save it in the pacing profile used by every CPI client.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("\n");
+    printf("    --help      Display this help screen\n");
+    printf("\n");
+    printf("    -t <CDEV>   Use CDEV as character-special device to read from\n");
+    printf("    -k <KEYID>  Use the specified key ID for putative ID queries (default is 0)\n");
+    printf("    -n <COUNT>  Run COUNT rounds of queries at each step (default %d)\n", CALIBRATE_ROUNDS);
+    printf("    -f <USECS>  Do not try delays below USECS (default 0)\n");
+    printf("    -m <PCT>    Add PCT percent to the smallest reliable delay (default %d)\n", CALIBRATE_MARGIN);
+    printf("    -p <FILE>   Save to FILE (default " CPI_PACING_PROFILE ")\n");
+    printf("    -l <SECS>   Wait up to SECS (-1 for ever) for other processes to release the CP\n");
+    printf("    -d          Dry run: report the delay, but do not save it\n");
+    printf("\n");
+    return;
+}
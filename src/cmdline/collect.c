@@ -0,0 +1,833 @@
+/*
+ * collect.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements "cpi collect", which runs a collection of any number
+ * of challenges unattended, issuing each one as soon as the CP's authentication
+ * budget allows (see cpi_load_budget), and appends the pairs straight into an
+ * archive (see cp_archive.h) rather than one queryN.xml and responseN.xml each.
+ *
+ * Progress is kept in a journal next to the archive, a text file of one line
+ * per event, each ending with a checksum of the line:
+ *
+ *   collect <version> <count> <keys> <records>  first line: run parameters, pairs in the archive at the start
+ *   plan <index> <key ID> <rand data>           query planned; synced before it is issued
+ *   issue <index>                               query sent to the CP
+ *   skip <index> <status>                       query given up on
+ *   prepare <records> <count> <first> <end>     pairs of queries [first, end) about to be appended
+ *   commit <records>                            they were, the archive now holds records pairs
+ *
+ * The journal is synced once per batch of pairs, before they are appended,
+ * rather than once per query. A run which stops, however it stops, is resumed
+ * by running it again: lines cut off by a crash are dropped, a prepared batch
+ * counts as committed if the archive holds it, and every query from the end of
+ * the last committed batch on is issued again, with the same random data.
+ */
+
+#include "cp_interface.h"
+#include "cp_archive.h"
+#include "cp_base64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+/*! journal layout version */
+#define COLLECT_VERSION         1
+
+/*! default number of queries, and of key IDs challenged in turn (as create_queries) */
+#define COLLECT_COUNT           24
+#define COLLECT_KEYS            24
+
+/*! default number of pairs appended to the archive at once */
+#define COLLECT_BATCH           64
+
+/*! queries planned, and synced, at once */
+#define COLLECT_PLAN_AHEAD      1024
+
+/*! attempts at a query which fails other than by AUTHCOUNT, before it is given up on */
+#define COLLECT_RETRIES         3
+
+/*! a wait for the budget at least this long, in seconds, is spent appending the pairs collected so far */
+#define COLLECT_IDLE_SEC        30
+
+/*! maximum length of a journal line */
+#define COLLECT_LINE_SIZE       0x100
+
+/*! a planned query */
+typedef struct _collect_query
+{
+    uint16_t key_id;
+    uint8_t  rndx[CPI_RNDX_SIZE];
+}
+collect_query;
+
+/*! public key of a key ID, queried once per run */
+typedef struct _collect_pkey
+{
+    int     state;                              /*!< 0 not queried yet, 1 valid, -1 not available */
+    uint8_t raw[CPI_ARCHIVE_PKEY_SIZE];
+}
+collect_pkey;
+
+/*! collection state, as rebuilt from the journal */
+typedef struct _collect_context
+{
+    cpi_t *p_cpi;
+
+    /*! archive and journal */
+    const char *archive_path;
+    const char *journal_path;
+    FILE *journal;
+
+    /*! parameters, from the first line of the journal */
+    uint32_t count;
+    uint32_t keys;
+    uint32_t base_records;
+
+    /*! planned queries, and which were given up on */
+    collect_query *plan;
+    uint8_t *skipped;
+    uint32_t planned;
+    uint32_t skip_count;
+
+    /*! queries [0, done) are in the archive or given up on; the archive then held records pairs */
+    uint32_t done;
+    uint32_t records;
+
+    /*! pairs of queries [done, next) not appended yet */
+    cpi_archive_record_t *batch;
+    uint32_t batch_size;
+    uint32_t batch_count;
+    uint32_t next;
+
+    /*! budget, and where it is kept */
+    cpi_budget_t budget;
+    const char *state_path;
+
+    /*! what is the same for every pair */
+    uint8_t raw_serial[CPI_SERIAL_NUMBER_SIZE];
+    collect_pkey *pkeys;
+    FILE *random;
+}
+collect_context;
+
+/*! set by SIGINT or SIGTERM, to stop once the query in progress is done */
+static volatile int collect_stop = 0;
+
+/*! signal handler, which stops collecting */
+static void collect_signal(int sig) { collect_stop = 1; }
+
+/*! print "cpi collect" usage screen */
+static void collect_usage();
+
+/*! utility function to checksum a journal line (FNV-1a) */
+static uint32_t collect_checksum(const char *line, int len)
+{
+    uint32_t hash = 0x811C9DC5;
+
+    int v;
+
+    for(v=0;v<len;v++) { hash = (hash ^ (uint8_t)line[v]) * 0x01000193; }
+
+    return hash;
+}
+
+/*! utility function to write a journal line (returns 0 on failure) */
+static int collect_log(collect_context *p_context, const char *format, ...)
+{
+    char line[COLLECT_LINE_SIZE];
+
+    va_list args;
+
+    int len = 0;
+
+    va_start(args, format);
+    len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if( (len < 0) || (len >= (int)sizeof(line)) ) { return 0; }
+
+    return fprintf(p_context->journal, "%s *%.08X\n", line, collect_checksum(line, len)) > 0;
+}
+
+/*! utility function to put every journal line written so far on disk (returns 0 on failure) */
+static int collect_sync(collect_context *p_context)
+{
+    return (fflush(p_context->journal) == 0) && (fsync(fileno(p_context->journal)) == 0);
+}
+
+/*! utility function to check the checksum of a journal line, and cut it off (returns 0 if the line is torn or corrupt) */
+static int collect_check(char *line)
+{
+    char *mark = strrchr(line, '*');
+
+    unsigned checksum = 0;
+
+    int len = (int)strlen(line);
+
+    if( (len == 0) || (line[len-1] != '\n') || (mark == 0) || (mark == line) || (mark[-1] != ' ') ) { return 0; }
+
+    if( (sscanf(mark + 1, "%8X", &checksum) != 1) || (mark + 1 + 8 != &line[len-1]) ) { return 0; }
+
+    mark[-1] = '\0';
+
+    return checksum == collect_checksum(line, (int)(mark - 1 - line));
+}
+
+/*! utility function to parse hex into size bytes (returns 0 on failure) */
+static int collect_hex(const char *str, uint8_t *raw, int size)
+{
+    int v;
+
+    for(v=0;v<size;v++)
+    {
+        unsigned byte = 0;
+
+        if(sscanf(&str[v*2], "%2X", &byte) != 1) { return 0; }
+
+        raw[v] = (uint8_t)byte;
+    }
+
+    return str[size*2] == '\0';
+}
+
+/*! utility function to allocate the plan, once the parameters are known (returns 0 on failure) */
+static int collect_alloc(collect_context *p_context)
+{
+    p_context->plan = (collect_query*)calloc(p_context->count + 1, sizeof(collect_query));
+    p_context->skipped = (uint8_t*)calloc(p_context->count + 1, 1);
+    p_context->pkeys = (collect_pkey*)calloc(p_context->keys, sizeof(collect_pkey));
+
+    return (p_context->plan != 0) && (p_context->skipped != 0) && (p_context->pkeys != 0);
+}
+
+/*! utility function to rebuild the state from the journal, dropping a torn tail (returns 1 if it was read, 0 if there is none, -1 on failure) */
+static int collect_replay(collect_context *p_context)
+{
+    char line[COLLECT_LINE_SIZE + 16];
+
+    uint32_t prep_records = 0, prep_count = 0, prep_first = 0, prep_end = 0, archive_records = 0;
+
+    int prepared = 0, lines = 0;
+
+    long valid = 0;
+
+    FILE *file = fopen(p_context->journal_path, "r");
+
+    if(file == 0) { return 0; }
+
+    while(fgets(line, sizeof(line), file) != 0)
+    {
+        unsigned a = 0, b = 0, c = 0, d = 0, e = 0;
+
+        char hex[CPI_RNDX_SIZE*2 + 2];
+
+        /*! a crash can only tear the tail, everything from the first bad line on is dropped */
+        if(!collect_check(line)) { break; }
+
+        if(lines++ == 0)
+        {
+            if( (sscanf(line, "collect %u %u %u %u", &a, &b, &c, &d) != 4) || (a != COLLECT_VERSION) || (b == 0) || (c == 0) || (c > UINT16_MAX + 1) ) { break; }
+
+            p_context->count = b;
+            p_context->keys = c;
+            p_context->base_records = p_context->records = d;
+
+            if(!collect_alloc(p_context)) { fclose(file); return -1; }
+        }
+        else if(sscanf(line, "plan %u %u %32s", &a, &b, hex) == 3)
+        {
+            if( (a != p_context->planned) || (a >= p_context->count) || (b > UINT16_MAX) || !collect_hex(hex, p_context->plan[a].rndx, CPI_RNDX_SIZE) ) { break; }
+
+            p_context->plan[a].key_id = (uint16_t)b;
+            p_context->planned++;
+        }
+        else if(sscanf(line, "issue %u", &a) == 1)
+        {
+            if(a >= p_context->planned) { break; }
+        }
+        else if(sscanf(line, "skip %u %u", &a, &b) == 2)
+        {
+            if(a >= p_context->planned) { break; }
+
+            if(!p_context->skipped[a]) { p_context->skipped[a] = 1; p_context->skip_count++; }
+        }
+        else if(sscanf(line, "prepare %u %u %u %u", &a, &b, &c, &d) == 4)
+        {
+            if( (a != p_context->records) || (c != p_context->done) || (d < c) || (d > p_context->planned) || (b > d - c) ) { break; }
+
+            prepared = 1;
+            prep_records = a;
+            prep_count = b;
+            prep_first = c;
+            prep_end = d;
+        }
+        else if(sscanf(line, "commit %u", &e) == 1)
+        {
+            if( !prepared || (e != prep_records + prep_count) ) { break; }
+
+            prepared = 0;
+            p_context->done = prep_end;
+            p_context->records = e;
+        }
+        else
+        {
+            break;
+        }
+
+        valid = ftell(file);
+    }
+
+    fclose(file);
+
+    if(lines == 0) { return 0; }
+
+    if(p_context->plan == 0)
+    {
+        fprintf(stderr, "Error: \"%s\" is not a collection journal\n", p_context->journal_path);
+        return -1;
+    }
+
+    if( (truncate(p_context->journal_path, valid) != 0) || ((p_context->journal = fopen(p_context->journal_path, "a")) == 0) )
+    {
+        fprintf(stderr, "Error: could not open \"%s\" for writing\n", p_context->journal_path);
+        return -1;
+    }
+
+    if(CPI_FAILED(cpi_archive_count(p_context->archive_path, &archive_records)))
+    {
+        fprintf(stderr, "Error: \"%s\" is not an archive\n", p_context->archive_path);
+        return -1;
+    }
+
+    /*! a batch prepared but not committed is in the archive, or not at all */
+    if(prepared)
+    {
+        if(archive_records == prep_records + prep_count)
+        {
+            if(!collect_log(p_context, "commit %u", archive_records)) { return -1; }
+
+            p_context->done = prep_end;
+            p_context->records = archive_records;
+        }
+        else if(archive_records == prep_records)
+        {
+            fprintf(stderr, "Batch of queries %u to %u did not make it into the archive, issuing them again\n", prep_first, prep_end - 1);
+        }
+    }
+
+    if(archive_records != p_context->records)
+    {
+        fprintf(stderr, "Error: \"%s\" holds %u pairs, the journal expects %u; was it written to by something else?\n", p_context->archive_path, archive_records, p_context->records);
+        return -1;
+    }
+
+    return 1;
+}
+
+/*! utility function to start a new journal (returns 0 on failure) */
+static int collect_begin(collect_context *p_context)
+{
+    if(CPI_FAILED(cpi_archive_count(p_context->archive_path, &p_context->records)))
+    {
+        fprintf(stderr, "Error: \"%s\" is not an archive\n", p_context->archive_path);
+        return 0;
+    }
+
+    p_context->base_records = p_context->records;
+
+    if(!collect_alloc(p_context))
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 0;
+    }
+
+    p_context->journal = fopen(p_context->journal_path, "w");
+
+    if(p_context->journal == 0)
+    {
+        fprintf(stderr, "Error: could not create \"%s\"\n", p_context->journal_path);
+        return 0;
+    }
+
+    return collect_log(p_context, "collect %u %u %u %u", COLLECT_VERSION, p_context->count, p_context->keys, p_context->records) && collect_sync(p_context);
+}
+
+/*! utility function to plan the next queries, on disk before any of them is issued (returns 0 on failure) */
+static int collect_plan(collect_context *p_context)
+{
+    uint32_t end = p_context->planned + COLLECT_PLAN_AHEAD;
+
+    if(end > p_context->count) { end = p_context->count; }
+
+    for(;p_context->planned<end;p_context->planned++)
+    {
+        collect_query *p_query = &p_context->plan[p_context->planned];
+
+        char hex[CPI_RNDX_SIZE*2 + 1];
+
+        int v;
+
+        if(fread(p_query->rndx, 1, CPI_RNDX_SIZE, p_context->random) != CPI_RNDX_SIZE) { return 0; }
+
+        p_query->key_id = (uint16_t)(p_context->planned % p_context->keys);
+
+        for(v=0;v<CPI_RNDX_SIZE;v++) { sprintf(&hex[v*2], "%.02X", p_query->rndx[v]); }
+
+        if(!collect_log(p_context, "plan %u %u %s", p_context->planned, p_query->key_id, hex)) { return 0; }
+    }
+
+    return collect_sync(p_context);
+}
+
+/*! utility function to append the pairs of queries [done, next) to the archive (returns 0 on failure) */
+static int collect_commit(collect_context *p_context)
+{
+    int ret = CPI_OK;
+
+    if(p_context->next == p_context->done) { return 1; }
+
+    if( !collect_log(p_context, "prepare %u %u %u %u", p_context->records, p_context->batch_count, p_context->done, p_context->next) || !collect_sync(p_context) )
+    {
+        fprintf(stderr, "Error: could not write \"%s\"\n", p_context->journal_path);
+        return 0;
+    }
+
+    ret = cpi_archive_append(p_context->archive_path, p_context->batch, p_context->batch_count);
+
+    if(CPI_FAILED(ret))
+    {
+        fprintf(stderr, "Error: could not append to \"%s\" (%s)\n", p_context->archive_path, CPI_RETURN_CODE_LOOKUP[ret]);
+        return 0;
+    }
+
+    p_context->records += p_context->batch_count;
+    p_context->done = p_context->next;
+    p_context->batch_count = 0;
+
+    /*! synced with the next batch: until then, the archive itself says the batch is in */
+    if( !collect_log(p_context, "commit %u", p_context->records) || (fflush(p_context->journal) != 0) )
+    {
+        fprintf(stderr, "Error: could not write \"%s\"\n", p_context->journal_path);
+        return 0;
+    }
+
+    fprintf(stderr, "Committed : %u of %u queries, %u pairs in archive, %u given up on\n", p_context->done, p_context->count, p_context->records - p_context->base_records, p_context->skip_count);
+
+    return 1;
+}
+
+/*! utility function to decode a public key block into the packet the archive keeps (returns 0 if it is not one) */
+static int collect_pkey_decode(const char *str, uint8_t *raw)
+{
+    static const char begin[] = "-----BEGIN PGP PUBLIC KEY BLOCK-----", end[] = "-----END PGP PUBLIC KEY BLOCK-----";
+
+    const char *beg = strstr(str, begin), *fin = 0, *sum = 0;
+
+    int size = CPI_ARCHIVE_PKEY_SIZE;
+
+    if(beg == 0) { return 0; }
+
+    beg += sizeof(begin) - 1;
+
+    fin = strstr(beg, end);
+
+    if(fin == 0) { return 0; }
+
+    /*! up to the armor checksum line, if any */
+    sum = strstr(beg, "\n=");
+
+    if( (sum != 0) && (sum < fin) ) { fin = sum; }
+
+    return CPI_SUCCESS(cpi_b64_decode(beg, (int)(fin - beg), raw, &size, CPI_B64_SKIP_WS)) && (size == CPI_ARCHIVE_PKEY_SIZE);
+}
+
+/*! utility function to query the public key of a key ID, the first time it is challenged */
+static void collect_get_pkey(collect_context *p_context, uint16_t key_id)
+{
+    collect_pkey *p_pkey = &p_context->pkeys[key_id % p_context->keys];
+
+    char str[CPI_MAX_RESULT_SIZE];
+
+    if(p_pkey->state != 0) { return; }
+
+    if( CPI_FAILED(cpi_get_public_key(p_context->p_cpi, key_id, str)) || !collect_pkey_decode(str, p_pkey->raw) )
+    {
+        fprintf(stderr, "Warning: no public key for key ID %u, its pairs are archived without one\n", key_id);
+        p_pkey->state = -1;
+        return;
+    }
+
+    p_pkey->state = 1;
+
+    return;
+}
+
+/*! utility function to issue a query until it is answered or given up on (returns 0 if collection must stop) */
+static int collect_query_one(collect_context *p_context)
+{
+    const collect_query *p_query = &p_context->plan[p_context->next];
+
+    cpi_archive_record_t *p_rec = &p_context->batch[p_context->batch_count];
+
+    uint8_t result1[CPI_RESULT1_SIZE], result2[CPI_RESULT2_SIZE], result3[CPI_RESULT3_SIZE];
+
+    int failures = 0;
+
+    collect_get_pkey(p_context, p_query->key_id);
+
+    while(!collect_stop)
+    {
+        cpi_cmd_t cmds[3] =
+        {
+            { .cmd = CPI_CMD_PIDX, .key_id = p_query->key_id, .out = { p_rec->pid }, .out_size = { sizeof(p_rec->pid) } },
+            { .cmd = CPI_CMD_CKEY },
+            { .cmd = CPI_CMD_CHAL, .key_id = p_query->key_id, .rand_data = (uint8_t*)p_query->rndx,
+              .out = { result1, result2, result3 }, .out_size = { CPI_RESULT1_SIZE, CPI_RESULT2_SIZE, CPI_RESULT3_SIZE } }
+        };
+
+        uint32_t cur_time = 0, wait = 0;
+
+        int ret = cpi_get_current_time(p_context->p_cpi, &cur_time), v;
+
+        /*! without the CP's time there is no telling what the budget allows */
+        if(CPI_FAILED(ret))
+        {
+            if(++failures < COLLECT_RETRIES) { continue; }
+
+            fprintf(stderr, "Error: cpi_get_current_time failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            return 0;
+        }
+
+        wait = cpi_budget_wait(&p_context->budget, cur_time);
+
+        if(wait > 0)
+        {
+            /*! time spent waiting anyway is best spent making the pairs so far safe */
+            if( (wait >= COLLECT_IDLE_SEC) && (p_context->batch_count > 0) )
+            {
+                if(!collect_commit(p_context)) { return 0; }
+
+                p_rec = &p_context->batch[0];
+            }
+
+            sleep(wait);
+            continue;
+        }
+
+        if( !collect_log(p_context, "issue %u", p_context->next) || (fflush(p_context->journal) != 0) )
+        {
+            fprintf(stderr, "Error: could not write \"%s\"\n", p_context->journal_path);
+            return 0;
+        }
+
+        cpi_execute_batch(p_context->p_cpi, cmds, 3);
+
+        if( (cmds[2].status == CPI_OK) || (cmds[2].status == CPI_ACCESS_DENIED) )
+        {
+            cpi_budget_update(&p_context->budget, cur_time, cmds[2].status);
+
+            ret = cpi_save_budget(p_context->state_path, &p_context->budget);
+
+            if(CPI_FAILED(ret)) { fprintf(stderr, "Warning: could not save \"%s\" (%s)\n", p_context->state_path, CPI_RETURN_CODE_LOOKUP[ret]); }
+        }
+
+        /*! denied challenges are issued again once the budget allows, however many times it takes */
+        if(cmds[2].status == CPI_ACCESS_DENIED) { continue; }
+
+        for(v=0;v<3;v++) { if(CPI_FAILED(cmds[v].status)) { ret = cmds[v].status; break; } }
+
+        if(CPI_FAILED(ret))
+        {
+            if(++failures < COLLECT_RETRIES) { continue; }
+
+            fprintf(stderr, "Warning: giving up on query %u (%s)\n", p_context->next, CPI_RETURN_CODE_LOOKUP[ret]);
+
+            p_context->skipped[p_context->next] = 1;
+            p_context->skip_count++;
+
+            if(!collect_log(p_context, "skip %u %d", p_context->next, ret)) { return 0; }
+
+            p_context->next++;
+
+            return 1;
+        }
+
+        p_rec->key_id = p_query->key_id;
+        p_rec->flags = CPI_ARCHIVE_HAS_SERIAL | CPI_ARCHIVE_HAS_CKEY;
+        p_rec->ckey = cmds[1].value;
+
+        memcpy(p_rec->serial, p_context->raw_serial, sizeof(p_rec->serial));
+        memcpy(p_rec->rndx, p_query->rndx, sizeof(p_rec->rndx));
+
+        /*! result1 is the encrypted owner key, rm, then the version; result3, where present, is not archived */
+        memcpy(p_rec->enc_ok, &result1[0], sizeof(p_rec->enc_ok));
+        memcpy(p_rec->rm, &result1[CPI_RESULT1_ENC_OK_SIZE], sizeof(p_rec->rm));
+        memcpy(p_rec->vers, &result1[CPI_RESULT1_ENC_OK_SIZE + CPI_RESULT1_RAND_SIZE], sizeof(p_rec->vers));
+        memcpy(p_rec->sig, result2, sizeof(p_rec->sig));
+
+        if(p_context->pkeys[p_query->key_id % p_context->keys].state > 0)
+        {
+            memcpy(p_rec->pkey, p_context->pkeys[p_query->key_id % p_context->keys].raw, sizeof(p_rec->pkey));
+
+            p_rec->flags |= CPI_ARCHIVE_HAS_PKEY;
+        }
+
+        p_context->batch_count++;
+        p_context->next++;
+
+        return 1;
+    }
+
+    return 1;
+}
+
+int collect_main(int argc, char **argv, const char *serial_device_path)
+{
+    /*! default at failure */
+    int main_ret = 1;
+
+    /*! journal path, if not next to the archive */
+    char journal_path[PATH_MAX];
+
+    /*! window to start the budget from if nothing is known of the CP */
+    uint32_t window = 0;
+
+    /*! time to wait for other processes to release the CP, in seconds */
+    int lock_wait = 0;
+
+    collect_context context;
+
+    /*! whether the number of queries or key IDs was given */
+    int sized = 0;
+
+    int cur_arg = 0, resumed = 0;
+
+    memset(&context, 0, sizeof(context));
+
+    context.count = COLLECT_COUNT;
+    context.keys = COLLECT_KEYS;
+    context.batch_size = COLLECT_BATCH;
+    context.state_path = CPI_BUDGET_STATE;
+
+    /*! parse command line */
+    for(cur_arg = 1; cur_arg < argc; cur_arg++)
+    {
+        if(argv[cur_arg][0] != '-')
+        {
+            fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+            continue;
+        }
+
+        switch(argv[cur_arg][1])
+        {
+            case 't':
+                if(++cur_arg < argc) { serial_device_path = argv[cur_arg]; }
+                break;
+
+            case 'o':
+                if(++cur_arg < argc) { context.archive_path = argv[cur_arg]; }
+                break;
+
+            case 'j':
+                if(++cur_arg < argc) { context.journal_path = argv[cur_arg]; }
+                break;
+
+            case 'n':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%u", &context.count); sized = 1; }
+                break;
+
+            case 'k':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%u", &context.keys); sized = 1; }
+                break;
+
+            case 'b':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%u", &context.batch_size); }
+                break;
+
+            case 's':
+                if(++cur_arg < argc) { context.state_path = argv[cur_arg]; }
+                break;
+
+            case 'w':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%u", &window); }
+                break;
+
+            case 'l':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &lock_wait); }
+                break;
+
+            case '-':
+                collect_usage();
+                return 0;
+
+            default:
+                fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+                break;
+        }
+    }
+
+    if( (context.archive_path == 0) || (context.count == 0) || (context.keys == 0) || (context.keys > UINT16_MAX + 1) || (context.batch_size == 0) )
+    {
+        collect_usage();
+        return 1;
+    }
+
+    if(context.journal_path == 0)
+    {
+        if(snprintf(journal_path, sizeof(journal_path), "%s.journal", context.archive_path) >= (int)sizeof(journal_path))
+        {
+            fprintf(stderr, "Error: archive path is too long\n");
+            return 1;
+        }
+
+        context.journal_path = journal_path;
+    }
+
+    /*! pick up where the journal stops, or start it */
+    {
+        uint32_t count = context.count, keys = context.keys;
+
+        resumed = collect_replay(&context);
+
+        if(resumed < 0) { goto cleanup; }
+
+        if( (resumed == 0) && !collect_begin(&context) ) { goto cleanup; }
+
+        if( resumed && sized && ((count != context.count) || (keys != context.keys)) )
+        {
+            fprintf(stderr, "Warning: resuming with the journal's %u queries over %u key IDs\n", context.count, context.keys);
+        }
+
+        context.next = context.done;
+
+        context.batch = (cpi_archive_record_t*)calloc(context.batch_size, sizeof(cpi_archive_record_t));
+
+        context.random = fopen("/dev/urandom", "rb");
+
+        if( (context.batch == 0) || (context.random == 0) )
+        {
+            fprintf(stderr, "Error: out of memory, or no /dev/urandom\n");
+            goto cleanup;
+        }
+
+        if(resumed) { fprintf(stderr, "Resuming : %u of %u queries done, %u pairs in archive\n", context.done, context.count, context.records - context.base_records); }
+    }
+
+    /*! open the CP */
+    {
+        cpi_info_t cpi_info = { 0, lock_wait*1000, 0 };
+
+        int ret = cpi_create(&cpi_info, &context.p_cpi);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: cpi_create failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+
+        ret = cpi_init(context.p_cpi, (char*)serial_device_path);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: cpi_init failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+
+        ret = cpi_get_serial_number(context.p_cpi, context.raw_serial);
+
+        if( CPI_SUCCESS(ret) ) { ret = cpi_load_budget(context.state_path, context.raw_serial, &context.budget); }
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: could not read the serial number or budget (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+
+        /*! nothing learned yet */
+        if( (window > 0) && (context.budget.accepted + context.budget.denied == 0) ) { context.budget.window_hi = window; }
+    }
+
+    /*! stop cleanly, at the end of the query in progress */
+    {
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof(sa));
+
+        sa.sa_handler = collect_signal;
+
+        sigaction(SIGINT, &sa, 0);
+        sigaction(SIGTERM, &sa, 0);
+    }
+
+    while( !collect_stop && (context.next < context.count) )
+    {
+        if( (context.next >= context.planned) && !collect_plan(&context) )
+        {
+            fprintf(stderr, "Error: could not plan queries in \"%s\"\n", context.journal_path);
+            goto cleanup;
+        }
+
+        if(context.skipped[context.next]) { context.next++; }
+        else if(!collect_query_one(&context)) { goto cleanup; }
+
+        if( (context.batch_count == context.batch_size) && !collect_commit(&context) ) { goto cleanup; }
+    }
+
+    if( !collect_commit(&context) || !collect_sync(&context) ) { goto cleanup; }
+
+    if(collect_stop) { fprintf(stderr, "Stopped : run again to resume\n"); }
+
+    main_ret = 0;
+
+cleanup:
+
+    if(context.p_cpi != 0) { cpi_close(context.p_cpi); }
+
+    if(context.journal != 0) { fclose(context.journal); }
+    if(context.random != 0) { fclose(context.random); }
+
+    free(context.batch);
+    free(context.pkeys);
+    free(context.skipped);
+    free(context.plan);
+
+    return main_ret;
+}
+
+static void collect_usage()
+{
+    printf("Usage : cpi collect [--help] -o <FILE> [-j <FILE>] [-n <COUNT>] [-k <KEYS>] [-b <COUNT>] [-t <CDEV>] [-s <FILE>] [-w <SECS>] [-l <SECS>]\n");
+    printf("\n");
+    printf("Challenge the Crypto Processor COUNT times, as soon as its authentication budget\n");
+    printf("allows, and append the pairs to an archive for cpi-verify and cpi-decrypt-ok.\n");
+    printf("Progress is journaled; if a run stops, run the same command again to resume it.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("\n");
+    printf("    --help      Display this help screen\n");
+    printf("\n");
+    printf("    -o <FILE>   Append pairs to the archive FILE, created if missing\n");
+    printf("    -j <FILE>   Journal to FILE (default is the archive path with .journal appended)\n");
+    printf("    -n <COUNT>  Issue COUNT challenges (default %d)\n", COLLECT_COUNT);
+    printf("    -k <KEYS>   Challenge key IDs 0 to KEYS-1 in turn (default %d)\n", COLLECT_KEYS);
+    printf("    -b <COUNT>  Append pairs COUNT at a time, at most (default %d)\n", COLLECT_BATCH);
+    printf("    -t <CDEV>   Use CDEV as character-special device to read from\n");
+    printf("    -s <FILE>   Keep the authentication budget in FILE (default " CPI_BUDGET_STATE ")\n");
+    printf("    -w <SECS>   Start from one challenge per SECS, if nothing is known of the CP yet\n");
+    printf("    -l <SECS>   Wait up to SECS (-1 for ever) for other processes to release the CP\n");
+    printf("\n");
+    printf("The number of challenges and key IDs of a journal which already exists are kept.\n");
+    printf("\n");
+    return;
+}
@@ -17,6 +17,8 @@
 #include <malloc.h>
 #include <memory.h>
 #include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
 
 #define VER_STR "1.03"
 
@@ -33,9 +35,33 @@
 /*! print program usage screen */
 static void show_usage();
 
+/*! entry point for "cpi multi" (see multi.c) */
+int multi_main(int argc, char **argv);
+
+/*! entry point for "cpi calibrate" (see calibrate.c) */
+int calibrate_main(int argc, char **argv, const char *serial_device_path);
+
+/*! entry point for "cpi schedule" (see schedule.c) */
+int schedule_main(int argc, char **argv, const char *serial_device_path);
+
+/*! entry point for "cpi collect" (see collect.c) */
+int collect_main(int argc, char **argv, const char *serial_device_path);
+
 /*! utility function to print raw data */
 static void print_raw(uint8_t *raw_data, int size);
 
+/*! utility function to print scheduler metrics */
+static void print_metrics(const cpi_metrics_t *p_metrics);
+
+/*! utility function to print cross-process lock metrics */
+static void print_lock_metrics(const cpi_lock_metrics_t *p_metrics);
+
+/*! set by SIGINT or SIGTERM, to stop serving (see --serve) */
+static volatile int serve_stop = 0;
+
+/*! signal handler, which stops serving */
+static void serve_signal(int sig) { serve_stop = 1; }
+
 /*! @hack @todo this thread exists in order to monitor that
  *  the CPI is not in a hung state. If the CPI is deemed to
  *  be hung, this thread will call exit(1). This is necessary
@@ -78,6 +104,7 @@ int main(int argc, char **argv)
     int print_putative_id = 0;
     int print_all = 0;
     int print_usage = 0;
+    int print_sched = 0;
 
     /*! options for power down and alarm */
     int do_shutdown = 0;
@@ -87,12 +114,40 @@ int main(int argc, char **argv)
     /*! key id */
     uint16_t key_id = 0;
 
+    /*! number of times to process the query XML, for benchmarking (0 = normal operation) */
+    int bench_count = 0;
+
+    /*! time to wait for other processes to release the CP, in seconds */
+    int lock_wait = 0;
+
+    /*! CPI_INFO_ flags */
+    int cpi_flags = 0;
+
+    /*! daemon socket path, if serving (see --serve) */
+    const char *serve_path = 0;
+
+    /*! output format for query results, and size of the last result */
+    int out_format = CPI_FORMAT_XML;
+    int out_size = 0;
+
     /*! raw buffer, used to parse results */
     uint8_t *tmp_buffer1 = 0, *tmp_buffer2 = 0, *tmp_buffer3 = 0;
 
     /*! @hack @todo thread for monitoring timeout */
     pthread_t timeout_thread;
 
+    /*! multi-device mode enforces its own time limits */
+    if( (argc > 1) && (strcmp(argv[1], "multi") == 0) ) { return multi_main(argc - 1, &argv[1]); }
+
+    /*! calibration tells a wedged CP from a slow one itself */
+    if( (argc > 1) && (strcmp(argv[1], "calibrate") == 0) ) { return calibrate_main(argc - 1, &argv[1], serial_device_path); }
+
+    /*! scheduling sleeps for as long as the CP's authentication budget needs */
+    if( (argc > 1) && (strcmp(argv[1], "schedule") == 0) ) { return schedule_main(argc - 1, &argv[1], serial_device_path); }
+
+    /*! as does collection, which also runs for as long as it takes */
+    if( (argc > 1) && (strcmp(argv[1], "collect") == 0) ) { return collect_main(argc - 1, &argv[1], serial_device_path); }
+
     /*! initialize timeout thread */
     pthread_create(&timeout_thread, 0, timeout_hack, 0);
 
@@ -230,10 +285,62 @@ int main(int argc, char **argv)
                     print_all = 1;
                     break;
 
-                case '-':
-                    print_usage = 1;
+                case 'm':
+                    print_sched = 1;
+                    break;
+
+                case 'x':
+                    cpi_flags |= CPI_INFO_PIPELINED;
                     break;
 
+                case 'l':
+                {
+                    /*! skip over to wait time */
+                    if(++cur_arg >= argc) { break; }
+
+                    /*! attempt to parse wait time */
+                    sscanf(argv[cur_arg], "%d", &lock_wait);
+                }
+                break;
+
+                case 'f':
+                {
+                    /*! skip over to format name */
+                    if(++cur_arg >= argc) { break; }
+
+                    /*! attempt to parse format name */
+                    if(strcmp(argv[cur_arg], "xml") == 0) { out_format = CPI_FORMAT_XML; }
+                    else if(strcmp(argv[cur_arg], "json") == 0) { out_format = CPI_FORMAT_JSON; }
+                    else if(strcmp(argv[cur_arg], "tlv") == 0) { out_format = CPI_FORMAT_TLV; }
+                    else
+                    {
+                        fprintf(stderr, "Warning: Unrecognized format \"%s\", using xml\n", argv[cur_arg]);
+                    }
+                }
+                break;
+
+                case 'b':
+                {
+                    /*! skip over to iteration count */
+                    if(++cur_arg >= argc) { break; }
+
+                    /*! attempt to parse iteration count */
+                    sscanf(argv[cur_arg], "%d", &bench_count);
+                }
+                break;
+
+                case '-':
+                {
+                    /*! any other long option displays usage */
+                    if(strcmp(argv[cur_arg], "--serve") != 0) { print_usage = 1; break; }
+
+                    /*! skip over to socket path */
+                    if(++cur_arg >= argc) { print_usage = 1; break; }
+
+                    serve_path = argv[cur_arg];
+                }
+                break;
+
                 default:
                     fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
                     break;
@@ -250,7 +357,7 @@ int main(int argc, char **argv)
 
     /*! create CPI instance */
     {
-        cpi_info_t cpi_info = { 0 };
+        cpi_info_t cpi_info = { cpi_flags, lock_wait*1000 };
 
         /*!< @hack @todo enable hung CPI timeout */
         enable_timeout(10);
@@ -266,8 +373,11 @@ int main(int argc, char **argv)
 
     /*! initialize CPI instance */
     {
-        /*!< @hack @todo enable hung CPI timeout */
-        enable_timeout(10);
+        /*!< @hack @todo enable hung CPI timeout (waiting in line for the CP is not a hang) */
+        enable_timeout(10 + ((lock_wait > 0) ? lock_wait : 0));
+
+        /*! waiting for ever is not a hang either */
+        if(lock_wait < 0) { timeout_hack_enabled = 0; }
 
         int ret = cpi_init(p_cpi, serial_device_path);
 
@@ -278,6 +388,39 @@ int main(int argc, char **argv)
         }
     }
 
+    /*! optionally, serve the CP to other processes until signalled */
+    if(serve_path != 0)
+    {
+        struct sigaction sa;
+
+        int ret = 0;
+
+        /*! requests are answered as the CP responds, so there is nothing to watch for */
+        timeout_hack_enabled = 0;
+
+        /*! no SA_RESTART, so the signal interrupts the daemon's wait */
+        memset(&sa, 0, sizeof(sa));
+
+        sa.sa_handler = serve_signal;
+
+        sigaction(SIGINT, &sa, 0);
+        sigaction(SIGTERM, &sa, 0);
+
+        fprintf(stderr, "Serving %s on %s\n", serial_device_path, serve_path);
+
+        ret = cpi_serve(p_cpi, serve_path, &serve_stop);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: cpi_serve failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+
+        main_ret = 0;
+
+        goto cleanup;
+    }
+
     /*! optionally read input XML data */
     if(inp_xml_file != 0)
     {
@@ -299,19 +442,59 @@ int main(int argc, char **argv)
             /*!< @hack @todo enable hung CPI timeout */
             enable_timeout(10);
 
-            int ret = cpi_process_xml(p_cpi, (char*)tmp_buffer1, (char*)tmp_buffer2);
+            out_size = CPI_MAX_RESULT_SIZE;
+
+            int ret = cpi_process_query(p_cpi, (char*)tmp_buffer1, out_format, tmp_buffer2, &out_size);
 
             if(CPI_FAILED(ret))
             {
-                fprintf(stderr, "Error: cpi_process_xml failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+                fprintf(stderr, "Error: cpi_process_query failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
                 goto cleanup;
             }
         }
 
-        /*! optionally write XML output */
+        /*! optionally, benchmark repeated processing of the same document. the first pass above
+         *  warms up the instance, so any allocations counted here are on the steady-state path */
+        if(bench_count > 0)
+        {
+            unsigned long alloc_beg = cpi_get_alloc_count();
+
+            struct timeval tv_beg, tv_end;
+
+            int v;
+
+            gettimeofday(&tv_beg, 0);
+
+            for(v=0;v<bench_count;v++)
+            {
+                /*!< @hack @todo enable hung CPI timeout */
+                enable_timeout(10);
+
+                out_size = CPI_MAX_RESULT_SIZE;
+
+                int ret = cpi_process_query(p_cpi, (char*)tmp_buffer1, out_format, tmp_buffer2, &out_size);
+
+                if(CPI_FAILED(ret))
+                {
+                    fprintf(stderr, "Error: cpi_process_query failed on pass %d (%s)\n", v, CPI_RETURN_CODE_LOOKUP[ret]);
+                    goto cleanup;
+                }
+            }
+
+            gettimeofday(&tv_end, 0);
+
+            {
+                double elapsed_ms = (tv_end.tv_sec - tv_beg.tv_sec)*1000.0 + (tv_end.tv_usec - tv_beg.tv_usec)/1000.0;
+
+                fprintf(stderr, "Benchmark : %d documents, %.3f ms/document, %lu allocations on steady-state path\n",
+                        bench_count, elapsed_ms / bench_count, cpi_get_alloc_count() - alloc_beg);
+            }
+        }
+
+        /*! optionally write XML (or selected format) output */
         if(out_xml_file != 0)
         {
-            int size = strlen((char*)tmp_buffer2);
+            int size = out_size;
 
             /*! write output data to out_xml_file */
             if(size > 0)
@@ -328,214 +511,217 @@ int main(int argc, char **argv)
 
     }
 
-    /*! get putative ID */
+    /*! retrieve putative ID and, optionally, all other CP data in a single batch */
     if(print_all || print_putative_id)
     {
-        char str[CPI_PUTATIVE_ID_SIZE];
+        uint8_t raw_pid[0x10];
+        uint8_t raw_vers[CPI_VERSION_SIZE];
+        uint8_t raw_serial[CPI_SERIAL_NUMBER_SIZE];
+        uint8_t raw_hard_vers[CPI_HARDWARE_VERSION_SIZE];
+        uint8_t rand_data[0x10] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
 
-        /*!< @hack @todo enable hung CPI timeout */
-        enable_timeout(4);
+        /*! batch entries, and the API each one stands in for (used in error messages) */
+        cpi_cmd_t cmds[8];
+        const char *cmd_names[8];
 
-        int ret = cpi_get_putative_id(p_cpi, key_id, str);
+        int count = 0, v;
 
-        if(CPI_FAILED(ret))
-        {
-            fprintf(stderr, "Error: cpi_get_putative_id failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
-            goto cleanup;
-        }
-
-        /*! print to stdout in all format */
-        if(print_all)
-        {
-            printf("Putative ID : %s\n", str);
-        }
-        /*! print only putative ID */
-        else if(print_putative_id)
-        {
-            printf("%s\n", str);
-        }
-    }
+        memset(cmds, 0, sizeof(cmds));
+        memset(tmp_buffer1, 0, CPI_MAX_RESULT_SIZE);
+        memset(tmp_buffer2, 0, CPI_MAX_RESULT_SIZE);
+        memset(tmp_buffer3, 0, CPI_MAX_RESULT_SIZE);
 
-    /*! get public key */
-    if(print_all)
-    {
-        /*!< @hack @todo enable hung CPI timeout */
-        enable_timeout(10);
+        /*! helper macro for appending a batch entry */
+        #define HELPER_APPEND_CMD(c, name) { cmd_names[count] = name; cmds[count].cmd = c; cmds[count].key_id = key_id; count++; }
 
-        int ret = cpi_get_public_key(p_cpi, key_id, (char*)tmp_buffer1);
+        HELPER_APPEND_CMD(CPI_CMD_PIDX, "cpi_get_putative_id");
+        cmds[count-1].out[0] = raw_pid;
+        cmds[count-1].out_size[0] = sizeof(raw_pid);
 
-        if(CPI_FAILED(ret))
+        if(print_all)
         {
-            fprintf(stderr, "Error: cpi_get_public_key failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
-            goto cleanup;
+            HELPER_APPEND_CMD(CPI_CMD_PKEY, "cpi_get_public_key");
+            cmds[count-1].out[0] = tmp_buffer1;
+            cmds[count-1].out_size[0] = CPI_MAX_RESULT_SIZE;
+
+            HELPER_APPEND_CMD(CPI_CMD_VERS, "cpi_get_version_data");
+            cmds[count-1].out[0] = raw_vers;
+            cmds[count-1].out_size[0] = sizeof(raw_vers);
+
+            HELPER_APPEND_CMD(CPI_CMD_TIME, "cpi_get_current_time");
+
+            HELPER_APPEND_CMD(CPI_CMD_CKEY, "cpi_get_owner_key_index");
+
+            HELPER_APPEND_CMD(CPI_CMD_SNUM, "cpi_get_serial_number");
+            cmds[count-1].out[0] = raw_serial;
+            cmds[count-1].out_size[0] = sizeof(raw_serial);
+
+            HELPER_APPEND_CMD(CPI_CMD_HWVR, "cpi_get_hardware_version_data");
+            cmds[count-1].out[0] = raw_hard_vers;
+            cmds[count-1].out_size[0] = sizeof(raw_hard_vers);
+
+            /*! challenge results go to tmp_buffer2 (result1, result3) and tmp_buffer3 (result2) */
+            HELPER_APPEND_CMD(CPI_CMD_CHAL, "cpi_issue_challenge");
+            cmds[count-1].rand_data = rand_data;
+            cmds[count-1].out[0] = tmp_buffer2;
+            cmds[count-1].out[1] = tmp_buffer3;
+            cmds[count-1].out[2] = &tmp_buffer2[CPI_RESULT1_SIZE];
+            cmds[count-1].out_size[0] = CPI_RESULT1_SIZE;
+            cmds[count-1].out_size[1] = CPI_RESULT2_SIZE;
+            cmds[count-1].out_size[2] = CPI_RESULT3_SIZE;
         }
 
-        /*! public key contains an endline already */
-        printf("Public Key : \n%s", tmp_buffer1);
-    }
-
-    /*! get version data */
-    if(print_all)
-    {
-        /*!< @hack @todo enable hung CPI timeout */
-        enable_timeout(10);
+        #undef HELPER_APPEND_CMD
 
-        int ret = cpi_get_version_data(p_cpi, tmp_buffer1);
+        /*!< @hack @todo enable hung CPI timeout, for the whole batch */
+        enable_timeout(10*count);
 
-        if(CPI_FAILED(ret))
+        /*! the challenge spends an authentication, so it is only issued once everything before it succeeded */
+        if( CPI_SUCCESS(cpi_execute_batch(p_cpi, cmds, print_all ? count - 1 : count)) && print_all )
         {
-            fprintf(stderr, "Error: cpi_get_version_data failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
-            goto cleanup;
+            cpi_execute_batch(p_cpi, &cmds[count-1], 1);
         }
 
-        printf("Version Data :\n");
-
-        print_raw(tmp_buffer1, CPI_VERSION_SIZE);
-    }
+        /*! report results in order, stopping at the first failure */
+        for(v=0;v<count;v++)
+        {
+            if(CPI_FAILED(cmds[v].status))
+            {
+                fprintf(stderr, "Error: %s failed (%s)\n", cmd_names[v], CPI_RETURN_CODE_LOOKUP[cmds[v].status]);
+                goto cleanup;
+            }
 
-    /*! get current time */
-    if(print_all)
-    {
-        uint32_t cur_time = 0;
+            switch(cmds[v].cmd)
+            {
+                case CPI_CMD_PIDX:
+                {
+                    char str[CPI_PUTATIVE_ID_SIZE];
+
+                    /*! format raw PID into GUID format */
+                    sprintf(str, "%.02X%.02X%.02X%.02X-%.02X%.02X-%.02X%.02X-%.02X%.02X-%.02X%.02X%.02X%.02X%.02X%.02X",
+                        raw_pid[0x00], raw_pid[0x01], raw_pid[0x02], raw_pid[0x03],
+                        raw_pid[0x04], raw_pid[0x05],
+                        raw_pid[0x06], raw_pid[0x07],
+                        raw_pid[0x08], raw_pid[0x09], raw_pid[0x0A], raw_pid[0x0B],
+                        raw_pid[0x0C], raw_pid[0x0D], raw_pid[0x0E], raw_pid[0x0F]);
+
+                    /*! print to stdout in all format */
+                    if(print_all)
+                    {
+                        printf("Putative ID : %s\n", str);
+                    }
+                    /*! print only putative ID */
+                    else if(print_putative_id)
+                    {
+                        printf("%s\n", str);
+                    }
+                }
+                break;
 
-        /*!< @hack @todo enable hung CPI timeout */
-        enable_timeout(10);
+                case CPI_CMD_PKEY:
+                    /*! public key contains an endline already */
+                    printf("Public Key : \n%s", tmp_buffer1);
+                    break;
 
-        int ret = cpi_get_current_time(p_cpi, &cur_time);
+                case CPI_CMD_VERS:
+                    printf("Version Data :\n");
+                    print_raw(raw_vers, CPI_VERSION_SIZE);
+                    break;
 
-        if(CPI_FAILED(ret))
-        {
-            fprintf(stderr, "Error: cpi_get_current_time failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
-            goto cleanup;
-        }
+                case CPI_CMD_TIME:
+                    printf("Current Time : %d seconds since last reboot\n", cmds[v].value);
+                    break;
 
-        printf("Current Time : %d seconds since last reboot\n", cur_time);
-    }
+                case CPI_CMD_CKEY:
+                    printf("Current Owner Key Index : %d\n", cmds[v].value);
+                    break;
 
-    /*! get current owner key index */
-    if(print_all)
-    {
-        uint32_t cur_oki = 0;
+                case CPI_CMD_SNUM:
+                    printf("Serial Number :\n");
+                    print_raw(raw_serial, CPI_SERIAL_NUMBER_SIZE);
+                    break;
 
-        /*!< @hack @todo enable hung CPI timeout */
-        enable_timeout(10);
+                case CPI_CMD_HWVR:
+                    printf("Hardware Version Data :\n");
+                    print_raw(raw_hard_vers, CPI_HARDWARE_VERSION_SIZE);
+                    break;
 
-        int ret = cpi_get_owner_key_index(p_cpi, &cur_oki);
+                case CPI_CMD_CHAL:
+                {
+                    printf("result1 : \n");
 
-        if(CPI_FAILED(ret))
-        {
-            fprintf(stderr, "Error: cpi_get_owner_key_index failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
-            goto cleanup;
-        }
+                    /*! print result1 */
+                    print_raw(tmp_buffer2, CPI_RESULT1_SIZE);
 
-        printf("Current Owner Key Index : %d\n", cur_oki);
-    }
+                    printf("result2 : \n");
 
-    /*! get serial number data */
-    if(print_all)
-    {
-        /*!< @hack @todo enable hung CPI timeout */
-        enable_timeout(10);
+                    /*! print result2 */
+                    print_raw(tmp_buffer3, CPI_RESULT2_SIZE);
 
-        int ret = cpi_get_serial_number(p_cpi, tmp_buffer1);
+#if defined(CNPLATFORM_falconwing)        
+                    printf("result3 : \n");
 
-        if(CPI_FAILED(ret))
-        {
-            fprintf(stderr, "Error: cpi_get_serial_number failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
-            goto cleanup;
+                    /*! print result3 */
+                    print_raw(&tmp_buffer2[CPI_RESULT1_SIZE], CPI_RESULT3_SIZE);
+#endif
+                }
+                break;
+            }
         }
-
-        printf("Serial Number :\n");
-
-        print_raw(tmp_buffer1, CPI_SERIAL_NUMBER_SIZE);
     }
 
-    /*! get hardware version data */
-    if(print_all)
+    /*! set alarm */
+    if(do_alarm)
     {
         /*!< @hack @todo enable hung CPI timeout */
         enable_timeout(10);
 
-        int ret = cpi_get_hardware_version_data(p_cpi, tmp_buffer1);
+        int ret = cpi_set_alarm_time(p_cpi, alarm_time);
 
         if(CPI_FAILED(ret))
         {
-            fprintf(stderr, "Error: cpi_get_hardware_version_data failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            fprintf(stderr, "Error: cpi_set_alarm_time failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
             goto cleanup;
         }
 
-        printf("Hardware Version Data :\n");
-
-        print_raw(tmp_buffer1, CPI_HARDWARE_VERSION_SIZE);
+        printf("Alarm was set for %d seconds from now\n", alarm_time);
     }
 
-    /*! issue challenge */
-    if(print_all)
+    /*! optionally, power down */
+    if(do_shutdown)
     {
-        uint8_t rand_data[0x10] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
-
-        memset(tmp_buffer1, 0, CPI_MAX_RESULT_SIZE);
-        memset(tmp_buffer2, 0, CPI_MAX_RESULT_SIZE);
-        memset(tmp_buffer3, 0, CPI_MAX_RESULT_SIZE);
-
         /*!< @hack @todo enable hung CPI timeout */
         enable_timeout(10);
 
-        int ret = cpi_issue_challenge(p_cpi, key_id, rand_data, tmp_buffer1, tmp_buffer2, tmp_buffer3);
+        int ret = cpi_trigger_power_down(p_cpi);
 
         if(CPI_FAILED(ret))
         {
-            fprintf(stderr, "Error: cpi_issue_challenge failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            fprintf(stderr, "Error: cpi_trigger_power_down failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
             goto cleanup;
         }
-
-        printf("result1 : \n");
-
-        /*! print result1 */
-        print_raw(tmp_buffer1, CPI_RESULT1_SIZE);
-
-        printf("result2 : \n");
-
-        /*! print result1 */
-        print_raw(tmp_buffer2, CPI_RESULT2_SIZE);
-
-#if defined(CNPLATFORM_falconwing)        
-	printf("result3 : \n");
-
-        /*! print result1 */
-        print_raw(tmp_buffer3, CPI_RESULT3_SIZE);
-#endif
     }
 
-    /*! set alarm */
-    if(do_alarm)
+    /*! optionally, print scheduler metrics (of the daemon, if connected to one) */
+    if(print_sched)
     {
-        /*!< @hack @todo enable hung CPI timeout */
-        enable_timeout(10);
+        cpi_metrics_t metrics;
 
-        int ret = cpi_set_alarm_time(p_cpi, alarm_time);
+        int ret = cpi_get_metrics(p_cpi, &metrics);
 
         if(CPI_FAILED(ret))
         {
-            fprintf(stderr, "Error: cpi_set_alarm_time failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            fprintf(stderr, "Error: cpi_get_metrics failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
             goto cleanup;
         }
 
-        printf("Alarm was set for %d seconds from now\n", alarm_time);
-    }
+        print_metrics(&metrics);
 
-    /*! optionally, power down */
-    if(do_shutdown)
-    {
-        /*!< @hack @todo enable hung CPI timeout */
-        enable_timeout(10);
-
-        int ret = cpi_trigger_power_down(p_cpi);
-
-        if(CPI_FAILED(ret))
+        /*! lock metrics are shared by every process using the device, but there are none through a daemon */
         {
-            fprintf(stderr, "Error: cpi_trigger_power_down failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
-            goto cleanup;
+            cpi_lock_metrics_t lock_metrics;
+
+            if(CPI_SUCCESS(cpi_get_lock_metrics(p_cpi, &lock_metrics))) { print_lock_metrics(&lock_metrics); }
         }
     }
 
@@ -597,7 +783,12 @@ static void show_usage()
 {
     printf("CPI " VER_STR " [sean@chumby.com]\n");
     printf("\n");
-    printf("Usage : cpi [--help] | [-p] [-a] [-d] [-r]\n");
+    printf("Usage : cpi [--help] | [-p] [-a] [-d] [-m] [-l <SECS>] [-x] [-r]\n");
+    printf("        cpi --serve <SOCKET> [-t <CDEV>]\n");
+    printf("        cpi multi [--help] | [options] <CDEV>...\n");
+    printf("        cpi calibrate [--help] | [options]\n");
+    printf("        cpi schedule [--help] | [options] <queryN.xml>...\n");
+    printf("        cpi collect [--help] | [options] -o <FILE>\n");
     printf("\n");
     printf("Interface with Crypto Processor\n");
     printf("\n");
@@ -614,7 +805,16 @@ static void show_usage()
     printf("    -a <TIME>   Set alarm to go off TIME seconds from now\n");
     printf("    -s          Shutdown the chumby (will occur after all other options)\n");
     printf("    -d          Write all CP data to stdout\n");
-    printf("    -t <CDEV>   Use CDEV as character-special device to read from\n");
+    printf("    -m          Write scheduler and CP lock metrics (queue depth, wait time) to stdout\n");
+    printf("    -l <SECS>   Wait up to SECS (-1 for ever) for other processes to release the CP,\n");
+    printf("                in order of arrival, rather than failing right away\n");
+    printf("    -t <CDEV>   Use CDEV as character-special device to read from, or the\n");
+    printf("                SOCKET of a cpi --serve daemon\n");
+    printf("    --serve <SOCKET>\n");
+    printf("                Own the CP, and serve requests from other processes on SOCKET\n");
+    printf("    -f <FMT>    Write results as FMT: xml (default), json or tlv\n");
+    printf("    -b <COUNT>  Benchmark: process query XML COUNT more times, report time and allocations\n");
+    printf("    -x          Pipeline: start each request as soon as the CP has sent the last response\n");
     printf("\n");
     return;
 }
@@ -634,6 +834,80 @@ static void print_raw(uint8_t *raw_data, int size)
     return;
 }
 
+static void print_metrics(const cpi_metrics_t *p_metrics)
+{
+    static const char *names[CPI_PRIORITY_COUNT] = { "normal", "urgent", "bulk" };
+
+    int c, b;
+
+    printf("class  : depth  max  completed  rejected  avg wait ms  max wait ms\n");
+
+    for(c=0;c<CPI_PRIORITY_COUNT;c++)
+    {
+        /*! every command taken off the queue has its wait recorded in the histogram */
+        uint64_t started = 0;
+
+        for(b=0;b<CPI_METRICS_BUCKETS;b++) { started += p_metrics->wait_hist[c][b]; }
+
+        printf("%-6s : %5u %4u %10llu %9llu %12.1f %12.1f\n", names[c],
+               p_metrics->depth[c], p_metrics->max_depth[c],
+               (unsigned long long)p_metrics->completed[c], (unsigned long long)p_metrics->rejected[c],
+               (started > 0) ? p_metrics->wait_total_us[c] / 1000.0 / started : 0.0,
+               p_metrics->wait_max_us[c] / 1000.0);
+    }
+
+    printf("coalesced : %llu\n", (unsigned long long)p_metrics->coalesced);
+    printf("pacing : %u us between written characters, %llu backoffs\n", p_metrics->write_delay_us, (unsigned long long)p_metrics->backoffs);
+
+    /*! wait time histogram, skipping empty buckets */
+    for(c=0;c<CPI_PRIORITY_COUNT;c++)
+    {
+        printf("%-6s :", names[c]);
+
+        for(b=0;b<CPI_METRICS_BUCKETS;b++)
+        {
+            if(p_metrics->wait_hist[c][b] == 0) { continue; }
+
+            if(b < CPI_METRICS_BUCKETS - 1) { printf(" <%ums:%u", 1u << b, p_metrics->wait_hist[c][b]); } else { printf(" more:%u", p_metrics->wait_hist[c][b]); }
+        }
+
+        printf("\n");
+    }
+
+    return;
+}
+
+static void print_lock_metrics(const cpi_lock_metrics_t *p_metrics)
+{
+    int b;
+
+    printf("lock   : waiting %u, acquired %u, timeouts %u, recovered %u, max wait %.1f ms, max hold %.1f ms\n",
+           p_metrics->waiting, p_metrics->acquired, p_metrics->timeouts, p_metrics->recovered,
+           p_metrics->wait_max_us / 1000.0, p_metrics->hold_max_us / 1000.0);
+
+    printf("wait   :");
+
+    for(b=0;b<CPI_METRICS_BUCKETS;b++)
+    {
+        if(p_metrics->wait_hist[b] == 0) { continue; }
+
+        if(b < CPI_METRICS_BUCKETS - 1) { printf(" <%ums:%u", 1u << b, p_metrics->wait_hist[b]); } else { printf(" more:%u", p_metrics->wait_hist[b]); }
+    }
+
+    printf("\nhold   :");
+
+    for(b=0;b<CPI_METRICS_BUCKETS;b++)
+    {
+        if(p_metrics->hold_hist[b] == 0) { continue; }
+
+        if(b < CPI_METRICS_BUCKETS - 1) { printf(" <%ums:%u", 1u << b, p_metrics->hold_hist[b]); } else { printf(" more:%u", p_metrics->hold_hist[b]); }
+    }
+
+    printf("\n");
+
+    return;
+}
+
 static void *timeout_hack(void *p_context)
 {
     int count = 0;
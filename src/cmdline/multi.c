@@ -0,0 +1,349 @@
+/*
+ * multi.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements "cpi multi", which runs the same queries on many
+ * CPs at once (see cp_pool.h), and streams one JSON line per device as soon
+ * as that device is done.
+ */
+
+#include "cp_interface.h"
+#include "cp_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/*! size of the response document buffer */
+#define MULTI_OUT_SIZE      (64*1024)
+
+/*! query types accepted by -q */
+static const struct
+{
+    const char *type;
+    int cmd;
+}
+multi_types[] =
+{
+    { "pidx", CPI_CMD_PIDX },
+    { "pkey", CPI_CMD_PKEY },
+    { "vers", CPI_CMD_VERS },
+    { "time", CPI_CMD_TIME },
+    { "ckey", CPI_CMD_CKEY },
+    { "snum", CPI_CMD_SNUM },
+    { "hwvr", CPI_CMD_HWVR },
+    { "chal", CPI_CMD_CHAL }
+};
+
+/*! state shared with the completion callback */
+typedef struct _multi_context
+{
+    /*! current round */
+    int round;
+    /*! number of devices which finished a round with every query successful */
+    int ok_count;
+    /*! response document buffer */
+    char *out;
+}
+multi_context;
+
+/*! print "cpi multi" usage screen */
+static void multi_usage();
+
+/*! completion callback, prints the results of one device */
+static void multi_report(cpi_pool_t *p_pool, int index, cpi_cmd_t *cmds, size_t n, void *user_data);
+
+/*! utility function to append a query to the plan (returns 0 if the type is unknown) */
+static int multi_append(cpi_cmd_t *plan, int *p_count, const char *type, int len, uint16_t key_id)
+{
+    int v;
+
+    for(v=0;v<(int)(sizeof(multi_types)/sizeof(multi_types[0]));v++)
+    {
+        if( (strlen(multi_types[v].type) != (size_t)len) || (strncmp(type, multi_types[v].type, len) != 0) ) { continue; }
+
+        /*! plan is full */
+        if(*p_count == CPI_MAX_PENDING) { return 0; }
+
+        memset(&plan[*p_count], 0, sizeof(cpi_cmd_t));
+
+        plan[*p_count].cmd = multi_types[v].cmd;
+        plan[*p_count].key_id = key_id;
+
+        (*p_count)++;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+int multi_main(int argc, char **argv)
+{
+    /*! default at failure */
+    int main_ret = 1;
+
+    /*! query types, comma separated */
+    const char *query_list = "pidx,pkey,vers,time,ckey,snum,hwvr,chal";
+
+    /*! key id */
+    uint16_t key_id = 0;
+
+    /*! number of rounds, time limit for each, and pause between them */
+    int rounds = 1;
+    int limit_sec = 0;
+    int pause_sec = 0;
+
+    /*! query plan, executed on every device */
+    cpi_cmd_t plan[CPI_MAX_PENDING];
+    int plan_count = 0;
+
+    cpi_pool_t *p_pool = 0;
+
+    multi_context context = { 0, 0, 0 };
+
+    int cur_arg = 0;
+
+    /*! create device pool */
+    {
+        int ret = cpi_pool_create(&p_pool);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: cpi_pool_create failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            return 1;
+        }
+    }
+
+    /*! parse command line, opening devices as they are named */
+    for(cur_arg = 1; cur_arg < argc; cur_arg++)
+    {
+        if(argv[cur_arg][0] != '-')
+        {
+            int ret = cpi_pool_add(p_pool, argv[cur_arg], 0);
+
+            if(CPI_FAILED(ret)) { fprintf(stderr, "Warning: could not open \"%s\" (%s), skipping\n", argv[cur_arg], CPI_RETURN_CODE_LOOKUP[ret]); }
+
+            continue;
+        }
+
+        switch(argv[cur_arg][1])
+        {
+            case 'k':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%hu", &key_id); }
+                break;
+
+            case 'q':
+                if(++cur_arg < argc) { query_list = argv[cur_arg]; }
+                break;
+
+            case 'n':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &rounds); }
+                break;
+
+            case 'w':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &limit_sec); }
+                break;
+
+            case 's':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &pause_sec); }
+                break;
+
+            case '-':
+                multi_usage();
+                main_ret = 0;
+                goto cleanup;
+
+            default:
+                fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+                break;
+        }
+    }
+
+    /*! build query plan */
+    {
+        const char *type = query_list;
+
+        while(*type != '\0')
+        {
+            int len = strcspn(type, ",");
+
+            if( (len > 0) && !multi_append(plan, &plan_count, type, len, key_id) )
+            {
+                fprintf(stderr, "Error: Unrecognized query \"%.*s\", or too many queries\n", len, type);
+                goto cleanup;
+            }
+
+            type += len;
+
+            if(*type == ',') { type++; }
+        }
+
+        /*! results are tagged with the serial number, so always ask for it */
+        {
+            int v, found = 0;
+
+            for(v=0;v<plan_count;v++) { if(plan[v].cmd == CPI_CMD_SNUM) { found = 1; } }
+
+            if(!found && !multi_append(plan, &plan_count, "snum", 4, key_id))
+            {
+                fprintf(stderr, "Error: too many queries\n");
+                goto cleanup;
+            }
+        }
+    }
+
+    if(p_pool->count == 0)
+    {
+        fprintf(stderr, "Error: no devices\n");
+        multi_usage();
+        goto cleanup;
+    }
+
+    /*! default time limit, generous for the slowest (38400bps) link */
+    if(limit_sec <= 0) { limit_sec = 10*plan_count; }
+
+    context.out = (char*)malloc(MULTI_OUT_SIZE);
+
+    if(context.out == 0)
+    {
+        fprintf(stderr, "Error: could not allocate %d bytes for response documents\n", MULTI_OUT_SIZE);
+        goto cleanup;
+    }
+
+    /*! execute rounds, reporting throughput */
+    {
+        struct timeval tv_beg, tv_end;
+
+        gettimeofday(&tv_beg, 0);
+
+        for(context.round = 0; context.round < rounds; context.round++)
+        {
+            if( (context.round > 0) && (pause_sec > 0) ) { sleep(pause_sec); }
+
+            cpi_pool_execute(p_pool, plan, plan_count, limit_sec*1000, multi_report, &context);
+        }
+
+        gettimeofday(&tv_end, 0);
+
+        {
+            double elapsed = (tv_end.tv_sec - tv_beg.tv_sec) + (tv_end.tv_usec - tv_beg.tv_usec)/1000000.0;
+
+            fprintf(stderr, "Multi : %d devices, %d rounds, %d/%d succeeded, %.3f s, %.1f queries/s\n",
+                    p_pool->count, rounds, context.ok_count, p_pool->count*rounds, elapsed,
+                    (elapsed > 0) ? (p_pool->count*rounds*plan_count) / elapsed : 0.0);
+        }
+    }
+
+    if(context.ok_count == p_pool->count*rounds) { main_ret = 0; }
+
+cleanup:
+
+    if(context.out != 0) { free(context.out); }
+
+    cpi_pool_close(p_pool);
+
+    return main_ret;
+}
+
+static void multi_report(cpi_pool_t *p_pool, int index, cpi_cmd_t *cmds, size_t n, void *user_data)
+{
+    multi_context *p_context = (multi_context*)user_data;
+
+    const char *path = cpi_pool_get_path(p_pool, index);
+
+    int ret = CPI_OK, size = MULTI_OUT_SIZE, v;
+
+    /*! device path, escaped for JSON */
+    printf("{\"device\":\"");
+
+    for(v=0;path[v] != '\0';v++)
+    {
+        if( (path[v] == '"') || (path[v] == '\\') ) { putchar('\\'); }
+
+        putchar(path[v]);
+    }
+
+    printf("\",\"round\":%d,\"serial\":", p_context->round);
+
+    /*! serial number, as hex */
+    {
+        int found = 0;
+
+        for(v=0;v<(int)n;v++)
+        {
+            if( (cmds[v].cmd == CPI_CMD_SNUM) && CPI_SUCCESS(cmds[v].status) )
+            {
+                const uint8_t *raw_serial = (const uint8_t*)cmds[v].out[0];
+
+                int b;
+
+                printf("\"");
+                for(b=0;b<CPI_SERIAL_NUMBER_SIZE;b++) { printf("%.02X", raw_serial[b]); }
+                printf("\"");
+
+                found = 1;
+                break;
+            }
+        }
+
+        if(!found) { printf("null"); }
+    }
+
+    /*! first failure, if any */
+    for(v=0;v<(int)n;v++)
+    {
+        if(CPI_FAILED(cmds[v].status)) { ret = cmds[v].status; break; }
+    }
+
+    if(CPI_SUCCESS(ret)) { p_context->ok_count++; }
+
+    printf(",\"result\":\"%s\",\"response\":", CPI_RETURN_CODE_LOOKUP[ret]);
+
+    /*! results, in the same form as "cpi -f json" */
+    if(CPI_SUCCESS(cpi_pool_format(p_pool, index, CPI_FORMAT_JSON, p_context->out, &size)))
+    {
+        /*! keep one line per device */
+        while( (size > 0) && (p_context->out[size-1] == '\n') ) { size--; }
+
+        fwrite(p_context->out, 1, size, stdout);
+    }
+    else
+    {
+        printf("null");
+    }
+
+    printf("}\n");
+
+    /*! stream results, as each device finishes */
+    fflush(stdout);
+
+    return;
+}
+
+static void multi_usage()
+{
+    printf("Usage : cpi multi [--help] [-k <KEYID>] [-q <LIST>] [-n <COUNT>] [-w <SECS>] [-s <SECS>] <CDEV>...\n");
+    printf("\n");
+    printf("Run the same queries on many Crypto Processors at once, printing one JSON\n");
+    printf("line per device and round, tagged with device path and serial number.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("\n");
+    printf("    --help      Display this help screen\n");
+    printf("\n");
+    printf("    -k <KEYID>  Use the specified key ID (default is 0)\n");
+    printf("    -q <LIST>   Comma separated query types (default pidx,pkey,vers,time,ckey,snum,hwvr,chal)\n");
+    printf("                snum is always added; chal uses fresh random data for each device\n");
+    printf("    -n <COUNT>  Run COUNT rounds (default 1)\n");
+    printf("    -w <SECS>   Time limit for each round, after which busy devices are reopened\n");
+    printf("    -s <SECS>   Pause between rounds\n");
+    printf("\n");
+    return;
+}
@@ -0,0 +1,548 @@
+/*
+ * schedule.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements "cpi schedule", which processes a list of query
+ * documents (such as test/production_test/collect.sh's queryN.xml) and issues
+ * each challenge as soon as the CP's authentication budget allows, rather than
+ * after a fixed sleep.
+ *
+ * The budget is learned from the CP's answers (see cpi_load_budget) and saved
+ * after every challenge, so a later run, or a run cut off and started again,
+ * goes on from what has been learned. When challenges of a document are
+ * denied, only those are issued again once the budget allows, and their
+ * responses take the place of the denials; documents whose response already
+ * exists are skipped, so a run can be started again over the same list.
+ */
+
+#include "cp_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+/*! opening of a challenge response, as written by the XML format */
+#define SCHEDULE_CHAL_TAG       "<response type=\"chal\" result=\""
+
+/*! query document issuing again the denied challenges of another, around their query elements */
+#define SCHEDULE_RETRY_BEG      "<?xml version='1.0'?>\n<cpi version='1.0'>\n    <query_list>\n"
+#define SCHEDULE_RETRY_END      "\n    </query_list>\n</cpi>\n"
+
+/*! maximum number of elements of a query document */
+#define SCHEDULE_MAX_ELEMENTS   0x100
+
+/*! print "cpi schedule" usage screen */
+static void schedule_usage();
+
+/*! utility function to find the response path of a query path, "query" replaced by "response" in the file name (returns 0 if it has none) */
+static int schedule_response_path(const char *req_path, char *res_path, size_t size)
+{
+    const char *base = strrchr(req_path, '/'), *query = 0;
+
+    base = (base == 0) ? req_path : base + 1;
+
+    query = strstr(base, "query");
+
+    if(query == 0) { return 0; }
+
+    return snprintf(res_path, size, "%.*sresponse%s", (int)(query - req_path), req_path, query + 5) < (int)size;
+}
+
+/*! utility function to read a query document, null terminated, into CPI_MAX_RESULT_SIZE bytes (returns 0 on failure, -1 if it is too long) */
+static int schedule_read(const char *path, char *buff)
+{
+    FILE *file = fopen(path, "r");
+
+    size_t size = 0;
+
+    int ret = 0;
+
+    if(file == 0) { return 0; }
+
+    size = fread(buff, 1, CPI_MAX_RESULT_SIZE-1, file);
+
+    buff[size] = '\0';
+
+    /*! cpi_process_query takes no more, and a document cut short would lose queries */
+    ret = ( (size == CPI_MAX_RESULT_SIZE-1) && (fgetc(file) != EOF) ) ? -1 : (size > 0);
+
+    fclose(file);
+
+    return ret;
+}
+
+/*! utility function to write a response document in one step, so an existing response is always whole (returns 0 on failure) */
+static int schedule_write(const char *path, const char *buff, int size)
+{
+    char tmp_path[PATH_MAX];
+
+    FILE *file = 0;
+
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) { return 0; }
+
+    file = fopen(tmp_path, "w");
+
+    if(file == 0) { return 0; }
+
+    if(fwrite(buff, 1, size, file) != (size_t)size) { size = -1; }
+
+    if( (fclose(file) != 0) || (size < 0) || (rename(tmp_path, path) != 0) )
+    {
+        unlink(tmp_path);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+/*! utility function to find the elements with the specified tag in a document, outside comments, one per query or response (returns their count, or -1 if there are too many or one is not closed) */
+static int schedule_elements(const char *doc, const char *tag, const char **begs, const char **ends)
+{
+    const char *cur = doc;
+
+    size_t len = strlen(tag);
+
+    int count = 0;
+
+    while( (cur = strchr(cur, '<')) != 0 )
+    {
+        const char *end = 0;
+
+        if(strncmp(cur, "<!--", 4) == 0)
+        {
+            cur = strstr(cur, "-->");
+
+            if(cur == 0) { return -1; }
+
+            continue;
+        }
+
+        /*! the tag itself, not one it begins (such as response_list) */
+        if( (strncmp(cur + 1, tag, len) != 0) || (strchr(" \t\r\n/>", cur[1 + len]) == 0) ) { cur++; continue; }
+
+        end = strchr(cur, '>');
+
+        if(end == 0) { return -1; }
+
+        /*! an element which is not empty ends at its closing tag */
+        if(end[-1] != '/')
+        {
+            end = strstr(end, "</");
+
+            while( (end != 0) && ((strncmp(end + 2, tag, len) != 0) || (end[2 + len] != '>')) ) { end = strstr(end + 2, "</"); }
+
+            if(end == 0) { return -1; }
+
+            end += len + 2;
+        }
+
+        if(count == SCHEDULE_MAX_ELEMENTS) { return -1; }
+
+        begs[count] = cur;
+        ends[count] = end + 1;
+
+        count++;
+
+        cur = end + 1;
+    }
+
+    return count;
+}
+
+/*! utility function to find the status of a response element (returns 0 if it is not a challenge's) */
+static int schedule_chal_status(const char *response, int *p_status)
+{
+    const char *result = response + strlen(SCHEDULE_CHAL_TAG);
+
+    if(strncmp(response, SCHEDULE_CHAL_TAG, strlen(SCHEDULE_CHAL_TAG)) != 0) { return 0; }
+
+    if(strncmp(result, "success\"", 8) == 0) { *p_status = CPI_OK; return 1; }
+
+    /*! failures carry the return code name, AUTHCOUNT being CPI_ACCESS_DENIED */
+    if( (strncmp(result, "failure\">", 9) == 0) && (strncmp(result + 9, CPI_RETURN_CODE_LOOKUP[CPI_ACCESS_DENIED], strlen(CPI_RETURN_CODE_LOOKUP[CPI_ACCESS_DENIED])) == 0) )
+    {
+        *p_status = CPI_ACCESS_DENIED;
+    }
+    else
+    {
+        *p_status = CPI_FAIL;
+    }
+
+    return 1;
+}
+
+/*! utility function to replace the bytes from beg to end of a document of CPI_MAX_RESULT_SIZE bytes with size bytes of str (returns 0 if they do not fit) */
+static int schedule_splice(char *doc, char *beg, const char *end, const char *str, size_t size)
+{
+    size_t tail = strlen(end) + 1;
+
+    if( (size_t)(beg - doc) + size + tail > CPI_MAX_RESULT_SIZE ) { return 0; }
+
+    memmove(beg + size, end, tail);
+    memcpy(beg, str, size);
+
+    return 1;
+}
+
+/*! utility function to print the budget model */
+static void schedule_print_budget(const cpi_budget_t *p_budget)
+{
+    fprintf(stderr, "Budget : %u%s challenge(s) per %u s", p_budget->capacity, p_budget->capacity_known ? "" : "+", p_budget->window_hi);
+
+    if(p_budget->window_hi - p_budget->window_lo > 1) { fprintf(stderr, " (window over %u s)", p_budget->window_lo); }
+
+    fprintf(stderr, ", %llu accepted, %llu denied\n", (unsigned long long)p_budget->accepted, (unsigned long long)p_budget->denied);
+
+    return;
+}
+
+int schedule_main(int argc, char **argv, const char *serial_device_path)
+{
+    /*! default at failure */
+    int main_ret = 1;
+
+    /*! budget state file, and the window to start from if it knows nothing of the CP */
+    const char *state_path = CPI_BUDGET_STATE;
+    uint32_t window = 0;
+
+    /*! time to wait for other processes to release the CP, in seconds */
+    int lock_wait = 0;
+
+    /*! query documents */
+    const char **queries = (const char**)calloc(argc, sizeof(char*));
+    int query_count = 0;
+
+    /*! documents processed, skipped and failed */
+    int done = 0, skipped = 0, failed = 0;
+
+    /*! query document, its response, and the query and response issuing again its denied challenges */
+    char *inp_buff = (char*)malloc(CPI_MAX_RESULT_SIZE), *out_buff = (char*)malloc(CPI_MAX_RESULT_SIZE);
+    char *retry_inp = (char*)malloc(CPI_MAX_RESULT_SIZE), *retry_out = (char*)malloc(CPI_MAX_RESULT_SIZE);
+
+    /*! elements of the query document and of a response */
+    const char *query_begs[SCHEDULE_MAX_ELEMENTS], *query_ends[SCHEDULE_MAX_ELEMENTS];
+    const char *res_begs[SCHEDULE_MAX_ELEMENTS], *res_ends[SCHEDULE_MAX_ELEMENTS];
+
+    cpi_t *p_cpi = 0;
+
+    cpi_budget_t budget;
+
+    /*! document being issued (the query document, or the retry of its denied challenges), and the elements of the whole document each retried query and each denial stands for */
+    char *pending = 0;
+    int pending_slots[SCHEDULE_MAX_ELEMENTS], retry_slots[SCHEDULE_MAX_ELEMENTS], pending_count = 0, query_count_doc = 0;
+
+    int cur_arg = 0, ret = 0, v;
+
+    if( (queries == 0) || (inp_buff == 0) || (out_buff == 0) || (retry_inp == 0) || (retry_out == 0) )
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        goto cleanup;
+    }
+
+    /*! parse command line */
+    for(cur_arg = 1; cur_arg < argc; cur_arg++)
+    {
+        if(argv[cur_arg][0] != '-') { queries[query_count++] = argv[cur_arg]; continue; }
+
+        switch(argv[cur_arg][1])
+        {
+            case 't':
+                if(++cur_arg < argc) { serial_device_path = argv[cur_arg]; }
+                break;
+
+            case 's':
+                if(++cur_arg < argc) { state_path = argv[cur_arg]; }
+                break;
+
+            case 'w':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%u", &window); }
+                break;
+
+            case 'l':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &lock_wait); }
+                break;
+
+            case '-':
+                schedule_usage();
+                main_ret = 0;
+                goto cleanup;
+
+            default:
+                fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+                break;
+        }
+    }
+
+    if(query_count == 0)
+    {
+        schedule_usage();
+        goto cleanup;
+    }
+
+    /*! open the CP */
+    {
+        cpi_info_t cpi_info = { 0, lock_wait*1000, 0 };
+
+        int ret = cpi_create(&cpi_info, &p_cpi);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: cpi_create failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+
+        ret = cpi_init(p_cpi, (char*)serial_device_path);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: cpi_init failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+    }
+
+    /*! the budget is kept per CP */
+    {
+        uint8_t raw_serial[CPI_SERIAL_NUMBER_SIZE];
+
+        int ret = cpi_get_serial_number(p_cpi, raw_serial);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: cpi_get_serial_number failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+
+        ret = cpi_load_budget(state_path, raw_serial, &budget);
+
+        if(CPI_FAILED(ret))
+        {
+            fprintf(stderr, "Error: could not load \"%s\" (%s)\n", state_path, CPI_RETURN_CODE_LOOKUP[ret]);
+            goto cleanup;
+        }
+
+        /*! nothing learned yet */
+        if( (window > 0) && (budget.accepted + budget.denied == 0) ) { budget.window_hi = window; }
+
+        fprintf(stderr, "Serial : ");
+        for(v=0;v<CPI_SERIAL_NUMBER_SIZE;v++) { fprintf(stderr, "%.02X", raw_serial[v]); }
+        fprintf(stderr, "\n");
+
+        schedule_print_budget(&budget);
+    }
+
+    for(v=0;v<query_count;v++)
+    {
+        char res_path[PATH_MAX];
+
+        if(!schedule_response_path(queries[v], res_path, sizeof(res_path)))
+        {
+            fprintf(stderr, "Warning: skipping \"%s\": no \"query\" in its name\n", queries[v]);
+            failed++;
+            continue;
+        }
+
+        if(access(res_path, F_OK) == 0) { skipped++; continue; }
+
+        ret = schedule_read(queries[v], inp_buff);
+
+        if(ret <= 0)
+        {
+            if(ret < 0) { fprintf(stderr, "Warning: skipping \"%s\": longer than %d bytes\n", queries[v], CPI_MAX_RESULT_SIZE-1); }
+            else { fprintf(stderr, "Warning: skipping \"%s\": could not read it\n", queries[v]); }
+
+            failed++;
+            continue;
+        }
+
+        query_count_doc = schedule_elements(inp_buff, "query", query_begs, query_ends);
+
+        if(query_count_doc < 0)
+        {
+            fprintf(stderr, "Warning: skipping \"%s\": malformed, or more than %d queries\n", queries[v], SCHEDULE_MAX_ELEMENTS);
+            failed++;
+            continue;
+        }
+
+        /*! issue the document, then its denied challenges until none are */
+        pending = inp_buff;
+        pending_count = 0;
+
+        for(;;)
+        {
+            char *res = (pending == inp_buff) ? out_buff : retry_out;
+
+            uint32_t cur_time = 0, wait = 0;
+
+            int out_size = CPI_MAX_RESULT_SIZE, status = CPI_OK, res_count = 0, denied = 0, learned = 0, r;
+
+            /*! documents without a challenge do not count against the budget */
+            if(strstr(pending, "\"chal\"") != 0)
+            {
+                ret = cpi_get_current_time(p_cpi, &cur_time);
+
+                if(CPI_FAILED(ret))
+                {
+                    fprintf(stderr, "Error: cpi_get_current_time failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+                    goto cleanup;
+                }
+
+                wait = cpi_budget_wait(&budget, cur_time);
+
+                if(wait > 0)
+                {
+                    fprintf(stderr, "%s : waiting %u s\n", queries[v], wait);
+                    sleep(wait);
+                    continue;
+                }
+            }
+
+            ret = cpi_process_query(p_cpi, pending, CPI_FORMAT_XML, res, &out_size);
+
+            if(CPI_FAILED(ret))
+            {
+                fprintf(stderr, "Error: cpi_process_query failed (%s)\n", CPI_RETURN_CODE_LOOKUP[ret]);
+                goto cleanup;
+            }
+
+            /*! one response per query, in order */
+            res_count = schedule_elements(res, "response", res_begs, res_ends);
+
+            if(res_count != ((pending == inp_buff) ? query_count_doc : pending_count))
+            {
+                fprintf(stderr, "Error: \"%s\": %d response(s) to %d queries\n", queries[v], res_count, (pending == inp_buff) ? query_count_doc : pending_count);
+                goto cleanup;
+            }
+
+            /*! learn from each challenge, issued at cur_time as far as the CP's one second clock can tell, and note those denied */
+            for(r=0;r<res_count;r++)
+            {
+                if(!schedule_chal_status(res_begs[r], &status)) { continue; }
+
+                cpi_budget_update(&budget, cur_time, status);
+
+                learned = 1;
+
+                if(status == CPI_ACCESS_DENIED) { retry_slots[denied++] = (pending == inp_buff) ? r : pending_slots[r]; }
+            }
+
+            if(learned)
+            {
+                ret = cpi_save_budget(state_path, &budget);
+
+                if(CPI_FAILED(ret)) { fprintf(stderr, "Warning: could not save \"%s\" (%s)\n", state_path, CPI_RETURN_CODE_LOOKUP[ret]); }
+            }
+
+            /*! the responses to a retry take the place of the denials they answer, last first so the others do not move */
+            if(pending != inp_buff)
+            {
+                const char *full_begs[SCHEDULE_MAX_ELEMENTS], *full_ends[SCHEDULE_MAX_ELEMENTS];
+
+                if(schedule_elements(out_buff, "response", full_begs, full_ends) != query_count_doc)
+                {
+                    fprintf(stderr, "Error: \"%s\": could not find the denied responses\n", queries[v]);
+                    goto cleanup;
+                }
+
+                for(r=res_count-1;r>=0;r--)
+                {
+                    if(!schedule_splice(out_buff, (char*)full_begs[pending_slots[r]], full_ends[pending_slots[r]], res_begs[r], (size_t)(res_ends[r] - res_begs[r])))
+                    {
+                        fprintf(stderr, "Error: \"%s\": the response is longer than %d bytes\n", queries[v], CPI_MAX_RESULT_SIZE-1);
+                        goto cleanup;
+                    }
+                }
+            }
+
+            if(denied == 0) { break; }
+
+            fprintf(stderr, "%s : %d challenge(s) denied (AUTHCOUNT), retrying them\n", queries[v], denied);
+
+            /*! a query document of the denied challenges alone, each retry slot naming the element of the whole document it stands for */
+            {
+                size_t size = strlen(SCHEDULE_RETRY_BEG);
+
+                memcpy(retry_inp, SCHEDULE_RETRY_BEG, size);
+
+                for(r=0;r<denied;r++)
+                {
+                    size_t len = (size_t)(query_ends[retry_slots[r]] - query_begs[retry_slots[r]]);
+
+                    if(size + 9 + len + strlen(SCHEDULE_RETRY_END) >= CPI_MAX_RESULT_SIZE)
+                    {
+                        fprintf(stderr, "Error: \"%s\": the denied challenges do not fit in one document\n", queries[v]);
+                        goto cleanup;
+                    }
+
+                    memcpy(&retry_inp[size], "\n        ", 9);
+                    memcpy(&retry_inp[size + 9], query_begs[retry_slots[r]], len);
+
+                    size += len + 9;
+
+                    pending_slots[r] = retry_slots[r];
+                }
+
+                memcpy(&retry_inp[size], SCHEDULE_RETRY_END, strlen(SCHEDULE_RETRY_END) + 1);
+
+                pending = retry_inp;
+                pending_count = denied;
+            }
+        }
+
+        if(!schedule_write(res_path, out_buff, (int)strlen(out_buff)))
+        {
+            fprintf(stderr, "Error: could not write \"%s\"\n", res_path);
+            goto cleanup;
+        }
+
+        fprintf(stderr, "%s : %s\n", queries[v], res_path);
+
+        done++;
+    }
+
+    schedule_print_budget(&budget);
+
+    fprintf(stderr, "%d document(s) processed, %d skipped, %d failed\n", done, skipped, failed);
+
+    main_ret = (failed == 0) ? 0 : 1;
+
+cleanup:
+
+    if(p_cpi != 0) { cpi_close(p_cpi); }
+
+    free(retry_out);
+    free(retry_inp);
+    free(out_buff);
+    free(inp_buff);
+    free(queries);
+
+    return main_ret;
+}
+
+static void schedule_usage()
+{
+    printf("Usage : cpi schedule [--help] [-t <CDEV>] [-s <FILE>] [-w <SECS>] [-l <SECS>] <queryN.xml>...\n");
+    printf("\n");
+    printf("Process each query document into the matching responseN.xml, issuing challenges\n");
+    printf("as soon as the Crypto Processor's authentication budget allows. The budget is\n");
+    printf("learned from the CP's AUTHCOUNT answers, and kept from one run to the next.\n");
+    printf("Documents whose response already exists are skipped.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("\n");
+    printf("    --help      Display this help screen\n");
+    printf("\n");
+    printf("    -t <CDEV>   Use CDEV as character-special device to read from\n");
+    printf("    -s <FILE>   Keep the budget in FILE (default " CPI_BUDGET_STATE ")\n");
+    printf("    -w <SECS>   Start from one challenge per SECS, if nothing is known of the CP yet\n");
+    printf("                (default %d)\n", CPI_BUDGET_WINDOW);
+    printf("    -l <SECS>   Wait up to SECS (-1 for ever) for other processes to release the CP\n");
+    printf("\n");
+    return;
+}
@@ -0,0 +1,343 @@
+/*
+ * cp_archive.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the archive writer: segment layout, and appending
+ * segments to an archive image (see cp_archive.h).
+ */
+
+#include "cp_archive.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+/*! size of the staging buffer of a segment writer */
+#define ARCHIVE_WRITE_BUFFER    0x10000
+
+/*! where each column lives in a cpi_archive_record_t, and its width */
+static const struct
+{
+    size_t offset;
+    int    size;
+}
+archive_columns[CPI_ARCHIVE_COL_COUNT] =
+{
+    { offsetof(cpi_archive_record_t, pid),    0x10 },
+    { offsetof(cpi_archive_record_t, key_id), sizeof(uint16_t) },
+    { offsetof(cpi_archive_record_t, flags),  sizeof(uint16_t) },
+    { offsetof(cpi_archive_record_t, ckey),   sizeof(uint32_t) },
+    { offsetof(cpi_archive_record_t, serial), CPI_SERIAL_NUMBER_SIZE },
+    { offsetof(cpi_archive_record_t, rndx),   CPI_RNDX_SIZE },
+    { offsetof(cpi_archive_record_t, rm),     CPI_RESULT1_RAND_SIZE },
+    { offsetof(cpi_archive_record_t, enc_ok), CPI_RESULT1_ENC_OK_SIZE },
+    { offsetof(cpi_archive_record_t, sig),    CPI_RESULT2_SIZE },
+    { offsetof(cpi_archive_record_t, vers),   CPI_RESULT1_VERS_SIZE },
+    { offsetof(cpi_archive_record_t, pkey),   CPI_ARCHIVE_PKEY_SIZE }
+};
+
+/*! index entry of a segment being written */
+typedef struct _archive_index_entry
+{
+    uint8_t  pid[0x10];
+    uint16_t key_id;
+    uint32_t record;
+}
+archive_index_entry;
+
+/*! segment writer: buffered writes at increasing offsets of a file */
+typedef struct _archive_writer
+{
+    int      fd;
+    uint64_t offset;                        /*!< file offset of buf[0] */
+    uint32_t used;
+    int      failed;
+    uint8_t  buf[ARCHIVE_WRITE_BUFFER];
+}
+archive_writer;
+
+/*! utility function to round up to the archive alignment */
+static uint64_t archive_align(uint64_t offset)
+{
+    return (offset + CPI_ARCHIVE_ALIGN - 1) & ~(uint64_t)(CPI_ARCHIVE_ALIGN - 1);
+}
+
+int cpi_archive_column_size(int column)
+{
+    return ( (column < 0) || (column >= CPI_ARCHIVE_COL_COUNT) ) ? 0 : archive_columns[column].size;
+}
+
+void *cpi_archive_column(const cpi_archive_record_t *p_rec, int column)
+{
+    if( (column < 0) || (column >= CPI_ARCHIVE_COL_COUNT) ) { return 0; }
+
+    return (uint8_t*)p_rec + archive_columns[column].offset;
+}
+
+uint64_t cpi_archive_layout(cpi_archive_segment_t *p_seg, uint32_t count)
+{
+    uint64_t offset = archive_align(sizeof(cpi_archive_segment_t));
+
+    int v;
+
+    for(v=0;v<CPI_ARCHIVE_COL_COUNT;v++)
+    {
+        p_seg->column_offset[v] = offset;
+
+        offset = archive_align(offset + (uint64_t)count * archive_columns[v].size);
+    }
+
+    p_seg->index_offset = offset;
+
+    return archive_align(offset + (uint64_t)count * sizeof(uint32_t));
+}
+
+/*! utility function to write bytes at the current offset of a segment writer */
+static void archive_put(archive_writer *p_writer, const void *data, uint64_t size)
+{
+    const uint8_t *cur = (const uint8_t*)data;
+
+    while( (size > 0) && !p_writer->failed )
+    {
+        uint32_t chunk = ARCHIVE_WRITE_BUFFER - p_writer->used;
+
+        if(chunk > size) { chunk = (uint32_t)size; }
+
+        if(cur != 0) { memcpy(&p_writer->buf[p_writer->used], cur, chunk); cur += chunk; } else { memset(&p_writer->buf[p_writer->used], 0, chunk); }
+
+        p_writer->used += chunk;
+        size -= chunk;
+
+        if(p_writer->used == ARCHIVE_WRITE_BUFFER)
+        {
+            if(pwrite(p_writer->fd, p_writer->buf, p_writer->used, (off_t)p_writer->offset) != (ssize_t)p_writer->used) { p_writer->failed = 1; }
+
+            p_writer->offset += p_writer->used;
+            p_writer->used = 0;
+        }
+    }
+
+    return;
+}
+
+/*! utility function to write zeros up to an offset of the segment, which begins at base */
+static void archive_pad(archive_writer *p_writer, uint64_t base, uint64_t offset)
+{
+    archive_put(p_writer, 0, base + offset - (p_writer->offset + p_writer->used));
+
+    return;
+}
+
+/*! utility function to order index entries by putative ID, key ID, then record */
+static int archive_compare_entries(const void *a, const void *b)
+{
+    const archive_index_entry *p_a = (const archive_index_entry*)a, *p_b = (const archive_index_entry*)b;
+
+    int diff = memcmp(p_a->pid, p_b->pid, sizeof(p_a->pid));
+
+    if(diff != 0) { return diff; }
+
+    if(p_a->key_id != p_b->key_id) { return (p_a->key_id > p_b->key_id) ? 1 : -1; }
+
+    return (p_a->record > p_b->record) - (p_a->record < p_b->record);
+}
+
+/*! utility function to write a segment at base (returns CPI_ status) */
+static int archive_write_segment(int fd, uint64_t base, uint32_t first_record, const cpi_archive_record_t *records, uint32_t count, uint64_t *p_size)
+{
+    cpi_archive_segment_t seg;
+
+    archive_index_entry *entries = (archive_index_entry*)malloc((count + 1) * sizeof(archive_index_entry));
+
+    archive_writer *p_writer = (archive_writer*)malloc(sizeof(archive_writer));
+
+    uint32_t v;
+
+    int c, ret = CPI_OK;
+
+    if( (entries == 0) || (p_writer == 0) ) { free(entries); free(p_writer); return CPI_OUT_OF_MEMORY; }
+
+    memset(&seg, 0, sizeof(seg));
+
+    seg.magic = CPI_ARCHIVE_SEGMENT_MAGIC;
+    seg.record_count = count;
+    seg.first_record = first_record;
+    seg.size = cpi_archive_layout(&seg, count);
+
+    p_writer->fd = fd;
+    p_writer->offset = base;
+    p_writer->used = 0;
+    p_writer->failed = 0;
+
+    archive_put(p_writer, &seg, sizeof(seg));
+
+    /*! each column in turn, gathered from the records */
+    for(c=0;c<CPI_ARCHIVE_COL_COUNT;c++)
+    {
+        archive_pad(p_writer, base, seg.column_offset[c]);
+
+        for(v=0;v<count;v++) { archive_put(p_writer, (const uint8_t*)&records[v] + archive_columns[c].offset, archive_columns[c].size); }
+    }
+
+    /*! index */
+    for(v=0;v<count;v++)
+    {
+        memcpy(entries[v].pid, records[v].pid, sizeof(entries[v].pid));
+
+        entries[v].key_id = records[v].key_id;
+        entries[v].record = v;
+    }
+
+    qsort(entries, count, sizeof(archive_index_entry), archive_compare_entries);
+
+    archive_pad(p_writer, base, seg.index_offset);
+
+    for(v=0;v<count;v++) { archive_put(p_writer, &entries[v].record, sizeof(uint32_t)); }
+
+    archive_pad(p_writer, base, seg.size);
+
+    /*! flush */
+    if( !p_writer->failed && (p_writer->used > 0) && (pwrite(fd, p_writer->buf, p_writer->used, (off_t)p_writer->offset) != (ssize_t)p_writer->used) ) { p_writer->failed = 1; }
+
+    if(p_writer->failed) { ret = CPI_FAIL; }
+
+    *p_size = seg.size;
+
+    free(entries);
+    free(p_writer);
+
+    return ret;
+}
+
+/*! utility function to read and check the header of an open archive (returns CPI_ status) */
+static int archive_read_header(int fd, cpi_archive_header_t *p_header)
+{
+    struct stat st;
+
+    if(pread(fd, p_header, sizeof(cpi_archive_header_t), 0) != (ssize_t)sizeof(cpi_archive_header_t)) { return CPI_INVALID_PARAM; }
+
+    if( (p_header->magic != CPI_ARCHIVE_MAGIC) || (p_header->version != CPI_ARCHIVE_VERSION) ) { return CPI_INVALID_PARAM; }
+
+    /*! an image shorter than its header says has lost committed segments */
+    if( (fstat(fd, &st) != 0) || (p_header->file_size > (uint64_t)st.st_size) ) { return CPI_INVALID_PARAM; }
+
+    return CPI_OK;
+}
+
+/*! utility function to sync the directory holding path, so that a file created there stays (returns 0 on failure) */
+static int archive_sync_dir(const char *path)
+{
+    char dir_path[PATH_MAX];
+
+    int fd = -1, ok = 0;
+
+    if(snprintf(dir_path, sizeof(dir_path), "%s", path) >= (int)sizeof(dir_path)) { return 0; }
+
+    fd = open(dirname(dir_path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if(fd < 0) { return 0; }
+
+    ok = (fsync(fd) == 0);
+
+    close(fd);
+
+    return ok;
+}
+
+int cpi_archive_append(const char *path, const cpi_archive_record_t *records, uint32_t count)
+{
+    cpi_archive_header_t header;
+
+    uint64_t size = 0;
+
+    int fd = 0, ret = CPI_OK;
+
+    /*! sanity check - null ptr */
+    if( (path == 0) || ((records == 0) && (count != 0)) ) { return CPI_INVALID_PARAM; }
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if(fd < 0) { return CPI_FAIL; }
+
+    /*! one appender at a time, or two would write their segments at the same file_size */
+    if(flock(fd, LOCK_EX) != 0) { close(fd); return CPI_FAIL; }
+
+    /*! a new archive starts with an empty header, on disk (directory entry included) before any segment.
+     *  a file too short to hold a header is one whose first append was cut off while writing it */
+    if(lseek(fd, 0, SEEK_END) < (off_t)sizeof(cpi_archive_header_t))
+    {
+        memset(&header, 0, sizeof(header));
+
+        header.magic = CPI_ARCHIVE_MAGIC;
+        header.version = CPI_ARCHIVE_VERSION;
+        header.file_size = archive_align(sizeof(cpi_archive_header_t));
+
+        if( (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) || (fsync(fd) != 0) || !archive_sync_dir(path) ) { close(fd); return CPI_FAIL; }
+    }
+
+    ret = archive_read_header(fd, &header);
+
+    if( CPI_SUCCESS(ret) && (header.record_count + count < header.record_count) ) { ret = CPI_INVALID_PARAM; }
+
+    if( CPI_FAILED(ret) || (count == 0) ) { close(fd); return ret; }
+
+    /*! drop whatever a crash left past the last segment, then write and sync the new one before the header points at it */
+    if(ftruncate(fd, (off_t)header.file_size) != 0) { close(fd); return CPI_FAIL; }
+
+    ret = archive_write_segment(fd, header.file_size, header.record_count, records, count, &size);
+
+    if( CPI_SUCCESS(ret) && (fsync(fd) != 0) ) { ret = CPI_FAIL; }
+
+    if(CPI_FAILED(ret)) { close(fd); return ret; }
+
+    header.segment_count++;
+    header.record_count += count;
+    header.file_size += size;
+
+    if( (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) || (fsync(fd) != 0) ) { ret = CPI_FAIL; }
+
+    if( (close(fd) != 0) && CPI_SUCCESS(ret) ) { ret = CPI_FAIL; }
+
+    return ret;
+}
+
+int cpi_archive_count(const char *path, uint32_t *p_count)
+{
+    cpi_archive_header_t header;
+
+    int fd = 0, ret = CPI_OK;
+
+    /*! sanity check - null ptr */
+    if( (path == 0) || (p_count == 0) ) { return CPI_INVALID_PARAM; }
+
+    *p_count = 0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    /*! no archive yet, or one whose first append never got past its header */
+    if(fd < 0) { return (errno == ENOENT) ? CPI_OK : CPI_FAIL; }
+
+    /*! not while an appender rewrites the header */
+    if(flock(fd, LOCK_SH) != 0) { close(fd); return CPI_FAIL; }
+
+    if(lseek(fd, 0, SEEK_END) < (off_t)sizeof(cpi_archive_header_t)) { close(fd); return CPI_OK; }
+
+    ret = archive_read_header(fd, &header);
+
+    if(CPI_SUCCESS(ret)) { *p_count = header.record_count; }
+
+    close(fd);
+
+    return ret;
+}
@@ -0,0 +1,1687 @@
+/*
+ * cp_async.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the CPI command queue, and the non-blocking state
+ * machine which runs queued commands over the serial device. Every exchange
+ * with the CP goes through here; the blocking APIs simply wait for their
+ * commands to complete (see cpi_async_execute).
+ *
+ * The serial device and a pacing timer are multiplexed onto a single epoll
+ * descriptor, which is what cpi_get_fd() hands out.
+ *
+ * Waiting commands are kept in one queue per CPI_PRIORITY_ class. Between
+ * exchanges, the oldest command of the most urgent non-empty class is started.
+ * Commands with a deadline are admitted only if the exchanges ahead of them,
+ * as estimated from the exchange times seen so far, leave enough time.
+ *
+ * Instances created with CPI_INFO_THREADED accept commands from any thread,
+ * through a bounded lock-free ring. An I/O thread owned by the instance is the
+ * only thread which touches the queue and the serial device; it drains the
+ * ring in batches, and wakes each blocked caller once its own commands are done.
+ */
+
+#include "cp_interface.h"
+#include "cp_utility.h"
+#include "cp_base64.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+/*! There is a corner case, which triggers quite frequently,
+ *  if writing is done too quickly. The CP will get into a
+ *  bad state where it will no longer service requests until
+ *  a system reboot. This delay between written characters
+ *  works around the issue. The safe delay differs between
+ *  CPs, so "cpi calibrate" measures it for each one, and
+ *  cpi_init loads it from the pacing profile. */
+#define ENABLE_MAGIC_SLEEP_FIX
+
+#ifdef ENABLE_MAGIC_SLEEP_FIX
+#define WRITE_DELAY_NS  (CPI_WRITE_DELAY_US*1000ULL)    /*!< default minimum time between written characters */
+#else
+#define WRITE_DELAY_NS  0
+#endif
+
+/*! longest delay between written characters, after backing off from failed exchanges */
+#define WRITE_DELAY_MAX_NS  (4*CPI_WRITE_DELAY_US*1000ULL)
+
+/*! delay after backing off from a delay shorter than this */
+#define WRITE_DELAY_MIN_NS  (1000*1000ULL)
+
+/*! time the CP may stay silent while an answer is expected, before the exchange fails */
+#define READ_TIMEOUT_NS     (5*1000000000ULL)
+
+/*! time to receive a single character, for exchange time estimates (10 bits per character) */
+#if defined(CNPLATFORM_ironforge)
+#define CHAR_NS         (10*1000000000ULL/38400)
+#else
+#define CHAR_NS         (10*1000000000ULL/115200)
+#endif
+
+/*! maximum length of a request: command, up to 3 base64 arguments with LF, and EOF */
+#define MAX_REQUEST_SIZE    (8 + 3*(CPI_UTIL_MAX_REQUEST_STR_SIZE+1) + 1)
+
+/*! \name command descriptor flags */
+/*! \{ */
+#define REQ_KEY_ID      0x0001  /*!< request carries cpi_cmd_t.key_id */
+#define REQ_RAND_DATA   0x0002  /*!< request carries cpi_cmd_t.rand_data */
+#define REQ_VALUE       0x0004  /*!< request carries cpi_cmd_t.value */
+#define REQ_SHARED      0x0008  /*!< read-only; identical commands in flight may share one exchange */
+#define RES_VALUE       0x0100  /*!< response is returned in cpi_cmd_t.value */
+/*! \} */
+
+/*! utility structure, describing the exchange for a single CPI_CMD_ code */
+typedef struct _cmd_desc
+{
+    char *cmd;          /*!< command string */
+    char *cmd_ack;      /*!< expected command acknowledgement, if any */
+    int   req_flags;    /*!< REQ_ and RES_ flags */
+    int   res_count;    /*!< number of responses */
+    struct
+    {
+        int str_size;   /*!< size of base64 string */
+        int raw_size;   /*!< size of raw data after base64 decode (0 for plain strings) */
+    }
+    res[3];
+}
+cmd_desc;
+
+/*! command descriptors, indexed by CPI_CMD_ code */
+static const cmd_desc cmd_descs[] =
+{
+    /* CPI_CMD_UNKNOWN */ { .cmd = 0 },
+    /* CPI_CMD_PIDX */    { .cmd = "!!!!PIDX", .cmd_ack = "PIDX", .req_flags = REQ_KEY_ID | REQ_SHARED, .res_count = 1, .res = { { 24, 0x10 } } },
+    /* CPI_CMD_PKEY */    { .cmd = "!!!!PKEY", .req_flags = REQ_KEY_ID | REQ_SHARED, .res_count = 1, .res = { { CPI_MAX_RESULT_SIZE, 0 } } },
+    /* CPI_CMD_VERS */    { .cmd = "!!!!VERS", .cmd_ack = "VRSR", .req_flags = REQ_SHARED, .res_count = 1, .res = { { 8, CPI_VERSION_SIZE } } },
+    /* CPI_CMD_TIME */    { .cmd = "!!!!TIME", .cmd_ack = "TIME", .req_flags = REQ_SHARED | RES_VALUE, .res_count = 1, .res = { { 8, 4 } } },
+    /* CPI_CMD_CKEY */    { .cmd = "!!!!CKEY", .cmd_ack = "CKEY", .req_flags = REQ_SHARED | RES_VALUE, .res_count = 1, .res = { { 8, 4 } } },
+    /* CPI_CMD_SNUM */    { .cmd = "!!!!SNUM", .cmd_ack = "SNUM", .req_flags = REQ_SHARED, .res_count = 1, .res = { { 24, CPI_SERIAL_NUMBER_SIZE } } },
+    /* CPI_CMD_HWVR */    { .cmd = "!!!!HWVR", .cmd_ack = "HVRS", .req_flags = REQ_SHARED, .res_count = 1, .res = { { 24, CPI_HARDWARE_VERSION_SIZE } } },
+#if defined(CNPLATFORM_falconwing)
+    /* CPI_CMD_CHAL */    { .cmd = "!!!!CHAL", .cmd_ack = "RESP", .req_flags = REQ_KEY_ID | REQ_RAND_DATA, .res_count = 3, .res = { { 373, CPI_RESULT1_SIZE }, { 173, CPI_RESULT2_SIZE }, { 567, CPI_RESULT3_SIZE } } },
+#else
+    /* CPI_CMD_CHAL */    { .cmd = "!!!!CHAL", .cmd_ack = "RESP", .req_flags = REQ_KEY_ID | REQ_RAND_DATA, .res_count = 2, .res = { { 373, CPI_RESULT1_SIZE }, { 173, CPI_RESULT2_SIZE } } },
+#endif
+    /* CPI_CMD_ALRM */    { .cmd = "!!!!ALRM", .cmd_ack = "ASET", .req_flags = REQ_VALUE },
+    /* CPI_CMD_DOWN */    { .cmd = "!!!!DOWN" },
+    /* CPI_CMD_RSET */    { .cmd = "!!!!RSET" }
+};
+
+/*! \name transport states */
+/*! \{ */
+#define ST_IDLE         0x00    /*!< no command in progress */
+#define ST_WAKE_WRITE   0x01    /*!< writing the wake character */
+#define ST_WAKE_READ    0x02    /*!< waiting for the CP to answer the wake character */
+#define ST_REQ_WRITE    0x03    /*!< writing the request */
+#define ST_ACK          0x04    /*!< reading the command acknowledgement */
+#define ST_DATA         0x05    /*!< reading a base64 response line */
+#define ST_STR          0x06    /*!< reading a plain string response */
+#define ST_SKIP         0x07    /*!< discarding the remainder of a truncated string response */
+#define ST_EOF          0x08    /*!< reading the trailing EOF character */
+/*! \} */
+
+/*! completion counter for the commands of one blocking call, on a shared instance */
+typedef struct _async_waiter
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             pending;    /*!< number of queued, uncompleted commands */
+}
+async_waiter;
+
+/*! queued command */
+typedef struct _async_entry
+{
+    cpi_cmd_t      *p_cmd;      /*!< caller-owned command */
+    cpi_callback_t  callback;   /*!< completion callback, if any */
+    async_waiter   *p_waiter;   /*!< blocked caller to wake on completion, if any */
+    int             follower;   /*!< first (or, for followers, next) identical command sharing this exchange, or -1 */
+    uint64_t        submitted;  /*!< submission time (CLOCK_MONOTONIC, in ns) */
+}
+async_entry;
+
+/*! waiting commands of a single priority class */
+typedef struct _async_class
+{
+    async_entry queue[CPI_MAX_PENDING]; /*!< submitted commands, in order */
+    int head;                           /*!< index of the oldest command */
+    int count;                          /*!< number of waiting commands */
+}
+async_class;
+
+/*! submission ring cell; seq tells producers and the I/O thread whose turn it is */
+typedef struct _ring_cell
+{
+    unsigned    seq;
+    async_entry entry;
+}
+ring_cell;
+
+/*! command queue and transport state, one per initialized CPI instance */
+typedef struct _cpi_async
+{
+    int epoll_fd;                       /*!< descriptor returned by cpi_get_fd */
+    int timer_fd;                       /*!< pacing timer */
+    int serial_events;                  /*!< epoll events registered for the serial device (-1 if not registered) */
+
+    async_class classes[CPI_PRIORITY_COUNT];    /*!< waiting commands, by CPI_PRIORITY_ class */
+    async_entry active;                 /*!< command in progress (p_cmd is null if none) */
+    uint64_t active_start;              /*!< time the exchange of the command in progress started */
+    int count;                          /*!< number of submitted, uncompleted commands, waiting or in progress */
+
+    uint64_t est_ns[CPI_CMD_RSET + 1];  /*!< expected exchange time of each command, learned as exchanges complete */
+
+    pthread_mutex_t metrics_lock;       /*!< guards metrics, which other threads may read */
+    cpi_metrics_t metrics;              /*!< scheduler metrics, see cpi_get_metrics */
+
+    async_entry followers[CPI_MAX_PENDING]; /*!< commands attached to an identical queued command */
+    int free_follower;                  /*!< first unused entry of followers, chained through follower (-1 if none) */
+
+    int in_events;                      /*!< set while cpi_process_events is running */
+    int state;                          /*!< ST_ transport state */
+    int awake;                          /*!< set once the CP has answered a wake, for the current session */
+    uint64_t next_write;                /*!< earliest time for the next write (CLOCK_MONOTONIC, in ns) */
+    uint64_t read_deadline;             /*!< time the exchange in progress fails, unless the CP sends something first */
+    uint64_t write_delay_ns;            /*!< time between written characters, raised after failed exchanges */
+    uint64_t base_delay_ns;             /*!< delay which write_delay_ns creeps back to (see cpi_set_write_delay) */
+    uint64_t delay_request;             /*!< base delay to apply before the next exchange, plus one (0 if none) */
+    int refused;                        /*!< set if the exchange in progress ended in a well-formed FAIL answer */
+    int eof_pending;                    /*!< set while the EOF character of a completed exchange is still to come */
+
+    /*! \name pipelined instances (CPI_INFO_PIPELINED) only */
+    /*! \{ */
+    int pipelined;                      /*!< set if the next request is started before the last exchange is finished */
+    async_entry deferred;               /*!< completed command, finished once the next request is under way (p_cmd is null if none) */
+    /*! \} */
+
+    char req[MAX_REQUEST_SIZE];         /*!< request for the command in progress */
+    int  req_len;                       /*!< length of req */
+    int  req_pos;                       /*!< number of characters of req written so far */
+
+    int  cur_resp;                      /*!< response line being read */
+    int  pos;                           /*!< characters read on the current line (excluding sync characters) */
+    int  limit;                         /*!< maximum characters on the current line */
+    int  ret;                           /*!< first decode error on the current line */
+    char prefix[9];                     /*!< leading characters of the current line, for failure detection */
+    int  res_size[3];                   /*!< bytes written for each response, reported on success */
+    cpi_b64_state dec;                  /*!< base64 decoder for the current line */
+
+    /*! \name shared instances (CPI_INFO_THREADED) only */
+    /*! \{ */
+    int threaded;                       /*!< set if commands are executed by the I/O thread */
+    int wake_fd;                        /*!< eventfd, signalled when the ring gains entries */
+    int wake_pending;                   /*!< set once wake_fd has been signalled, until the ring is drained */
+    int stop;                           /*!< set to stop the I/O thread */
+    pthread_t thread;                   /*!< I/O thread */
+    unsigned ring_head;                 /*!< next ring position to drain (I/O thread only) */
+    unsigned ring_tail __attribute__((aligned(64)));   /*!< next ring position to fill (all producers) */
+    ring_cell ring[CPI_MAX_PENDING];    /*!< submitted commands, not yet queued */
+    /*! \} */
+}
+cpi_async;
+
+/*! utility function to run the state machine for a single step (returns 0 once it would block) */
+static int async_step(struct _cpi_t *p_cpi, cpi_async *p_async);
+
+/*! utility function to feed a single character read from the CP to the state machine */
+static void async_read_char(struct _cpi_t *p_cpi, cpi_async *p_async, char c);
+
+/*! utility function to begin reading the specified response line, or finish the exchange */
+static void async_begin_line(struct _cpi_t *p_cpi, cpi_async *p_async, int cur_resp);
+
+/*! utility function to finish reading the current response line */
+static void async_end_line(struct _cpi_t *p_cpi, cpi_async *p_async);
+
+/*! utility function to complete the command in progress, and call its callback (pipelined instances may defer this, see async_deliver) */
+static void async_complete(struct _cpi_t *p_cpi, cpi_async *p_async, int status);
+
+/*! utility function to call the callbacks of the completed command held in deferred, and of commands attached to it */
+static void async_deliver(struct _cpi_t *p_cpi, cpi_async *p_async);
+
+/*! utility function to select the epoll events of interest for the serial device */
+static void async_set_serial_events(struct _cpi_t *p_cpi, cpi_async *p_async, int events);
+
+/*! utility function to arm the pacing timer for an absolute time (0 disarms) */
+static void async_set_timer(cpi_async *p_async, uint64_t when);
+
+/*! utility function to queue a validated command, from the thread which owns the queue */
+static int async_enqueue(cpi_async *p_async, const async_entry *p_new);
+
+/*! utility function to add a validated command to the submission ring, from any thread */
+static int async_ring_push(cpi_async *p_async, cpi_cmd_t *p_cmd, cpi_callback_t callback, async_waiter *p_waiter);
+
+/*! utility function to move submitted commands from the ring to the queue, as room allows */
+static void async_ring_drain(struct _cpi_t *p_cpi, cpi_async *p_async);
+
+/*! utility function to call the callback of a finished command, and wake its blocked caller */
+static void async_finish(struct _cpi_t *p_cpi, const async_entry *p_entry);
+
+/*! utility function to run the state machine until it would block */
+static void async_run(struct _cpi_t *p_cpi, cpi_async *p_async);
+
+/*! I/O thread entry point, for shared instances */
+static void *async_thread(void *arg);
+
+/*! utility function to retrieve the current time, in ns */
+static uint64_t async_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*! utility function to retrieve the command in progress */
+static cpi_cmd_t *async_cur_cmd(cpi_async *p_async) { return p_async->active.p_cmd; }
+
+/*! priority classes, in the order they are served */
+static const int async_class_order[CPI_PRIORITY_COUNT] = { CPI_PRIORITY_URGENT, CPI_PRIORITY_NORMAL, CPI_PRIORITY_BULK };
+
+/*! utility function to retrieve the service rank of a priority class (0 is served first) */
+static int async_class_rank(int priority)
+{
+    int v;
+
+    for(v=0;v<CPI_PRIORITY_COUNT;v++) { if(async_class_order[v] == priority) { return v; } }
+
+    return CPI_PRIORITY_COUNT;
+}
+
+/*! utility function to make an initial guess at the exchange time of a command: paced request, then response */
+static uint64_t async_default_estimate(int cmd, uint64_t write_delay_ns)
+{
+    const cmd_desc *p_desc = &cmd_descs[cmd];
+
+    /*! wake character, command, and EOF */
+    uint64_t req_chars = 1 + strlen(p_desc->cmd) + 1, res_chars = 8;
+
+    int cur_resp;
+
+    if(p_desc->req_flags & REQ_KEY_ID) { req_chars += 4 + 1; }
+    if(p_desc->req_flags & REQ_RAND_DATA) { req_chars += 24 + 1; }
+    if(p_desc->req_flags & REQ_VALUE) { req_chars += 8 + 1; }
+
+    for(cur_resp = 0; cur_resp < p_desc->res_count; cur_resp++) { res_chars += p_desc->res[cur_resp].str_size + 2; }
+
+    return req_chars*write_delay_ns + res_chars*CHAR_NS;
+}
+
+/*! utility function to retrieve the destination of the specified response line */
+static void *async_res_data(cpi_cmd_t *p_cmd, int cur_resp, int *p_size)
+{
+    if(cmd_descs[p_cmd->cmd].req_flags & RES_VALUE)
+    {
+        *p_size = sizeof(p_cmd->value);
+
+        return &p_cmd->value;
+    }
+
+    *p_size = p_cmd->out_size[cur_resp];
+
+    return p_cmd->out[cur_resp];
+}
+
+int cpi_async_init(struct _cpi_t *p_cpi)
+{
+    cpi_async *p_async = (cpi_async*)cpi_util_malloc(sizeof(cpi_async));
+
+    unsigned v;
+
+    /*! handle allocation failure */
+    if(p_async == 0) { return CPI_OUT_OF_MEMORY; }
+
+    memset(p_async, 0, sizeof(cpi_async));
+
+    p_async->serial_events = -1;
+    p_async->state = ST_IDLE;
+    p_async->threaded = (p_cpi->flags & CPI_INFO_THREADED) ? 1 : 0;
+    p_async->pipelined = (p_cpi->flags & CPI_INFO_PIPELINED) ? 1 : 0;
+    p_async->wake_fd = -1;
+
+    for(v=0;v<CPI_MAX_PENDING;v++) { p_async->ring[v].seq = v; }
+
+    for(v=0;v<CPI_MAX_PENDING;v++) { p_async->followers[v].follower = (v + 1 < CPI_MAX_PENDING) ? (int)(v + 1) : -1; }
+
+    p_async->free_follower = 0;
+
+    for(v=CPI_CMD_PIDX;v<=CPI_CMD_RSET;v++) { p_async->est_ns[v] = async_default_estimate(v, WRITE_DELAY_NS); }
+
+    p_async->write_delay_ns = p_async->base_delay_ns = WRITE_DELAY_NS;
+    p_async->metrics.write_delay_us = (uint32_t)(WRITE_DELAY_NS / 1000);
+
+    pthread_mutex_init(&p_async->metrics_lock, 0);
+
+    p_async->epoll_fd = epoll_create(3);
+    p_async->timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+
+    /*! register the timer, the serial device is only registered while there is something to wait for */
+    if( (p_async->epoll_fd != -1) && (p_async->timer_fd != -1) )
+    {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+
+        ev.events = EPOLLIN;
+
+        fcntl(p_async->timer_fd, F_SETFL, O_NONBLOCK);
+        fcntl(p_async->epoll_fd, F_SETFD, FD_CLOEXEC);
+        fcntl(p_async->timer_fd, F_SETFD, FD_CLOEXEC);
+
+        if(epoll_ctl(p_async->epoll_fd, EPOLL_CTL_ADD, p_async->timer_fd, &ev) == 0)
+        {
+            /*! shared instances are driven by their own I/O thread, woken through wake_fd */
+            if(!p_async->threaded)
+            {
+                p_cpi->async = p_async;
+
+                return CPI_OK;
+            }
+
+            p_async->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            if( (p_async->wake_fd != -1) && (epoll_ctl(p_async->epoll_fd, EPOLL_CTL_ADD, p_async->wake_fd, &ev) == 0) )
+            {
+                p_cpi->async = p_async;
+
+                if(pthread_create(&p_async->thread, 0, async_thread, p_cpi) == 0) { return CPI_OK; }
+
+                p_cpi->async = 0;
+            }
+        }
+    }
+
+    if(p_async->epoll_fd != -1) { close(p_async->epoll_fd); }
+    if(p_async->timer_fd != -1) { close(p_async->timer_fd); }
+    if(p_async->wake_fd != -1) { close(p_async->wake_fd); }
+
+    pthread_mutex_destroy(&p_async->metrics_lock);
+
+    cpi_util_free(p_async);
+
+    return CPI_FAIL;
+}
+
+void cpi_async_cleanup(struct _cpi_t *p_cpi)
+{
+    cpi_async *p_async = (cpi_async*)p_cpi->async;
+
+    if(p_async == 0) { return; }
+
+    /*! stop the I/O thread before tearing down the descriptors it waits on */
+    if(p_async->threaded)
+    {
+        uint64_t one = 1;
+
+        __atomic_store_n(&p_async->stop, 1, __ATOMIC_RELEASE);
+
+        if(write(p_async->wake_fd, &one, sizeof(one)) < 0) { /* already signalled */ }
+
+        pthread_join(p_async->thread, 0);
+
+        close(p_async->wake_fd);
+    }
+
+    /*! outstanding commands are dropped, without calling their callbacks */
+    close(p_async->epoll_fd);
+    close(p_async->timer_fd);
+
+    pthread_mutex_destroy(&p_async->metrics_lock);
+
+    cpi_util_free(p_async);
+
+    p_cpi->async = 0;
+
+    return;
+}
+
+/*! utility function to process events until no more than max_pending commands are outstanding */
+static int async_wait(struct _cpi_t *p_cpi, cpi_async *p_async, int max_pending)
+{
+    /*! blocking from within a callback would never return */
+    if(p_async->in_events) { return CPI_INVALID_CALL; }
+
+    while(p_async->count > max_pending)
+    {
+        struct pollfd pfd = { p_async->epoll_fd, POLLIN, 0 };
+
+        /*! errors (e.g. EINTR) simply cause another pass */
+        poll(&pfd, 1, -1);
+
+        cpi_process_events(p_cpi);
+    }
+
+    return CPI_OK;
+}
+
+/*! utility function to wait until no more than max_pending of the caller's commands are outstanding */
+static void async_waiter_wait(async_waiter *p_waiter, int max_pending)
+{
+    pthread_mutex_lock(&p_waiter->lock);
+
+    while(p_waiter->pending > max_pending) { pthread_cond_wait(&p_waiter->cond, &p_waiter->lock); }
+
+    pthread_mutex_unlock(&p_waiter->lock);
+
+    return;
+}
+
+/*! utility function to execute a batch on a shared instance, waiting only for its own commands */
+static int async_execute_shared(cpi_async *p_async, cpi_cmd_t *cmds, size_t n)
+{
+    async_waiter waiter;
+
+    int last = -1;
+
+    size_t v;
+
+    /*! blocking on the I/O thread (i.e. from a callback) would never return */
+    if(pthread_equal(pthread_self(), p_async->thread)) { return CPI_INVALID_CALL; }
+
+    pthread_mutex_init(&waiter.lock, 0);
+    pthread_cond_init(&waiter.cond, 0);
+
+    waiter.pending = 0;
+
+    for(v=0;v<n;v++)
+    {
+        /*! invalid entries are not queued, and keep their validation status */
+        cmds[v].status = cpi_validate_cmd(&cmds[v]);
+
+        if(CPI_FAILED(cmds[v].status)) { continue; }
+
+        /*! an entry of another class would be served out of order, so it waits for the earlier ones */
+        if( (last != -1) && (cmds[v].priority != last) ) { async_waiter_wait(&waiter, 0); }
+
+        last = cmds[v].priority;
+
+        /*! count the entry first, since it may complete before the push returns */
+        pthread_mutex_lock(&waiter.lock);
+        waiter.pending++;
+        pthread_mutex_unlock(&waiter.lock);
+
+        /*! ring is full - wait for one of our own earlier entries, or give other callers a chance to drain theirs */
+        while(CPI_FAILED(async_ring_push(p_async, &cmds[v], 0, &waiter)))
+        {
+            int pending = 0;
+
+            pthread_mutex_lock(&waiter.lock);
+
+            pending = waiter.pending;
+
+            while( (pending > 1) && (waiter.pending == pending) ) { pthread_cond_wait(&waiter.cond, &waiter.lock); }
+
+            pthread_mutex_unlock(&waiter.lock);
+
+            if(pending <= 1) { sched_yield(); }
+        }
+    }
+
+    async_waiter_wait(&waiter, 0);
+
+    pthread_cond_destroy(&waiter.cond);
+    pthread_mutex_destroy(&waiter.lock);
+
+    return CPI_OK;
+}
+
+int cpi_async_execute(struct _cpi_t *p_cpi, cpi_cmd_t *cmds, size_t n)
+{
+    cpi_async *p_async = (cpi_async*)p_cpi->async;
+
+    int last = -1;
+
+    size_t v;
+
+    if(p_async->threaded) { return async_execute_shared(p_async, cmds, n); }
+
+    /*! queue every entry, waiting for room as needed; consecutive entries share one CP session */
+    for(v=0;v<n;v++)
+    {
+        /*! an entry of another class would be served out of order, so it waits for the earlier ones */
+        int ret = async_wait(p_cpi, p_async, ((last != -1) && (cmds[v].priority != last)) ? 0 : CPI_MAX_PENDING - 1);
+
+        if(CPI_FAILED(ret)) { return ret; }
+
+        /*! invalid entries are not queued, and keep their validation status */
+        if(CPI_SUCCESS(cpi_submit(p_cpi, &cmds[v], 0))) { last = cmds[v].priority; }
+    }
+
+    /*! wait for the queue to drain */
+    return async_wait(p_cpi, p_async, 0);
+}
+
+int cpi_submit(struct _cpi_t *p_cpi, cpi_cmd_t *p_cmd, cpi_callback_t callback)
+{
+    cpi_async *p_async = 0;
+
+    /*! sanity check - null ptr */
+    if( (p_cpi == 0) || (p_cmd == 0) ) { return CPI_INVALID_PARAM; }
+
+    /*! the daemon queues the command */
+    if(p_cpi->remote != 0) { return cpi_remote_submit(p_cpi, p_cmd, callback); }
+
+    /*! sanity check - initialization */
+    if( !p_cpi->is_initialized || (p_cpi->async == 0) ) { return CPI_INVALID_CALL; }
+
+    p_async = (cpi_async*)p_cpi->async;
+
+    p_cmd->status = cpi_validate_cmd(p_cmd);
+
+    if(CPI_FAILED(p_cmd->status)) { return p_cmd->status; }
+
+    /*! shared instances hand the command to the I/O thread */
+    if(p_async->threaded) { return async_ring_push(p_async, p_cmd, callback, 0); }
+
+    /*! commands which cannot meet their deadline fail right away, without a callback */
+    {
+        async_entry entry = { p_cmd, callback, 0, -1, async_now() };
+
+        int ret = async_enqueue(p_async, &entry);
+
+        if(ret == CPI_BUSY) { p_cmd->status = CPI_BUSY; }
+
+        if(CPI_FAILED(ret)) { return ret; }
+    }
+
+    /*! make the event descriptor readable right away, so the caller's loop picks the command up */
+    if(p_async->state == ST_IDLE) { async_set_timer(p_async, 1); }
+
+    return CPI_OK;
+}
+
+int cpi_get_fd(struct _cpi_t *p_cpi)
+{
+    /*! responses from the daemon arrive on the connection */
+    if( (p_cpi != 0) && (p_cpi->remote != 0) ) { return cpi_remote_get_fd(p_cpi); }
+
+    /*! sanity check - initialization */
+    if( (p_cpi == 0) || !p_cpi->is_initialized || (p_cpi->async == 0) ) { return -1; }
+
+    /*! events of shared instances belong to the I/O thread */
+    if(((cpi_async*)p_cpi->async)->threaded) { return -1; }
+
+    return ((cpi_async*)p_cpi->async)->epoll_fd;
+}
+
+int cpi_process_events(struct _cpi_t *p_cpi)
+{
+    cpi_async *p_async = 0;
+
+    /*! sanity check - null ptr */
+    if(p_cpi == 0) { return CPI_INVALID_PARAM; }
+
+    /*! responses from the daemon arrive on the connection */
+    if(p_cpi->remote != 0) { return cpi_remote_process_events(p_cpi); }
+
+    /*! sanity check - initialization */
+    if( !p_cpi->is_initialized || (p_cpi->async == 0) ) { return CPI_INVALID_CALL; }
+
+    p_async = (cpi_async*)p_cpi->async;
+
+    /*! sanity check - recursive call from a callback, or shared instance */
+    if(p_async->threaded || p_async->in_events) { return CPI_INVALID_CALL; }
+
+    async_run(p_cpi, p_async);
+
+    return CPI_OK;
+}
+
+int cpi_get_metrics(struct _cpi_t *p_cpi, cpi_metrics_t *p_metrics)
+{
+    cpi_async *p_async = 0;
+
+    /*! sanity check - null ptr */
+    if( (p_cpi == 0) || (p_metrics == 0) ) { return CPI_INVALID_PARAM; }
+
+    /*! the daemon owns the queue */
+    if(p_cpi->remote != 0) { return cpi_remote_metrics(p_cpi, p_metrics); }
+
+    /*! sanity check - initialization */
+    if( !p_cpi->is_initialized || (p_cpi->async == 0) ) { return CPI_INVALID_CALL; }
+
+    p_async = (cpi_async*)p_cpi->async;
+
+    pthread_mutex_lock(&p_async->metrics_lock);
+
+    *p_metrics = p_async->metrics;
+
+    pthread_mutex_unlock(&p_async->metrics_lock);
+
+    return CPI_OK;
+}
+
+int cpi_set_write_delay(struct _cpi_t *p_cpi, uint32_t delay_us)
+{
+    /*! sanity check - null ptr */
+    if(p_cpi == 0) { return CPI_INVALID_PARAM; }
+
+    /*! the daemon owns the serial device, and paces it for every client */
+    if(p_cpi->remote != 0) { return cpi_remote_set_write_delay(p_cpi, delay_us); }
+
+    /*! sanity check - initialization */
+    if( !p_cpi->is_initialized || (p_cpi->async == 0) ) { return CPI_INVALID_CALL; }
+
+    /*! picked up by whichever thread runs the state machine, between exchanges */
+    __atomic_store_n(&((cpi_async*)p_cpi->async)->delay_request, delay_us*1000ULL + 1, __ATOMIC_RELEASE);
+
+    return CPI_OK;
+}
+
+/*! utility function to apply the base delay requested through cpi_set_write_delay, if any */
+static void async_apply_delay(cpi_async *p_async)
+{
+    uint64_t request = __atomic_exchange_n(&p_async->delay_request, 0, __ATOMIC_ACQUIRE);
+
+    int v;
+
+    if(request == 0) { return; }
+
+    p_async->write_delay_ns = p_async->base_delay_ns = request - 1;
+
+    /*! exchange times learned so far no longer apply */
+    for(v=CPI_CMD_PIDX;v<=CPI_CMD_RSET;v++) { p_async->est_ns[v] = async_default_estimate(v, p_async->write_delay_ns); }
+
+    pthread_mutex_lock(&p_async->metrics_lock);
+
+    p_async->metrics.write_delay_us = (uint32_t)(p_async->write_delay_ns / 1000);
+
+    pthread_mutex_unlock(&p_async->metrics_lock);
+
+    return;
+}
+
+static void async_run(struct _cpi_t *p_cpi, cpi_async *p_async)
+{
+    /*! acknowledge timer expiration, if any */
+    {
+        uint64_t expirations = 0;
+
+        if(read(p_async->timer_fd, &expirations, sizeof(expirations)) < 0) { /* not expired */ }
+    }
+
+    p_async->in_events = 1;
+
+    while(async_step(p_cpi, p_async)) { }
+
+    /*! the next request is under way, or there is none; either way, nothing is gained by waiting longer */
+    if(p_async->deferred.p_cmd != 0) { async_deliver(p_cpi, p_async); }
+
+    p_async->in_events = 0;
+
+    return;
+}
+
+/*! utility function to attach a command to an identical leader, expected to finish at the specified time, if it can share the leader's exchange */
+static int async_attach(cpi_async *p_async, async_entry *p_leader, const async_entry *p_new, uint64_t finish, int started)
+{
+    const cpi_cmd_t *p_other = p_leader->p_cmd;
+
+    cpi_cmd_t *p_cmd = p_new->p_cmd;
+
+    uint64_t deadline = p_new->submitted + p_cmd->deadline_ms*1000000ULL;
+
+    int cur_resp, slot;
+
+    if( (p_other->cmd != p_cmd->cmd) || (p_other == p_cmd) ) { return CPI_FAIL; }
+
+    if( (cmd_descs[p_cmd->cmd].req_flags & REQ_KEY_ID) && (p_other->key_id != p_cmd->key_id) ) { return CPI_FAIL; }
+
+    /*! admission, as for a command of its own: the shared exchange must be over in time */
+    if( (p_cmd->deadline_ms != 0) && (finish > deadline) ) { return CPI_FAIL; }
+
+    /*! a leader which is still waiting is dropped once its own deadline passes, which must not fail a command with a later one */
+    if( !started && (p_other->deadline_ms != 0) && ((p_cmd->deadline_ms == 0) || (deadline > p_leader->submitted + p_other->deadline_ms*1000000ULL)) ) { return CPI_FAIL; }
+
+    /*! whatever the exchange writes must fit the attached command's buffers too */
+    for(cur_resp = 0; cur_resp < cpi_cmd_out_count(p_cmd->cmd); cur_resp++)
+    {
+        if(p_cmd->out_size[cur_resp] < p_other->out_size[cur_resp]) { return CPI_FAIL; }
+    }
+
+    slot = p_async->free_follower;
+
+    p_async->free_follower = p_async->followers[slot].follower;
+
+    p_async->followers[slot] = *p_new;
+    p_async->followers[slot].follower = p_leader->follower;
+
+    p_leader->follower = slot;
+
+    pthread_mutex_lock(&p_async->metrics_lock);
+    p_async->metrics.coalesced++;
+    pthread_mutex_unlock(&p_async->metrics_lock);
+
+    return CPI_OK;
+}
+
+/*! utility function to attach a validated command to an identical one already queued (returns CPI_FAIL if there is none) */
+static int async_coalesce(cpi_async *p_async, const async_entry *p_new)
+{
+    uint64_t now = async_now(), expected = 0;
+
+    int rank = async_class_rank(p_new->p_cmd->priority), c, v;
+
+    if( !(cmd_descs[p_new->p_cmd->cmd].req_flags & REQ_SHARED) || (p_async->free_follower == -1) ) { return CPI_FAIL; }
+
+    /*! waiting commands may run in any order across classes, so none may change CP state */
+    for(c=0;c<CPI_PRIORITY_COUNT;c++)
+    {
+        async_class *p_class = &p_async->classes[c];
+
+        for(v=0;v<p_class->count;v++)
+        {
+            if(!(cmd_descs[p_class->queue[(p_class->head + v) % CPI_MAX_PENDING].p_cmd->cmd].req_flags & REQ_SHARED)) { return CPI_FAIL; }
+        }
+    }
+
+    /*! the exchange on the wire, then the waiting commands, in the order they are served */
+    if(p_async->active.p_cmd != 0)
+    {
+        uint64_t elapsed = now - p_async->active_start, est = p_async->est_ns[p_async->active.p_cmd->cmd];
+
+        if(est > elapsed) { expected += est - elapsed; }
+
+        if( (cmd_descs[p_async->active.p_cmd->cmd].req_flags & REQ_SHARED) && CPI_SUCCESS(async_attach(p_async, &p_async->active, p_new, now + expected, 1)) ) { return CPI_OK; }
+    }
+
+    /*! only behind leaders at least as urgent, which a less urgent one would otherwise hold back */
+    for(c=0;c<=rank;c++)
+    {
+        async_class *p_class = &p_async->classes[async_class_order[c]];
+
+        for(v=0;v<p_class->count;v++)
+        {
+            async_entry *p_leader = &p_class->queue[(p_class->head + v) % CPI_MAX_PENDING];
+
+            expected += p_async->est_ns[p_leader->p_cmd->cmd];
+
+            if(CPI_SUCCESS(async_attach(p_async, p_leader, p_new, now + expected, 0))) { return CPI_OK; }
+        }
+    }
+
+    return CPI_FAIL;
+}
+
+/*! utility function to decide whether a command can complete within its deadline, given the commands served before it */
+static int async_admit(cpi_async *p_async, const async_entry *p_new)
+{
+    const cpi_cmd_t *p_cmd = p_new->p_cmd;
+
+    uint64_t now = async_now(), expected = p_async->est_ns[p_cmd->cmd];
+
+    int rank = async_class_rank(p_cmd->priority), c, v;
+
+    if(p_cmd->deadline_ms == 0) { return CPI_OK; }
+
+    /*! remainder of the exchange on the wire */
+    if(p_async->active.p_cmd != 0)
+    {
+        uint64_t elapsed = now - p_async->active_start, est = p_async->est_ns[p_async->active.p_cmd->cmd];
+
+        if(est > elapsed) { expected += est - elapsed; }
+    }
+
+    /*! commands of this class, and of more urgent ones */
+    for(c=0;c<=rank;c++)
+    {
+        async_class *p_class = &p_async->classes[async_class_order[c]];
+
+        for(v=0;v<p_class->count;v++) { expected += p_async->est_ns[p_class->queue[(p_class->head + v) % CPI_MAX_PENDING].p_cmd->cmd]; }
+    }
+
+    if(now + expected > p_new->submitted + p_cmd->deadline_ms*1000000ULL) { return CPI_BUSY; }
+
+    return CPI_OK;
+}
+
+static int async_enqueue(cpi_async *p_async, const async_entry *p_new)
+{
+    async_class *p_class = &p_async->classes[p_new->p_cmd->priority];
+
+    /*! identical read-only command already in flight, share its exchange */
+    if(CPI_SUCCESS(async_coalesce(p_async, p_new))) { return CPI_OK; }
+
+    /*! class is full */
+    if(p_class->count == CPI_MAX_PENDING) { return CPI_OUT_OF_MEMORY; }
+
+    /*! reject early, rather than wait for a result which would come too late */
+    if(CPI_FAILED(async_admit(p_async, p_new)))
+    {
+        pthread_mutex_lock(&p_async->metrics_lock);
+        p_async->metrics.rejected[p_new->p_cmd->priority]++;
+        pthread_mutex_unlock(&p_async->metrics_lock);
+
+        return CPI_BUSY;
+    }
+
+    p_class->queue[(p_class->head + p_class->count) % CPI_MAX_PENDING] = *p_new;
+    p_class->queue[(p_class->head + p_class->count) % CPI_MAX_PENDING].follower = -1;
+    p_class->count++;
+
+    p_async->count++;
+
+    pthread_mutex_lock(&p_async->metrics_lock);
+
+    p_async->metrics.depth[p_new->p_cmd->priority] = p_class->count;
+
+    if(p_async->metrics.max_depth[p_new->p_cmd->priority] < (uint32_t)p_class->count) { p_async->metrics.max_depth[p_new->p_cmd->priority] = p_class->count; }
+
+    pthread_mutex_unlock(&p_async->metrics_lock);
+
+    return CPI_OK;
+}
+
+/*! utility function to start the next command, most urgent class first (returns 0 if none are waiting) */
+static int async_next(cpi_async *p_async)
+{
+    uint64_t now = async_now(), wait = 0;
+
+    int c, priority = 0, bucket = 0;
+
+    async_class *p_class = 0;
+
+    for(c=0;c<CPI_PRIORITY_COUNT;c++)
+    {
+        priority = async_class_order[c];
+
+        p_class = &p_async->classes[priority];
+
+        if(p_class->count > 0) { break; }
+    }
+
+    if(c == CPI_PRIORITY_COUNT) { return 0; }
+
+    p_async->active = p_class->queue[p_class->head];
+    p_async->active_start = now;
+
+    p_class->head = (p_class->head + 1) % CPI_MAX_PENDING;
+    p_class->count--;
+
+    wait = (now - p_async->active.submitted) / 1000;
+
+    /*! bucket b holds waits under 2^b ms */
+    while( (bucket < CPI_METRICS_BUCKETS - 1) && (wait >= (1000ULL << bucket)) ) { bucket++; }
+
+    pthread_mutex_lock(&p_async->metrics_lock);
+
+    p_async->metrics.depth[priority] = p_class->count;
+    p_async->metrics.wait_total_us[priority] += wait;
+    p_async->metrics.wait_hist[priority][bucket]++;
+
+    if(p_async->metrics.wait_max_us[priority] < wait) { p_async->metrics.wait_max_us[priority] = (wait > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)wait; }
+
+    pthread_mutex_unlock(&p_async->metrics_lock);
+
+    return 1;
+}
+
+static int async_ring_push(cpi_async *p_async, cpi_cmd_t *p_cmd, cpi_callback_t callback, async_waiter *p_waiter)
+{
+    unsigned pos = __atomic_load_n(&p_async->ring_tail, __ATOMIC_RELAXED);
+
+    ring_cell *p_cell = 0;
+
+    /*! claim a cell; a cell is free for position pos once its seq has come round to pos */
+    for(;;)
+    {
+        int dif = 0;
+
+        p_cell = &p_async->ring[pos % CPI_MAX_PENDING];
+
+        dif = (int)(__atomic_load_n(&p_cell->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if(dif == 0)
+        {
+            if(__atomic_compare_exchange_n(&p_async->ring_tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { break; }
+        }
+        else if(dif < 0)
+        {
+            /*! ring is full */
+            return CPI_OUT_OF_MEMORY;
+        }
+        else
+        {
+            pos = __atomic_load_n(&p_async->ring_tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    p_cell->entry.p_cmd = p_cmd;
+    p_cell->entry.callback = callback;
+    p_cell->entry.p_waiter = p_waiter;
+    p_cell->entry.follower = -1;
+    p_cell->entry.submitted = async_now();
+
+    /*! publish the cell to the I/O thread */
+    __atomic_store_n(&p_cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /*! only the first producer since the last drain needs to wake the I/O thread */
+    if(__atomic_exchange_n(&p_async->wake_pending, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        uint64_t one = 1;
+
+        if(write(p_async->wake_fd, &one, sizeof(one)) < 0) { /* already signalled */ }
+    }
+
+    return CPI_OK;
+}
+
+/*! utility function to check whether the ring has a published entry waiting, and its class has room for it */
+static int async_ring_ready(cpi_async *p_async)
+{
+    ring_cell *p_cell = &p_async->ring[p_async->ring_head % CPI_MAX_PENDING];
+
+    if(__atomic_load_n(&p_cell->seq, __ATOMIC_ACQUIRE) != p_async->ring_head + 1) { return 0; }
+
+    return p_async->classes[p_cell->entry.p_cmd->priority].count < CPI_MAX_PENDING;
+}
+
+static void async_ring_drain(struct _cpi_t *p_cpi, cpi_async *p_async)
+{
+    while(async_ring_ready(p_async))
+    {
+        ring_cell *p_cell = &p_async->ring[p_async->ring_head % CPI_MAX_PENDING];
+
+        async_entry entry = p_cell->entry;
+
+        /*! the command is finished right away if it cannot meet its deadline */
+        if(async_enqueue(p_async, &entry) == CPI_BUSY)
+        {
+            entry.p_cmd->status = CPI_BUSY;
+
+            async_finish(p_cpi, &entry);
+        }
+
+        /*! hand the cell back to producers, for the next lap */
+        __atomic_store_n(&p_cell->seq, p_async->ring_head + CPI_MAX_PENDING, __ATOMIC_RELEASE);
+
+        p_async->ring_head++;
+    }
+
+    return;
+}
+
+static void *async_thread(void *arg)
+{
+    struct _cpi_t *p_cpi = (struct _cpi_t*)arg;
+
+    cpi_async *p_async = (cpi_async*)p_cpi->async;
+
+    while(!__atomic_load_n(&p_async->stop, __ATOMIC_ACQUIRE))
+    {
+        struct epoll_event ev[3];
+
+        /*! acknowledge wake-ups before draining, so later submissions signal again */
+        {
+            uint64_t count = 0;
+
+            __atomic_store_n(&p_async->wake_pending, 0, __ATOMIC_SEQ_CST);
+
+            if(read(p_async->wake_fd, &count, sizeof(count)) < 0) { /* not signalled */ }
+        }
+
+        async_ring_drain(p_cpi, p_async);
+
+        async_run(p_cpi, p_async);
+
+        /*! completions made room for entries still in the ring */
+        if(async_ring_ready(p_async)) { continue; }
+
+        /*! errors (e.g. EINTR) simply cause another pass */
+        epoll_wait(p_async->epoll_fd, ev, 3, -1);
+    }
+
+    return 0;
+}
+
+int cpi_cmd_out_count(int cmd)
+{
+    if( (cmd <= CPI_CMD_UNKNOWN) || (cmd >= (int)(sizeof(cmd_descs)/sizeof(cmd_descs[0]))) ) { return 0; }
+
+    /*! TIME and CKEY return through value */
+    if(cmd_descs[cmd].req_flags & RES_VALUE) { return 0; }
+
+    return cmd_descs[cmd].res_count;
+}
+
+int cpi_validate_cmd(cpi_cmd_t *p_cmd)
+{
+    const cmd_desc *p_desc = 0;
+
+    int cur_resp = 0;
+
+    /*! sanity check - known command */
+    if( (p_cmd->cmd <= CPI_CMD_UNKNOWN) || (p_cmd->cmd >= (int)(sizeof(cmd_descs)/sizeof(cmd_descs[0]))) ) { return CPI_NOTIMPL; }
+
+    p_desc = &cmd_descs[p_cmd->cmd];
+
+    /*! sanity check - priority class */
+    if( (p_cmd->priority < 0) || (p_cmd->priority >= CPI_PRIORITY_COUNT) ) { return CPI_INVALID_PARAM; }
+
+    /*! sanity check - request data */
+    if( (p_desc->req_flags & REQ_RAND_DATA) && (p_cmd->rand_data == 0) ) { return CPI_INVALID_PARAM; }
+
+    /*! sanity check - caller-owned output buffers (TIME and CKEY return through value) */
+    if(p_desc->req_flags & RES_VALUE) { return CPI_OK; }
+
+    for(cur_resp = 0; cur_resp < p_desc->res_count; cur_resp++)
+    {
+        int min_size = (p_desc->res[cur_resp].raw_size > 0) ? p_desc->res[cur_resp].raw_size : 1;
+
+        if( (p_cmd->out[cur_resp] == 0) || (p_cmd->out_size[cur_resp] < min_size) ) { return CPI_INVALID_PARAM; }
+    }
+
+    return CPI_OK;
+}
+
+/*! utility function to append a base64 encoded request argument, followed by LF */
+static void async_append_arg(cpi_async *p_async, void *data, int size)
+{
+    int len = CPI_UTIL_MAX_REQUEST_STR_SIZE;
+
+    /*! arguments are at most CPI_RNDX_SIZE bytes, so they always fit */
+    cpi_b64_encode(data, size, &p_async->req[p_async->req_len], &len);
+
+    p_async->req_len += len;
+    p_async->req[p_async->req_len++] = '\n';
+
+    return;
+}
+
+/*! utility function to assemble the request for the command in progress */
+static void async_begin_cmd(cpi_async *p_async)
+{
+    cpi_cmd_t *p_cmd = async_cur_cmd(p_async);
+
+    const cmd_desc *p_desc = &cmd_descs[p_cmd->cmd];
+
+    p_async->req_len = strlen(p_desc->cmd);
+    p_async->req_pos = 0;
+
+    memcpy(p_async->req, p_desc->cmd, p_async->req_len);
+
+    /*! optionally, append associated request data */
+    if(p_desc->req_flags & REQ_KEY_ID) { async_append_arg(p_async, &p_cmd->key_id, sizeof(p_cmd->key_id)); }
+    if(p_desc->req_flags & REQ_RAND_DATA) { async_append_arg(p_async, p_cmd->rand_data, CPI_RNDX_SIZE); }
+    if(p_desc->req_flags & REQ_VALUE) { async_append_arg(p_async, &p_cmd->value, sizeof(p_cmd->value)); }
+
+    p_async->req[p_async->req_len++] = 0x0D;
+
+    /*! wake up CP, once per session */
+    p_async->state = p_async->awake ? ST_REQ_WRITE : ST_WAKE_WRITE;
+
+    return;
+}
+
+/*! utility function to write a single character, respecting the pacing delay (returns 1 if written, 0 if it would block, -1 on error) */
+static int async_write_char(struct _cpi_t *p_cpi, cpi_async *p_async, char c)
+{
+    uint64_t now = async_now();
+
+    /*! too early, wait for the pacing timer */
+    if(now < p_async->next_write)
+    {
+        async_set_serial_events(p_cpi, p_async, 0);
+        async_set_timer(p_async, p_async->next_write);
+
+        return 0;
+    }
+
+    for(;;)
+    {
+        int bytes_written = write(p_cpi->serial_file, &c, sizeof(char));
+
+        if(bytes_written == sizeof(char))
+        {
+            p_async->next_write = now + p_async->write_delay_ns;
+            p_async->read_deadline = now + READ_TIMEOUT_NS;
+
+            return 1;
+        }
+
+        if( (bytes_written < 0) && (errno == EINTR) ) { continue; }
+
+        /*! device is busy, wait until it is writable */
+        if( (bytes_written < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) )
+        {
+            async_set_timer(p_async, 0);
+            async_set_serial_events(p_cpi, p_async, EPOLLOUT);
+
+            return 0;
+        }
+
+        /*! handle write failure */
+        return -1;
+    }
+}
+
+static int async_step(struct _cpi_t *p_cpi, cpi_async *p_async)
+{
+    int ret = 0;
+
+    switch(p_async->state)
+    {
+        case ST_IDLE:
+        {
+            async_apply_delay(p_async);
+
+            /*! nothing left to do, the session ends here */
+            if(!async_next(p_async))
+            {
+                p_async->awake = 0;
+
+                async_set_serial_events(p_cpi, p_async, 0);
+                async_set_timer(p_async, 0);
+
+                return 0;
+            }
+
+            /*! too late already, leave the CP to commands which can still make it */
+            if( (p_async->active.p_cmd->deadline_ms != 0) && (p_async->active_start > p_async->active.submitted + p_async->active.p_cmd->deadline_ms*1000000ULL) )
+            {
+                async_complete(p_cpi, p_async, CPI_BUSY);
+                return 1;
+            }
+
+            async_begin_cmd(p_async);
+        }
+        return 1;
+
+        case ST_WAKE_WRITE:
+        {
+            ret = async_write_char(p_cpi, p_async, '!');
+
+            if(ret == 0) { return 0; }
+
+            if(ret < 0) { async_complete(p_cpi, p_async, CPI_FAIL); return 1; }
+
+            p_async->state = ST_WAKE_READ;
+        }
+        return 1;
+
+        case ST_REQ_WRITE:
+        {
+            ret = async_write_char(p_cpi, p_async, p_async->req[p_async->req_pos]);
+
+            if(ret == 0) { return 0; }
+
+            if(ret < 0) { async_complete(p_cpi, p_async, CPI_FAIL); return 1; }
+
+            /*! request complete, read cmd_ack (if any) and responses */
+            if(++p_async->req_pos == p_async->req_len)
+            {
+                if(cmd_descs[async_cur_cmd(p_async)->cmd].cmd_ack != 0)
+                {
+                    p_async->state = ST_ACK;
+                    p_async->pos = 0;
+                }
+                else
+                {
+                    async_begin_line(p_cpi, p_async, 0);
+                }
+            }
+        }
+        return 1;
+
+        default:
+        {
+            char c = '\0';
+
+            int bytes_read = read(p_cpi->serial_file, &c, sizeof(char));
+
+            if(bytes_read == sizeof(char))
+            {
+                p_async->read_deadline = async_now() + READ_TIMEOUT_NS;
+
+                async_read_char(p_cpi, p_async, c);
+
+                return 1;
+            }
+
+            if( (bytes_read < 0) && (errno == EINTR) ) { return 1; }
+
+            /*! nothing to read yet, wait until the device is readable, or until the CP has been silent for too long */
+            if( (bytes_read < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) )
+            {
+                if(async_now() >= p_async->read_deadline) { async_complete(p_cpi, p_async, CPI_FAIL); return 1; }
+
+                async_set_timer(p_async, p_async->read_deadline);
+                async_set_serial_events(p_cpi, p_async, EPOLLIN);
+
+                return 0;
+            }
+
+            /*! handle read failure */
+            async_complete(p_cpi, p_async, CPI_FAIL);
+        }
+        return 1;
+    }
+}
+
+static void async_read_char(struct _cpi_t *p_cpi, cpi_async *p_async, char c)
+{
+    cpi_cmd_t *p_cmd = async_cur_cmd(p_async);
+
+    switch(p_async->state)
+    {
+        case ST_WAKE_READ:
+            /*! the EOF character of the last exchange may still be ahead of the answer */
+            if(p_async->eof_pending && (c == (char)0x0D)) { p_async->eof_pending = 0; return; }
+
+            /*! keep waking until the CP answers with a sync character */
+            p_async->state = (c == '?') ? ST_REQ_WRITE : ST_WAKE_WRITE;
+            p_async->awake = (c == '?');
+            return;
+
+        case ST_EOF:
+            /*! sync characters answering the request may still come first; the EOF 0x0D character itself is not checked */
+            if(c != '?') { async_complete(p_cpi, p_async, CPI_OK); }
+            return;
+    }
+
+    /*! ignore sync character */
+    if(c == '?') { return; }
+
+    /*! EOF character of an exchange which was completed without waiting for it */
+    if(p_async->eof_pending)
+    {
+        p_async->eof_pending = 0;
+
+        if(c == (char)0x0D) { return; }
+    }
+
+    if(p_async->state == ST_SKIP)
+    {
+        if( (c == (char)0x0D) || (++p_async->pos >= p_async->limit) ) { async_begin_line(p_cpi, p_async, p_async->cur_resp + 1); }
+
+        return;
+    }
+
+    if(p_async->pos < (int)sizeof(p_async->prefix)) { p_async->prefix[p_async->pos] = c; }
+
+    /*! detect FAIL result: the CP turned the command down, but the exchange itself went well, up to the EOF character still to come */
+    if( (p_async->pos == 3) && (strncmp(p_async->prefix, "FAIL", 4) == 0) )
+    {
+        p_async->refused = 1;
+        p_async->eof_pending = 1;
+
+        async_complete(p_cpi, p_async, CPI_FAIL);
+        return;
+    }
+
+    if(p_async->state == ST_ACK)
+    {
+        if(c == (char)0x0D) { async_complete(p_cpi, p_async, CPI_FAIL); return; }
+
+        if(++p_async->pos < 4) { return; }
+
+        /*! AUTHCOUNT comes in place of the ack, and is told from a bad ack once all of it is in */
+        if(strncmp(p_async->prefix, "AUTHCOUNT", p_async->pos) == 0)
+        {
+            if(p_async->pos == 9) { async_complete(p_cpi, p_async, CPI_ACCESS_DENIED); }
+
+            return;
+        }
+
+        if(strncmp(p_async->prefix, cmd_descs[p_cmd->cmd].cmd_ack, 4) != 0) { async_complete(p_cpi, p_async, CPI_FAIL); return; }
+
+        async_begin_line(p_cpi, p_async, 0);
+
+        return;
+    }
+
+    /*! detect failure due to auth count being exceeded */
+    if( (p_async->pos == 8) && (strncmp(p_async->prefix, "AUTHCOUNT", 9) == 0) ) { async_complete(p_cpi, p_async, CPI_ACCESS_DENIED); return; }
+
+    if(p_async->state == ST_DATA)
+    {
+        /*! handle stop character */
+        if(c == (char)0x0D) { async_end_line(p_cpi, p_async); return; }
+
+        /*! decode straight into the destination, stopping at the first error (the rest of the line is still consumed) */
+        if(CPI_SUCCESS(p_async->ret)) { p_async->ret = cpi_b64_decode_update(&p_async->dec, &c, 1); }
+
+        if(++p_async->pos >= p_async->limit) { async_end_line(p_cpi, p_async); }
+
+        return;
+    }
+
+    /*! ST_STR */
+    {
+        int size = 0;
+
+        char *str = (char*)async_res_data(p_cmd, p_async->cur_resp, &size);
+
+        /*! handle stop character, appending null terminator if there is room */
+        if(c == (char)0x0D)
+        {
+            if(p_async->pos < p_async->limit) { str[p_async->pos++] = '\0'; }
+
+            async_end_line(p_cpi, p_async);
+
+            return;
+        }
+
+        str[p_async->pos] = c;
+
+        if(++p_async->pos >= p_async->limit) { async_end_line(p_cpi, p_async); }
+    }
+
+    return;
+}
+
+static void async_begin_line(struct _cpi_t *p_cpi, cpi_async *p_async, int cur_resp)
+{
+    cpi_cmd_t *p_cmd = async_cur_cmd(p_async);
+
+    const cmd_desc *p_desc = &cmd_descs[p_cmd->cmd];
+
+    int size = 0;
+
+    void *data = 0;
+
+    /*! all responses read, retrieve EOF character */
+    if(cur_resp >= p_desc->res_count)
+    {
+#if !defined(CNPLATFORM_falconwing) && !defined(CNPLATFORM_silvermoon)
+        /*! the CP is done once the EOF character is out, so the next request can start on its heels
+         *  (DOWN and RSET answer with nothing else, so there is nothing to overlap: their EOF character is read) */
+        if( p_async->pipelined && ((p_desc->res_count > 0) || (p_desc->cmd_ack != 0)) )
+        {
+            p_async->eof_pending = 1;
+            p_async->next_write = async_now();
+
+            async_complete(p_cpi, p_async, CPI_OK);
+
+            return;
+        }
+
+        p_async->state = ST_EOF;
+#else
+        /*! the CP is done, so the next request can start on its heels */
+        if(p_async->pipelined) { p_async->next_write = async_now(); }
+
+        async_complete(p_cpi, p_async, CPI_OK);
+#endif
+        return;
+    }
+
+    data = async_res_data(p_cmd, cur_resp, &size);
+
+    p_async->cur_resp = cur_resp;
+    p_async->pos = 0;
+    p_async->ret = CPI_OK;
+
+    if(p_desc->res[cur_resp].raw_size > 0)
+    {
+        /*! base64 line, plus the trailing LF (skipped as whitespace) */
+        cpi_b64_decode_begin(&p_async->dec, data, size, CPI_B64_SKIP_WS);
+
+        p_async->limit = p_desc->res[cur_resp].str_size + 1;
+        p_async->state = ST_DATA;
+    }
+    else
+    {
+        /*! plain string, leaving room for the null terminator */
+        p_async->limit = p_desc->res[cur_resp].str_size + 1;
+
+        if(p_async->limit > size) { p_async->limit = size; }
+
+        p_async->state = ST_STR;
+    }
+
+    return;
+}
+
+static void async_end_line(struct _cpi_t *p_cpi, cpi_async *p_async)
+{
+    cpi_cmd_t *p_cmd = async_cur_cmd(p_async);
+
+    const cmd_desc *p_desc = &cmd_descs[p_cmd->cmd];
+
+    int cur_resp = p_async->cur_resp;
+
+    if(p_async->state == ST_DATA)
+    {
+        int size = 0;
+
+        /*! invalid or oversized data */
+        if(CPI_FAILED(p_async->ret) || CPI_FAILED(cpi_b64_decode_end(&p_async->dec, &size))) { async_complete(p_cpi, p_async, CPI_FAIL); return; }
+
+        if(size != p_desc->res[cur_resp].raw_size) { async_complete(p_cpi, p_async, CPI_FAIL); return; }
+
+        p_async->res_size[cur_resp] = size;
+    }
+    else
+    {
+        int size = 0;
+
+        char *str = (char*)async_res_data(p_cmd, cur_resp, &size);
+
+        p_async->res_size[cur_resp] = p_async->pos;
+
+        /*! destination filled before the stop character, discard the remainder of the string */
+        if( (p_async->pos == size) && (str[size-1] != '\0') )
+        {
+            str[size-1] = '\0';
+
+            if(p_desc->res[cur_resp].str_size + 1 > size)
+            {
+                p_async->limit = p_desc->res[cur_resp].str_size + 1 - size;
+                p_async->pos = 0;
+                p_async->state = ST_SKIP;
+
+                return;
+            }
+        }
+    }
+
+    async_begin_line(p_cpi, p_async, cur_resp + 1);
+
+    return;
+}
+
+/*! utility function to copy the result of a finished command to an identical one which shared its exchange */
+static void async_share(const cpi_cmd_t *p_src, cpi_cmd_t *p_dst)
+{
+    const cmd_desc *p_desc = &cmd_descs[p_src->cmd];
+
+    int cur_resp;
+
+    p_dst->status = p_src->status;
+
+    if(CPI_FAILED(p_src->status)) { return; }
+
+    if(p_desc->req_flags & RES_VALUE) { p_dst->value = p_src->value; return; }
+
+    for(cur_resp = 0; cur_resp < p_desc->res_count; cur_resp++)
+    {
+        memcpy(p_dst->out[cur_resp], p_src->out[cur_resp], p_src->out_size[cur_resp]);
+
+        p_dst->out_size[cur_resp] = p_src->out_size[cur_resp];
+    }
+
+    return;
+}
+
+/*! utility function to call the callback of a finished command, and wake its blocked caller */
+static void async_finish(struct _cpi_t *p_cpi, const async_entry *p_entry)
+{
+    if(p_entry->callback != 0) { p_entry->callback(p_cpi, p_entry->p_cmd); }
+
+    /*! wake the blocked caller; the command may be gone as soon as the lock is released */
+    if(p_entry->p_waiter != 0)
+    {
+        pthread_mutex_lock(&p_entry->p_waiter->lock);
+
+        p_entry->p_waiter->pending--;
+
+        pthread_cond_broadcast(&p_entry->p_waiter->cond);
+        pthread_mutex_unlock(&p_entry->p_waiter->lock);
+    }
+
+    return;
+}
+
+static void async_complete(struct _cpi_t *p_cpi, cpi_async *p_async, int status)
+{
+    async_entry entry = p_async->active;
+
+    /*! a FAIL answer is the CP's verdict on the command; only framing errors, bad acks and timeouts tell of an overrun link */
+    int cur_resp = 0, priority = entry.p_cmd->priority, exchanged = CPI_SUCCESS(status) || p_async->refused, link_failed = (status == CPI_FAIL) && !p_async->refused;
+
+    p_async->refused = 0;
+
+    /*! callbacks run in completion order */
+    if(p_async->deferred.p_cmd != 0) { async_deliver(p_cpi, p_async); }
+
+    p_async->active.p_cmd = 0;
+    p_async->count--;
+
+    /*! back off after an exchange failed, then creep back to the base delay, an eighth of the way per successful exchange */
+    if(link_failed)
+    {
+        p_async->write_delay_ns = (p_async->write_delay_ns < WRITE_DELAY_MIN_NS) ? WRITE_DELAY_MIN_NS : 2*p_async->write_delay_ns;
+
+        if(p_async->write_delay_ns > WRITE_DELAY_MAX_NS) { p_async->write_delay_ns = (p_async->base_delay_ns > WRITE_DELAY_MAX_NS) ? p_async->base_delay_ns : WRITE_DELAY_MAX_NS; }
+    }
+    else if(exchanged && (p_async->write_delay_ns > p_async->base_delay_ns))
+    {
+        p_async->write_delay_ns -= (p_async->write_delay_ns - p_async->base_delay_ns + 7) / 8;
+    }
+
+    pthread_mutex_lock(&p_async->metrics_lock);
+
+    if(status == CPI_BUSY) { p_async->metrics.rejected[priority]++; } else { p_async->metrics.completed[priority]++; }
+
+    if(link_failed) { p_async->metrics.backoffs++; }
+
+    p_async->metrics.write_delay_us = (uint32_t)(p_async->write_delay_ns / 1000);
+
+    pthread_mutex_unlock(&p_async->metrics_lock);
+
+    /*! learn the exchange time, for admission of later commands (moving average, weight 1/4) */
+    if(CPI_SUCCESS(status))
+    {
+        uint64_t sample = async_now() - p_async->active_start;
+
+        p_async->est_ns[entry.p_cmd->cmd] = p_async->est_ns[entry.p_cmd->cmd] - p_async->est_ns[entry.p_cmd->cmd]/4 + sample/4;
+    }
+
+    /*! report number of bytes written to each output buffer */
+    if(CPI_SUCCESS(status) && !(cmd_descs[entry.p_cmd->cmd].req_flags & RES_VALUE))
+    {
+        for(cur_resp = 0; cur_resp < cmd_descs[entry.p_cmd->cmd].res_count; cur_resp++)
+        {
+            entry.p_cmd->out_size[cur_resp] = p_async->res_size[cur_resp];
+        }
+    }
+
+    /*! start a new session after a failed exchange, to resynchronize with the CP (a rejected command never reached it) */
+    if(!exchanged && (status != CPI_BUSY)) { p_async->awake = 0; }
+
+    p_async->state = ST_IDLE;
+
+    entry.p_cmd->status = status;
+
+    p_async->deferred = entry;
+
+    /*! let the next request get under way first, so callbacks (and whatever formatting they do) overlap its transfer */
+    if(p_async->pipelined && CPI_SUCCESS(status) && (p_async->count > 0)) { return; }
+
+    async_deliver(p_cpi, p_async);
+
+    return;
+}
+
+static void async_deliver(struct _cpi_t *p_cpi, cpi_async *p_async)
+{
+    async_entry entry = p_async->deferred;
+
+    p_async->deferred.p_cmd = 0;
+
+    /*! hand the result to attached commands first, since the leader may be gone once it is finished */
+    {
+        int slot = entry.follower;
+
+        while(slot != -1)
+        {
+            async_share(entry.p_cmd, p_async->followers[slot].p_cmd);
+
+            slot = p_async->followers[slot].follower;
+        }
+    }
+
+    async_finish(p_cpi, &entry);
+
+    /*! release each follower before finishing it, so its callback may submit again */
+    while(entry.follower != -1)
+    {
+        async_entry follower = p_async->followers[entry.follower];
+
+        p_async->followers[entry.follower].follower = p_async->free_follower;
+        p_async->free_follower = entry.follower;
+
+        entry.follower = follower.follower;
+
+        async_finish(p_cpi, &follower);
+    }
+
+    return;
+}
+
+static void async_set_serial_events(struct _cpi_t *p_cpi, cpi_async *p_async, int events)
+{
+    struct epoll_event ev;
+
+    if( ((events == 0) ? -1 : events) == p_async->serial_events ) { return; }
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = events;
+
+    /*! the device is unregistered while idle, so hangups are not reported to an idle event loop */
+    if(events == 0)
+    {
+        epoll_ctl(p_async->epoll_fd, EPOLL_CTL_DEL, p_cpi->serial_file, &ev);
+
+        p_async->serial_events = -1;
+
+        return;
+    }
+
+    epoll_ctl(p_async->epoll_fd, (p_async->serial_events == -1) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, p_cpi->serial_file, &ev);
+
+    p_async->serial_events = events;
+
+    return;
+}
+
+static void async_set_timer(cpi_async *p_async, uint64_t when)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+
+    its.it_value.tv_sec = when / 1000000000ULL;
+    its.it_value.tv_nsec = when % 1000000000ULL;
+
+    timerfd_settime(p_async->timer_fd, TFD_TIMER_ABSTIME, &its, 0);
+
+    return;
+}
@@ -0,0 +1,634 @@
+/*
+ * cp_base64.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the base64 encoder and decoder. The streaming
+ * front end handles padding, whitespace and partial groups one character at
+ * a time, and hands runs of complete groups to the selected engine. Engines
+ * only ever process input they can fully validate, and stop at the first
+ * group they can not handle, leaving it to the front end.
+ */
+
+#include "cp_base64.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define CPI_B64_HAVE_X86
+#include <immintrin.h>
+#endif
+
+/*! \name decode table values, other than 6 bit data */
+/*! \{ */
+#define DEC_WS      0x80    /*!< whitespace */
+#define DEC_PAD     0x81    /*!< padding character */
+#define DEC_BAD     0xFF    /*!< invalid character */
+/*! \} */
+
+/*! encode function, returns # bytes consumed (a multiple of 3), writing 4 characters per 3 bytes */
+typedef int (*b64_enc_fn)(const uint8_t *data, int size, char *str, int len);
+
+/*! decode function, returns # characters consumed (a multiple of 4), writing 3 bytes per 4 characters */
+typedef int (*b64_dec_fn)(const char *str, int len, uint8_t *data, int size);
+
+/*! engine descriptor */
+typedef struct _b64_engine
+{
+    int        id;      /*!< CPI_B64_ENGINE_ value */
+    b64_enc_fn enc;     /*!< bulk encode */
+    b64_dec_fn dec;     /*!< bulk decode */
+}
+b64_engine;
+
+static const char b64_alphabet[64] =
+{
+    'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P',
+    'Q','R','S','T','U','V','W','X','Y','Z','a','b','c','d','e','f',
+    'g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v',
+    'w','x','y','z','0','1','2','3','4','5','6','7','8','9','+','/'
+};
+
+/*! character to 6 bit value, or DEC_ code */
+static const uint8_t b64_dec_table[256] =
+{
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0x80,0x80,0xFF,0xFF,0x80,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0x80,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0x3E,0xFF,0xFF,0xFF,0x3F,
+    0x34,0x35,0x36,0x37,0x38,0x39,0x3A,0x3B,0x3C,0x3D,0xFF,0xFF,0xFF,0x81,0xFF,0xFF,
+    0xFF,0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0A,0x0B,0x0C,0x0D,0x0E,
+    0x0F,0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0x1A,0x1B,0x1C,0x1D,0x1E,0x1F,0x20,0x21,0x22,0x23,0x24,0x25,0x26,0x27,0x28,
+    0x29,0x2A,0x2B,0x2C,0x2D,0x2E,0x2F,0x30,0x31,0x32,0x33,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF
+};
+
+/*! engine in use, resolved on first use */
+static const b64_engine *cur_engine = 0;
+
+/*! utility function to resolve the engine in use */
+static const b64_engine *b64_get_engine(void);
+
+/*! utility function to emit the bytes held by a partial (padded or unpadded) final group */
+static int b64_decode_partial(cpi_b64_state *p_state);
+
+/******************************************************************************
+ * scalar engine
+ *****************************************************************************/
+
+static int enc_scalar(const uint8_t *data, int size, char *str, int len)
+{
+    int v = 0;
+
+    for(; (size - v >= 3) && (len >= 4); v += 3, len -= 4)
+    {
+        uint32_t w = ((uint32_t)data[v+0] << 16) | ((uint32_t)data[v+1] << 8) | (uint32_t)data[v+2];
+
+        *str++ = b64_alphabet[(w >> 18) & 0x3F];
+        *str++ = b64_alphabet[(w >> 12) & 0x3F];
+        *str++ = b64_alphabet[(w >>  6) & 0x3F];
+        *str++ = b64_alphabet[(w >>  0) & 0x3F];
+    }
+
+    return v;
+}
+
+static int dec_scalar(const char *str, int len, uint8_t *data, int size)
+{
+    int v = 0;
+
+    for(; (len - v >= 4) && (size >= 3); v += 4, size -= 3)
+    {
+        uint32_t a = b64_dec_table[(uint8_t)str[v+0]];
+        uint32_t b = b64_dec_table[(uint8_t)str[v+1]];
+        uint32_t c = b64_dec_table[(uint8_t)str[v+2]];
+        uint32_t d = b64_dec_table[(uint8_t)str[v+3]];
+
+        /*! whitespace, padding or invalid characters are left to the front end */
+        if((a | b | c | d) & 0xC0) { break; }
+
+        uint32_t w = (a << 18) | (b << 12) | (c << 6) | d;
+
+        *data++ = (uint8_t)(w >> 16);
+        *data++ = (uint8_t)(w >> 8);
+        *data++ = (uint8_t)(w >> 0);
+    }
+
+    return v;
+}
+
+/******************************************************************************
+ * x86 engines (SSSE3 and AVX2), based on the pshufb lookup technique
+ *****************************************************************************/
+
+#ifdef CPI_B64_HAVE_X86
+
+__attribute__((target("ssse3")))
+static __m128i enc_lookup_ssse3(__m128i in)
+{
+    /*! split 3 bytes into 4 6 bit indices, one per byte */
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    __m128i idx = _mm_or_si128(t1, t3);
+
+    /*! map each index range to its ASCII offset */
+    __m128i rng = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    __m128i lt26 = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+
+    rng = _mm_or_si128(rng, _mm_and_si128(lt26, _mm_set1_epi8(13)));
+
+    __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                  '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    return _mm_add_epi8(_mm_shuffle_epi8(shift, rng), idx);
+}
+
+__attribute__((target("ssse3")))
+static int dec_lookup_ssse3(__m128i in, __m128i *p_out)
+{
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0F));
+    __m128i lo = _mm_and_si128(in, _mm_set1_epi8(0x0F));
+
+    /*! any character outside the alphabet has a common bit in both lookups */
+    __m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo), _mm_shuffle_epi8(lut_hi, hi));
+
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xFFFF) { return 0; }
+
+    /*! translate ASCII to 6 bit values */
+    __m128i eq_2f = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    __m128i val = _mm_add_epi8(in, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi)));
+
+    /*! pack 4 x 6 bits into 3 bytes */
+    val = _mm_maddubs_epi16(val, _mm_set1_epi32(0x01400140));
+    val = _mm_madd_epi16(val, _mm_set1_epi32(0x00011000));
+
+    *p_out = _mm_shuffle_epi8(val, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+    return 1;
+}
+
+__attribute__((target("ssse3")))
+static int enc_ssse3(const uint8_t *data, int size, char *str, int len)
+{
+    int v = 0;
+
+    /*! each step reads 16 bytes, of which 12 are encoded */
+    for(; (size - v >= 16) && (len >= 16); v += 12, str += 16, len -= 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)&data[v]);
+
+        _mm_storeu_si128((__m128i*)str, enc_lookup_ssse3(in));
+    }
+
+    return v + enc_scalar(&data[v], size - v, str, len);
+}
+
+__attribute__((target("ssse3")))
+static int dec_ssse3(const char *str, int len, uint8_t *data, int size)
+{
+    int v = 0;
+
+    /*! each step writes 16 bytes, of which 12 are decoded */
+    for(; (len - v >= 16) && (size >= 16); v += 16, data += 12, size -= 12)
+    {
+        __m128i out;
+
+        if(!dec_lookup_ssse3(_mm_loadu_si128((const __m128i*)&str[v]), &out)) { break; }
+
+        _mm_storeu_si128((__m128i*)data, out);
+    }
+
+    return v + dec_scalar(&str[v], len - v, data, size);
+}
+
+__attribute__((target("avx2")))
+static int enc_avx2(const uint8_t *data, int size, char *str, int len)
+{
+    int v = 0;
+
+    const __m256i shuf = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                         10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    /*! each step reads 28 bytes (12 per lane, lanes offset by 12), of which 24 are encoded */
+    for(; (size - v >= 28) && (len >= 32); v += 24, str += 32, len -= 32)
+    {
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)&data[v])),
+                                             _mm_loadu_si128((const __m128i*)&data[v+12]), 1);
+
+        in = _mm256_shuffle_epi8(in, shuf);
+
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i idx = _mm256_or_si256(t1, t3);
+
+        __m256i rng = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        __m256i lt26 = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+
+        rng = _mm256_or_si256(rng, _mm256_and_si256(lt26, _mm256_set1_epi8(13)));
+
+        _mm256_storeu_si256((__m256i*)str, _mm256_add_epi8(_mm256_shuffle_epi8(shift, rng), idx));
+    }
+
+    return v + enc_ssse3(&data[v], size - v, str, len);
+}
+
+__attribute__((target("avx2")))
+static int dec_avx2(const char *str, int len, uint8_t *data, int size)
+{
+    int v = 0;
+
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    /*! each step writes 32 bytes, of which 24 are decoded */
+    for(; (len - v >= 32) && (size >= 32); v += 32, data += 24, size -= 24)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i*)&str[v]);
+
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0F));
+        __m256i lo = _mm256_and_si256(in, _mm256_set1_epi8(0x0F));
+
+        __m256i bad = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo), _mm256_shuffle_epi8(lut_hi, hi));
+
+        if(!_mm256_testz_si256(bad, bad)) { break; }
+
+        __m256i eq_2f = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        __m256i val = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi)));
+
+        val = _mm256_maddubs_epi16(val, _mm256_set1_epi32(0x01400140));
+        val = _mm256_madd_epi16(val, _mm256_set1_epi32(0x00011000));
+        val = _mm256_shuffle_epi8(val, pack);
+
+        /*! gather the 12 decoded bytes of each lane into the low 24 bytes */
+        val = _mm256_permutevar8x32_epi32(val, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+        _mm256_storeu_si256((__m256i*)data, val);
+    }
+
+    return v + dec_ssse3(&str[v], len - v, data, size);
+}
+
+#endif
+
+/******************************************************************************
+ * engine selection
+ *****************************************************************************/
+
+static const b64_engine engines[] =
+{
+    { CPI_B64_ENGINE_SCALAR, enc_scalar, dec_scalar },
+#ifdef CPI_B64_HAVE_X86
+    { CPI_B64_ENGINE_SSSE3,  enc_ssse3,  dec_ssse3  },
+    { CPI_B64_ENGINE_AVX2,   enc_avx2,   dec_avx2   },
+#endif
+};
+
+/*! utility function to determine whether the CPU supports the specified engine */
+static int b64_cpu_supports(int engine)
+{
+    switch(engine)
+    {
+        case CPI_B64_ENGINE_SCALAR:
+            return 1;
+#ifdef CPI_B64_HAVE_X86
+        case CPI_B64_ENGINE_SSSE3:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("ssse3");
+        case CPI_B64_ENGINE_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    return 0;
+}
+
+int cpi_b64_select(int engine)
+{
+    int v;
+
+    /*! pick the last (best) supported engine */
+    if(engine == CPI_B64_ENGINE_AUTO)
+    {
+        for(v = (int)(sizeof(engines)/sizeof(engines[0])) - 1; v >= 0; v--)
+        {
+            if(b64_cpu_supports(engines[v].id)) { cur_engine = &engines[v]; return CPI_OK; }
+        }
+
+        return CPI_FAIL;
+    }
+
+    for(v = 0; v < (int)(sizeof(engines)/sizeof(engines[0])); v++)
+    {
+        if(engines[v].id != engine) { continue; }
+
+        if(!b64_cpu_supports(engine)) { return CPI_NOTIMPL; }
+
+        cur_engine = &engines[v];
+
+        return CPI_OK;
+    }
+
+    return CPI_NOTIMPL;
+}
+
+int cpi_b64_engine(void)
+{
+    return b64_get_engine()->id;
+}
+
+static const b64_engine *b64_get_engine(void)
+{
+    /*! a racing first use resolves to the same engine, so no locking is required */
+    if(cur_engine == 0) { cpi_b64_select(CPI_B64_ENGINE_AUTO); }
+
+    return cur_engine;
+}
+
+/******************************************************************************
+ * encode
+ *****************************************************************************/
+
+int cpi_b64_encode(const void *data, int size, char *str, int *p_len)
+{
+    cpi_b64_state state;
+
+    /*! sanity check - null ptr */
+    if( (str == 0) || (p_len == 0) || ((data == 0) && (size != 0)) ) { return CPI_INVALID_PARAM; }
+
+    /*! check the whole output fits up front, so nothing is written on failure */
+    if(CPI_B64_ENCODED_SIZE(size) > *p_len) { return CPI_OUT_OF_MEMORY; }
+
+    cpi_b64_encode_begin(&state, str, *p_len);
+    cpi_b64_encode_update(&state, data, size);
+
+    return cpi_b64_encode_end(&state, p_len);
+}
+
+void cpi_b64_encode_begin(cpi_b64_state *p_state, char *str, int len)
+{
+    memset(p_state, 0, sizeof(cpi_b64_state));
+
+    p_state->data = (uint8_t*)str;
+    p_state->size = len;
+}
+
+int cpi_b64_encode_update(cpi_b64_state *p_state, const void *data, int size)
+{
+    const uint8_t *src = (const uint8_t*)data;
+
+    if(CPI_FAILED(p_state->error)) { return p_state->error; }
+
+    /*! complete a pending group first */
+    while( (p_state->quad != 0) && (size > 0) )
+    {
+        p_state->pending[p_state->quad++] = *src++;
+        size--;
+
+        if(p_state->quad == 3)
+        {
+            if(p_state->size - p_state->used < 4) { return p_state->error = CPI_OUT_OF_MEMORY; }
+
+            enc_scalar(p_state->pending, 3, (char*)&p_state->data[p_state->used], 4);
+
+            p_state->used += 4;
+            p_state->quad = 0;
+        }
+    }
+
+    /*! bulk encode complete groups */
+    {
+        int done = b64_get_engine()->enc(src, size, (char*)&p_state->data[p_state->used], p_state->size - p_state->used);
+
+        p_state->used += (done / 3) * 4;
+
+        src += done;
+        size -= done;
+    }
+
+    /*! a complete group remains only if the output is full */
+    if(size >= 3) { return p_state->error = CPI_OUT_OF_MEMORY; }
+
+    /*! keep the remainder for the next update */
+    while(size-- > 0) { p_state->pending[p_state->quad++] = *src++; }
+
+    return CPI_OK;
+}
+
+int cpi_b64_encode_end(cpi_b64_state *p_state, int *p_len)
+{
+    if(CPI_FAILED(p_state->error)) { return p_state->error; }
+
+    /*! encode the final partial group, with padding */
+    if(p_state->quad != 0)
+    {
+        char *str = (char*)&p_state->data[p_state->used];
+
+        uint32_t w = (uint32_t)p_state->pending[0] << 16;
+
+        if(p_state->quad == 2) { w |= (uint32_t)p_state->pending[1] << 8; }
+
+        if(p_state->size - p_state->used < 4) { return p_state->error = CPI_OUT_OF_MEMORY; }
+
+        str[0] = b64_alphabet[(w >> 18) & 0x3F];
+        str[1] = b64_alphabet[(w >> 12) & 0x3F];
+        str[2] = (p_state->quad == 2) ? b64_alphabet[(w >> 6) & 0x3F] : '=';
+        str[3] = '=';
+
+        p_state->used += 4;
+        p_state->quad = 0;
+    }
+
+    /*! append null terminator, if there is room */
+    if(p_state->used < p_state->size) { p_state->data[p_state->used] = '\0'; }
+
+    if(p_len != 0) { *p_len = p_state->used; }
+
+    return CPI_OK;
+}
+
+/******************************************************************************
+ * decode
+ *****************************************************************************/
+
+int cpi_b64_decode(const char *str, int len, void *data, int *p_size, int flags)
+{
+    cpi_b64_state state;
+
+    /*! sanity check - null ptr */
+    if( (p_size == 0) || ((str == 0) && (len != 0)) || ((data == 0) && (*p_size != 0)) ) { return CPI_INVALID_PARAM; }
+
+    cpi_b64_decode_begin(&state, data, *p_size, flags);
+    cpi_b64_decode_update(&state, str, len);
+
+    return cpi_b64_decode_end(&state, p_size);
+}
+
+void cpi_b64_decode_begin(cpi_b64_state *p_state, void *data, int size, int flags)
+{
+    memset(p_state, 0, sizeof(cpi_b64_state));
+
+    p_state->data = (uint8_t*)data;
+    p_state->size = size;
+    p_state->flags = flags;
+}
+
+int cpi_b64_decode_update(cpi_b64_state *p_state, const char *str, int len)
+{
+    const b64_dec_fn dec = b64_get_engine()->dec;
+
+    int v = 0;
+
+    if(CPI_FAILED(p_state->error)) { return p_state->error; }
+
+    while(v < len)
+    {
+        /*! bulk decode complete groups, when aligned to a group and not yet padded */
+        if( (p_state->quad == 0) && (p_state->pad == 0) )
+        {
+            int done = dec(&str[v], len - v, &p_state->data[p_state->used], p_state->size - p_state->used);
+
+            p_state->used += (done / 4) * 3;
+
+            v += done;
+
+            if(v >= len) { break; }
+        }
+
+        /*! handle the next character individually */
+        {
+            uint8_t c = b64_dec_table[(uint8_t)str[v++]];
+
+            if(c == DEC_WS)
+            {
+                if(p_state->flags & CPI_B64_SKIP_WS) { continue; }
+
+                return p_state->error = CPI_FAIL;
+            }
+
+            if(c == DEC_BAD) { return p_state->error = CPI_FAIL; }
+
+            if(c == DEC_PAD)
+            {
+                /*! padding may only complete a group of at least 2 characters */
+                if(p_state->pad == 0)
+                {
+                    if(p_state->quad < 2) { return p_state->error = CPI_FAIL; }
+
+                    if(CPI_FAILED(b64_decode_partial(p_state))) { return p_state->error; }
+                }
+                else if(p_state->quad == 0)
+                {
+                    return p_state->error = CPI_FAIL;
+                }
+
+                p_state->pad++;
+                p_state->quad = (p_state->quad + 1) & 3;
+
+                continue;
+            }
+
+            /*! no data may follow padding */
+            if(p_state->pad != 0) { return p_state->error = CPI_FAIL; }
+
+            p_state->pending[p_state->quad++] = c;
+
+            if(p_state->quad == 4)
+            {
+                uint32_t w = ((uint32_t)p_state->pending[0] << 18) | ((uint32_t)p_state->pending[1] << 12) |
+                             ((uint32_t)p_state->pending[2] << 6) | (uint32_t)p_state->pending[3];
+
+                if(p_state->size - p_state->used < 3) { return p_state->error = CPI_OUT_OF_MEMORY; }
+
+                p_state->data[p_state->used++] = (uint8_t)(w >> 16);
+                p_state->data[p_state->used++] = (uint8_t)(w >> 8);
+                p_state->data[p_state->used++] = (uint8_t)(w >> 0);
+
+                p_state->quad = 0;
+            }
+        }
+    }
+
+    return CPI_OK;
+}
+
+int cpi_b64_decode_end(cpi_b64_state *p_state, int *p_size)
+{
+    if(CPI_FAILED(p_state->error)) { return p_state->error; }
+
+    if(p_state->pad == 0)
+    {
+        /*! unpadded final group */
+        if(p_state->quad == 1) { return p_state->error = CPI_FAIL; }
+
+        if(p_state->quad > 1)
+        {
+            if(CPI_FAILED(b64_decode_partial(p_state))) { return p_state->error; }
+
+            p_state->quad = 0;
+        }
+    }
+    /*! incomplete padding */
+    else if(p_state->quad != 0)
+    {
+        return p_state->error = CPI_FAIL;
+    }
+
+    if(p_size != 0) { *p_size = p_state->used; }
+
+    return CPI_OK;
+}
+
+static int b64_decode_partial(cpi_b64_state *p_state)
+{
+    uint32_t a = p_state->pending[0], b = p_state->pending[1], c = p_state->pending[2];
+
+    int count = p_state->quad - 1;
+
+    /*! unused trailing bits must be zero */
+    if( (count == 1) && ((b & 0x0F) != 0) ) { return p_state->error = CPI_FAIL; }
+    if( (count == 2) && ((c & 0x03) != 0) ) { return p_state->error = CPI_FAIL; }
+
+    if(p_state->size - p_state->used < count) { return p_state->error = CPI_OUT_OF_MEMORY; }
+
+    p_state->data[p_state->used++] = (uint8_t)((a << 2) | (b >> 4));
+
+    if(count == 2) { p_state->data[p_state->used++] = (uint8_t)((b << 4) | (c >> 2)); }
+
+    return CPI_OK;
+}
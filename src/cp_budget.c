@@ -0,0 +1,304 @@
+/*
+ * cp_budget.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the authentication budget model, which learns how
+ * quickly a CP accepts challenges from its AUTHCOUNT answers, so that bulk
+ * collection (see "cpi schedule") waits no longer than the CP needs.
+ *
+ * The CP is taken to accept a challenge while fewer than C challenges were
+ * accepted in the last W seconds. C is learned first, within the window known
+ * to be safe: each challenge is issued as soon as one more than the known
+ * capacity would allow, until one is denied. W is then found by bisection
+ * between the longest window seen to be too short and the shortest seen to be
+ * long enough, after which every wait is exactly the time left until the
+ * oldest challenge in the window leaves it.
+ *
+ * A budget state file is a text file with one line per CP:
+ *
+ *   <serial number, in hex> <C> <C known> <W low> <W high> <last CP time> <accepted> <denied> <count> <CP time>...
+ *
+ * Lines starting with '#' are comments.
+ */
+
+#include "cp_interface.h"
+#include "cp_utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+/*! model being saved */
+typedef struct _budget_line
+{
+    char serial[CPI_UTIL_SERIAL_SIZE];
+    const cpi_budget_t *p_budget;
+}
+budget_line;
+
+/*! utility function to set up the model of a CP with no saved state */
+static void budget_default(cpi_budget_t *p_budget, const uint8_t *raw_serial)
+{
+    memset(p_budget, 0, sizeof(cpi_budget_t));
+
+    memcpy(p_budget->raw_serial, raw_serial, CPI_SERIAL_NUMBER_SIZE);
+
+    p_budget->capacity = 1;
+    p_budget->window_hi = CPI_BUDGET_WINDOW;
+
+    return;
+}
+
+/*! utility function to parse a state line into p_budget (returns 0 for comments and malformed lines) */
+static int budget_parse(const char *line, char *serial, cpi_budget_t *p_budget)
+{
+    unsigned capacity = 0, known = 0, lo = 0, hi = 0, last = 0, count = 0, v;
+
+    unsigned long long accepted = 0, denied = 0;
+
+    int len = 0;
+
+    if(line[0] == '#') { return 0; }
+
+    if(sscanf(line, "%32s %u %u %u %u %u %llu %llu %u%n", serial, &capacity, &known, &lo, &hi, &last, &accepted, &denied, &count, &len) != 9) { return 0; }
+
+    if( (capacity < 1) || (capacity > CPI_BUDGET_MAX_CAPACITY) || (hi <= lo) || (count > CPI_BUDGET_MAX_CAPACITY) ) { return 0; }
+
+    p_budget->capacity = capacity;
+    p_budget->capacity_known = (known != 0);
+    p_budget->window_lo = lo;
+    p_budget->window_hi = hi;
+    p_budget->last_time = last;
+    p_budget->accepted = accepted;
+    p_budget->denied = denied;
+    p_budget->log_count = count;
+
+    for(v=0;v<count;v++)
+    {
+        char *end = 0;
+
+        unsigned long t = strtoul(&line[len], &end, 10);
+
+        if( (end == &line[len]) || (t > UINT32_MAX) || ((v > 0) && (t < p_budget->log[v-1])) ) { return 0; }
+
+        p_budget->log[v] = (uint32_t)t;
+
+        len = (int)(end - line);
+    }
+
+    return 1;
+}
+
+int cpi_load_budget(const char *state_path, const uint8_t *raw_serial, cpi_budget_t *p_budget)
+{
+    char serial[CPI_UTIL_SERIAL_SIZE], line[CPI_UTIL_STATE_LINE_SIZE];
+
+    FILE *file = 0;
+
+    /*! sanity check - null ptr */
+    if( (raw_serial == 0) || (p_budget == 0) ) { return CPI_INVALID_PARAM; }
+
+    if(state_path == 0) { state_path = CPI_BUDGET_STATE; }
+
+    budget_default(p_budget, raw_serial);
+
+    cpi_util_format_serial(raw_serial, serial);
+
+    /*! no state, the defaults stand */
+    file = fopen(state_path, "r");
+
+    if(file == 0) { return CPI_OK; }
+
+    while(fgets(line, sizeof(line), file) != 0)
+    {
+        char line_serial[CPI_UTIL_SERIAL_SIZE];
+
+        cpi_budget_t budget;
+
+        budget_default(&budget, raw_serial);
+
+        if(!budget_parse(line, line_serial, &budget)) { continue; }
+
+        if(strcasecmp(line_serial, serial) == 0) { *p_budget = budget; break; }
+    }
+
+    fclose(file);
+
+    return CPI_OK;
+}
+
+/*! utility function to tell whether a state line is the one being saved (see cpi_util_save_state) */
+static int budget_replaced(const char *line, void *arg)
+{
+    const budget_line *p_line = (const budget_line*)arg;
+
+    char line_serial[CPI_UTIL_SERIAL_SIZE];
+
+    cpi_budget_t budget;
+
+    budget_default(&budget, p_line->p_budget->raw_serial);
+
+    return budget_parse(line, line_serial, &budget) && (strcasecmp(line_serial, p_line->serial) == 0);
+}
+
+/*! utility function to write the state line being saved (see cpi_util_save_state) */
+static void budget_append(FILE *file, void *arg)
+{
+    const budget_line *p_line = (const budget_line*)arg;
+
+    const cpi_budget_t *p_budget = p_line->p_budget;
+
+    uint32_t v;
+
+    fprintf(file, "%s %u %u %u %u %u %llu %llu %u", p_line->serial, p_budget->capacity, (p_budget->capacity_known != 0), p_budget->window_lo, p_budget->window_hi,
+        p_budget->last_time, (unsigned long long)p_budget->accepted, (unsigned long long)p_budget->denied, p_budget->log_count);
+
+    for(v=0;v<p_budget->log_count;v++) { fprintf(file, " %u", p_budget->log[v]); }
+
+    fprintf(file, "\n");
+
+    return;
+}
+
+int cpi_save_budget(const char *state_path, const cpi_budget_t *p_budget)
+{
+    budget_line save;
+
+    /*! sanity check - null ptr */
+    if(p_budget == 0) { return CPI_INVALID_PARAM; }
+
+    if(state_path == 0) { state_path = CPI_BUDGET_STATE; }
+
+    cpi_util_format_serial(p_budget->raw_serial, save.serial);
+
+    save.p_budget = p_budget;
+
+    return cpi_util_save_state(state_path, "# CPI authentication budget: serial number, capacity, capacity known, window low and high (s), last CP time, accepted, denied, then the CP times of the latest accepted challenges",
+        budget_replaced, budget_append, &save);
+}
+
+/*! utility function to rebase the model on the CP's clock, which restarts from 0 when the CP reboots */
+static void budget_rebase(cpi_budget_t *p_budget, uint32_t cur_time)
+{
+    uint32_t v;
+
+    /*! nothing tells how long ago the logged challenges were, so they are taken to be just now */
+    if(cur_time < p_budget->last_time)
+    {
+        for(v=0;v<p_budget->log_count;v++) { p_budget->log[v] = cur_time; }
+    }
+
+    p_budget->last_time = cur_time;
+
+    return;
+}
+
+/*! utility function to count the logged challenges less than window seconds before cur_time */
+static uint32_t budget_in_window(const cpi_budget_t *p_budget, uint32_t cur_time, uint32_t window)
+{
+    uint32_t count = 0;
+
+    while( (count < p_budget->log_count) && (cur_time - p_budget->log[p_budget->log_count - 1 - count] < window) ) { count++; }
+
+    return count;
+}
+
+/*! utility function to find the window to schedule by: a bisection probe once the capacity is known, otherwise the window known to be safe */
+static uint32_t budget_window(const cpi_budget_t *p_budget)
+{
+    if( !p_budget->capacity_known || (p_budget->window_hi - p_budget->window_lo <= 1) ) { return p_budget->window_hi; }
+
+    return p_budget->window_lo + (p_budget->window_hi - p_budget->window_lo) / 2;
+}
+
+uint32_t cpi_budget_wait(cpi_budget_t *p_budget, uint32_t cur_time)
+{
+    uint32_t window = budget_window(p_budget), capacity = p_budget->capacity;
+
+    budget_rebase(p_budget, cur_time);
+
+    /*! one more than the known capacity is tried until a denial shows it is too many */
+    if( !p_budget->capacity_known && (capacity < CPI_BUDGET_MAX_CAPACITY) ) { capacity++; }
+
+    if(budget_in_window(p_budget, cur_time, window) < capacity) { return 0; }
+
+    return p_budget->log[p_budget->log_count - capacity] + window - cur_time;
+}
+
+void cpi_budget_update(cpi_budget_t *p_budget, uint32_t cur_time, int status)
+{
+    uint32_t in_window = 0;
+
+    if( (status != CPI_OK) && (status != CPI_ACCESS_DENIED) ) { return; }
+
+    budget_rebase(p_budget, cur_time);
+
+    in_window = budget_in_window(p_budget, cur_time, p_budget->window_hi);
+
+    if(status == CPI_OK)
+    {
+        p_budget->accepted++;
+
+        /*! accepted with in_window others in the safe window: the capacity is at least one more */
+        if(!p_budget->capacity_known)
+        {
+            if( (in_window + 1 > p_budget->capacity) && (in_window < CPI_BUDGET_MAX_CAPACITY) ) { p_budget->capacity = in_window + 1; }
+        }
+        /*! accepted although a full capacity of challenges lies within the safe window: the window is no longer than the oldest of them */
+        else if(in_window >= p_budget->capacity)
+        {
+            p_budget->window_hi = cur_time - p_budget->log[p_budget->log_count - p_budget->capacity];
+
+            if(p_budget->window_lo >= p_budget->window_hi) { p_budget->window_lo = (p_budget->window_hi > 0) ? p_budget->window_hi - 1 : 0; }
+
+            /*! a window of 0 would let every challenge through */
+            if(p_budget->window_hi == 0) { p_budget->window_hi = 1; }
+        }
+
+        /*! log it, dropping the oldest */
+        if(p_budget->log_count == CPI_BUDGET_MAX_CAPACITY)
+        {
+            memmove(&p_budget->log[0], &p_budget->log[1], (CPI_BUDGET_MAX_CAPACITY - 1) * sizeof(uint32_t));
+
+            p_budget->log_count--;
+        }
+
+        p_budget->log[p_budget->log_count++] = cur_time;
+
+        return;
+    }
+
+    p_budget->denied++;
+
+    /*! fewer than capacity accepted within the safe window, yet denied: the capacity was seen accepted, so the window is longer than was known */
+    if(in_window < p_budget->capacity)
+    {
+        uint32_t gap = (p_budget->log_count >= p_budget->capacity) ? cur_time - p_budget->log[p_budget->log_count - p_budget->capacity] : p_budget->window_hi;
+
+        p_budget->window_lo = (gap > p_budget->window_lo) ? gap : p_budget->window_lo;
+        p_budget->window_hi = (2*p_budget->window_hi > gap) ? 2*p_budget->window_hi : gap + 1;
+
+        return;
+    }
+
+    /*! denied with in_window others in the safe window, while trying one more: that is the capacity */
+    if(!p_budget->capacity_known)
+    {
+        p_budget->capacity = in_window;
+        p_budget->capacity_known = 1;
+
+        return;
+    }
+
+    /*! denied while probing a shorter window: the window is longer than the oldest of them */
+    p_budget->window_lo = cur_time - p_budget->log[p_budget->log_count - p_budget->capacity];
+
+    if(p_budget->window_lo >= p_budget->window_hi) { p_budget->window_hi = p_budget->window_lo + 1; }
+
+    return;
+}
@@ -0,0 +1,666 @@
+/*
+ * cp_format.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the XML, JSON and TLV response writers. All three
+ * are fed by the same query engine (see cp_xml_interface.c), so they always
+ * carry the same set of results.
+ */
+
+#include "cp_format.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cp_base64.h"
+
+/*! armor lines surrounding the base64 body of a PKEY result */
+static const char *pkey_armor_beg = "-----BEGIN PGP PUBLIC KEY BLOCK-----";
+static const char *pkey_armor_end = "-----END PGP PUBLIC KEY BLOCK-----";
+
+/*! utility function to construct a 16 bit integer in host byte order, from little endian data */
+static uint16_t util_make16(const uint8_t *raw_data) { return (raw_data[0] | (raw_data[1] << 8)); }
+
+/*! locate the base64 body of an armored PKEY result */
+static void pkey_body(const query_result *p_result, const char **p_body, int *p_size);
+
+/*! append a string to the output buffer, escaped as a JSON string literal */
+static void cpi_out_json_str(cpi_out *p_out, const char *str);
+
+static void xml_begin(cpi_out *p_out);
+static void xml_result(cpi_out *p_out, const query_result *p_result);
+static void xml_end(cpi_out *p_out);
+
+static void json_begin(cpi_out *p_out);
+static void json_result(cpi_out *p_out, const query_result *p_result);
+static void json_end(cpi_out *p_out);
+
+static void tlv_begin(cpi_out *p_out);
+static void tlv_result(cpi_out *p_out, const query_result *p_result);
+static void tlv_end(cpi_out *p_out);
+
+/*! response writers, indexed by CPI_FORMAT_ value */
+static const cpi_writer writers[] =
+{
+    { xml_begin,  xml_result,  xml_end  },
+    { json_begin, json_result, json_end },
+    { tlv_begin,  tlv_result,  tlv_end  }
+};
+
+/*! query types understood by the query engine */
+static const struct
+{
+    const char *type;
+    int cmd;
+}
+query_types[] =
+{
+    { "pidx", CPI_CMD_PIDX },
+    { "pkey", CPI_CMD_PKEY },
+    { "vers", CPI_CMD_VERS },
+    { "time", CPI_CMD_TIME },
+    { "ckey", CPI_CMD_CKEY },
+    { "snum", CPI_CMD_SNUM },
+    { "hwvr", CPI_CMD_HWVR },
+    { "chal", CPI_CMD_CHAL }
+};
+
+const cpi_writer *cpi_format_writer(int format)
+{
+    if( (format < 0) || (format >= (int)(sizeof(writers)/sizeof(writers[0]))) ) { return 0; }
+
+    return &writers[format];
+}
+
+int cpi_format_cmd(const char *type)
+{
+    int v;
+
+    for(v=0;v<(int)(sizeof(query_types)/sizeof(query_types[0]));v++)
+    {
+        if(strncmp(type, query_types[v].type, strlen(query_types[v].type)) == 0) { return query_types[v].cmd; }
+    }
+
+    return CPI_CMD_UNKNOWN;
+}
+
+const char *cpi_format_type(int cmd)
+{
+    int v;
+
+    for(v=0;v<(int)(sizeof(query_types)/sizeof(query_types[0]));v++)
+    {
+        if(query_types[v].cmd == cmd) { return query_types[v].type; }
+    }
+
+    return 0;
+}
+
+int cpi_format_result_size(int cmd)
+{
+    switch(cmd)
+    {
+        case CPI_CMD_PIDX: return 0x10;
+        case CPI_CMD_PKEY: return CPI_MAX_RESULT_SIZE;
+        case CPI_CMD_VERS: return CPI_VERSION_SIZE;
+        case CPI_CMD_SNUM: return CPI_SERIAL_NUMBER_SIZE;
+        case CPI_CMD_HWVR: return CPI_HARDWARE_VERSION_SIZE;
+        case CPI_CMD_CHAL: return CPI_RESULT1_SIZE + CPI_RESULT2_SIZE + CPI_RESULT3_SIZE;
+    }
+
+    /*! TIME, CKEY and unknown queries need no result storage */
+    return 0;
+}
+
+void cpi_format_bind(cpi_cmd_t *p_cmd, uint8_t *res)
+{
+    int res_size = cpi_format_result_size(p_cmd->cmd);
+
+    if(res_size == 0) { return; }
+
+    memset(res, 0, res_size);
+
+    /*! CHAL results are laid out back to back */
+    if(p_cmd->cmd == CPI_CMD_CHAL)
+    {
+        p_cmd->out[0] = &res[0];
+        p_cmd->out[1] = &res[CPI_RESULT1_SIZE];
+        p_cmd->out[2] = &res[CPI_RESULT1_SIZE + CPI_RESULT2_SIZE];
+        p_cmd->out_size[0] = CPI_RESULT1_SIZE;
+        p_cmd->out_size[1] = CPI_RESULT2_SIZE;
+        p_cmd->out_size[2] = CPI_RESULT3_SIZE;
+    }
+    else
+    {
+        p_cmd->out[0] = res;
+        p_cmd->out_size[0] = res_size;
+    }
+
+    return;
+}
+
+void cpi_format_result(const cpi_cmd_t *p_cmd, const char *type, query_result *p_result)
+{
+    p_result->cmd = p_cmd->cmd;
+    p_result->type = type;
+    p_result->ret = p_cmd->status;
+    p_result->data = (const uint8_t*)p_cmd->out[0];
+    p_result->value = p_cmd->value;
+
+    switch(p_cmd->cmd)
+    {
+        case CPI_CMD_PKEY:
+            p_result->size = CPI_SUCCESS(p_cmd->status) ? strlen((const char*)p_cmd->out[0]) : 0;
+            break;
+
+        case CPI_CMD_CHAL:
+#if defined(CNPLATFORM_falconwing)
+            p_result->size = CPI_RESULT1_SIZE + CPI_RESULT2_SIZE + CPI_RESULT3_SIZE;
+#else
+            p_result->size = CPI_RESULT1_SIZE + CPI_RESULT2_SIZE;
+#endif
+            break;
+
+        default:
+            p_result->size = p_cmd->out_size[0];
+            break;
+    }
+
+    return;
+}
+
+void cpi_out_bytes(cpi_out *p_out, const void *data, int size)
+{
+    /*! always keep room for a null terminator */
+    if(p_out->used + size >= p_out->size) { p_out->overflow = 1; return; }
+
+    memcpy(&p_out->data[p_out->used], data, size);
+
+    p_out->used += size;
+    p_out->data[p_out->used] = '\0';
+
+    return;
+}
+
+void cpi_out_str(cpi_out *p_out, const char *str)
+{
+    cpi_out_bytes(p_out, str, strlen(str));
+
+    return;
+}
+
+void cpi_out_hex(cpi_out *p_out, const uint8_t *data, int size)
+{
+    static const char hex_digits[] = "0123456789ABCDEF";
+
+    if(p_out->used + size*2 >= p_out->size) { p_out->overflow = 1; return; }
+
+    char *dst = &p_out->data[p_out->used];
+
+    int v;
+    for(v=0;v<size;v++)
+    {
+        *dst++ = hex_digits[data[v] >> 4];
+        *dst++ = hex_digits[data[v] & 0x0F];
+    }
+
+    p_out->used += size*2;
+    p_out->data[p_out->used] = '\0';
+
+    return;
+}
+
+void cpi_out_b64(cpi_out *p_out, const uint8_t *data, int size)
+{
+    int ret = p_out->size - p_out->used - 1;
+
+    if(size == 0) { return; }
+
+    if( (ret <= 0) || CPI_FAILED(cpi_b64_encode(data, size, &p_out->data[p_out->used], &ret)) ) { p_out->overflow = 1; return; }
+
+    p_out->used += ret;
+    p_out->data[p_out->used] = '\0';
+
+    return;
+}
+
+static void cpi_out_json_str(cpi_out *p_out, const char *str)
+{
+    cpi_out_bytes(p_out, "\"", 1);
+
+    for(; *str != '\0'; str++)
+    {
+        char buff[8];
+
+        if( (*str == '"') || (*str == '\\') )
+        {
+            buff[0] = '\\'; buff[1] = *str;
+            cpi_out_bytes(p_out, buff, 2);
+        }
+        else if( (uint8_t)*str < 0x20 )
+        {
+            sprintf(buff, "\\u%.04X", (int)(uint8_t)*str);
+            cpi_out_str(p_out, buff);
+        }
+        else
+        {
+            cpi_out_bytes(p_out, str, 1);
+        }
+    }
+
+    cpi_out_bytes(p_out, "\"", 1);
+
+    return;
+}
+
+static void pkey_body(const query_result *p_result, const char **p_body, int *p_size)
+{
+    const char *beg = (const char*)p_result->data;
+    const char *end = beg + p_result->size;
+
+    /*! skip past the begin armor line, if present */
+    {
+        const char *armor = strstr(beg, pkey_armor_beg);
+
+        if(armor != 0) { beg = armor + strlen(pkey_armor_beg); }
+    }
+
+    /*! stop at the end armor line, if present */
+    {
+        const char *armor = strstr(beg, pkey_armor_end);
+
+        if(armor != 0) { end = armor; }
+    }
+
+    /*! stop at the armor checksum line ("=" followed by the CRC24), if present */
+    {
+        const char *crc = beg;
+
+        while( (crc = memchr(crc, '\n', end - crc)) != 0 && (++crc < end) )
+        {
+            if(*crc == '=') { end = crc; break; }
+        }
+    }
+
+    *p_body = beg;
+    *p_size = end - beg;
+
+    return;
+}
+
+/*! \name XML writer */
+/*! \{ */
+
+static void xml_begin(cpi_out *p_out)
+{
+    cpi_out_str(p_out, "<?xml version='1.0'?>\n");
+    cpi_out_str(p_out, "<cpi version='1.0'>\n");
+    cpi_out_str(p_out, "  <response_list>\n");
+
+    return;
+}
+
+static void xml_result(cpi_out *p_out, const query_result *p_result)
+{
+    char buff[64];
+
+    /*! handle unknown query */
+    if(p_result->cmd == CPI_CMD_UNKNOWN)
+    {
+        cpi_out_str(p_out, "    <response result=\"failure\">Unknown \"type\" value</response>\n");
+        return;
+    }
+
+    cpi_out_str(p_out, "    <response type=\"");
+    cpi_out_str(p_out, p_result->type);
+    cpi_out_str(p_out, "\"");
+
+    /*! handle failure condition */
+    if(CPI_FAILED(p_result->ret))
+    {
+        cpi_out_str(p_out, " result=\"failure\">");
+        cpi_out_str(p_out, CPI_RETURN_CODE_LOOKUP[p_result->ret]);
+        cpi_out_str(p_out, "</response>\n");
+        return;
+    }
+
+    cpi_out_str(p_out, " result=\"success\">");
+
+    switch(p_result->cmd)
+    {
+        case CPI_CMD_PIDX:
+        {
+            const uint8_t *raw_pid = p_result->data;
+
+            /*! format raw PID into GUID format */
+            sprintf(buff, "%.02X%.02X%.02X%.02X-%.02X%.02X-%.02X%.02X-%.02X%.02X-%.02X%.02X%.02X%.02X%.02X%.02X",
+                raw_pid[0x00], raw_pid[0x01], raw_pid[0x02], raw_pid[0x03],
+                raw_pid[0x04], raw_pid[0x05],
+                raw_pid[0x06], raw_pid[0x07],
+                raw_pid[0x08], raw_pid[0x09], raw_pid[0x0A], raw_pid[0x0B],
+                raw_pid[0x0C], raw_pid[0x0D], raw_pid[0x0E], raw_pid[0x0F]);
+
+            cpi_out_str(p_out, buff);
+        }
+        break;
+
+        case CPI_CMD_PKEY:
+        {
+            cpi_out_str(p_out, "\n");
+            cpi_out_bytes(p_out, p_result->data, p_result->size);
+            cpi_out_str(p_out, "    ");
+        }
+        break;
+
+        case CPI_CMD_VERS:
+        {
+            /*! generate version string major.minor.fix (e.g. 4.2.0) */
+            sprintf(buff, "%d.%d.%d", util_make16(&p_result->data[4]), util_make16(&p_result->data[2]), util_make16(&p_result->data[0]));
+
+            cpi_out_str(p_out, buff);
+        }
+        break;
+
+        case CPI_CMD_TIME:
+        case CPI_CMD_CKEY:
+        {
+            sprintf(buff, "%u", p_result->value);
+
+            cpi_out_str(p_out, buff);
+        }
+        break;
+
+        case CPI_CMD_SNUM:
+        case CPI_CMD_HWVR:
+        {
+            cpi_out_hex(p_out, p_result->data, p_result->size);
+        }
+        break;
+
+        case CPI_CMD_CHAL:
+        {
+            const uint8_t *result1 = &p_result->data[0];
+            const uint8_t *result2 = &p_result->data[CPI_RESULT1_SIZE];
+
+            cpi_out_str(p_out, "\n");
+            cpi_out_str(p_out, "      <enc_owner_key>");
+            cpi_out_hex(p_out, &result1[0], CPI_RESULT1_ENC_OK_SIZE);
+            cpi_out_str(p_out, "</enc_owner_key>\n");
+            cpi_out_str(p_out, "      <rand_data>");
+            cpi_out_hex(p_out, &result1[CPI_RESULT1_ENC_OK_SIZE], CPI_RESULT1_RAND_SIZE);
+            cpi_out_str(p_out, "</rand_data>\n");
+            cpi_out_str(p_out, "      <vers>");
+            cpi_out_hex(p_out, &result1[CPI_RESULT1_ENC_OK_SIZE+CPI_RESULT1_RAND_SIZE], CPI_RESULT1_VERS_SIZE);
+            cpi_out_str(p_out, "</vers>\n");
+            cpi_out_str(p_out, "      <signature>");
+            cpi_out_hex(p_out, result2, CPI_RESULT2_SIZE);
+
+            /*! result3, where present, is appended to the signature */
+            if(p_result->size > CPI_RESULT1_SIZE + CPI_RESULT2_SIZE)
+            {
+                cpi_out_hex(p_out, &result2[CPI_RESULT2_SIZE], p_result->size - CPI_RESULT1_SIZE - CPI_RESULT2_SIZE);
+            }
+
+            cpi_out_str(p_out, "</signature>\n");
+            cpi_out_str(p_out, "    ");
+        }
+        break;
+    }
+
+    cpi_out_str(p_out, "</response>\n");
+
+    return;
+}
+
+static void xml_end(cpi_out *p_out)
+{
+    cpi_out_str(p_out, "  </response_list>\n");
+    cpi_out_str(p_out, "</cpi>\n");
+
+    return;
+}
+
+/*! \} */
+
+/*! \name JSON writer */
+/*! \{ */
+
+static void json_begin(cpi_out *p_out)
+{
+    cpi_out_str(p_out, "{\"cpi\":\"1.0\",\"response_list\":[");
+
+    return;
+}
+
+static void json_result(cpi_out *p_out, const query_result *p_result)
+{
+    char buff[64];
+
+    /*! separate from previous record */
+    if(p_out->records++ > 0) { cpi_out_str(p_out, ","); }
+
+    cpi_out_str(p_out, "{\"type\":");
+    cpi_out_json_str(p_out, p_result->type);
+
+    /*! handle unknown query */
+    if(p_result->cmd == CPI_CMD_UNKNOWN)
+    {
+        cpi_out_str(p_out, ",\"result\":\"failure\",\"error\":\"Unknown \\\"type\\\" value\"}");
+        return;
+    }
+
+    /*! handle failure condition */
+    if(CPI_FAILED(p_result->ret))
+    {
+        cpi_out_str(p_out, ",\"result\":\"failure\",\"error\":");
+        cpi_out_json_str(p_out, CPI_RETURN_CODE_LOOKUP[p_result->ret]);
+        cpi_out_str(p_out, "}");
+        return;
+    }
+
+    cpi_out_str(p_out, ",\"result\":\"success\",\"value\":");
+
+    switch(p_result->cmd)
+    {
+        case CPI_CMD_PIDX:
+        case CPI_CMD_SNUM:
+        case CPI_CMD_HWVR:
+        {
+            cpi_out_str(p_out, "\"");
+            cpi_out_b64(p_out, p_result->data, p_result->size);
+            cpi_out_str(p_out, "\"");
+        }
+        break;
+
+        case CPI_CMD_PKEY:
+        {
+            const char *body = 0;
+            int size = 0, v;
+
+            pkey_body(p_result, &body, &size);
+
+            /*! emit the armored base64 body as a single line */
+            cpi_out_str(p_out, "\"");
+
+            for(v=0;v<size;v++)
+            {
+                if( (body[v] != '\n') && (body[v] != '\r') && (body[v] != ' ') ) { cpi_out_bytes(p_out, &body[v], 1); }
+            }
+
+            cpi_out_str(p_out, "\"");
+        }
+        break;
+
+        case CPI_CMD_VERS:
+        {
+            sprintf(buff, "\"%d.%d.%d\"", util_make16(&p_result->data[4]), util_make16(&p_result->data[2]), util_make16(&p_result->data[0]));
+
+            cpi_out_str(p_out, buff);
+        }
+        break;
+
+        case CPI_CMD_TIME:
+        case CPI_CMD_CKEY:
+        {
+            sprintf(buff, "%u", p_result->value);
+
+            cpi_out_str(p_out, buff);
+        }
+        break;
+
+        case CPI_CMD_CHAL:
+        {
+            const uint8_t *result1 = &p_result->data[0];
+            const uint8_t *result2 = &p_result->data[CPI_RESULT1_SIZE];
+
+            cpi_out_str(p_out, "{\"enc_owner_key\":\"");
+            cpi_out_b64(p_out, &result1[0], CPI_RESULT1_ENC_OK_SIZE);
+            cpi_out_str(p_out, "\",\"rand_data\":\"");
+            cpi_out_b64(p_out, &result1[CPI_RESULT1_ENC_OK_SIZE], CPI_RESULT1_RAND_SIZE);
+            cpi_out_str(p_out, "\",\"vers\":\"");
+            cpi_out_b64(p_out, &result1[CPI_RESULT1_ENC_OK_SIZE+CPI_RESULT1_RAND_SIZE], CPI_RESULT1_VERS_SIZE);
+            cpi_out_str(p_out, "\",\"signature\":\"");
+            cpi_out_b64(p_out, result2, CPI_RESULT2_SIZE);
+
+            /*! result3, where present, is reported separately */
+            if(p_result->size > CPI_RESULT1_SIZE + CPI_RESULT2_SIZE)
+            {
+                cpi_out_str(p_out, "\",\"hash\":\"");
+                cpi_out_b64(p_out, &result2[CPI_RESULT2_SIZE], p_result->size - CPI_RESULT1_SIZE - CPI_RESULT2_SIZE);
+            }
+
+            cpi_out_str(p_out, "\"}");
+        }
+        break;
+    }
+
+    cpi_out_str(p_out, "}");
+
+    return;
+}
+
+static void json_end(cpi_out *p_out)
+{
+    cpi_out_str(p_out, "]}\n");
+
+    return;
+}
+
+/*! \} */
+
+/*! \name TLV writer */
+/*! \{ */
+
+static void tlv_begin(cpi_out *p_out)
+{
+    static const uint8_t hdr[4] = { 'C', 'P', 'I', CPI_TLV_VERSION };
+
+    cpi_out_bytes(p_out, hdr, sizeof(hdr));
+
+    return;
+}
+
+/*! append a TLV record header, with the length field to be patched by tlv_record_end */
+static int tlv_record_beg(cpi_out *p_out, int tag, int ret)
+{
+    uint8_t hdr[4] = { (uint8_t)tag, (uint8_t)ret, 0, 0 };
+
+    cpi_out_bytes(p_out, hdr, sizeof(hdr));
+
+    return p_out->used;
+}
+
+/*! patch the length field of the TLV record started at the specified offset */
+static void tlv_record_end(cpi_out *p_out, int offs)
+{
+    if(p_out->overflow) { return; }
+
+    int size = p_out->used - offs;
+
+    p_out->data[offs-2] = (char)(size & 0xFF);
+    p_out->data[offs-1] = (char)((size >> 8) & 0xFF);
+
+    return;
+}
+
+static void tlv_result(cpi_out *p_out, const query_result *p_result)
+{
+    /*! handle unknown query, and failure condition, as empty records */
+    if(p_result->cmd == CPI_CMD_UNKNOWN)
+    {
+        tlv_record_beg(p_out, CPI_CMD_UNKNOWN, CPI_INVALID_PARAM);
+        return;
+    }
+
+    if(CPI_FAILED(p_result->ret))
+    {
+        tlv_record_beg(p_out, p_result->cmd, p_result->ret);
+        return;
+    }
+
+    int offs = tlv_record_beg(p_out, p_result->cmd, CPI_OK);
+
+    switch(p_result->cmd)
+    {
+        case CPI_CMD_PKEY:
+        {
+            const char *body = 0;
+            int size = 0;
+
+            pkey_body(p_result, &body, &size);
+
+            /*! decode the armored body into the raw public key packet */
+            {
+                int ret = p_out->size - p_out->used - 1, status = CPI_OUT_OF_MEMORY;
+
+                /*! the body is split across lines */
+                if(ret > 0) { status = cpi_b64_decode(body, size, &p_out->data[p_out->used], &ret, CPI_B64_SKIP_WS); }
+
+                if(status == CPI_OUT_OF_MEMORY) { p_out->overflow = 1; break; }
+
+                /*! a body which does not decode fails this record only, as an empty record */
+                if(CPI_FAILED(status)) { if(!p_out->overflow) { p_out->data[offs-3] = (char)CPI_FAIL; } break; }
+
+                p_out->used += ret;
+                p_out->data[p_out->used] = '\0';
+            }
+        }
+        break;
+
+        case CPI_CMD_TIME:
+        case CPI_CMD_CKEY:
+        {
+            uint8_t raw[4] =
+            {
+                (uint8_t)(p_result->value >> 0), (uint8_t)(p_result->value >> 8),
+                (uint8_t)(p_result->value >> 16), (uint8_t)(p_result->value >> 24)
+            };
+
+            cpi_out_bytes(p_out, raw, sizeof(raw));
+        }
+        break;
+
+        default:
+        {
+            cpi_out_bytes(p_out, p_result->data, p_result->size);
+        }
+        break;
+    }
+
+    tlv_record_end(p_out, offs);
+
+    return;
+}
+
+static void tlv_end(cpi_out *p_out)
+{
+    tlv_record_beg(p_out, CPI_TLV_END, CPI_OK);
+
+    return;
+}
+
+/*! \} */
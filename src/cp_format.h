@@ -0,0 +1,90 @@
+/*
+ * cp_format.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API defines the response writers shared by the query engine. Each
+ * writer emits the same set of query results in one output format.
+ */
+
+#ifndef CP_FORMAT_H
+#define CP_FORMAT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "cp_interface.h"
+
+/*! output buffer, filled by the response writers */
+typedef struct _cpi_out
+{
+    char *data;     /*!< output memory */
+    int   size;     /*!< size of output memory, in bytes */
+    int   used;     /*!< number of bytes written so far */
+    int   overflow; /*!< set if any write did not fit */
+    int   records;  /*!< number of result records written so far */
+}
+cpi_out;
+
+/*! result of a single query, as produced by the query engine */
+typedef struct _query_result
+{
+    int            cmd;     /*!< CPI_CMD_ code, or CPI_CMD_UNKNOWN */
+    const char    *type;    /*!< "type" attribute of the query, as given */
+    int            ret;     /*!< CPI_ return code for this query */
+    const uint8_t *data;    /*!< raw result data (PIDX, PKEY, VERS, SNUM, HWVR, CHAL) */
+    int            size;    /*!< size of raw result data, in bytes */
+    uint32_t       value;   /*!< numeric result (TIME, CKEY) */
+}
+query_result;
+
+/*! response writer for one output format */
+typedef struct _cpi_writer
+{
+    /*! write document header */
+    void (*begin)(cpi_out *p_out);
+    /*! write a single query result */
+    void (*result)(cpi_out *p_out, const query_result *p_result);
+    /*! write document footer */
+    void (*end)(cpi_out *p_out);
+}
+cpi_writer;
+
+/*! retrieve the response writer for the specified CPI_FORMAT_ value (returns 0 if unknown) */
+const cpi_writer *cpi_format_writer(int format);
+
+/*! retrieve the CPI_CMD_ code for a query type name (returns CPI_CMD_UNKNOWN if unknown) */
+int cpi_format_cmd(const char *type);
+
+/*! retrieve the query type name for a CPI_CMD_ code (returns 0 if unknown) */
+const char *cpi_format_type(int cmd);
+
+/*! retrieve the result storage needed by a CPI_CMD_ code, in bytes (0 for numeric results) */
+int cpi_format_result_size(int cmd);
+
+/*! point the outputs of a command at result storage of cpi_format_result_size() bytes, laid out as the writers expect */
+void cpi_format_bind(cpi_cmd_t *p_cmd, uint8_t *res);
+
+/*! describe a completed command, bound with cpi_format_bind, as a query result */
+void cpi_format_result(const cpi_cmd_t *p_cmd, const char *type, query_result *p_result);
+
+/*! append raw bytes to the output buffer */
+void cpi_out_bytes(cpi_out *p_out, const void *data, int size);
+
+/*! append a null terminated string to the output buffer */
+void cpi_out_str(cpi_out *p_out, const char *str);
+
+/*! append binary data to the output buffer, as upper case hex */
+void cpi_out_hex(cpi_out *p_out, const uint8_t *data, int size);
+
+/*! append binary data to the output buffer, as base64 */
+void cpi_out_b64(cpi_out *p_out, const uint8_t *data, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,48 +17,39 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <stdlib.h>
 
 
 
-/*! utility structure, for generic data requests */
-typedef struct _request_info
-{
-    int   raw_size; /*!< size of raw data */
-    void *raw_data; /*!< memory pointer containing raw request data */
-}
-request_info;
-
-/*! utility structure, for generic data responses */
-typedef struct _response_info
-{
-    int   str_size; /*!< size of base64 string */
-    int   raw_size; /*!< size of raw data after base64 decode */
-    void *raw_data; /*!< memory pointer to fill with decoded raw data */
-}
-response_info;
-
-/*! utility function for generic data retrieval command */
-static int cpi_get_generic_data(struct _cpi_t *p_cpi, char *cmd, char *cmd_ack, request_info *p_request_info, int req_count, response_info *p_response_info, int res_count);
-
 int cpi_create(struct _cpi_info_t *p_cpi_info, struct _cpi_t **pp_cpi)
 {
     /*! sanity check - null ptr */
     if(pp_cpi == 0) { return CPI_INVALID_PARAM; }
 
     /*! allocate associated context */
-    cpi_t *cpi = (cpi_t*)malloc(sizeof(cpi_t));
+    cpi_t *cpi = (cpi_t*)cpi_util_malloc(sizeof(cpi_t));
 
-    /*! return allocated context */
-    *pp_cpi = cpi;
+    /*! handle allocation failure */
+    if(cpi == 0) { return CPI_OUT_OF_MEMORY; }
 
     /*! set context to default state */
-    memset(*pp_cpi, 0, sizeof(cpi_t));
+    memset(cpi, 0, sizeof(cpi_t));
     /*! default state - invalid file */
     cpi->serial_file = -1;
-    cpi->tmp_buff = (char*)malloc(CPI_MAX_RESULT_SIZE+1);
-    cpi->tmp_buff_xml = (char*)malloc(CPI_MAX_RESULT_SIZE+1);
+
+    /*! optional instance flags */
+    if(p_cpi_info != 0)
+    {
+        cpi->flags = p_cpi_info->flags;
+        cpi->lock_timeout_ms = p_cpi_info->lock_timeout_ms;
+        cpi->pacing_profile = p_cpi_info->pacing_profile;
+        cpi->lock_dir = p_cpi_info->lock_dir;
+    }
+
+    /*! return allocated context */
+    *pp_cpi = cpi;
 
     return CPI_OK;
 }
@@ -68,19 +59,17 @@ int cpi_close(struct _cpi_t *p_cpi)
     /*! sanity check - null ptr */
     if(p_cpi == 0) { return CPI_INVALID_PARAM; }
 
-    /*! cleanup temp XML buffer */
-    if(p_cpi->tmp_buff_xml != 0)
-    {
-        /*! free temporary XML buffer */
-        free(p_cpi->tmp_buff_xml);
-    }
+    /*! cleanup XML parser and batch storage */
+    cpi_xml_cleanup(p_cpi);
 
-    /*! cleanup temp buffer */
-    if(p_cpi->tmp_buff != 0)
-    {
-        /*! free temporary buffer */
-        free(p_cpi->tmp_buff);
-    }
+    /*! cleanup command queue and event descriptor */
+    cpi_async_cleanup(p_cpi);
+
+    /*! cleanup daemon connection state */
+    cpi_remote_cleanup(p_cpi);
+
+    /*! release lock, and hand the device to the next process in line */
+    cpi_lock_release(p_cpi);
 
     /*! cleanup serial device file */
     if(p_cpi->serial_file != -1)
@@ -89,15 +78,8 @@ int cpi_close(struct _cpi_t *p_cpi)
         close(p_cpi->serial_file);
     }
 
-    /*! attempt to release lock */
-    {
-        struct flock fl = { F_UNLCK, SEEK_SET, 0, 0, getpid() };
-
-        fcntl(p_cpi->serial_file, F_SETLK, &fl);
-    }
-
     /*! free associated context */
-    free(p_cpi);
+    cpi_util_free(p_cpi);
 
     return CPI_OK;
 }
@@ -107,6 +89,24 @@ int cpi_init(struct _cpi_t *p_cpi, char *serial_device_path)
     /*! sanity check - null ptr */
     if(p_cpi == 0) { return CPI_INVALID_PARAM; }
 
+#if !defined(CNPLATFORM_falconwing)
+    /*! a socket names a CPI daemon (see cpi_serve), which owns the serial device for us */
+    {
+        struct stat st;
+
+        if( (stat(serial_device_path, &st) == 0) && S_ISSOCK(st.st_mode) )
+        {
+            int ret = cpi_remote_init(p_cpi, serial_device_path);
+
+            if(CPI_FAILED(ret)) { return ret; }
+
+            p_cpi->is_initialized = 1;
+
+            return CPI_OK;
+        }
+    }
+#endif
+
     /*! attempt to open serial device */
 #if defined(CNPLATFORM_falconwing)
     struct sockaddr_un cpi_sa;
@@ -173,14 +173,11 @@ int cpi_init(struct _cpi_t *p_cpi, char *serial_device_path)
     /*! failed to open serial device */
     if(p_cpi->serial_file == -1) { return CPI_FAIL; }
 
-    /*! attempt to obtain lock */
+    /*! attempt to obtain lock, waiting in line for other processes if allowed */
     {
-        struct flock fl = { F_WRLCK, SEEK_SET, 0, 0, getpid() };
+        int ret = cpi_lock_acquire(p_cpi, serial_device_path, p_cpi->lock_timeout_ms);
 
-        if(fcntl(p_cpi->serial_file, F_SETLK, &fl) == -1)
-        {
-            return CPI_ACCESS_DENIED;
-        }
+        if(CPI_FAILED(ret)) { return ret; }
     }
 
     /*! configure serial device file */
@@ -189,7 +186,8 @@ int cpi_init(struct _cpi_t *p_cpi, char *serial_device_path)
 
         memset(&options, 0, sizeof(options));
 
-        fcntl(p_cpi->serial_file, F_SETFL, 0);
+        /*! all I/O is driven by the non-blocking state machine in cp_async.c */
+        fcntl(p_cpi->serial_file, F_SETFL, O_NONBLOCK);
 
     /*! Only ironforge uses bitrate of 38400bps - all others use 115.2kbps */
         options.c_cflag |= (CLOCAL | CREAD | CS8 | 
@@ -214,23 +212,32 @@ int cpi_init(struct _cpi_t *p_cpi, char *serial_device_path)
         tcsetattr(p_cpi->serial_file, TCSANOW, &options);
     }
 
+    /*! create command queue and event descriptor */
+    {
+        int ret = cpi_async_init(p_cpi);
+
+        if(CPI_FAILED(ret)) { return ret; }
+    }
+
     /*! we're all initialized now */
     p_cpi->is_initialized = 1;
 
+    /*! pace writes as calibrated for this CP, if it has been */
+    cpi_pacing_load(p_cpi, p_cpi->pacing_profile);
+
     return CPI_OK;
 }
 
 int cpi_get_putative_id(struct _cpi_t *p_cpi, uint16_t cpi_key_id, char *str)
 {
     /*! temporary raw, binary, putative id */
-    char raw_pid[0x10];
+    uint8_t raw_pid[0x10];
 
-    /*! use generic data utility function to obtain version data */
+    /*! obtain raw putative id */
     {
-        request_info req_info = { .raw_size = sizeof(cpi_key_id), .raw_data = &cpi_key_id };
-        response_info res_info = { .str_size = 24, .raw_size = 0x10, .raw_data = raw_pid };
+        cpi_cmd_t cmd = { .cmd = CPI_CMD_PIDX, .key_id = cpi_key_id, .out = { raw_pid }, .out_size = { sizeof(raw_pid) } };
 
-        int ret = cpi_get_generic_data(p_cpi, "!!!!PIDX", "PIDX", &req_info, 1, &res_info, 1);
+        int ret = cpi_execute_batch(p_cpi, &cmd, 1);
 
         if(CPI_FAILED(ret)) { return ret; }
     }
@@ -248,18 +255,17 @@ int cpi_get_putative_id(struct _cpi_t *p_cpi, uint16_t cpi_key_id, char *str)
 
 int cpi_get_public_key(struct _cpi_t *p_cpi, uint16_t cpi_key_id, char *str)
 {
-    request_info req_info = { .raw_size = sizeof(cpi_key_id), .raw_data = &cpi_key_id };
-    response_info res_info = { .str_size = CPI_MAX_RESULT_SIZE, .raw_size = 0, .raw_data = str };
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_PKEY, .key_id = cpi_key_id, .out = { str }, .out_size = { CPI_MAX_RESULT_SIZE }, .priority = CPI_PRIORITY_BULK };
 
-    return cpi_get_generic_data(p_cpi, "!!!!PKEY", 0, &req_info, 1, &res_info, 1);
+    return cpi_execute_batch(p_cpi, &cmd, 1);
 }
 
 int cpi_get_version_data(struct _cpi_t *p_cpi, uint8_t *raw_vers)
 {
-    response_info res_info = { .str_size = 8, .raw_size = 6, .raw_data = raw_vers };
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_VERS, .out = { raw_vers }, .out_size = { CPI_VERSION_SIZE } };
 
-    /*! use generic data utility function to obtain version data */
-    return cpi_get_generic_data(p_cpi, "!!!!VERS", "VRSR", 0, 0, &res_info, 1);
+    /*! use batch execution to obtain version data */
+    return cpi_execute_batch(p_cpi, &cmd, 1);
 }
 
 /*! utility function to construct a 16 bit integer in host byte order, from
@@ -284,188 +290,109 @@ int cpi_get_version_number(struct _cpi_t *p_cpi, uint16_t *p_vers_major, uint16_
 
 int cpi_set_alarm_time(struct _cpi_t *p_cpi, uint32_t alarm_time)
 {
-    request_info req_info = { .raw_size = sizeof(alarm_time), .raw_data = &alarm_time };
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_ALRM, .value = alarm_time, .priority = CPI_PRIORITY_URGENT };
 
-    int ret = cpi_get_generic_data(p_cpi, "!!!!ALRM", "ASET", &req_info, 1, 0, 0);
-
-    if(CPI_FAILED(ret)) { return ret; }
-
-    return CPI_OK;
+    return cpi_execute_batch(p_cpi, &cmd, 1);
 }
 
 int cpi_trigger_power_down(struct _cpi_t *p_cpi)
 {
-    return cpi_get_generic_data(p_cpi, "!!!!DOWN", 0, 0, 0, 0, 0);
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_DOWN };
+
+    return cpi_execute_batch(p_cpi, &cmd, 1);
 }
 
 int cpi_trigger_reset(struct _cpi_t *p_cpi)
 {
-    return cpi_get_generic_data(p_cpi, "!!!!RSET", 0, 0, 0, 0, 0);
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_RSET };
+
+    return cpi_execute_batch(p_cpi, &cmd, 1);
 }
 
 int cpi_get_current_time(struct _cpi_t *p_cpi, uint32_t *p_cur_time)
 {
-    response_info ri = { .str_size = 8, .raw_size = 4, .raw_data = p_cur_time };
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_TIME, .priority = CPI_PRIORITY_URGENT };
+
+    /*! use batch execution to obtain current time */
+    int ret = cpi_execute_batch(p_cpi, &cmd, 1);
 
-    /*! use generic data utility function to obtain current time */
-    return cpi_get_generic_data(p_cpi, "!!!!TIME", "TIME", 0, 0, &ri, 1);
+    if(CPI_FAILED(ret)) { return ret; }
+
+    *p_cur_time = cmd.value;
+
+    return CPI_OK;
 }
 
 int cpi_get_owner_key_index(struct _cpi_t *p_cpi, uint32_t *p_oki)
 {
-    response_info ri = { .str_size = 8, .raw_size = 4, .raw_data = p_oki };
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_CKEY, .priority = CPI_PRIORITY_URGENT };
+
+    /*! use batch execution to obtain current owner key */
+    int ret = cpi_execute_batch(p_cpi, &cmd, 1);
+
+    if(CPI_FAILED(ret)) { return ret; }
 
-    /*! use generic data utility function to obtain current owner key */
-    return cpi_get_generic_data(p_cpi, "!!!!CKEY", "CKEY", 0, 0, &ri, 1);
+    *p_oki = cmd.value;
+
+    return CPI_OK;
 }
 
 int cpi_get_serial_number(struct _cpi_t *p_cpi, uint8_t *raw_serial)
 {
-    response_info ri = { .str_size = 24, .raw_size = 16, .raw_data = raw_serial };
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_SNUM, .out = { raw_serial }, .out_size = { CPI_SERIAL_NUMBER_SIZE } };
 
-    /*! use generic data utility function to obtain serial number data */
-    return cpi_get_generic_data(p_cpi, "!!!!SNUM", "SNUM", 0, 0, &ri, 1);
+    /*! use batch execution to obtain serial number data */
+    return cpi_execute_batch(p_cpi, &cmd, 1);
 }
 
 int cpi_get_hardware_version_data(struct _cpi_t *p_cpi, uint8_t *raw_hard_vers)
 {
-    response_info ri = { .str_size = 24, .raw_size = 16, .raw_data = raw_hard_vers };
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_HWVR, .out = { raw_hard_vers }, .out_size = { CPI_HARDWARE_VERSION_SIZE } };
 
-    /*! use generic data utility function to obtain hardware version data */
-    return cpi_get_generic_data(p_cpi, "!!!!HWVR", "HVRS", 0, 0, &ri, 1);
+    /*! use batch execution to obtain hardware version data */
+    return cpi_execute_batch(p_cpi, &cmd, 1);
 }
 
 int cpi_issue_challenge(struct _cpi_t *p_cpi, uint16_t cpi_key_id, uint8_t *rand_data, uint8_t *result1, uint8_t *result2, uint8_t *result3)
 {
-    request_info req_info[2] = 
+    cpi_cmd_t cmd = 
     { 
-        { .raw_size = sizeof(cpi_key_id), .raw_data = &cpi_key_id },
-        { .raw_size = CPI_RNDX_SIZE, .raw_data = rand_data }
-    };
-
-#if defined(CNPLATFORM_falconwing)
-    response_info res_info[3] = 
-    {
-        { .str_size = 373, .raw_size = CPI_RESULT1_SIZE, .raw_data = result1 },
-        { .str_size = 173, .raw_size = CPI_RESULT2_SIZE, .raw_data = result2 },
-        { .str_size = 567, .raw_size = CPI_RESULT3_SIZE, .raw_data = result3 },
+        .cmd = CPI_CMD_CHAL, 
+        .key_id = cpi_key_id, 
+        .rand_data = rand_data,
+        .out = { result1, result2, result3 },
+        .out_size = { CPI_RESULT1_SIZE, CPI_RESULT2_SIZE, CPI_RESULT3_SIZE },
+        .priority = CPI_PRIORITY_BULK
     };
 
-    /*! use generic data utility function to issue challenge */
-    return cpi_get_generic_data(p_cpi, "!!!!CHAL", "RESP", req_info, 2, res_info, 3);
-#else
-    response_info res_info[2] = 
-    {
-        { .str_size = 373, .raw_size = CPI_RESULT1_SIZE, .raw_data = result1 },
-        { .str_size = 173, .raw_size = CPI_RESULT2_SIZE, .raw_data = result2 },
-    };
-
-    /*! use generic data utility function to issue challenge */
-    return cpi_get_generic_data(p_cpi, "!!!!CHAL", "RESP", req_info, 2, res_info, 2);
-#endif
+    /*! use batch execution to issue challenge */
+    return cpi_execute_batch(p_cpi, &cmd, 1);
 }
 
-static int cpi_get_generic_data(struct _cpi_t *p_cpi, char *cmd, char *cmd_ack, request_info *p_request_info, int req_count, response_info *p_response_info, int res_count)
+int cpi_execute_batch(struct _cpi_t *p_cpi, cpi_cmd_t *cmds, size_t n)
 {
-    /*! sanity check - null ptr */
-    if(p_cpi == 0) { return CPI_INVALID_PARAM; }
+    /*! first failure, reported as the batch result */
+    int batch_ret = CPI_OK;
 
-    /*! sanity check - initialization */
-    if(!p_cpi->is_initialized) { return CPI_INVALID_CALL; }
+    size_t v;
 
-    /*! wake up CP */
-    {
-        int ret = cpi_util_wakeup_cp(p_cpi);
-    //  printf( "failed to wake up\n" );
-        if(CPI_FAILED(ret)) { return ret; }
-    }
-
-    /*! use command to make request */
-    {
-        int ret = cpi_util_write_str(p_cpi, cmd);
-
-    //  printf( "failed request\n" );
-        if(CPI_FAILED(ret)) { return ret; }
-
-        int cur_req = 0;
-
-        /*! optionally, send associated request data */
-        for(cur_req = 0; cur_req < req_count; cur_req++)
-        {
-            ret = cpi_util_write_bin(p_cpi, p_request_info[cur_req].raw_data, p_request_info[cur_req].raw_size);
-
-        //      printf( "failed req data\n" );
-            if(CPI_FAILED(ret)) { return ret; }
-        }
-
-        ret = cpi_util_write_eof(p_cpi);
+    /*! sanity check - null ptr */
+    if( (p_cpi == 0) || ((cmds == 0) && (n > 0)) ) { return CPI_INVALID_PARAM; }
 
-    //  printf( "failed write eof\n" );
-        if(CPI_FAILED(ret)) { return ret; }
-    }
+    /*! sanity check - initialization */
+    if( !p_cpi->is_initialized || ((p_cpi->async == 0) && (p_cpi->remote == 0)) ) { return CPI_INVALID_CALL; }
 
-    /*! read and validate cmd_ack */
-    if(cmd_ack != 0)
+    /*! queue every entry (or forward them to the daemon), and wait for them to complete */
     {
-        int size = 4;
-
-        int ret = cpi_util_read_str(p_cpi, p_cpi->tmp_buff, &size);
+        int ret = (p_cpi->remote != 0) ? cpi_remote_execute(p_cpi, cmds, n) : cpi_async_execute(p_cpi, cmds, n);
 
-    //  printf( "failed to read ack\n" );
         if(CPI_FAILED(ret)) { return ret; }
-
-        /*! @todo we should probably return CPI_ACCESS_DENIED when appropriate */
-
-        if( (size != 4) || (strncmp(p_cpi->tmp_buff, cmd_ack, 4) != 0) ) { return CPI_FAIL; }
     }
 
-    int cur_resp = 0;
-
-    /*! retrieve generic data */
-    for(cur_resp = 0; cur_resp < res_count; cur_resp++)
+    for(v=0;v<n;v++)
     {
-        int gen_size = p_response_info[cur_resp].str_size + 1;
-
-        /*! read generic data */
-        {
-            int ret = cpi_util_read_str(p_cpi, p_cpi->tmp_buff, &gen_size);
-        //      printf( "failed to read generic data\n" );
-
-            if(CPI_FAILED(ret)) { return ret; }
-
-            // this check is probably obsolete, since we dont need to know size beforehand
-            //if(gen_size != (p_response_info[cur_resp].str_size + 1) ) { return CPI_FAIL; }
-
-            /*! change LF to null termninator */
-            p_cpi->tmp_buff[gen_size] = '\0';
-        }
-
-        /*! decode base64 data into raw data */
-        if(p_response_info[cur_resp].raw_size > 0)
-        {
-            int size = p_response_info[cur_resp].raw_size;
-
-            int ret = cpi_util_decode_str(p_cpi, p_cpi->tmp_buff, /*p_response_info[cur_resp].str_size*/gen_size, p_response_info[cur_resp].raw_data, &size);
-
-        //      printf( "failed to decode string\n" );
-            if(CPI_FAILED(ret)) { return ret; }
-
-            if(size != p_response_info[cur_resp].raw_size) { return CPI_FAIL; }
-        }
-        else
-        {
-            memcpy(p_response_info[cur_resp].raw_data, p_cpi->tmp_buff, gen_size);
-        }
+        if(CPI_FAILED(cmds[v].status)) { batch_ret = cmds[v].status; break; }
     }
 
-    /*! retrieve EOF character */
-    {
-        cpi_util_read_eof(p_cpi);
-
-        // this check is probably obsolete, since we may have thrown out EOF above */
-        //if(CPI_FAILED(ret)) { return ret; }
-    }
-
-    return CPI_OK;
+    return batch_ret;
 }
-
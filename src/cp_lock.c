@@ -0,0 +1,578 @@
+/*
+ * cp_lock.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the cross-process CP lock, which gives a process
+ * exclusive use of the serial device from cpi_init() to cpi_close().
+ *
+ * Processes queue for the device in a small shared segment (a file in the
+ * lock directory, mapped by every process using the same device), guarded by
+ * a robust, process-shared mutex. The device is granted in arrival order;
+ * waiters sleep on a process-shared condition until the owner releases it, or
+ * their timeout expires. A process which dies while queued or while owning
+ * the device is dropped by the next waiter to notice, so the queue never
+ * stalls.
+ *
+ * The owner also holds an open file description (OFD) write lock on the
+ * device, which the kernel releases on close or exit, and which keeps out
+ * processes which do not use the shared segment. Processes which can not use
+ * the segment poll for that lock instead, until their timeout expires, and
+ * say so on stderr.
+ *
+ * The lock directory is created mode 2770, with the group of the first device
+ * queued for, so that every user allowed to open the device (typically its
+ * group's members) shares the queue, and segments inherit that group. The
+ * directory and segments are only used if they are not symbolic links, are
+ * writable by no one outside their group, and are ours or in one of our
+ * groups, so no one outside that group can plant a file there or hold the
+ * mutex.
+ */
+
+#include "cp_interface.h"
+#include "cp_utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*! OFD lock commands, as defined by Linux 3.15 (not exposed without _GNU_SOURCE) */
+#ifndef F_OFD_SETLK
+#define F_OFD_GETLK         36
+#define F_OFD_SETLK         37
+#endif
+
+/*! shared segment path, in the lock directory, from the device number and inode of the serial device */
+#define LOCK_PATH_FMT       "%s/lock-%llx-%llx"
+
+/*! maximum number of supplementary groups checked for a shared directory or segment */
+#define LOCK_MAX_GROUPS     0x100
+
+/*! shared segment magic, "CPIL" (set once the segment is initialized) */
+#define LOCK_MAGIC          0x4C495043
+
+/*! maximum number of queued processes */
+#define LOCK_MAX_WAITERS    0x40
+
+/*! interval at which waiters check that the owner is still alive, in ms */
+#define LOCK_POLL_MS        100
+
+/*! longest wait for the shared mutex on release, in ms, after which the device is released regardless */
+#define LOCK_RELEASE_MS     1000
+
+/*! queued process */
+typedef struct _lock_waiter
+{
+    uint32_t token;     /*!< unique ticket */
+    int32_t  pid;       /*!< waiting process */
+    uint64_t since;     /*!< time the process joined the queue (CLOCK_MONOTONIC, in ns) */
+}
+lock_waiter;
+
+/*! shared segment, one per serial device */
+typedef struct _lock_shared
+{
+    uint32_t magic;                         /*!< LOCK_MAGIC, once initialized */
+    pthread_mutex_t mutex;                  /*!< guards everything below */
+    pthread_cond_t cond;                    /*!< signalled whenever the owner or the queue changes */
+    uint32_t next_token;                    /*!< last ticket handed out */
+    uint32_t owner_token;                   /*!< ticket of the owner (0 if none) */
+    int32_t  owner_pid;                     /*!< owning process */
+    uint64_t owner_since;                   /*!< time the owner was granted the device (CLOCK_MONOTONIC, in ns) */
+    lock_waiter queue[LOCK_MAX_WAITERS];    /*!< queued processes, in arrival order */
+    int head;                               /*!< index of the oldest queued process */
+    int count;                              /*!< number of queued processes */
+    cpi_lock_metrics_t metrics;             /*!< see cpi_get_lock_metrics */
+}
+lock_shared;
+
+/*! lock state, one per initialized CPI instance */
+typedef struct _cpi_lock
+{
+    /*! shared segment (null if it could not be mapped, in which case only the OFD lock is used) */
+    lock_shared *p_shared;
+    /*! our ticket, while owning the device */
+    uint32_t token;
+    /*! fcntl command used for the device lock (F_OFD_SETLK, or F_SETLK on kernels without OFD locks) */
+    int lock_cmd;
+}
+cpi_lock;
+
+/*! utility function to read the monotonic clock, which is shared by every process, in ns */
+static uint64_t lock_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*! utility function to record a duration in a log2 histogram (bucket b holds durations under 2^b ms) */
+static void lock_record(uint32_t *hist, uint32_t *p_max_us, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+
+    int bucket = 0;
+
+    while( (bucket < CPI_METRICS_BUCKETS - 1) && (us >= (1000ULL << bucket)) ) { bucket++; }
+
+    hist[bucket]++;
+
+    if(*p_max_us < us) { *p_max_us = (us > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)us; }
+
+    return;
+}
+
+/*! utility function to check whether a process is still alive */
+static int lock_alive(int32_t pid)
+{
+    /*! EPERM means it exists, under another user */
+    return (kill(pid, 0) == 0) || (errno != ESRCH);
+}
+
+/*! utility function to lock the shared mutex by a CLOCK_MONOTONIC deadline (0 for none), recovering it from a process which died holding it (returns 0 on timeout) */
+static int lock_enter(lock_shared *p_shared, uint64_t deadline)
+{
+    struct timespec ts;
+
+    uint64_t now = lock_now(), when = 0;
+
+    int ret = 0;
+
+    if(deadline == 0) { ret = pthread_mutex_lock(&p_shared->mutex); }
+    else
+    {
+        /*! pthread_mutex_timedlock() only takes CLOCK_REALTIME */
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        when = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec + ((deadline > now) ? deadline - now : 0);
+
+        ts.tv_sec = when / 1000000000ULL;
+        ts.tv_nsec = when % 1000000000ULL;
+
+        ret = pthread_mutex_timedlock(&p_shared->mutex, &ts);
+    }
+
+    if(ret == EOWNERDEAD) { pthread_mutex_consistent(&p_shared->mutex); ret = 0; }
+
+    return ret == 0;
+}
+
+/*! utility function to take or release the device lock (returns 0 on failure) */
+static int lock_device(struct _cpi_t *p_cpi, cpi_lock *p_lock, int type)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+
+    if(fcntl(p_cpi->serial_file, p_lock->lock_cmd, &fl) == 0) { return 1; }
+
+    /*! kernel without OFD locks, fall back to process-associated locks */
+    if( (errno == EINVAL) && (p_lock->lock_cmd != F_SETLK) )
+    {
+        p_lock->lock_cmd = F_SETLK;
+
+        return lock_device(p_cpi, p_lock, type);
+    }
+
+    return 0;
+}
+
+/*! utility function to check whether another open file description still holds the device lock */
+static int lock_device_held(struct _cpi_t *p_cpi, cpi_lock *p_lock)
+{
+    struct flock fl;
+
+    /*! process-associated locks of our own process are not reported, so assume they are held */
+    if(p_lock->lock_cmd != F_OFD_SETLK) { return 1; }
+
+    memset(&fl, 0, sizeof(fl));
+
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+
+    if(fcntl(p_cpi->serial_file, F_OFD_GETLK, &fl) == -1) { return 1; }
+
+    return fl.l_type != F_UNLCK;
+}
+
+/*! utility function to check that a file is trusted: writable by no one outside its group, and ours or in one of our groups */
+static int lock_trusted(const struct stat *p_st)
+{
+    gid_t groups[LOCK_MAX_GROUPS];
+
+    int count = 0, v;
+
+    if(p_st->st_mode & S_IWOTH) { return 0; }
+
+    if( (p_st->st_uid == geteuid()) || (p_st->st_gid == getegid()) ) { return 1; }
+
+    count = getgroups(LOCK_MAX_GROUPS, groups);
+
+    for(v=0;v<count;v++) { if(groups[v] == p_st->st_gid) { return 1; } }
+
+    return 0;
+}
+
+/*! utility function to map the shared segment of a serial device, initializing it if we are first (returns null on failure, with the reason in *p_reason) */
+static lock_shared *lock_map(const char *lock_dir, const char *serial_device_path, const char **p_reason)
+{
+    char path[PATH_MAX];
+
+    struct stat st;
+
+    struct flock fl;
+
+    lock_shared *p_shared = 0;
+
+    gid_t group = 0;
+
+    int fd = -1;
+
+    *p_reason = "can not stat the device";
+
+    if(stat(serial_device_path, &st) == -1) { return 0; }
+
+    group = st.st_gid;
+
+    snprintf(path, sizeof(path), LOCK_PATH_FMT, lock_dir, (unsigned long long)st.st_rdev, (unsigned long long)st.st_ino);
+
+    /*! shared with the device's group; the mode is set again, as the umask may have taken the group's access */
+    if(mkdir(lock_dir, 0770) == 0)
+    {
+        /*! if we are not in the device's group, the directory keeps ours */
+        if(chown(lock_dir, (uid_t)-1, group) == -1) { }
+
+        chmod(lock_dir, S_ISGID | 0770);
+    }
+    else if(errno != EEXIST)
+    {
+        *p_reason = "can not create the directory";
+
+        return 0;
+    }
+
+    /*! the directory must be a real one, and trusted, or anyone could swap the segment under us */
+    *p_reason = "the directory is not a directory, or is open to other users";
+
+    if( (lstat(lock_dir, &st) == -1) || !S_ISDIR(st.st_mode) || !lock_trusted(&st) ) { return 0; }
+
+    *p_reason = "can not open the segment (the directory may belong to another group)";
+
+    fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0660);
+
+    if(fd == -1) { return 0; }
+
+    *p_reason = "the segment is not a regular file, or is open to other users";
+
+    if( (fstat(fd, &st) == -1) || !S_ISREG(st.st_mode) || !lock_trusted(&st) ) { close(fd); return 0; }
+
+    /*! open the segment to the directory's group, in spite of the umask */
+    if( (st.st_uid == geteuid()) && ((st.st_mode & 0777) != 0660) ) { fchmod(fd, 0660); }
+
+    /*! serialize initialization; this lock is held only for a moment */
+    memset(&fl, 0, sizeof(fl));
+
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+
+    while( (fcntl(fd, F_SETLKW, &fl) == -1) && (errno == EINTR) ) { }
+
+    if(ftruncate(fd, sizeof(lock_shared)) == 0)
+    {
+        p_shared = (lock_shared*)mmap(0, sizeof(lock_shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if(p_shared == MAP_FAILED) { p_shared = 0; }
+    }
+
+    if( (p_shared != 0) && (p_shared->magic != LOCK_MAGIC) )
+    {
+        pthread_mutexattr_t mattr;
+        pthread_condattr_t cattr;
+
+        memset(p_shared, 0, sizeof(lock_shared));
+
+        pthread_mutexattr_init(&mattr);
+        pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&p_shared->mutex, &mattr);
+        pthread_mutexattr_destroy(&mattr);
+
+        pthread_condattr_init(&cattr);
+        pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+        pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+        pthread_cond_init(&p_shared->cond, &cattr);
+        pthread_condattr_destroy(&cattr);
+
+        __atomic_store_n(&p_shared->magic, LOCK_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    /*! the mapping stays valid once the file is closed */
+    close(fd);
+
+    *p_reason = "can not map the segment";
+
+    return p_shared;
+}
+
+/*! utility function to drop queued processes which have died, and the owner if it has (must hold the mutex) */
+static void lock_prune(struct _cpi_t *p_cpi, cpi_lock *p_lock, lock_shared *p_shared)
+{
+    int v, kept = 0;
+
+    /*! the owner takes the device lock before it is recorded, and drops it after, so a free device means it exited */
+    if( (p_shared->owner_token != 0) && (!lock_alive(p_shared->owner_pid) || !lock_device_held(p_cpi, p_lock)) )
+    {
+        lock_record(p_shared->metrics.hold_hist, &p_shared->metrics.hold_max_us, lock_now() - p_shared->owner_since);
+
+        p_shared->owner_token = 0;
+        p_shared->metrics.recovered++;
+    }
+
+    for(v=0;v<p_shared->count;v++)
+    {
+        lock_waiter *p_waiter = &p_shared->queue[(p_shared->head + v) % LOCK_MAX_WAITERS];
+
+        if(!lock_alive(p_waiter->pid)) { p_shared->metrics.recovered++; continue; }
+
+        p_shared->queue[(p_shared->head + kept) % LOCK_MAX_WAITERS] = *p_waiter;
+
+        kept++;
+    }
+
+    p_shared->count = kept;
+    p_shared->metrics.waiting = kept;
+
+    return;
+}
+
+/*! utility function to remove a ticket from the queue (must hold the mutex) */
+static void lock_dequeue(lock_shared *p_shared, uint32_t token)
+{
+    int v, kept = 0;
+
+    for(v=0;v<p_shared->count;v++)
+    {
+        lock_waiter *p_waiter = &p_shared->queue[(p_shared->head + v) % LOCK_MAX_WAITERS];
+
+        if(p_waiter->token == token) { continue; }
+
+        p_shared->queue[(p_shared->head + kept) % LOCK_MAX_WAITERS] = *p_waiter;
+
+        kept++;
+    }
+
+    p_shared->count = kept;
+    p_shared->metrics.waiting = kept;
+
+    return;
+}
+
+int cpi_lock_acquire(struct _cpi_t *p_cpi, const char *serial_device_path, int timeout_ms)
+{
+    cpi_lock *p_lock = (cpi_lock*)cpi_util_malloc(sizeof(cpi_lock));
+
+    lock_shared *p_shared = 0;
+
+    uint64_t start = lock_now(), deadline = start + (uint64_t)timeout_ms*1000000ULL;
+
+    const char *lock_dir = (p_cpi->lock_dir != 0) ? p_cpi->lock_dir : CPI_LOCK_DIR, *reason = 0;
+
+    uint32_t token = 0;
+
+    int ret = CPI_ACCESS_DENIED;
+
+    /*! handle allocation failure */
+    if(p_lock == 0) { return CPI_OUT_OF_MEMORY; }
+
+    memset(p_lock, 0, sizeof(cpi_lock));
+
+    p_lock->lock_cmd = F_OFD_SETLK;
+
+    p_cpi->lock = p_lock;
+
+    p_lock->p_shared = p_shared = lock_map(lock_dir, serial_device_path, &reason);
+
+    /*! no shared segment (e.g. no access to its directory), so there is no queue to wait in */
+    if(p_shared == 0)
+    {
+        fprintf(stderr, "cpi: no lock queue in %s for %s (%s), polling for the device instead\n", lock_dir, serial_device_path, reason);
+
+        while(!lock_device(p_cpi, p_lock, F_WRLCK))
+        {
+            if( (timeout_ms >= 0) && (lock_now() >= deadline) ) { return CPI_ACCESS_DENIED; }
+
+            usleep(LOCK_POLL_MS*1000);
+        }
+
+        return CPI_OK;
+    }
+
+    /*! the mutex is only held for moments, but never wait for it past our own deadline */
+    if(!lock_enter(p_shared, (timeout_ms >= 0) ? deadline : 0)) { return CPI_ACCESS_DENIED; }
+
+    lock_prune(p_cpi, p_lock, p_shared);
+
+    if(p_shared->count == LOCK_MAX_WAITERS) { pthread_mutex_unlock(&p_shared->mutex); return CPI_ACCESS_DENIED; }
+
+    /*! join the queue */
+    {
+        lock_waiter *p_waiter = &p_shared->queue[(p_shared->head + p_shared->count) % LOCK_MAX_WAITERS];
+
+        /*! 0 means no owner */
+        if(++p_shared->next_token == 0) { p_shared->next_token = 1; }
+
+        token = p_shared->next_token;
+
+        p_waiter->token = token;
+        p_waiter->pid = getpid();
+        p_waiter->since = start;
+
+        p_shared->count++;
+        p_shared->metrics.waiting = p_shared->count;
+    }
+
+    for(;;)
+    {
+        uint64_t now = 0, wake = 0;
+
+        struct timespec ts;
+
+        /*! our turn; the device lock may still be held by a process outside the queue */
+        if( (p_shared->owner_token == 0) && (p_shared->queue[p_shared->head].token == token) && lock_device(p_cpi, p_lock, F_WRLCK) )
+        {
+            now = lock_now();
+
+            p_shared->head = (p_shared->head + 1) % LOCK_MAX_WAITERS;
+            p_shared->count--;
+
+            p_shared->owner_token = token;
+            p_shared->owner_pid = getpid();
+            p_shared->owner_since = now;
+
+            p_shared->metrics.waiting = p_shared->count;
+            p_shared->metrics.acquired++;
+
+            lock_record(p_shared->metrics.wait_hist, &p_shared->metrics.wait_max_us, now - start);
+
+            p_lock->token = token;
+
+            ret = CPI_OK;
+            break;
+        }
+
+        now = lock_now();
+
+        /*! out of time, give up our place */
+        if( (timeout_ms >= 0) && (now >= deadline) )
+        {
+            lock_dequeue(p_shared, token);
+
+            p_shared->metrics.timeouts++;
+
+            /*! we may have been at the head */
+            pthread_cond_broadcast(&p_shared->cond);
+
+            break;
+        }
+
+        /*! sleep until the queue changes, checking now and then that the owner is still alive */
+        wake = now + LOCK_POLL_MS*1000000ULL;
+
+        if( (timeout_ms >= 0) && (deadline < wake) ) { wake = deadline; }
+
+        ts.tv_sec = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+
+        if(pthread_cond_timedwait(&p_shared->cond, &p_shared->mutex, &ts) == EOWNERDEAD) { pthread_mutex_consistent(&p_shared->mutex); }
+
+        lock_prune(p_cpi, p_lock, p_shared);
+    }
+
+    pthread_mutex_unlock(&p_shared->mutex);
+
+    return ret;
+}
+
+void cpi_lock_release(struct _cpi_t *p_cpi)
+{
+    cpi_lock *p_lock = (cpi_lock*)p_cpi->lock;
+
+    if(p_lock == 0) { return; }
+
+    if(p_lock->p_shared != 0)
+    {
+        lock_shared *p_shared = p_lock->p_shared;
+
+        /*! release the device before handing it on; we may have been dropped, if thought dead */
+        if(lock_enter(p_shared, lock_now() + LOCK_RELEASE_MS*1000000ULL))
+        {
+            if( (p_lock->token != 0) && (p_shared->owner_token == p_lock->token) )
+            {
+                lock_device(p_cpi, p_lock, F_UNLCK);
+
+                lock_record(p_shared->metrics.hold_hist, &p_shared->metrics.hold_max_us, lock_now() - p_shared->owner_since);
+
+                p_shared->owner_token = 0;
+
+                pthread_cond_broadcast(&p_shared->cond);
+            }
+
+            pthread_mutex_unlock(&p_shared->mutex);
+        }
+        /*! the next waiter finds the device free, and drops us as the owner */
+        else if(p_lock->token != 0)
+        {
+            lock_device(p_cpi, p_lock, F_UNLCK);
+        }
+
+        munmap(p_shared, sizeof(lock_shared));
+    }
+    else if(p_cpi->serial_file != -1)
+    {
+        lock_device(p_cpi, p_lock, F_UNLCK);
+    }
+
+    cpi_util_free(p_lock);
+
+    p_cpi->lock = 0;
+
+    return;
+}
+
+int cpi_get_lock_metrics(struct _cpi_t *p_cpi, cpi_lock_metrics_t *p_metrics)
+{
+    cpi_lock *p_lock = 0;
+
+    /*! sanity check - null ptr */
+    if( (p_cpi == 0) || (p_metrics == 0) ) { return CPI_INVALID_PARAM; }
+
+    p_lock = (cpi_lock*)p_cpi->lock;
+
+    /*! daemon connections, and devices without a shared segment, have no queue */
+    if( (p_lock == 0) || (p_lock->p_shared == 0) ) { return CPI_NOTIMPL; }
+
+    if(!lock_enter(p_lock->p_shared, lock_now() + LOCK_RELEASE_MS*1000000ULL)) { return CPI_BUSY; }
+
+    *p_metrics = p_lock->p_shared->metrics;
+
+    pthread_mutex_unlock(&p_lock->p_shared->mutex);
+
+    return CPI_OK;
+}
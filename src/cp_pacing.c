@@ -0,0 +1,162 @@
+/*
+ * cp_pacing.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements pacing profiles, which record the delay between
+ * written characters that "cpi calibrate" found to be reliable for each CP.
+ *
+ * A profile is a text file with one line per CP and platform:
+ *
+ *   <serial number, in hex> <platform> <delay in us>
+ *
+ * Lines starting with '#' are comments. cpi_init only asks the CP for its
+ * serial number if the profile has a line for the platform it was built for.
+ */
+
+#include "cp_interface.h"
+#include "cp_utility.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+/*! platform name, as recorded in pacing profiles */
+#if defined(CNPLATFORM_ironforge)
+#define PACING_PLATFORM     "ironforge"
+#elif defined(CNPLATFORM_silvermoon)
+#define PACING_PLATFORM     "silvermoon"
+#elif defined(CNPLATFORM_falconwing)
+#define PACING_PLATFORM     "falconwing"
+#elif defined(CNPLATFORM_stormwind)
+#define PACING_PLATFORM     "stormwind"
+#else
+#define PACING_PLATFORM     "generic"
+#endif
+
+/*! maximum length of a profile line */
+#define PACING_LINE_SIZE    0x100
+
+/*! maximum length of a platform name, including null terminator */
+#define PACING_PLATFORM_SIZE 0x20
+
+/*! profile line being saved */
+typedef struct _pacing_line
+{
+    char serial[CPI_UTIL_SERIAL_SIZE];
+    uint32_t delay_us;
+}
+pacing_line;
+
+/*! utility function to parse a profile line (returns 0 for comments and malformed lines) */
+static int pacing_parse(const char *line, char *serial, char *platform, uint32_t *p_delay_us)
+{
+    unsigned delay_us = 0;
+
+    if(line[0] == '#') { return 0; }
+
+    if(sscanf(line, "%32s %31s %u", serial, platform, &delay_us) != 3) { return 0; }
+
+    *p_delay_us = delay_us;
+
+    return 1;
+}
+
+/*! utility function to ask the CP of an initialized CPI instance for its serial number, in hex (returns 0 on failure) */
+static int pacing_read_serial(cpi_t *p_cpi, char *serial)
+{
+    uint8_t raw_serial[CPI_SERIAL_NUMBER_SIZE];
+
+    cpi_cmd_t cmd = { .cmd = CPI_CMD_SNUM, .out = { raw_serial }, .out_size = { sizeof(raw_serial) } };
+
+    if(CPI_FAILED(cpi_execute_batch(p_cpi, &cmd, 1)) || CPI_FAILED(cmd.status)) { return 0; }
+
+    cpi_util_format_serial(raw_serial, serial);
+
+    return 1;
+}
+
+void cpi_pacing_load(cpi_t *p_cpi, const char *profile_path)
+{
+    char serial[CPI_UTIL_SERIAL_SIZE], line[PACING_LINE_SIZE];
+
+    int have_serial = 0;
+
+    FILE *file = 0;
+
+    if(profile_path == 0) { profile_path = CPI_PACING_PROFILE; }
+
+    /*! profiles disabled */
+    if(profile_path[0] == '\0') { return; }
+
+    /*! no profile, the default delay stands */
+    file = fopen(profile_path, "r");
+
+    if(file == 0) { return; }
+
+    while(fgets(line, sizeof(line), file) != 0)
+    {
+        char line_serial[CPI_UTIL_SERIAL_SIZE], line_platform[PACING_PLATFORM_SIZE];
+
+        uint32_t delay_us = 0;
+
+        if(!pacing_parse(line, line_serial, line_platform, &delay_us)) { continue; }
+
+        if(strcmp(line_platform, PACING_PLATFORM) != 0) { continue; }
+
+        /*! the first line which could apply costs an exchange at the default delay */
+        if(!have_serial)
+        {
+            if(!pacing_read_serial(p_cpi, serial)) { break; }
+
+            have_serial = 1;
+        }
+
+        if(strcasecmp(line_serial, serial) == 0) { cpi_set_write_delay(p_cpi, delay_us); break; }
+    }
+
+    fclose(file);
+
+    return;
+}
+
+/*! utility function to tell whether a profile line is the one being saved (see cpi_util_save_state) */
+static int pacing_replaced(const char *line, void *arg)
+{
+    const pacing_line *p_line = (const pacing_line*)arg;
+
+    char line_serial[CPI_UTIL_SERIAL_SIZE], line_platform[PACING_PLATFORM_SIZE];
+
+    uint32_t line_delay_us = 0;
+
+    return pacing_parse(line, line_serial, line_platform, &line_delay_us) && (strcasecmp(line_serial, p_line->serial) == 0) && (strcmp(line_platform, PACING_PLATFORM) == 0);
+}
+
+/*! utility function to write the profile line being saved (see cpi_util_save_state) */
+static void pacing_append(FILE *file, void *arg)
+{
+    const pacing_line *p_line = (const pacing_line*)arg;
+
+    fprintf(file, "%s %s %u\n", p_line->serial, PACING_PLATFORM, p_line->delay_us);
+
+    return;
+}
+
+int cpi_save_pacing(const char *profile_path, const uint8_t *raw_serial, uint32_t delay_us)
+{
+    pacing_line save;
+
+    /*! sanity check - null ptr */
+    if(raw_serial == 0) { return CPI_INVALID_PARAM; }
+
+    if(profile_path == 0) { profile_path = CPI_PACING_PROFILE; }
+
+    cpi_util_format_serial(raw_serial, save.serial);
+
+    save.delay_us = delay_us;
+
+    return cpi_util_save_state(profile_path, "# CPI pacing profile: serial number, platform, delay between written characters (us)", pacing_replaced, pacing_append, &save);
+}
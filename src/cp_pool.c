@@ -0,0 +1,507 @@
+/*
+ * cp_pool.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the CPI pool. The event descriptor of every device
+ * (see cpi_get_fd) is registered with one epoll descriptor, so a single
+ * thread can keep all of the devices busy; pacing delays on one device
+ * overlap with traffic on the others.
+ */
+
+#include "cp_pool.h"
+#include "cp_utility.h"
+#include "cp_format.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+/*! state of a single device */
+typedef struct _pool_device
+{
+    /*! CPI instance (null while the device cannot be opened) */
+    cpi_t *p_cpi;
+    /*! serial device path */
+    char *path;
+    /*! per-device copy of the plan, holding results and status */
+    cpi_cmd_t cmds[CPI_MAX_PENDING];
+    /*! random data input of each CHAL entry */
+    uint8_t rand_data[CPI_MAX_PENDING][CPI_RNDX_SIZE];
+    /*! number of entries in cmds */
+    int n;
+    /*! number of submitted, uncompleted entries */
+    int pending;
+    /*! set once the plan has been reported to the caller */
+    int done;
+    /*! result storage for the plan */
+    uint8_t *arena;
+    /*! size of arena, in bytes */
+    int arena_size;
+}
+pool_device;
+
+/*! utility function to retrieve the specified device */
+static pool_device *pool_get(cpi_pool_t *p_pool, int index) { return ((pool_device**)p_pool->devices)[index]; }
+
+/*! utility function to open the device, and watch its event descriptor */
+static int pool_open(cpi_pool_t *p_pool, int index);
+
+/*! utility function to stop watching the device, and close it */
+static void pool_shut(cpi_pool_t *p_pool, int index);
+
+/*! completion callback for every plan entry */
+static void pool_complete(cpi_t *p_cpi, cpi_cmd_t *p_cmd);
+
+/*! utility function to retrieve the current time, in ms */
+static int64_t pool_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int cpi_pool_create(struct _cpi_pool_t **pp_pool)
+{
+    cpi_pool_t *p_pool = 0;
+
+    /*! sanity check - null ptr */
+    if(pp_pool == 0) { return CPI_INVALID_PARAM; }
+
+    p_pool = (cpi_pool_t*)cpi_util_malloc(sizeof(cpi_pool_t));
+
+    /*! handle allocation failure */
+    if(p_pool == 0) { return CPI_OUT_OF_MEMORY; }
+
+    memset(p_pool, 0, sizeof(cpi_pool_t));
+
+    p_pool->epoll_fd = epoll_create(16);
+
+    if(p_pool->epoll_fd == -1) { cpi_util_free(p_pool); return CPI_FAIL; }
+
+    fcntl(p_pool->epoll_fd, F_SETFD, FD_CLOEXEC);
+
+    *pp_pool = p_pool;
+
+    return CPI_OK;
+}
+
+int cpi_pool_close(struct _cpi_pool_t *p_pool)
+{
+    int v;
+
+    /*! sanity check - null ptr */
+    if(p_pool == 0) { return CPI_INVALID_PARAM; }
+
+    for(v=0;v<p_pool->count;v++)
+    {
+        pool_device *p_dev = pool_get(p_pool, v);
+
+        pool_shut(p_pool, v);
+
+        cpi_util_free(p_dev->arena);
+        cpi_util_free(p_dev->path);
+        cpi_util_free(p_dev);
+    }
+
+    cpi_util_free(p_pool->devices);
+
+    close(p_pool->epoll_fd);
+
+    cpi_util_free(p_pool);
+
+    return CPI_OK;
+}
+
+int cpi_pool_add(struct _cpi_pool_t *p_pool, const char *serial_device_path, int *p_index)
+{
+    pool_device *p_dev = 0;
+
+    int ret = CPI_OK;
+
+    /*! sanity check - null ptr */
+    if( (p_pool == 0) || (serial_device_path == 0) ) { return CPI_INVALID_PARAM; }
+
+    /*! grow device table, as needed */
+    if(p_pool->count == p_pool->capacity)
+    {
+        int capacity = (p_pool->capacity == 0) ? 8 : p_pool->capacity * 2;
+
+        pool_device **devices = (pool_device**)cpi_util_malloc(capacity * sizeof(pool_device*));
+
+        if(devices == 0) { return CPI_OUT_OF_MEMORY; }
+
+        if(p_pool->count > 0) { memcpy(devices, p_pool->devices, p_pool->count * sizeof(pool_device*)); }
+
+        cpi_util_free(p_pool->devices);
+
+        p_pool->devices = devices;
+        p_pool->capacity = capacity;
+    }
+
+    p_dev = (pool_device*)cpi_util_malloc(sizeof(pool_device));
+
+    if(p_dev == 0) { return CPI_OUT_OF_MEMORY; }
+
+    memset(p_dev, 0, sizeof(pool_device));
+
+    p_dev->path = (char*)cpi_util_malloc(strlen(serial_device_path) + 1);
+
+    if(p_dev->path == 0) { cpi_util_free(p_dev); return CPI_OUT_OF_MEMORY; }
+
+    strcpy(p_dev->path, serial_device_path);
+
+    ((pool_device**)p_pool->devices)[p_pool->count] = p_dev;
+
+    ret = pool_open(p_pool, p_pool->count);
+
+    if(CPI_FAILED(ret))
+    {
+        cpi_util_free(p_dev->path);
+        cpi_util_free(p_dev);
+
+        return ret;
+    }
+
+    if(p_index != 0) { *p_index = p_pool->count; }
+
+    p_pool->count++;
+
+    return CPI_OK;
+}
+
+const char *cpi_pool_get_path(struct _cpi_pool_t *p_pool, int index)
+{
+    if( (p_pool == 0) || (index < 0) || (index >= p_pool->count) ) { return 0; }
+
+    return pool_get(p_pool, index)->path;
+}
+
+struct _cpi_t *cpi_pool_get_cpi(struct _cpi_pool_t *p_pool, int index)
+{
+    if( (p_pool == 0) || (index < 0) || (index >= p_pool->count) ) { return 0; }
+
+    return pool_get(p_pool, index)->p_cpi;
+}
+
+/*! utility function to copy the plan to a device, and submit it (returns number of entries submitted) */
+static int pool_submit(cpi_pool_t *p_pool, int index, const cpi_cmd_t *plan, size_t n, int rand_fd)
+{
+    pool_device *p_dev = pool_get(p_pool, index);
+
+    int arena_size = 0, v;
+
+    p_dev->n = (int)n;
+    p_dev->pending = 0;
+    p_dev->done = 0;
+
+    /*! size result storage */
+    for(v=0;v<(int)n;v++) { arena_size += cpi_format_result_size(plan[v].cmd); }
+
+    if(arena_size > p_dev->arena_size)
+    {
+        cpi_util_free(p_dev->arena);
+
+        p_dev->arena = (uint8_t*)cpi_util_malloc(arena_size);
+        p_dev->arena_size = (p_dev->arena == 0) ? 0 : arena_size;
+    }
+
+    arena_size = 0;
+
+    for(v=0;v<(int)n;v++)
+    {
+        cpi_cmd_t *p_cmd = &p_dev->cmds[v];
+
+        memset(p_cmd, 0, sizeof(cpi_cmd_t));
+
+        p_cmd->cmd = plan[v].cmd;
+        p_cmd->key_id = plan[v].key_id;
+        p_cmd->value = plan[v].value;
+        p_cmd->priority = plan[v].priority;
+        p_cmd->deadline_ms = plan[v].deadline_ms;
+
+        /*! device is gone, or there is no room for results */
+        if( (p_dev->p_cpi == 0) || (p_dev->arena == 0 && cpi_format_result_size(p_cmd->cmd) > 0) )
+        {
+            p_cmd->status = (p_dev->p_cpi == 0) ? CPI_INVALID_CALL : CPI_OUT_OF_MEMORY;
+            continue;
+        }
+
+        if(cpi_format_result_size(p_cmd->cmd) > 0)
+        {
+            cpi_format_bind(p_cmd, &p_dev->arena[arena_size]);
+
+            arena_size += cpi_format_result_size(p_cmd->cmd);
+        }
+
+        /*! random data input, from the plan or fresh for this device */
+        if(p_cmd->cmd == CPI_CMD_CHAL)
+        {
+            if(plan[v].rand_data != 0)
+            {
+                memcpy(p_dev->rand_data[v], plan[v].rand_data, CPI_RNDX_SIZE);
+            }
+            else if( (rand_fd == -1) || (read(rand_fd, p_dev->rand_data[v], CPI_RNDX_SIZE) != CPI_RNDX_SIZE) )
+            {
+                p_cmd->status = CPI_FAIL;
+                continue;
+            }
+
+            p_cmd->rand_data = p_dev->rand_data[v];
+        }
+
+        /*! user_data marks entries in flight; invalid entries are not queued, and keep their validation status */
+        p_cmd->user_data = p_dev;
+
+        if(CPI_SUCCESS(cpi_submit(p_dev->p_cpi, p_cmd, pool_complete))) { p_dev->pending++; } else { p_cmd->user_data = 0; }
+    }
+
+    return p_dev->pending;
+}
+
+/*! utility function to report a finished device (returns its first failure, if any) */
+static int pool_report(cpi_pool_t *p_pool, int index, cpi_pool_callback_t callback, void *user_data)
+{
+    pool_device *p_dev = pool_get(p_pool, index);
+
+    int v;
+
+    p_dev->done = 1;
+
+    if(callback != 0) { callback(p_pool, index, p_dev->cmds, p_dev->n, user_data); }
+
+    for(v=0;v<p_dev->n;v++)
+    {
+        if(CPI_FAILED(p_dev->cmds[v].status)) { return p_dev->cmds[v].status; }
+    }
+
+    return CPI_OK;
+}
+
+int cpi_pool_execute(struct _cpi_pool_t *p_pool, const struct _cpi_cmd_t *plan, size_t n, int timeout_ms, cpi_pool_callback_t callback, void *user_data)
+{
+    /*! first failure, reported as the overall result */
+    int pool_ret = CPI_OK;
+
+    /*! number of devices which have not finished the plan */
+    int remaining = 0;
+
+    /*! random data source, for CHAL entries without rand_data */
+    int rand_fd = -1;
+
+    int64_t deadline = 0;
+
+    int v;
+
+    /*! sanity check - null ptr */
+    if( (p_pool == 0) || ((plan == 0) && (n > 0)) ) { return CPI_INVALID_PARAM; }
+
+    /*! sanity check - the whole plan is queued at once */
+    if(n > CPI_MAX_PENDING) { return CPI_INVALID_PARAM; }
+
+    for(v=0;v<(int)n;v++)
+    {
+        if( (plan[v].cmd == CPI_CMD_CHAL) && (plan[v].rand_data == 0) ) { rand_fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC); break; }
+    }
+
+    /*! start every device, reporting those with nothing to wait for right away */
+    for(v=0;v<p_pool->count;v++)
+    {
+        if(pool_submit(p_pool, v, plan, n, rand_fd) > 0) { remaining++; continue; }
+
+        {
+            int ret = pool_report(p_pool, v, callback, user_data);
+
+            if(CPI_SUCCESS(pool_ret)) { pool_ret = ret; }
+        }
+    }
+
+    if(rand_fd != -1) { close(rand_fd); }
+
+    deadline = pool_now() + timeout_ms;
+
+    while(remaining > 0)
+    {
+        struct epoll_event ev[16];
+
+        int wait_ms = -1, count = 0, e;
+
+        if(timeout_ms >= 0)
+        {
+            int64_t left = deadline - pool_now();
+
+            wait_ms = (left > 0) ? (int)left : 0;
+        }
+
+        count = epoll_wait(p_pool->epoll_fd, ev, 16, wait_ms);
+
+        if( (count < 0) && (errno == EINTR) ) { continue; }
+
+        /*! time is up - reopen devices which are still busy, failing their unfinished entries */
+        if(count <= 0)
+        {
+            for(v=0;v<p_pool->count;v++)
+            {
+                pool_device *p_dev = pool_get(p_pool, v);
+
+                int c;
+
+                if(p_dev->done) { continue; }
+
+                pool_shut(p_pool, v);
+
+                for(c=0;c<p_dev->n;c++)
+                {
+                    if(p_dev->cmds[c].user_data != 0) { p_dev->cmds[c].status = CPI_FAIL; }
+                }
+
+                p_dev->pending = 0;
+
+                pool_open(p_pool, v);
+
+                {
+                    int ret = pool_report(p_pool, v, callback, user_data);
+
+                    if(CPI_SUCCESS(pool_ret)) { pool_ret = ret; }
+                }
+            }
+
+            break;
+        }
+
+        for(e=0;e<count;e++)
+        {
+            int index = (int)ev[e].data.u32;
+
+            pool_device *p_dev = pool_get(p_pool, index);
+
+            if(p_dev->done || (p_dev->p_cpi == 0)) { continue; }
+
+            cpi_process_events(p_dev->p_cpi);
+
+            if(p_dev->pending == 0)
+            {
+                int ret = pool_report(p_pool, index, callback, user_data);
+
+                if(CPI_SUCCESS(pool_ret)) { pool_ret = ret; }
+
+                remaining--;
+            }
+        }
+    }
+
+    return pool_ret;
+}
+
+int cpi_pool_format(struct _cpi_pool_t *p_pool, int index, int format, void *out_buff, int *p_out_size)
+{
+    pool_device *p_dev = 0;
+
+    cpi_out out = { (char*)out_buff, 0, 0, 0, 0 };
+
+    const cpi_writer *p_writer = cpi_format_writer(format);
+
+    int v;
+
+    /*! sanity check - null ptr */
+    if( (p_pool == 0) || (out_buff == 0) || (p_out_size == 0) ) { return CPI_INVALID_PARAM; }
+
+    /*! sanity check - device, output format and size */
+    if( (index < 0) || (index >= p_pool->count) || (p_writer == 0) || (*p_out_size <= 0) ) { return CPI_INVALID_PARAM; }
+
+    p_dev = pool_get(p_pool, index);
+
+    out.size = *p_out_size;
+    out.data[0] = '\0';
+
+    p_writer->begin(&out);
+
+    for(v=0;v<p_dev->n;v++)
+    {
+        query_result result;
+
+        const char *type = cpi_format_type(p_dev->cmds[v].cmd);
+
+        cpi_format_result(&p_dev->cmds[v], (type != 0) ? type : "unknown", &result);
+
+        p_writer->result(&out, &result);
+    }
+
+    p_writer->end(&out);
+
+    *p_out_size = out.used;
+
+    return out.overflow ? CPI_OUT_OF_MEMORY : CPI_OK;
+}
+
+static int pool_open(cpi_pool_t *p_pool, int index)
+{
+    pool_device *p_dev = pool_get(p_pool, index);
+
+    struct epoll_event ev;
+
+    int ret = cpi_create(0, &p_dev->p_cpi);
+
+    if(CPI_FAILED(ret)) { p_dev->p_cpi = 0; return ret; }
+
+    ret = cpi_init(p_dev->p_cpi, p_dev->path);
+
+    if(CPI_FAILED(ret)) { cpi_close(p_dev->p_cpi); p_dev->p_cpi = 0; return ret; }
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)index;
+
+    if(epoll_ctl(p_pool->epoll_fd, EPOLL_CTL_ADD, cpi_get_fd(p_dev->p_cpi), &ev) != 0)
+    {
+        cpi_close(p_dev->p_cpi);
+        p_dev->p_cpi = 0;
+
+        return CPI_FAIL;
+    }
+
+    return CPI_OK;
+}
+
+static void pool_shut(cpi_pool_t *p_pool, int index)
+{
+    pool_device *p_dev = pool_get(p_pool, index);
+
+    struct epoll_event ev;
+
+    if(p_dev->p_cpi == 0) { return; }
+
+    memset(&ev, 0, sizeof(ev));
+
+    epoll_ctl(p_pool->epoll_fd, EPOLL_CTL_DEL, cpi_get_fd(p_dev->p_cpi), &ev);
+
+    cpi_close(p_dev->p_cpi);
+
+    p_dev->p_cpi = 0;
+
+    return;
+}
+
+static void pool_complete(cpi_t *p_cpi, cpi_cmd_t *p_cmd)
+{
+    pool_device *p_dev = (pool_device*)p_cmd->user_data;
+
+    (void)p_cpi;
+
+    /*! mark the entry finished, so a timeout leaves its status alone */
+    p_cmd->user_data = 0;
+
+    p_dev->pending--;
+
+    return;
+}
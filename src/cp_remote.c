@@ -0,0 +1,1432 @@
+/*
+ * cp_remote.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the CPI daemon (see cpi_serve), which owns the serial
+ * device on behalf of many client processes, and the client side of its socket
+ * protocol, used by instances whose cpi_init() was given the daemon socket.
+ *
+ * Each message is a frame: a remote_hdr, followed by its payload. A request
+ * carries a batch of commands, as remote_req records; the response carries a
+ * remote_res record for each of them, in the same order, each followed by the
+ * data written to its output buffers. A request without commands asks for the
+ * daemon's scheduler metrics, returned as a cpi_metrics_t, or, if it carries a
+ * 32 bit delay in microseconds, sets the daemon's write delay, and is answered
+ * with an empty frame. Both ends run on the same host, so fields are fixed
+ * width, in host byte order.
+ *
+ * The daemon answers each client's requests in the order they were sent, so a
+ * client keeps its requests in flight in a FIFO, and matches every response to
+ * the oldest one. Commands queued with cpi_submit() are sent as requests of
+ * their own; their responses are read by cpi_process_events(), or, for shared
+ * (CPI_INFO_THREADED) instances, by a reader thread.
+ */
+
+#include "cp_interface.h"
+#include "cp_utility.h"
+#include "cp_format.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+
+/*! frame header magic, "CPIR" */
+#define REMOTE_MAGIC        0x52495043
+
+/*! frame header */
+typedef struct _remote_hdr
+{
+    uint32_t magic;     /*!< REMOTE_MAGIC */
+    uint32_t count;     /*!< number of commands */
+    uint32_t size;      /*!< size of the payload following the header, in bytes */
+}
+remote_hdr;
+
+/*! request record, for a single command */
+typedef struct _remote_req
+{
+    uint8_t  cmd;                           /*!< CPI_CMD_ code */
+    uint8_t  has_rand;                      /*!< set if rand_data is present */
+    uint16_t key_id;                        /*!< key ID */
+    uint32_t value;                         /*!< input value */
+    uint8_t  rand_data[CPI_RNDX_SIZE];      /*!< random data, for CPI_CMD_CHAL */
+    uint8_t  priority;                      /*!< CPI_PRIORITY_ class */
+    uint8_t  pad[3];
+    uint32_t deadline_ms;                   /*!< time limit, from the moment the daemon reads the request (0 for none) */
+}
+remote_req;
+
+/*! response record, for a single command (followed by out_size[0..2] bytes of output data) */
+typedef struct _remote_res
+{
+    int32_t  status;                        /*!< CPI_ return code */
+    uint32_t value;                         /*!< result value */
+    uint32_t out_size[3];                   /*!< number of bytes written to each output buffer */
+}
+remote_res;
+
+/*! maximum size of a request frame */
+#define REMOTE_MAX_REQUEST  (sizeof(remote_hdr) + CPI_MAX_PENDING*sizeof(remote_req))
+
+/*! maximum size of a response payload */
+#define REMOTE_MAX_RESPONSE (CPI_MAX_PENDING*(sizeof(remote_res) + CPI_MAX_RESULT_SIZE))
+
+/*! caller of a blocking request, waiting for its response */
+typedef struct _remote_wait
+{
+    /*! commands of the request (null for a control request) */
+    cpi_cmd_t *cmds;
+    /*! index in cmds of each forwarded command */
+    int index[CPI_MAX_PENDING];
+    /*! number of forwarded commands */
+    int count;
+    /*! metrics output, for a metrics request */
+    cpi_metrics_t *p_metrics;
+    /*! set once the response has been read */
+    int done;
+    /*! CPI_ return code of the request */
+    int ret;
+}
+remote_wait;
+
+/*! request waiting for its response */
+typedef struct _remote_entry
+{
+    /*! blocking caller (null for a command queued by cpi_submit) */
+    remote_wait *p_wait;
+    /*! command queued by cpi_submit */
+    cpi_cmd_t *p_cmd;
+    /*! its completion callback (may be null) */
+    cpi_callback_t callback;
+}
+remote_entry;
+
+/*! maximum number of requests in flight on a connection */
+#define REMOTE_MAX_INFLIGHT CPI_MAX_PENDING
+
+/*! daemon connection state, one per client CPI instance */
+typedef struct _cpi_remote
+{
+    /*! guards the requests in flight, and the order in which they are written to the socket */
+    pthread_mutex_t lock;
+    /*! signalled whenever a request completes */
+    pthread_cond_t cond;
+    /*! requests waiting for their response, oldest first (the daemon answers in order) */
+    remote_entry inflight[REMOTE_MAX_INFLIGHT];
+    /*! index of the oldest request in inflight */
+    int head;
+    /*! number of requests in inflight */
+    int count;
+    /*! set once the connection has failed */
+    int broken;
+    /*! set once cpi_close has begun, so that callbacks are no longer called */
+    int closing;
+    /*! set while a callback runs on the caller's thread */
+    int in_events;
+    /*! set if responses are read by the reader thread (CPI_INFO_THREADED) */
+    int threaded;
+    /*! reader thread */
+    pthread_t reader;
+    /*! header of the response frame being read */
+    remote_hdr rx_hdr;
+    /*! number of bytes of the response frame read so far, header included */
+    int rx_len;
+    /*! response payload buffer, grown as needed */
+    uint8_t *res;
+    /*! size of res, in bytes */
+    int res_size;
+}
+cpi_remote;
+
+/*! \name daemon client states */
+/*! \{ */
+#define CL_READ         0x00    /*!< reading a request */
+#define CL_QUEUED       0x01    /*!< request read, waiting for room in the command queue */
+#define CL_BUSY         0x02    /*!< request being executed */
+#define CL_WRITE        0x03    /*!< writing the response */
+/*! \} */
+
+struct _remote_server;
+
+/*! daemon state for a single client connection */
+typedef struct _remote_client
+{
+    /*! owning daemon */
+    struct _remote_server *p_server;
+    /*! connected socket */
+    int fd;
+    /*! CL_ state */
+    int state;
+    /*! set once the peer has gone away, while its commands are still queued */
+    int closed;
+    /*! request frame being read */
+    uint8_t rx[REMOTE_MAX_REQUEST];
+    /*! number of bytes of rx read so far */
+    int rx_len;
+    /*! commands of the current request */
+    cpi_cmd_t cmds[CPI_MAX_PENDING];
+    /*! random data input of each command */
+    uint8_t rand_data[CPI_MAX_PENDING][CPI_RNDX_SIZE];
+    /*! number of entries in cmds */
+    int n;
+    /*! number of submitted, uncompleted entries */
+    int pending;
+    /*! time the current request was read (CLOCK_MONOTONIC, in ms) */
+    uint64_t rx_time;
+    /*! result storage for the current request */
+    uint8_t *arena;
+    /*! size of arena, in bytes */
+    int arena_size;
+    /*! response frame */
+    uint8_t *tx;
+    /*! size of tx, in bytes */
+    int tx_size;
+    /*! length of the response frame */
+    int tx_len;
+    /*! number of bytes of the response frame written so far */
+    int tx_pos;
+    /*! next connection */
+    struct _remote_client *next;
+    /*! next client waiting for room in the command queue */
+    struct _remote_client *next_queued;
+}
+remote_client;
+
+/*! daemon state */
+typedef struct _remote_server
+{
+    /*! CPI instance which owns the serial device */
+    cpi_t *p_cpi;
+    /*! epoll descriptor, watching the listening socket, the CPI instance and every client */
+    int epoll_fd;
+    /*! listening socket */
+    int listen_fd;
+    /*! every connection */
+    remote_client *clients;
+    /*! clients waiting for room in the command queue, in arrival order */
+    remote_client *queue_head;
+    remote_client *queue_tail;
+    /*! number of submitted, uncompleted commands of each CPI_PRIORITY_ class, across all clients */
+    int in_flight[CPI_PRIORITY_COUNT];
+}
+remote_server;
+
+/*! utility function to read the monotonic clock, in ms */
+static uint64_t remote_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/*! utility function to make sure a buffer holds at least size bytes (contents are not preserved) */
+static int remote_reserve(uint8_t **pp_buf, int *p_buf_size, int size)
+{
+    if(*p_buf_size >= size) { return CPI_OK; }
+
+    if(*pp_buf != 0) { cpi_util_free(*pp_buf); }
+
+    *pp_buf = (uint8_t*)cpi_util_malloc(size);
+    *p_buf_size = (*pp_buf != 0) ? size : 0;
+
+    return (*pp_buf != 0) ? CPI_OK : CPI_OUT_OF_MEMORY;
+}
+
+/*! utility function to send an entire buffer on a blocking socket */
+static int remote_send(int fd, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t*)data;
+
+    while(size > 0)
+    {
+        ssize_t ret = send(fd, p, size, MSG_NOSIGNAL);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR) { continue; }
+
+            return CPI_FAIL;
+        }
+
+        p += ret;
+        size -= ret;
+    }
+
+    return CPI_OK;
+}
+
+/*! utility function to read as much of a response frame as is available (returns 1 once it is complete, 0 if more is yet to come, or -1 if the connection failed) */
+static int remote_read_frame(cpi_t *p_cpi, cpi_remote *p_remote, int flags)
+{
+    for(;;)
+    {
+        uint8_t *p_dst = (uint8_t*)&p_remote->rx_hdr + p_remote->rx_len;
+
+        int want = sizeof(remote_hdr);
+
+        ssize_t ret;
+
+        /*! once the header is in, read exactly the rest of the frame */
+        if(p_remote->rx_len >= (int)sizeof(remote_hdr))
+        {
+            want += p_remote->rx_hdr.size;
+
+            p_dst = &p_remote->res[p_remote->rx_len - sizeof(remote_hdr)];
+        }
+
+        if(p_remote->rx_len == want) { p_remote->rx_len = 0; return 1; }
+
+        ret = recv(p_cpi->serial_file, p_dst, want - p_remote->rx_len, flags);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR) { continue; }
+
+            if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) { return 0; }
+
+            return -1;
+        }
+
+        /*! daemon went away */
+        if(ret == 0) { return -1; }
+
+        p_remote->rx_len += ret;
+
+        /*! validate the header as soon as it is complete, and make room for the payload */
+        if(p_remote->rx_len == sizeof(remote_hdr))
+        {
+            if( (p_remote->rx_hdr.magic != REMOTE_MAGIC) || (p_remote->rx_hdr.size > REMOTE_MAX_RESPONSE) ) { return -1; }
+
+            if(CPI_FAILED(remote_reserve(&p_remote->res, &p_remote->res_size, p_remote->rx_hdr.size))) { return -1; }
+        }
+    }
+}
+
+/*! utility function to write back the results of forwarded commands, from the response just read */
+static int remote_decode(cpi_remote *p_remote, cpi_cmd_t *cmds, const int *index, int count)
+{
+    uint32_t size = p_remote->rx_hdr.size;
+
+    int pos = 0, v;
+
+    if(p_remote->rx_hdr.count != (uint32_t)count) { return CPI_FAIL; }
+
+    for(v=0;v<count;v++)
+    {
+        cpi_cmd_t *p_cmd = &cmds[index[v]];
+
+        remote_res rec;
+
+        int cur_resp;
+
+        if(pos + sizeof(rec) > size) { return CPI_FAIL; }
+
+        memcpy(&rec, &p_remote->res[pos], sizeof(rec));
+
+        pos += sizeof(rec);
+
+        for(cur_resp = 0; cur_resp < 3; cur_resp++)
+        {
+            int out_size = rec.out_size[cur_resp];
+
+            if( (out_size > CPI_MAX_RESULT_SIZE) || (pos + out_size > (int)size) ) { return CPI_FAIL; }
+
+            if( CPI_SUCCESS(rec.status) && (out_size > 0) && (p_cmd->out[cur_resp] != 0) )
+            {
+                if(out_size > p_cmd->out_size[cur_resp]) { out_size = p_cmd->out_size[cur_resp]; }
+
+                memcpy(p_cmd->out[cur_resp], &p_remote->res[pos], out_size);
+
+                /*! public key is a string, which must stay terminated if truncated */
+                if( (p_cmd->cmd == CPI_CMD_PKEY) && (out_size > 0) ) { ((char*)p_cmd->out[cur_resp])[out_size-1] = '\0'; }
+
+                p_cmd->out_size[cur_resp] = out_size;
+            }
+
+            pos += rec.out_size[cur_resp];
+        }
+
+        if(CPI_SUCCESS(rec.status)) { p_cmd->value = rec.value; }
+
+        p_cmd->status = rec.status;
+    }
+
+    return CPI_OK;
+}
+
+/*! utility function to complete the oldest request in flight with the response just read, or with CPI_FAIL if failed is set (returns CPI_FAIL if the response does not match the request) */
+static int remote_finish(cpi_t *p_cpi, cpi_remote *p_remote, int failed)
+{
+    static const int first = 0;
+
+    remote_hdr *p_hdr = &p_remote->rx_hdr;
+
+    remote_entry entry;
+
+    int ret = CPI_FAIL, closing = 0;
+
+    pthread_mutex_lock(&p_remote->lock);
+
+    /*! a response nobody asked for */
+    if(p_remote->count == 0) { pthread_mutex_unlock(&p_remote->lock); return CPI_FAIL; }
+
+    entry = p_remote->inflight[p_remote->head];
+
+    p_remote->head = (p_remote->head + 1) % REMOTE_MAX_INFLIGHT;
+    p_remote->count--;
+
+    if(!failed)
+    {
+        if(entry.p_wait == 0) { ret = remote_decode(p_remote, entry.p_cmd, &first, 1); }
+        else if(entry.p_wait->cmds != 0) { ret = remote_decode(p_remote, entry.p_wait->cmds, entry.p_wait->index, entry.p_wait->count); }
+        else if(entry.p_wait->p_metrics != 0)
+        {
+            if( (p_hdr->count == 0) && (p_hdr->size == sizeof(cpi_metrics_t)) )
+            {
+                memcpy(entry.p_wait->p_metrics, p_remote->res, sizeof(cpi_metrics_t));
+
+                ret = CPI_OK;
+            }
+        }
+        else if( (p_hdr->count == 0) && (p_hdr->size == 0) ) { ret = CPI_OK; }
+    }
+
+    /*! the waiting caller returns as soon as the lock is released, taking p_wait with it */
+    if(entry.p_wait != 0)
+    {
+        entry.p_wait->ret = ret;
+        entry.p_wait->done = 1;
+    }
+
+    closing = p_remote->closing;
+
+    pthread_cond_broadcast(&p_remote->cond);
+
+    pthread_mutex_unlock(&p_remote->lock);
+
+    /*! callbacks run without the lock, so that they may submit further commands */
+    if( (entry.p_wait == 0) && (entry.callback != 0) && !closing )
+    {
+        p_remote->in_events++;
+
+        entry.callback(p_cpi, entry.p_cmd);
+
+        p_remote->in_events--;
+    }
+
+    return failed ? CPI_OK : ret;
+}
+
+/*! utility function to give up on the connection, failing every request in flight */
+static void remote_break(cpi_t *p_cpi, cpi_remote *p_remote)
+{
+    pthread_mutex_lock(&p_remote->lock);
+
+    p_remote->broken = 1;
+
+    pthread_mutex_unlock(&p_remote->lock);
+
+    /*! the stream can not be resynchronized, so make every later call fail quickly */
+    shutdown(p_cpi->serial_file, SHUT_RDWR);
+
+    while(CPI_SUCCESS(remote_finish(p_cpi, p_remote, 1))) { }
+
+    return;
+}
+
+/*! utility function to read the next response, blocking, and complete the oldest request with it */
+static void remote_pump(cpi_t *p_cpi, cpi_remote *p_remote)
+{
+    if( (remote_read_frame(p_cpi, p_remote, 0) == 1) && CPI_SUCCESS(remote_finish(p_cpi, p_remote, 0)) ) { return; }
+
+    remote_break(p_cpi, p_remote);
+
+    return;
+}
+
+/*! reader thread of shared (CPI_INFO_THREADED) instances, which completes requests as their responses arrive */
+static void *remote_reader(void *p_arg)
+{
+    cpi_t *p_cpi = (cpi_t*)p_arg;
+
+    cpi_remote *p_remote = (cpi_remote*)p_cpi->remote;
+
+    while( (remote_read_frame(p_cpi, p_remote, 0) == 1) && CPI_SUCCESS(remote_finish(p_cpi, p_remote, 0)) ) { }
+
+    remote_break(p_cpi, p_remote);
+
+    return 0;
+}
+
+/*! utility function to send a request frame, and add it to the requests in flight; blocking requests (p_entry->p_wait set) wait for room, and then for their response */
+static int remote_request(cpi_t *p_cpi, cpi_remote *p_remote, const void *frame, size_t size, const remote_entry *p_entry)
+{
+    remote_wait *p_wait = p_entry->p_wait;
+
+    int ret = CPI_OK;
+
+    /*! blocking from within a callback would never return */
+    if( (p_wait != 0) && (p_remote->threaded ? pthread_equal(pthread_self(), p_remote->reader) : p_remote->in_events) ) { return CPI_INVALID_CALL; }
+
+    pthread_mutex_lock(&p_remote->lock);
+
+    while( (p_wait != 0) && !p_remote->broken && (p_remote->count == REMOTE_MAX_INFLIGHT) )
+    {
+        if(p_remote->threaded) { pthread_cond_wait(&p_remote->cond, &p_remote->lock); continue; }
+
+        pthread_mutex_unlock(&p_remote->lock);
+
+        remote_pump(p_cpi, p_remote);
+
+        pthread_mutex_lock(&p_remote->lock);
+    }
+
+    /*! requests are written under the lock, so that inflight is in the order of the stream */
+    if(p_remote->broken) { ret = CPI_FAIL; }
+    else if(p_remote->count == REMOTE_MAX_INFLIGHT) { ret = CPI_OUT_OF_MEMORY; }
+    else if(CPI_FAILED(remote_send(p_cpi->serial_file, frame, size)))
+    {
+        /*! responses still on their way are failed by whoever reads next */
+        p_remote->broken = 1;
+
+        shutdown(p_cpi->serial_file, SHUT_RDWR);
+
+        ret = CPI_FAIL;
+    }
+    else
+    {
+        p_remote->inflight[(p_remote->head + p_remote->count) % REMOTE_MAX_INFLIGHT] = *p_entry;
+        p_remote->count++;
+    }
+
+    if( CPI_FAILED(ret) || (p_wait == 0) ) { pthread_mutex_unlock(&p_remote->lock); return ret; }
+
+    if(p_remote->threaded)
+    {
+        while(!p_wait->done) { pthread_cond_wait(&p_remote->cond, &p_remote->lock); }
+
+        pthread_mutex_unlock(&p_remote->lock);
+    }
+    else
+    {
+        pthread_mutex_unlock(&p_remote->lock);
+
+        while(!p_wait->done) { remote_pump(p_cpi, p_remote); }
+    }
+
+    return p_wait->ret;
+}
+
+/*! utility function to encode a command as a request record */
+static void remote_encode(const cpi_cmd_t *p_cmd, remote_req *p_rec)
+{
+    memset(p_rec, 0, sizeof(remote_req));
+
+    p_rec->cmd = (uint8_t)p_cmd->cmd;
+    p_rec->key_id = p_cmd->key_id;
+    p_rec->value = p_cmd->value;
+    p_rec->priority = (uint8_t)p_cmd->priority;
+    p_rec->deadline_ms = p_cmd->deadline_ms;
+
+    if(p_cmd->rand_data != 0)
+    {
+        p_rec->has_rand = 1;
+        memcpy(p_rec->rand_data, p_cmd->rand_data, CPI_RNDX_SIZE);
+    }
+
+    return;
+}
+
+int cpi_remote_init(cpi_t *p_cpi, const char *socket_path)
+{
+    struct sockaddr_un sa;
+
+    cpi_remote *p_remote = 0;
+
+    int fd = -1;
+
+    /*! sanity check - socket path length */
+    if(strlen(socket_path) >= sizeof(sa.sun_path)) { return CPI_INVALID_PARAM; }
+
+    memset(&sa, 0, sizeof(sa));
+
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(fd == -1) { return CPI_FAIL; }
+
+    /*! daemon is not running */
+    if(connect(fd, (struct sockaddr*)&sa, sizeof(sa)) == -1)
+    {
+        close(fd);
+        return CPI_FAIL;
+    }
+
+    p_remote = (cpi_remote*)cpi_util_malloc(sizeof(cpi_remote));
+
+    /*! handle allocation failure */
+    if(p_remote == 0)
+    {
+        close(fd);
+        return CPI_OUT_OF_MEMORY;
+    }
+
+    memset(p_remote, 0, sizeof(cpi_remote));
+
+    pthread_mutex_init(&p_remote->lock, 0);
+    pthread_cond_init(&p_remote->cond, 0);
+
+    p_remote->threaded = (p_cpi->flags & CPI_INFO_THREADED) ? 1 : 0;
+
+    /*! the connection takes the place of the serial device, and is closed with it */
+    p_cpi->serial_file = fd;
+    p_cpi->remote = p_remote;
+
+    if( p_remote->threaded && (pthread_create(&p_remote->reader, 0, remote_reader, p_cpi) != 0) )
+    {
+        p_remote->threaded = 0;
+
+        cpi_remote_cleanup(p_cpi);
+
+        close(fd);
+        p_cpi->serial_file = -1;
+
+        return CPI_FAIL;
+    }
+
+    return CPI_OK;
+}
+
+void cpi_remote_cleanup(cpi_t *p_cpi)
+{
+    cpi_remote *p_remote = (cpi_remote*)p_cpi->remote;
+
+    if(p_remote == 0) { return; }
+
+    /*! requests still in flight are dropped, without calling their callbacks */
+    pthread_mutex_lock(&p_remote->lock);
+
+    p_remote->closing = 1;
+
+    pthread_mutex_unlock(&p_remote->lock);
+
+    /*! the reader thread stops once the connection is shut down */
+    if(p_remote->threaded)
+    {
+        shutdown(p_cpi->serial_file, SHUT_RDWR);
+
+        pthread_join(p_remote->reader, 0);
+    }
+
+    pthread_cond_destroy(&p_remote->cond);
+    pthread_mutex_destroy(&p_remote->lock);
+
+    if(p_remote->res != 0) { cpi_util_free(p_remote->res); }
+
+    cpi_util_free(p_remote);
+
+    p_cpi->remote = 0;
+
+    return;
+}
+
+/*! utility function to forward up to CPI_MAX_PENDING commands to the daemon */
+static int remote_execute_chunk(cpi_t *p_cpi, cpi_remote *p_remote, cpi_cmd_t *cmds, size_t n)
+{
+    uint8_t req[REMOTE_MAX_REQUEST];
+
+    remote_hdr hdr;
+
+    remote_wait wait;
+
+    remote_entry entry = { &wait, 0, 0 };
+
+    int v;
+
+    memset(&wait, 0, sizeof(wait));
+
+    wait.cmds = cmds;
+
+    /*! build request; invalid entries are not forwarded, and keep their validation status */
+    for(v=0;v<(int)n;v++)
+    {
+        remote_req rec;
+
+        cmds[v].status = cpi_validate_cmd(&cmds[v]);
+
+        if(CPI_FAILED(cmds[v].status)) { continue; }
+
+        remote_encode(&cmds[v], &rec);
+
+        memcpy(&req[sizeof(hdr) + wait.count*sizeof(rec)], &rec, sizeof(rec));
+
+        /*! forwarded entries fail, unless the daemon says otherwise */
+        cmds[v].status = CPI_FAIL;
+
+        wait.index[wait.count++] = v;
+    }
+
+    if(wait.count == 0) { return CPI_OK; }
+
+    hdr.magic = REMOTE_MAGIC;
+    hdr.count = wait.count;
+    hdr.size = wait.count*sizeof(remote_req);
+
+    memcpy(req, &hdr, sizeof(hdr));
+
+    return remote_request(p_cpi, p_remote, req, sizeof(hdr) + hdr.size, &entry);
+}
+
+int cpi_remote_execute(cpi_t *p_cpi, cpi_cmd_t *cmds, size_t n)
+{
+    cpi_remote *p_remote = (cpi_remote*)p_cpi->remote;
+
+    int ret = CPI_OK;
+
+    size_t count = 0, v;
+
+    /*! the daemon accepts up to CPI_MAX_PENDING commands per request, and answers requests in order, so each holds a single class */
+    for(v=0;v<n;v+=count)
+    {
+        for(count=1; (v + count < n) && (count < CPI_MAX_PENDING) && (cmds[v + count].priority == cmds[v].priority); count++) { }
+
+        ret = remote_execute_chunk(p_cpi, p_remote, &cmds[v], count);
+
+        if(CPI_FAILED(ret)) { break; }
+    }
+
+    return ret;
+}
+
+int cpi_remote_submit(cpi_t *p_cpi, cpi_cmd_t *p_cmd, cpi_callback_t callback)
+{
+    uint8_t req[sizeof(remote_hdr) + sizeof(remote_req)];
+
+    remote_hdr hdr = { REMOTE_MAGIC, 1, sizeof(remote_req) };
+
+    remote_entry entry = { 0, p_cmd, callback };
+
+    remote_req rec;
+
+    int ret = CPI_OK;
+
+    p_cmd->status = cpi_validate_cmd(p_cmd);
+
+    if(CPI_FAILED(p_cmd->status)) { return p_cmd->status; }
+
+    remote_encode(p_cmd, &rec);
+
+    memcpy(req, &hdr, sizeof(hdr));
+    memcpy(&req[sizeof(hdr)], &rec, sizeof(rec));
+
+    /*! fails, unless the daemon says otherwise */
+    p_cmd->status = CPI_FAIL;
+
+    ret = remote_request(p_cpi, (cpi_remote*)p_cpi->remote, req, sizeof(req), &entry);
+
+    if(CPI_FAILED(ret)) { p_cmd->status = ret; }
+
+    return ret;
+}
+
+int cpi_remote_get_fd(cpi_t *p_cpi)
+{
+    /*! responses of shared instances belong to the reader thread */
+    if(((cpi_remote*)p_cpi->remote)->threaded) { return -1; }
+
+    return p_cpi->serial_file;
+}
+
+int cpi_remote_process_events(cpi_t *p_cpi)
+{
+    cpi_remote *p_remote = (cpi_remote*)p_cpi->remote;
+
+    /*! sanity check - recursive call from a callback, or shared instance */
+    if(p_remote->threaded || p_remote->in_events) { return CPI_INVALID_CALL; }
+
+    for(;;)
+    {
+        int ret = remote_read_frame(p_cpi, p_remote, MSG_DONTWAIT);
+
+        if(ret == 0) { break; }
+
+        if( (ret == 1) && CPI_SUCCESS(remote_finish(p_cpi, p_remote, 0)) ) { continue; }
+
+        /*! once broken, nothing more can arrive */
+        if(p_remote->count > 0) { remote_break(p_cpi, p_remote); }
+
+        break;
+    }
+
+    return CPI_OK;
+}
+
+int cpi_remote_set_write_delay(cpi_t *p_cpi, uint32_t delay_us)
+{
+    uint8_t req[sizeof(remote_hdr) + sizeof(uint32_t)];
+
+    remote_hdr hdr = { REMOTE_MAGIC, 0, sizeof(uint32_t) };
+
+    remote_wait wait;
+
+    remote_entry entry = { &wait, 0, 0 };
+
+    memset(&wait, 0, sizeof(wait));
+
+    memcpy(req, &hdr, sizeof(hdr));
+    memcpy(&req[sizeof(hdr)], &delay_us, sizeof(delay_us));
+
+    return remote_request(p_cpi, (cpi_remote*)p_cpi->remote, req, sizeof(req), &entry);
+}
+
+int cpi_remote_metrics(cpi_t *p_cpi, cpi_metrics_t *p_metrics)
+{
+    remote_hdr hdr = { REMOTE_MAGIC, 0, 0 };
+
+    remote_wait wait;
+
+    remote_entry entry = { &wait, 0, 0 };
+
+    memset(&wait, 0, sizeof(wait));
+
+    wait.p_metrics = p_metrics;
+
+    return remote_request(p_cpi, (cpi_remote*)p_cpi->remote, &hdr, sizeof(hdr), &entry);
+}
+
+/*! utility function to select the epoll events of interest for a client */
+static void remote_watch(remote_client *p_client, int events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = events;
+    ev.data.ptr = p_client;
+
+    epoll_ctl(p_client->p_server->epoll_fd, EPOLL_CTL_MOD, p_client->fd, &ev);
+
+    return;
+}
+
+/*! utility function to free a client, once none of its commands are queued */
+static void remote_free(remote_client *p_client)
+{
+    remote_server *p_server = p_client->p_server;
+
+    remote_client **pp_link = &p_server->clients;
+
+    while(*pp_link != p_client) { pp_link = &(*pp_link)->next; }
+
+    *pp_link = p_client->next;
+
+    if(p_client->arena != 0) { cpi_util_free(p_client->arena); }
+    if(p_client->tx != 0) { cpi_util_free(p_client->tx); }
+
+    cpi_util_free(p_client);
+
+    return;
+}
+
+/*! utility function to drop a client connection */
+static void remote_drop(remote_client *p_client)
+{
+    remote_server *p_server = p_client->p_server;
+
+    epoll_ctl(p_server->epoll_fd, EPOLL_CTL_DEL, p_client->fd, 0);
+
+    close(p_client->fd);
+
+    p_client->fd = -1;
+
+    /*! take the client out of the queue, if it is waiting */
+    if(p_client->state == CL_QUEUED)
+    {
+        remote_client **pp_link = &p_server->queue_head;
+
+        p_server->queue_tail = 0;
+
+        while(*pp_link != 0)
+        {
+            if(*pp_link == p_client) { *pp_link = p_client->next_queued; continue; }
+
+            p_server->queue_tail = *pp_link;
+
+            pp_link = &(*pp_link)->next_queued;
+        }
+    }
+
+    /*! queued commands still point at the client, so it is freed once they complete */
+    if(p_client->state == CL_BUSY)
+    {
+        p_client->closed = 1;
+        return;
+    }
+
+    remote_free(p_client);
+
+    return;
+}
+
+/*! utility function to write as much of the response as possible, then go back to reading */
+static void remote_flush(remote_client *p_client)
+{
+    while(p_client->tx_pos < p_client->tx_len)
+    {
+        ssize_t ret = send(p_client->fd, &p_client->tx[p_client->tx_pos], p_client->tx_len - p_client->tx_pos, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR) { continue; }
+
+            /*! socket buffer is full, resume once it drains */
+            if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) { remote_watch(p_client, EPOLLOUT); return; }
+
+            remote_drop(p_client);
+            return;
+        }
+
+        p_client->tx_pos += ret;
+    }
+
+    p_client->state = CL_READ;
+    p_client->rx_len = 0;
+
+    remote_watch(p_client, EPOLLIN);
+
+    return;
+}
+
+/*! utility function to encode and start writing the response of a finished request */
+static void remote_respond(remote_client *p_client)
+{
+    remote_hdr hdr = { REMOTE_MAGIC, p_client->n, 0 };
+
+    int size = sizeof(hdr), pos = 0, v;
+
+    /*! peer went away while its commands were queued */
+    if(p_client->closed) { remote_free(p_client); return; }
+
+    /*! measure response, sending only the output the CP actually produced */
+    for(v=0;v<p_client->n;v++)
+    {
+        cpi_cmd_t *p_cmd = &p_client->cmds[v];
+
+        int count = CPI_SUCCESS(p_cmd->status) ? cpi_cmd_out_count(p_cmd->cmd) : 0, cur_resp;
+
+        size += sizeof(remote_res);
+
+        for(cur_resp = 0; cur_resp < count; cur_resp++) { size += p_cmd->out_size[cur_resp]; }
+    }
+
+    if(CPI_FAILED(remote_reserve(&p_client->tx, &p_client->tx_size, size))) { remote_drop(p_client); return; }
+
+    hdr.size = size - sizeof(hdr);
+
+    memcpy(&p_client->tx[pos], &hdr, sizeof(hdr));
+
+    pos += sizeof(hdr);
+
+    for(v=0;v<p_client->n;v++)
+    {
+        cpi_cmd_t *p_cmd = &p_client->cmds[v];
+
+        int count = CPI_SUCCESS(p_cmd->status) ? cpi_cmd_out_count(p_cmd->cmd) : 0, cur_resp;
+
+        remote_res rec;
+
+        memset(&rec, 0, sizeof(rec));
+
+        rec.status = p_cmd->status;
+        rec.value = p_cmd->value;
+
+        for(cur_resp = 0; cur_resp < count; cur_resp++) { rec.out_size[cur_resp] = p_cmd->out_size[cur_resp]; }
+
+        memcpy(&p_client->tx[pos], &rec, sizeof(rec));
+
+        pos += sizeof(rec);
+
+        for(cur_resp = 0; cur_resp < count; cur_resp++)
+        {
+            memcpy(&p_client->tx[pos], p_cmd->out[cur_resp], p_cmd->out_size[cur_resp]);
+
+            pos += p_cmd->out_size[cur_resp];
+        }
+    }
+
+    p_client->state = CL_WRITE;
+    p_client->tx_len = size;
+    p_client->tx_pos = 0;
+
+    remote_flush(p_client);
+
+    return;
+}
+
+/*! completion callback for every command submitted on behalf of a client */
+static void remote_complete(cpi_t *p_cpi, cpi_cmd_t *p_cmd)
+{
+    remote_client *p_client = (remote_client*)p_cmd->user_data;
+
+    (void)p_cpi;
+
+    p_client->p_server->in_flight[p_cmd->priority]--;
+
+    if(--p_client->pending == 0) { remote_respond(p_client); }
+
+    return;
+}
+
+/*! utility function to decode a complete request frame, and queue the client */
+static void remote_accept_request(remote_client *p_client)
+{
+    remote_server *p_server = p_client->p_server;
+
+    remote_hdr hdr;
+
+    int arena_size = 0, pos = 0, v;
+
+    memcpy(&hdr, p_client->rx, sizeof(hdr));
+
+    p_client->n = hdr.count;
+    p_client->rx_time = remote_now_ms();
+
+    /*! write delay request, applied to the serial device from its next exchange, and answered right away */
+    if( (p_client->n == 0) && (hdr.size == sizeof(uint32_t)) )
+    {
+        uint32_t delay_us = 0;
+
+        memcpy(&delay_us, &p_client->rx[sizeof(hdr)], sizeof(delay_us));
+
+        cpi_set_write_delay(p_server->p_cpi, delay_us);
+
+        if(CPI_FAILED(remote_reserve(&p_client->tx, &p_client->tx_size, sizeof(hdr)))) { remote_drop(p_client); return; }
+
+        hdr.size = 0;
+
+        memcpy(p_client->tx, &hdr, sizeof(hdr));
+
+        p_client->state = CL_WRITE;
+        p_client->tx_len = sizeof(hdr);
+        p_client->tx_pos = 0;
+
+        remote_flush(p_client);
+        return;
+    }
+
+    /*! metrics request, answered right away */
+    if(p_client->n == 0)
+    {
+        cpi_metrics_t metrics;
+
+        memset(&metrics, 0, sizeof(metrics));
+
+        cpi_get_metrics(p_server->p_cpi, &metrics);
+
+        if(CPI_FAILED(remote_reserve(&p_client->tx, &p_client->tx_size, sizeof(hdr) + sizeof(metrics)))) { remote_drop(p_client); return; }
+
+        hdr.size = sizeof(metrics);
+
+        memcpy(p_client->tx, &hdr, sizeof(hdr));
+        memcpy(&p_client->tx[sizeof(hdr)], &metrics, sizeof(metrics));
+
+        p_client->state = CL_WRITE;
+        p_client->tx_len = sizeof(hdr) + sizeof(cpi_metrics_t);
+        p_client->tx_pos = 0;
+
+        remote_flush(p_client);
+        return;
+    }
+
+    for(v=0;v<p_client->n;v++)
+    {
+        cpi_cmd_t *p_cmd = &p_client->cmds[v];
+
+        remote_req rec;
+
+        memcpy(&rec, &p_client->rx[sizeof(hdr) + v*sizeof(rec)], sizeof(rec));
+
+        memset(p_cmd, 0, sizeof(cpi_cmd_t));
+
+        p_cmd->cmd = rec.cmd;
+        p_cmd->key_id = rec.key_id;
+        p_cmd->value = rec.value;
+        p_cmd->priority = rec.priority;
+        p_cmd->deadline_ms = rec.deadline_ms;
+        p_cmd->user_data = p_client;
+
+        if(rec.has_rand)
+        {
+            memcpy(p_client->rand_data[v], rec.rand_data, CPI_RNDX_SIZE);
+
+            p_cmd->rand_data = p_client->rand_data[v];
+        }
+
+        arena_size += cpi_format_result_size(p_cmd->cmd);
+    }
+
+    if(CPI_FAILED(remote_reserve(&p_client->arena, &p_client->arena_size, arena_size))) { remote_drop(p_client); return; }
+
+    for(v=0;v<p_client->n;v++)
+    {
+        cpi_format_bind(&p_client->cmds[v], &p_client->arena[pos]);
+
+        pos += cpi_format_result_size(p_client->cmds[v].cmd);
+    }
+
+    /*! stop reading (further requests wait in the socket) until this one is answered */
+    remote_watch(p_client, 0);
+
+    p_client->state = CL_QUEUED;
+    p_client->next_queued = 0;
+
+    if(p_server->queue_tail != 0) { p_server->queue_tail->next_queued = p_client; } else { p_server->queue_head = p_client; }
+
+    p_server->queue_tail = p_client;
+
+    return;
+}
+
+/*! utility function to read as much of a request frame as is available */
+static void remote_read(remote_client *p_client)
+{
+    for(;;)
+    {
+        int want = sizeof(remote_hdr);
+
+        ssize_t ret;
+
+        /*! once the header is in, read exactly the rest of the frame */
+        if(p_client->rx_len >= (int)sizeof(remote_hdr))
+        {
+            remote_hdr hdr;
+
+            memcpy(&hdr, p_client->rx, sizeof(hdr));
+
+            want += hdr.size;
+        }
+
+        if(p_client->rx_len == want) { remote_accept_request(p_client); return; }
+
+        ret = recv(p_client->fd, &p_client->rx[p_client->rx_len], want - p_client->rx_len, MSG_DONTWAIT);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR) { continue; }
+
+            if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) { return; }
+        }
+
+        /*! peer went away, or failed */
+        if(ret <= 0) { remote_drop(p_client); return; }
+
+        p_client->rx_len += ret;
+
+        /*! validate the header as soon as it is complete */
+        if(p_client->rx_len == sizeof(remote_hdr))
+        {
+            remote_hdr hdr;
+
+            memcpy(&hdr, p_client->rx, sizeof(hdr));
+
+            /*! a request without commands carries nothing, or a write delay */
+            int size_ok = (hdr.count == 0) ? ((hdr.size == 0) || (hdr.size == sizeof(uint32_t))) : (hdr.size == hdr.count*sizeof(remote_req));
+
+            if( (hdr.magic != REMOTE_MAGIC) || (hdr.count > CPI_MAX_PENDING) || !size_ok )
+            {
+                remote_drop(p_client);
+                return;
+            }
+        }
+    }
+}
+
+/*! utility function to submit queued requests, as room in the command queue allows; each class is served in arrival order, but a request never waits behind one blocked on another class */
+static void remote_dispatch(remote_server *p_server)
+{
+    remote_client **pp_link = &p_server->queue_head;
+
+    /*! classes for which an earlier request is still waiting */
+    int blocked[CPI_PRIORITY_COUNT] = { 0 };
+
+    p_server->queue_tail = 0;
+
+    while(*pp_link != 0)
+    {
+        remote_client *p_client = *pp_link;
+
+        int need[CPI_PRIORITY_COUNT] = { 0 }, fits = 1, c, v;
+
+        uint64_t elapsed = remote_now_ms() - p_client->rx_time;
+
+        /*! out of range classes are rejected by cpi_submit, and need no room */
+        for(v=0;v<p_client->n;v++)
+        {
+            if( (p_client->cmds[v].priority >= 0) && (p_client->cmds[v].priority < CPI_PRIORITY_COUNT) ) { need[p_client->cmds[v].priority]++; }
+        }
+
+        for(c=0;c<CPI_PRIORITY_COUNT;c++)
+        {
+            if( (need[c] > 0) && (blocked[c] || (p_server->in_flight[c] + need[c] > CPI_MAX_PENDING)) ) { fits = 0; }
+        }
+
+        if(!fits)
+        {
+            for(c=0;c<CPI_PRIORITY_COUNT;c++) { if(need[c] > 0) { blocked[c] = 1; } }
+
+            p_server->queue_tail = p_client;
+
+            pp_link = &p_client->next_queued;
+
+            continue;
+        }
+
+        *pp_link = p_client->next_queued;
+
+        p_client->state = CL_BUSY;
+        p_client->pending = 0;
+
+        for(v=0;v<p_client->n;v++)
+        {
+            cpi_cmd_t *p_cmd = &p_client->cmds[v];
+
+            /*! deadlines run from the moment the request was read, not from submission */
+            if(p_cmd->deadline_ms != 0)
+            {
+                if(elapsed >= p_cmd->deadline_ms) { p_cmd->status = CPI_BUSY; continue; }
+
+                p_cmd->deadline_ms -= (uint32_t)elapsed;
+            }
+
+            /*! invalid entries are not queued, and keep their validation status */
+            if(CPI_SUCCESS(cpi_submit(p_server->p_cpi, p_cmd, remote_complete)))
+            {
+                p_client->pending++;
+                p_server->in_flight[p_cmd->priority]++;
+            }
+        }
+
+        if(p_client->pending == 0) { remote_respond(p_client); }
+    }
+
+    return;
+}
+
+/*! utility function to accept pending connections */
+static void remote_accept(remote_server *p_server)
+{
+    for(;;)
+    {
+        struct epoll_event ev;
+
+        remote_client *p_client = 0;
+
+        int fd = accept(p_server->listen_fd, 0, 0);
+
+        if(fd == -1) { return; }
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        p_client = (remote_client*)cpi_util_malloc(sizeof(remote_client));
+
+        if(p_client == 0) { close(fd); continue; }
+
+        memset(p_client, 0, sizeof(remote_client));
+
+        p_client->p_server = p_server;
+        p_client->fd = fd;
+        p_client->state = CL_READ;
+
+        memset(&ev, 0, sizeof(ev));
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = p_client;
+
+        if(epoll_ctl(p_server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            close(fd);
+            cpi_util_free(p_client);
+            continue;
+        }
+
+        p_client->next = p_server->clients;
+        p_server->clients = p_client;
+    }
+}
+
+int cpi_serve(struct _cpi_t *p_cpi, const char *socket_path, volatile int *p_stop)
+{
+    remote_server server;
+
+    struct sockaddr_un sa;
+
+    int ret = CPI_FAIL, bound = 0;
+
+    /*! sanity check - null ptr */
+    if( (p_cpi == 0) || (socket_path == 0) || (p_stop == 0) ) { return CPI_INVALID_PARAM; }
+
+    /*! sanity check - socket path length */
+    if(strlen(socket_path) >= sizeof(sa.sun_path)) { return CPI_INVALID_PARAM; }
+
+    /*! sanity check - the daemon drives an initialized, local, single threaded instance */
+    if( !p_cpi->is_initialized || (p_cpi->remote != 0) || (cpi_get_fd(p_cpi) == -1) ) { return CPI_INVALID_CALL; }
+
+    memset(&server, 0, sizeof(server));
+
+    server.p_cpi = p_cpi;
+    server.listen_fd = -1;
+
+    memset(&sa, 0, sizeof(sa));
+
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, socket_path);
+
+    /*! replace a stale socket, left behind by a previous daemon, but not one a daemon still answers on */
+    {
+        struct stat st;
+
+        if( (stat(socket_path, &st) == 0) && S_ISSOCK(st.st_mode) )
+        {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0), live = 0;
+
+            if(fd != -1)
+            {
+                live = (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) == 0);
+
+                close(fd);
+            }
+
+            if(live) { return CPI_BUSY; }
+
+            unlink(socket_path);
+        }
+    }
+
+    server.epoll_fd = epoll_create(16);
+
+    if(server.epoll_fd == -1) { return CPI_FAIL; }
+
+    fcntl(server.epoll_fd, F_SETFD, FD_CLOEXEC);
+
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if( (server.listen_fd == -1) || (bind(server.listen_fd, (struct sockaddr*)&sa, sizeof(sa)) == -1) ) { goto cleanup; }
+
+    bound = 1;
+
+    /*! clients of the same group may connect, whatever the umask */
+    if( (chmod(socket_path, 0660) == -1) || (listen(server.listen_fd, 16) == -1) ) { goto cleanup; }
+
+    /*! watch the listening socket (null tag) and the CPI instance (server tag) */
+    {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = 0;
+
+        if(epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev) == -1) { goto cleanup; }
+
+        ev.data.ptr = &server;
+
+        if(epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, cpi_get_fd(p_cpi), &ev) == -1) { goto cleanup; }
+    }
+
+    ret = CPI_OK;
+
+    while(!*p_stop)
+    {
+        struct epoll_event ev[16];
+
+        int count = epoll_wait(server.epoll_fd, ev, 16, -1), v;
+
+        /*! interrupted, most likely by the signal which sets *p_stop */
+        if(count < 0)
+        {
+            if(errno == EINTR) { continue; }
+
+            ret = CPI_FAIL;
+            break;
+        }
+
+        for(v=0;v<count;v++)
+        {
+            remote_client *p_client = (remote_client*)ev[v].data.ptr;
+
+            if(ev[v].data.ptr == 0) { remote_accept(&server); continue; }
+
+            if(ev[v].data.ptr == &server) { cpi_process_events(p_cpi); continue; }
+
+            /*! the client may have been dropped by an earlier event of this pass (e.g. completion) */
+            {
+                remote_client *p_cur = server.clients;
+
+                while( (p_cur != 0) && (p_cur != p_client) ) { p_cur = p_cur->next; }
+
+                if( (p_cur == 0) || (p_client->fd == -1) ) { continue; }
+            }
+
+            if(ev[v].events & (EPOLLERR | EPOLLHUP))
+            {
+                /*! a hung up peer may still have a complete request to read */
+                if( (p_client->state == CL_READ) && (ev[v].events & EPOLLIN) ) { remote_read(p_client); continue; }
+
+                remote_drop(p_client);
+                continue;
+            }
+
+            if(p_client->state == CL_READ) { remote_read(p_client); }
+            else if(p_client->state == CL_WRITE) { remote_flush(p_client); }
+        }
+
+        remote_dispatch(&server);
+    }
+
+    /*! let commands already queued complete, since they refer to client state */
+    while(server.in_flight[CPI_PRIORITY_NORMAL] + server.in_flight[CPI_PRIORITY_URGENT] + server.in_flight[CPI_PRIORITY_BULK] > 0)
+    {
+        struct pollfd pfd = { cpi_get_fd(p_cpi), POLLIN, 0 };
+
+        poll(&pfd, 1, -1);
+
+        cpi_process_events(p_cpi);
+    }
+
+cleanup:
+
+    while(server.clients != 0)
+    {
+        remote_client *p_client = server.clients;
+
+        if(p_client->fd != -1) { close(p_client->fd); }
+
+        remote_free(p_client);
+    }
+
+    if(server.listen_fd != -1) { close(server.listen_fd); }
+
+    if(bound) { unlink(socket_path); }
+
+    close(server.epoll_fd);
+
+    return ret;
+}
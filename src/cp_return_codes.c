@@ -11,7 +11,7 @@
 
 #include "cp_interface.h"
 
-char *CPI_RETURN_CODE_LOOKUP[0x07] =
+char *CPI_RETURN_CODE_LOOKUP[0x08] =
 {
     "CPI_OK",
     "CPI_FAIL",
@@ -19,5 +19,6 @@ char *CPI_RETURN_CODE_LOOKUP[0x07] =
     "CPI_INVALID_PARAM",
     "CPI_OUT_OF_MEMORY",
     "CPI_ACCESS_DENIED",
-    "CPI_INVALID_CALL"
+    "CPI_INVALID_CALL",
+    "CPI_BUSY"
 };
@@ -10,159 +10,117 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
-#include "b64/b64.h"
+/*! number of heap allocations made through cpi_util_malloc */
+static volatile unsigned long alloc_count = 0;
 
-/*! There is a corner case, which triggers quite frequently,
- *  if writing is done too quickly. The CP will get into a 
- *  bad state where it will no longer service requests until 
- *  a system reboot. This sleep works around the issue. */
-#define ENABLE_MAGIC_SLEEP_FIX
+void *cpi_util_malloc(size_t size)
+{
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+
+    return malloc(size);
+}
 
-int cpi_util_wakeup_cp(cpi_t *p_cpi)
+void cpi_util_free(void *ptr)
 {
-    char c = '\0';
+    free(ptr);
+}
 
-    while(c != '?')
-    {
-        /*! wake command */
-        cpi_util_write_str(p_cpi, "!");
-        // It may be possible to get caught in a state where a single ! will not respond
-        // with a reset ack. Somehow enabling this extra '!' will slow down the commands
-        // a little bit - so it is currently commented out.
-        //cpi_util_write_str(p_cpi, "!");
+unsigned long cpi_get_alloc_count(void)
+{
+    return alloc_count;
+}
 
-        int bytes_read = read(p_cpi->serial_file, &c, sizeof(char));
+void cpi_util_format_serial(const uint8_t *raw_serial, char *serial)
+{
+    int v;
 
-        /*! handle read failure */
-        if(bytes_read != sizeof(char)) { printf( "returned %d bytes\n", bytes_read ); return CPI_FAIL; }
-    }
+    for(v=0;v<CPI_SERIAL_NUMBER_SIZE;v++) { sprintf(&serial[v*2], "%.02X", raw_serial[v]); }
 
-    return CPI_OK;
+    return;
 }
 
-int cpi_util_write_str(cpi_t *p_cpi, char *str)
+int cpi_util_save_state(const char *path, const char *header, int (*replaced)(const char *line, void *arg), void (*append)(FILE *file, void *arg), void *arg)
 {
-    int v=0;
+    char line[CPI_UTIL_STATE_LINE_SIZE], tmp_path[PATH_MAX], lock_path[PATH_MAX], dir_path[PATH_MAX];
 
-    while(str[v] != '\0')
-    {
-        int bytes_written = write(p_cpi->serial_file, &str[v++], sizeof(char));
-	//	printf( "%c", str[v-1] );
+    FILE *inp_file = 0, *out_file = 0;
 
-#ifdef ENABLE_MAGIC_SLEEP_FIX
-    usleep(10*1000);
-#endif
+    struct stat st;
 
-        /*! handle write failure */
-        if(bytes_written != sizeof(char)) { return CPI_FAIL; }
-    }
+    int synced = 0, dir_fd = -1, lock_fd = -1, tmp_fd = -1, ret = CPI_FAIL;
 
-    return CPI_OK;
-}
+    if( (path[0] == '\0') || (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int)sizeof(tmp_path)) ||
+        (snprintf(lock_path, sizeof(lock_path), "%s.lock", path) >= (int)sizeof(lock_path)) ) { return CPI_INVALID_PARAM; }
 
-int cpi_util_write_bin(cpi_t *p_cpi, void *data, int size)
-{
-    size_t ret = b64_encode(data, size, p_cpi->tmp_buff, CPI_MAX_RESULT_SIZE);
+    /*! processes saving at the same time take turns, so that neither drops the other's line */
+    lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
 
-    /*! failed to encode */
-    if(ret == 0 || (ret > CPI_MAX_RESULT_SIZE)) { return CPI_FAIL; }
+    if(lock_fd == -1) { return CPI_FAIL; }
 
-    p_cpi->tmp_buff[ret+0] = '\n';
-    p_cpi->tmp_buff[ret+1] = '\0';
+    while(flock(lock_fd, LOCK_EX) == -1) { if(errno != EINTR) { close(lock_fd); return CPI_FAIL; } }
 
-    /*! write base64 string */
-    cpi_util_write_str(p_cpi, p_cpi->tmp_buff);
+    /*! the file is replaced in one step, so a reader never sees half of it; the temporary name is our own */
+    tmp_fd = mkstemp(tmp_path);
 
-    return CPI_OK;
-}
+    if(tmp_fd == -1) { goto cleanup; }
 
-int cpi_util_write_lf(cpi_t *p_cpi)
-{
-  //  printf( "LF" );
-    return cpi_util_write_str(p_cpi, "\n");
-}
+    /*! mkstemp creates it for us alone, so keep the mode of the file it replaces */
+    fchmod(tmp_fd, (stat(path, &st) == 0) ? (st.st_mode & 0777) : (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH));
 
-int cpi_util_write_eof(cpi_t *p_cpi)
-{
-  //  printf( "EOF" );
-    return cpi_util_write_str(p_cpi, "\x0D");
-}
+    out_file = fdopen(tmp_fd, "w");
 
-int cpi_util_read_str(cpi_t *p_cpi, char *str, int *p_size)
-{
-    int v=0;
+    if(out_file == 0) { close(tmp_fd); unlink(tmp_path); goto cleanup; }
 
-    while(v < *p_size)
+    inp_file = fopen(path, "r");
+
+    if(inp_file == 0)
     {
-        int bytes_read = read(p_cpi->serial_file, &str[v], sizeof(char));
-
-        /*! handle read failure */
-        if(bytes_read != sizeof(char)) { printf( "returned %d bytes.\n", bytes_read); fflush(stdout); return CPI_FAIL; }
-	//	printf( "%c", str[v] );
-	fflush(stdout);
-        /*! ignore sync character */
-        if(str[v] == '?')
-        {
-            /*! detect failure response from CP */
-            /*! @todo needs testing - should parse 0x0D if necessary */
-            //if( (v == 3) && (strcmp(str, "CMD?") == 0) ) { return CPI_FAIL; }
-
-            /*! otherwise, keep parsing */
-            continue; 
-        }
-
-        /*! detect FAIL result */
-        if( (v == 3) && (strncmp(str, "FAIL", 4) == 0) ) { return CPI_FAIL; }
-        /*! detect failure due to auth count being exceeded */
-        if( (v == 8) && (strncmp(str, "AUTHCOUNT", 9) == 0) ) { return CPI_ACCESS_DENIED; }
-
-        /*! handle stop character */
-        if(str[v] == (char)0x0D) { break; }
-
-        v++;
+        fprintf(out_file, "%s\n", header);
     }
+    else
+    {
+        /*! keep every other line as it is */
+        while(fgets(line, sizeof(line), inp_file) != 0) { if(!replaced(line, arg)) { fputs(line, out_file); } }
 
-    /*! append null terminator, if there is room */
-    if(v < *p_size) { str[v++] = '\0'; } 
+        fclose(inp_file);
+    }
 
-    /*! return result size */
-    *p_size = v;
+    append(out_file, arg);
 
-    return CPI_OK;
-}
+    /*! the new file is on disk before it replaces the old one, so a power cut leaves one or the other */
+    synced = (fflush(out_file) == 0) && (fsync(fileno(out_file)) == 0);
 
-int cpi_util_read_eof(cpi_t *p_cpi)
-{
-#ifndef CNPLATFORM_falconwing
-#ifndef CNPLATFORM_silvermoon
-    char c = '\0';
+    if( (fclose(out_file) != 0) || !synced || (rename(tmp_path, path) != 0) )
+    {
+        unlink(tmp_path);
 
-    int bytes_read = read(p_cpi->serial_file, &c, sizeof(char));
+        goto cleanup;
+    }
 
-    /*! handle read failure */
-    if(bytes_read != sizeof(char)) { return CPI_FAIL; }
+    /*! and so is the rename, as far as the file system allows */
+    snprintf(dir_path, sizeof(dir_path), "%s", path);
 
-    /*! we are expecting an EOF 0x0D character */
-    if(c != (char)0x0D) { return CPI_FAIL; }
-#endif
-#endif
-    return CPI_OK;
-}
+    dir_fd = open(dirname(dir_path), O_RDONLY | O_DIRECTORY);
 
-int cpi_util_decode_str(cpi_t *p_cpi, char *str, int size, void *data, int *p_size)
-{
-    size_t ret = b64_decode(str, size, p_cpi->tmp_buff, CPI_MAX_RESULT_SIZE);
+    if(dir_fd >= 0) { fsync(dir_fd); close(dir_fd); }
 
-    /*! failed to decode */
-    if( (ret == 0) || (ret > CPI_MAX_RESULT_SIZE) ) { return CPI_FAIL; }
+    ret = CPI_OK;
 
-    /*! return decoded data, respecting max sizes */
-    memcpy(data, p_cpi->tmp_buff, (ret+1 > *p_size) ? *p_size : ret+1);
+cleanup:
 
-    return CPI_OK;
-}
+    /*! closing it releases the lock */
+    close(lock_fd);
 
+    return ret;
+}
@@ -17,29 +17,81 @@ extern "C" {
 
 #include "cp_interface.h"
 
-/*! wake up the CP if it is sleeping */
-int cpi_util_wakeup_cp(cpi_t *p_cpi);
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 
-/*! write the specified string to the serial device file */
-int cpi_util_write_str(cpi_t *p_cpi, char *str);
+/*! maximum length of a base64 encoded request argument */
+#define CPI_UTIL_MAX_REQUEST_STR_SIZE   0x40
 
-/*! write the specified binary data to the serial device file */
-int cpi_util_write_bin(cpi_t *p_cpi, void *data, int size);
+/*! length of a serial number in hex, including null terminator */
+#define CPI_UTIL_SERIAL_SIZE            (2*CPI_SERIAL_NUMBER_SIZE + 1)
 
-/*! write the LF character (0x0A) to the serial device file */
-int cpi_util_write_lf(cpi_t *p_cpi);
+/*! maximum length of a line of a state file (see cpi_util_save_state) */
+#define CPI_UTIL_STATE_LINE_SIZE        0x400
 
-/*! write the EOF character (0x0D) to the serial device file */
-int cpi_util_write_eof(cpi_t *p_cpi);
+/*! create the command queue and event descriptor for the specified (open) CPI instance */
+int cpi_async_init(cpi_t *p_cpi);
 
-/*! read string with max of specified size from the serial device file (returns # bytes written) */
-int cpi_util_read_str(cpi_t *p_cpi, char *str, int *p_size);
+/*! release the command queue and event descriptor owned by the specified CPI instance, if any */
+void cpi_async_cleanup(cpi_t *p_cpi);
 
-/*! write the EOF character (0x0D) from the serial device file */
-int cpi_util_read_eof(cpi_t *p_cpi);
+/*! queue a batch of commands, and wait until all of them have completed */
+int cpi_async_execute(cpi_t *p_cpi, cpi_cmd_t *cmds, size_t n);
 
-/*! base64 decode the specified string into the specified buffer (returns # bytes written) */
-int cpi_util_decode_str(cpi_t *p_cpi, char *str, int size, void *data, int *p_size);
+/*! load the write delay saved for the CP of an initialized CPI instance from the specified pacing profile, if any (null for CPI_PACING_PROFILE) */
+void cpi_pacing_load(cpi_t *p_cpi, const char *profile_path);
+
+/*! validate a command before it is queued (returns the status it should fail with, if any) */
+int cpi_validate_cmd(cpi_cmd_t *p_cmd);
+
+/*! retrieve the number of output buffers written by the specified CPI_CMD_ code */
+int cpi_cmd_out_count(int cmd);
+
+/*! connect the specified CPI instance to the CPI daemon listening on socket_path */
+int cpi_remote_init(cpi_t *p_cpi, const char *socket_path);
+
+/*! release the daemon connection owned by the specified CPI instance, if any */
+void cpi_remote_cleanup(cpi_t *p_cpi);
+
+/*! execute a batch of commands through the daemon, writing back results and status */
+int cpi_remote_execute(cpi_t *p_cpi, cpi_cmd_t *cmds, size_t n);
+
+/*! queue a command with the daemon, calling callback once its response has been read */
+int cpi_remote_submit(cpi_t *p_cpi, cpi_cmd_t *p_cmd, cpi_callback_t callback);
+
+/*! retrieve the connection to the daemon, for cpi_get_fd */
+int cpi_remote_get_fd(cpi_t *p_cpi);
+
+/*! complete commands queued with the daemon whose responses have arrived, without blocking */
+int cpi_remote_process_events(cpi_t *p_cpi);
+
+/*! set the write delay of the daemon's serial device */
+int cpi_remote_set_write_delay(cpi_t *p_cpi, uint32_t delay_us);
+
+/*! retrieve the scheduler metrics of the daemon */
+int cpi_remote_metrics(cpi_t *p_cpi, cpi_metrics_t *p_metrics);
+
+/*! take the cross-process lock on the open serial device, waiting up to timeout_ms (-1 for no limit) in arrival order */
+int cpi_lock_acquire(cpi_t *p_cpi, const char *serial_device_path, int timeout_ms);
+
+/*! release the cross-process lock held by the specified CPI instance, if any (before the serial device is closed) */
+void cpi_lock_release(cpi_t *p_cpi);
+
+/*! format a raw serial number as hex, into CPI_UTIL_SERIAL_SIZE bytes */
+void cpi_util_format_serial(const uint8_t *raw_serial, char *serial);
+
+/*! save a line based state file (pacing profile, budget state) in one step, under an flock on path.lock: lines for which replaced returns nonzero are dropped, and append writes their successors (a new file starts with the header line) */
+int cpi_util_save_state(const char *path, const char *header, int (*replaced)(const char *line, void *arg), void (*append)(FILE *file, void *arg), void *arg);
+
+/*! allocate heap memory on behalf of the library (counted, see cpi_get_alloc_count) */
+void *cpi_util_malloc(size_t size);
+
+/*! free heap memory allocated by cpi_util_malloc */
+void cpi_util_free(void *ptr);
+
+/*! release the XML parser and batch storage owned by the specified CPI instance, if any */
+void cpi_xml_cleanup(cpi_t *p_cpi);
 
 #ifdef __cplusplus
 }
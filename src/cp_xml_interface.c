@@ -8,9 +8,11 @@
 
 #include "cp_interface.h"
 #include "cp_utility.h"
+#include "cp_format.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <expat.h>
 
 /*! utility structure for parser context */
@@ -18,8 +20,10 @@ typedef struct _parser_context
 {
     /*! cpi instance handle */
     cpi_t *p_cpi;
-    /*! output XML string */
-    char *out_xml_str;
+    /*! output buffer */
+    cpi_out *p_out;
+    /*! response writer for the requested output format */
+    const cpi_writer *p_writer;
     /*! current parser state */
     enum parser_state
     {
@@ -34,21 +38,23 @@ typedef struct _parser_context
     cur_state;
     /*! flag specifying if we are validating */
     int validate_state;
+    /*! pending queries, owned by this call */
+    struct _xml_batch *p_batch;
 }
 parser_context;
 
+/*! obtain a parser (and batch storage), ready for a new document, creating them if necessary */
+static XML_Parser xml_parser_prepare(XML_Parser *p_xml_parser, struct _xml_batch **pp_batch, parser_context *p_context);
+/*! return the parser and batch storage used by a call to the instance, for reuse (or free them) */
+static void xml_scratch_release(cpi_t *p_cpi, XML_Parser xml_parser, struct _xml_batch *p_batch);
 /*! expat element start handler */
 static void expat_handler_element_start(void *usr_data, const XML_Char *name, const XML_Char **attr);
 /*! expat element end handler */
 static void expat_handler_element_end(void *usr_data, const XML_Char *name);
-/*! query execution function */
+/*! query execution function - queues the query into the pending batch */
 static int execute_query(parser_context *p_context, const char **attr);
-/*! output error condition */
-static void output_condition_failure(parser_context *p_context, const char *type, int ret);
-/*! output success condition (begin) */
-static void output_condition_success_beg(parser_context *p_context, const char *type);
-/*! output success condition (end) */
-static void output_condition_success_end(parser_context *p_context);
+/*! execute all pending queries as a single batch, and report their results */
+static void execute_batch(parser_context *p_context);
 /*! retrieve attribute with the specified name - string type */
 static int get_attr_str(const char **attr, const char *attr_str, char const **p_attr_val);
 /*! retrieve attribute with the specified name - uint16_t type */
@@ -57,28 +63,110 @@ static int get_attr_uint16(const char **attr, const char *attr_str, uint16_t *p_
 /*! character encoding */
 static const char *expat_char_encoding = "US-ASCII";
 
-/*! max size of output string */
-static int max_size = CPI_MAX_RESULT_SIZE;
+/*! expat allocator - small blocks are recycled through xml_block_cache */
+static void *expat_malloc(size_t size);
+/*! expat reallocator */
+static void *expat_realloc(void *ptr, size_t size);
+/*! expat deallocator */
+static void expat_free(void *ptr);
+
+/*! expat memory suite, so parser allocations are counted with the rest of the library */
+static const XML_Memory_Handling_Suite expat_memory_suite = { expat_malloc, expat_realloc, expat_free };
+
+/*! header preceding every block handed to expat */
+typedef union _xml_block_hdr
+{
+    size_t size;                        /*!< usable size of the block */
+    union _xml_block_hdr *next;         /*!< next free block, while cached */
+    long double align;                  /*!< forces maximum alignment of the payload */
+}
+xml_block_hdr;
+
+/*! usable size of small, recyclable blocks */
+#define XML_BLOCK_SIZE      64
+/*! max number of small blocks kept for reuse */
+#define XML_BLOCK_CACHE_MAX 64
+
+/*! @note resetting an expat parser frees and recreates its element type and attribute
+ *  hash entries, as well as the copied encoding name. these are all small, so they are
+ *  recycled here, which keeps repeated cpi_process_xml calls free of malloc/free. */
+static struct
+{
+    pthread_mutex_t lock;
+    xml_block_hdr *head;
+    int count;
+}
+xml_block_cache = { PTHREAD_MUTEX_INITIALIZER, 0, 0 };
+
+/*! max number of queries executed as a single batch */
+#define XML_BATCH_MAX       32
+/*! size of the result arena shared by a batch of queries */
+#define XML_BATCH_ARENA     (2*CPI_MAX_RESULT_SIZE)
+
+/*! utility structure for the pending batch; one is cached by the CPI instance, for reuse by the next call */
+typedef struct _xml_batch
+{
+    /*! pending queries, in document order */
+    cpi_cmd_t cmds[XML_BATCH_MAX];
+    /*! "type" attribute of each pending query, as given (truncated) */
+    char types[XML_BATCH_MAX][16];
+    /*! random data input of each pending query, for CHAL queries */
+    uint8_t rand_data[XML_BATCH_MAX][CPI_RNDX_SIZE];
+    /*! number of pending queries */
+    int count;
+    /*! number of arena bytes handed out to pending queries */
+    int arena_used;
+    /*! result storage for pending queries */
+    uint8_t arena[XML_BATCH_ARENA];
+}
+xml_batch;
+
 
 int cpi_process_xml(struct _cpi_t *p_cpi, char *inp_xml_str, char *out_xml_str)
+{
+    int size = CPI_MAX_RESULT_SIZE;
+
+    return cpi_process_query(p_cpi, inp_xml_str, CPI_FORMAT_XML, out_xml_str, &size);
+}
+
+int cpi_process_query(struct _cpi_t *p_cpi, char *inp_xml_str, int format, void *out_buff, int *p_out_size)
 {
     int success = 0;
 
-    enum XML_Status status;
+    int ret = CPI_OK;
+
+    enum XML_Status status = XML_STATUS_ERROR;
+
+    /*! per-call scratch space - the cached parser and batch storage, unless another thread is using them */
+    XML_Parser xml_parser = 0;
+
+    xml_batch *p_batch = 0;
+
+    /*! output buffer state */
+    cpi_out out = { (char*)out_buff, 0, 0, 0, 0 };
+
+    /*! response writer for the requested format */
+    const cpi_writer *p_writer = cpi_format_writer(format);
+
+    /*! sanity check - null ptr */
+    if( (p_cpi == 0) || (inp_xml_str == 0) || (out_buff == 0) || (p_out_size == 0) ) { return CPI_INVALID_PARAM; }
 
-    /*! create parser instance */
-    XML_Parser xml_parser = XML_ParserCreate(expat_char_encoding);
+    /*! sanity check - output format and size */
+    if( (p_writer == 0) || (*p_out_size <= 0) ) { return CPI_INVALID_PARAM; }
+
+    out.size = *p_out_size;
+    out.data[0] = '\0';
+
+    xml_parser = (XML_Parser)__atomic_exchange_n(&p_cpi->xml_parser, 0, __ATOMIC_ACQUIRE);
+    p_batch = (xml_batch*)__atomic_exchange_n(&p_cpi->xml_batch, 0, __ATOMIC_ACQUIRE);
 
     /*! validate XML */
     {
         /*! initialize parser context, in validate mode */
-        parser_context context = { p_cpi, out_xml_str, PARSER_STATE_CPI_BEG, 1 };
+        parser_context context = { p_cpi, &out, p_writer, PARSER_STATE_CPI_BEG, 1, 0 };
 
-        /*! set user data */
-        XML_SetUserData(xml_parser, &context);
-
-        /*! set start and end handlers for parsing */
-        XML_SetElementHandler(xml_parser, expat_handler_element_start, expat_handler_element_end);
+        /*! obtain a clean parser instance */
+        if(xml_parser_prepare(&xml_parser, &p_batch, &context) == 0) { xml_scratch_release(p_cpi, xml_parser, p_batch); return CPI_OUT_OF_MEMORY; }
 
         /*! parse document, validating syntax */
         status = XML_Parse(xml_parser, inp_xml_str, strlen(inp_xml_str), 1);
@@ -88,42 +176,121 @@ int cpi_process_xml(struct _cpi_t *p_cpi, char *inp_xml_str, char *out_xml_str)
     }
 
     /*! if validation went okay, parse again while executing queries */
-    if( (status == XML_STATUS_OK) && success && (XML_ParserReset(xml_parser, expat_char_encoding) == XML_TRUE) )
+    if( (status == XML_STATUS_OK) && success )
     {
         /*! initialize parser context, in execution mode */
-        parser_context context = { p_cpi, out_xml_str, PARSER_STATE_CPI_BEG, 0 };
+        parser_context context = { p_cpi, &out, p_writer, PARSER_STATE_CPI_BEG, 0, 0 };
 
-        /*! write XML header */
-        strcpy(out_xml_str, "<?xml version='1.0'?>\n");
-        
-        /*! begin basic XML template */
-        strncat(out_xml_str, "<cpi version='1.0'>\n", max_size);
-        strncat(out_xml_str, "  <response_list>\n", max_size);
+        /*! obtain a clean parser instance */
+        if(xml_parser_prepare(&xml_parser, &p_batch, &context) == 0) { xml_scratch_release(p_cpi, xml_parser, p_batch); return CPI_OUT_OF_MEMORY; }
 
-        /*! set user data */
-        XML_SetUserData(xml_parser, &context);
+        /*! start with an empty batch */
+        p_batch->count = 0;
+        p_batch->arena_used = 0;
 
-        /*! set start and end handlers for parsing */
-        XML_SetElementHandler(xml_parser, expat_handler_element_start, expat_handler_element_end);
+        /*! begin response document */
+        p_writer->begin(&out);
 
-        /*! parse document, executing queries */
+        /*! parse document, queueing and executing queries */
         status = XML_Parse(xml_parser, inp_xml_str, strlen(inp_xml_str), 1);
 
-        /*! finish basic XML template */
-        strncat(out_xml_str, "  </response_list>\n", max_size);
-        strncat(out_xml_str, "</cpi>\n", max_size);
+        /*! execute remaining queries */
+        execute_batch(&context);
+
+        /*! finish response document */
+        p_writer->end(&out);
 
         /*! update success state, if appropriate */
         success = (context.cur_state == PARSER_STATE_SUCCESS);
     }
 
-    /*! free parser instance */
-    XML_ParserFree(xml_parser);
+    xml_scratch_release(p_cpi, xml_parser, p_batch);
+
+    /*! return output size */
+    *p_out_size = out.used;
 
     /*! check XML parsing return code */
-    if( (status != XML_STATUS_OK) || !success ) { return CPI_FAIL; }
+    if( (status != XML_STATUS_OK) || !success ) { ret = CPI_FAIL; }
 
-    return CPI_OK;
+    /*! check that all output fit */
+    else if(out.overflow) { ret = CPI_OUT_OF_MEMORY; }
+
+    return ret;
+}
+
+void cpi_xml_cleanup(cpi_t *p_cpi)
+{
+    if(p_cpi->xml_parser != 0)
+    {
+        XML_ParserFree((XML_Parser)p_cpi->xml_parser);
+        p_cpi->xml_parser = 0;
+    }
+
+    if(p_cpi->xml_batch != 0)
+    {
+        cpi_util_free(p_cpi->xml_batch);
+        p_cpi->xml_batch = 0;
+    }
+
+    return;
+}
+
+static void xml_scratch_release(cpi_t *p_cpi, XML_Parser xml_parser, xml_batch *p_batch)
+{
+    void *expected = 0;
+
+    /*! keep them for the next call, unless a concurrent call has already returned its own */
+    if( (xml_parser != 0) && !__atomic_compare_exchange_n(&p_cpi->xml_parser, &expected, (void*)xml_parser, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED) )
+    {
+        XML_ParserFree(xml_parser);
+    }
+
+    expected = 0;
+
+    if( (p_batch != 0) && !__atomic_compare_exchange_n(&p_cpi->xml_batch, &expected, (void*)p_batch, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED) )
+    {
+        cpi_util_free(p_batch);
+    }
+
+    return;
+}
+
+static XML_Parser xml_parser_prepare(XML_Parser *p_xml_parser, xml_batch **pp_batch, parser_context *p_context)
+{
+    XML_Parser xml_parser = *p_xml_parser;
+
+    /*! create pending batch storage on first use */
+    if(*pp_batch == 0)
+    {
+        *pp_batch = (xml_batch*)cpi_util_malloc(sizeof(xml_batch));
+
+        if(*pp_batch == 0) { return 0; }
+    }
+
+    p_context->p_batch = *pp_batch;
+
+    /*! create parser instance on first use, routing its allocations through the library */
+    if(xml_parser == 0)
+    {
+        xml_parser = XML_ParserCreate_MM(expat_char_encoding, &expat_memory_suite, 0);
+
+        if(xml_parser == 0) { return 0; }
+
+        *p_xml_parser = xml_parser;
+    }
+    /*! otherwise, reset the existing instance - this reuses its internal memory pools */
+    else if(XML_ParserReset(xml_parser, expat_char_encoding) != XML_TRUE)
+    {
+        return 0;
+    }
+
+    /*! set user data */
+    XML_SetUserData(xml_parser, p_context);
+
+    /*! set start and end handlers for parsing (handlers are cleared by a reset) */
+    XML_SetElementHandler(xml_parser, expat_handler_element_start, expat_handler_element_end);
+
+    return xml_parser;
 }
 
 static void expat_handler_element_start(void *usr_data, const XML_Char *name, const XML_Char **attr)
@@ -210,343 +377,143 @@ static void expat_handler_element_end(void *usr_data, const XML_Char *name)
 
 static int execute_query(parser_context *p_context, const char **attr)
 {
+    xml_batch *p_batch = p_context->p_batch;
+
+    /*! query being queued, built locally until its parameters are known to be valid */
+    cpi_cmd_t cmd;
+
+    /*! random data input, for CHAL queries */
+    uint8_t rand_data[CPI_RNDX_SIZE] = { 0 };
+
+    /*! arena bytes needed for results */
+    int res_size = 0;
+
     const char *type = 0;
 
     int ret = get_attr_str(attr, "type", &type);
 
     if(CPI_FAILED(ret)) { return ret; }
 
-    /*! handle PIDX query */
-    if(strncmp(type, "pidx", strlen("pidx")) == 0)
-    {
-        uint16_t key_id = 0;
-
-        /*! retrieve key_id */
-        {
-            ret = get_attr_uint16(attr, "key_id", &key_id);
-
-            if(CPI_FAILED(ret)) { return ret; }
-        }
+    memset(&cmd, 0, sizeof(cmd));
 
-        ret = cpi_get_putative_id(p_context->p_cpi, key_id, p_context->p_cpi->tmp_buff_xml);
+    /*! identify query type */
+    cmd.cmd = cpi_format_cmd(type);
 
-        if(CPI_FAILED(ret))
-        {
-            output_condition_failure(p_context, type, ret);
-        }
-        else
-        {
-            output_condition_success_beg(p_context, type);
-            strncat(p_context->out_xml_str, p_context->p_cpi->tmp_buff_xml, max_size);
-            output_condition_success_end(p_context);
-        }
-    }
-    /*! handle PKEY query */
-    else if(strncmp(type, "pkey", strlen("pkey")) == 0)
+    switch(cmd.cmd)
     {
-        uint16_t key_id = 0;
-
-        /*! retrieve key_id */
+        /*! PIDX query needs key_id */
+        case CPI_CMD_PIDX:
         {
-            ret = get_attr_uint16(attr, "key_id", &key_id);
+            ret = get_attr_uint16(attr, "key_id", &cmd.key_id);
 
             if(CPI_FAILED(ret)) { return ret; }
         }
+        break;
 
-        ret = cpi_get_public_key(p_context->p_cpi, key_id, p_context->p_cpi->tmp_buff_xml);
-
-        if(CPI_FAILED(ret))
-        {
-            output_condition_failure(p_context, type, ret);
-        }
-        else
-        {
-            output_condition_success_beg(p_context, type);
-            strncat(p_context->out_xml_str, "\n", max_size);
-            strncat(p_context->out_xml_str, p_context->p_cpi->tmp_buff_xml, max_size);
-            strncat(p_context->out_xml_str, "    ", max_size);
-            output_condition_success_end(p_context);
-        }
-    }
-    /*! handle VERS query */
-    else if(strncmp(type, "vers", strlen("vers")) == 0)
-    {
-        uint16_t major = 0, minor = 0, fix = 0;
-
-        ret = cpi_get_version_number(p_context->p_cpi, &major, &minor, &fix);
-
-        if(CPI_FAILED(ret))
+        /*! PKEY query needs key_id */
+        case CPI_CMD_PKEY:
         {
-            output_condition_failure(p_context, type, ret);
-        }
-        else
-        {
-            /*! generate version string major.minor.fix (e.g. 4.2.0) */
-            sprintf(p_context->p_cpi->tmp_buff_xml, "%d.%d.%d", major, minor, fix);
+            ret = get_attr_uint16(attr, "key_id", &cmd.key_id);
 
-            output_condition_success_beg(p_context, type);
-            strncat(p_context->out_xml_str, p_context->p_cpi->tmp_buff_xml, max_size);
-            output_condition_success_end(p_context);
+            if(CPI_FAILED(ret)) { return ret; }
         }
-    }
-    /*! handle TIME query */
-    else if(strncmp(type, "time", strlen("time")) == 0)
-    {
-        uint32_t cur_time = 0;
-
-        ret = cpi_get_current_time(p_context->p_cpi, &cur_time);
+        break;
 
-        if(CPI_FAILED(ret))
+        /*! CHAL query needs key_id and rand_data */
+        case CPI_CMD_CHAL:
         {
-            output_condition_failure(p_context, type, ret);
-        }
-        else
-        {
-            /*! convert time to string format */
-            sprintf(p_context->p_cpi->tmp_buff_xml, "%u", cur_time);
+            ret = get_attr_uint16(attr, "key_id", &cmd.key_id);
 
-            output_condition_success_beg(p_context, type);
-            strncat(p_context->out_xml_str, p_context->p_cpi->tmp_buff_xml, max_size);
-            output_condition_success_end(p_context);
-        }
-    }
-    /*! handle CKEY query */
-    else if(strncmp(type, "ckey", strlen("ckey")) == 0)
-    {
-        uint32_t cur_oki = 0;
-
-        ret = cpi_get_owner_key_index(p_context->p_cpi, &cur_oki);
-
-        if(CPI_FAILED(ret))
-        {
-            output_condition_failure(p_context, type, ret);
-        }
-        else
-        {
-            /*! convert owner key to string format */
-            sprintf(p_context->p_cpi->tmp_buff_xml, "%u", cur_oki);
+            if(CPI_FAILED(ret)) { return ret; }
 
-            output_condition_success_beg(p_context, type);
-            strncat(p_context->out_xml_str, p_context->p_cpi->tmp_buff_xml, max_size);
-            output_condition_success_end(p_context);
-        }
-    }
-    /*! handle SNUM query */
-    else if(strncmp(type, "snum", strlen("snum")) == 0)
-    {
-        uint8_t serial_number[CPI_SERIAL_NUMBER_SIZE] = { 0 };
+            /*! parse random data input */
+            {
+                const char *rand_data_str = 0;
 
-        ret = cpi_get_serial_number(p_context->p_cpi, serial_number);
+                ret = get_attr_str(attr, "rand_data", (char const **)&rand_data_str);
 
-        if(CPI_FAILED(ret))
-        {
-            output_condition_failure(p_context, type, ret);
-        }
-        else
-        {
-            /*! blank out temporary buffer */
-            strcpy(p_context->p_cpi->tmp_buff_xml, "");
+                if(CPI_FAILED(ret)) { return ret; }
 
-            /*! convert serial number to string format */
-            {
-                char buff[8];
+                /*! handle invalid # of characters */
+                if(strlen(rand_data_str) < (CPI_RNDX_SIZE*2)) { return CPI_FAIL; }
 
                 int v;
-                for(v=0;v<CPI_SERIAL_NUMBER_SIZE;v++)
+                for(v=0;v<CPI_RNDX_SIZE;v++)
                 {
-                    sprintf(buff, "%.02X", (uint32_t)serial_number[v]);
-                    strncat(p_context->p_cpi->tmp_buff_xml, buff, max_size);
-                }
-            }
+                    uint32_t cur_val = 0;
 
-            output_condition_success_beg(p_context, type);
-            strncat(p_context->out_xml_str, p_context->p_cpi->tmp_buff_xml, max_size);
-            output_condition_success_end(p_context);
-        }
-    }
-    /*! handle HWVR query */
-    else if(strncmp(type, "hwvr", strlen("hwvr")) == 0)
-    {
-        uint8_t hardware_version[CPI_HARDWARE_VERSION_SIZE] = { 0 };
-
-        ret = cpi_get_hardware_version_data(p_context->p_cpi, hardware_version);
+                    ret = sscanf(&rand_data_str[v*2], "%02X", &cur_val);
 
-        if(CPI_FAILED(ret))
-        {
-            output_condition_failure(p_context, type, ret);
-        }
-        else
-        {
-            /*! blank out temporary buffer */
-            strcpy(p_context->p_cpi->tmp_buff_xml, "");
-
-            /*! convert serial number to string format */
-            {
-                char buff[8];
+                    if(ret != 1) { return CPI_FAIL; }
 
-                int v;
-                for(v=0;v<CPI_HARDWARE_VERSION_SIZE;v++)
-                {
-                    sprintf(buff, "%.02X", (uint32_t)hardware_version[v]);
-                    strncat(p_context->p_cpi->tmp_buff_xml, buff, max_size);
+                    rand_data[v] = (uint8_t)cur_val;
                 }
             }
-
-            output_condition_success_beg(p_context, type);
-            strncat(p_context->out_xml_str, p_context->p_cpi->tmp_buff_xml, max_size);
-            output_condition_success_end(p_context);
         }
-    }
-    /*! handle CHAL query */
-    else if(strncmp(type, "chal", strlen("chal")) == 0)
-    {
-        uint16_t key_id = 0;
-        uint8_t rand_data[CPI_RNDX_SIZE] = { 0 };
-
-        /*! retrieve key_id */
-        {
-            ret = get_attr_uint16(attr, "key_id", &key_id);
-
-            if(CPI_FAILED(ret)) { return ret; }
-        }
-
-        /*! parse random data input */
-        {
-            const char *rand_data_str = 0;
-
-            ret = get_attr_str(attr, "rand_data", (char const **)&rand_data_str);
-
-            if(CPI_FAILED(ret)) { return ret; }
+        break;
 
-            /*! handle invalid # of characters */
-            if(strlen(rand_data_str) < (CPI_RNDX_SIZE*2)) { return CPI_FAIL; }
+        /*! VERS, TIME, CKEY, SNUM, HWVR and unknown queries need no parameters */
+        default:
+            break;
+    }
 
-            int v;
-            for(v=0;v<CPI_RNDX_SIZE;v++)
-            {
-                uint32_t cur_val = 0;
+    res_size = cpi_format_result_size(cmd.cmd);
 
-                ret = sscanf(&rand_data_str[v*2], "%02X", &cur_val);
+    /*! execute pending queries first, if this one does not fit */
+    if( (p_batch->count == XML_BATCH_MAX) || (p_batch->arena_used + res_size > XML_BATCH_ARENA) )
+    {
+        execute_batch(p_context);
+    }
 
-                if(ret != 1) { return CPI_FAIL; }
+    /*! assign result storage, laid out as the writers expect */
+    if(res_size > 0)
+    {
+        cpi_format_bind(&cmd, &p_batch->arena[p_batch->arena_used]);
 
-                rand_data[v] = (uint8_t)cur_val;
-            }
-        }
+        p_batch->arena_used += res_size;
+    }
 
-        uint8_t *result1 = (uint8_t*)&p_context->p_cpi->tmp_buff_xml[0];
-        uint8_t *result2 = (uint8_t*)&p_context->p_cpi->tmp_buff_xml[CPI_RESULT1_SIZE];
-        uint8_t *result3 = (uint8_t*)&p_context->p_cpi->tmp_buff_xml[CPI_RESULT1_SIZE + CPI_RESULT2_SIZE];
+    /*! queue query */
+    {
+        int cur = p_batch->count++;
 
-        /*! clear result buffers */
-        memset(result1, 0, CPI_RESULT1_SIZE);
-        memset(result2, 0, CPI_RESULT2_SIZE);
-        memset(result3, 0, CPI_RESULT3_SIZE);
+        strncpy(p_batch->types[cur], type, sizeof(p_batch->types[cur])-1);
+        p_batch->types[cur][sizeof(p_batch->types[cur])-1] = '\0';
 
-        ret = cpi_issue_challenge(p_context->p_cpi, key_id, rand_data, result1, result2, result3);
+        memcpy(p_batch->rand_data[cur], rand_data, CPI_RNDX_SIZE);
 
-        if(CPI_FAILED(ret))
-        {
-            output_condition_failure(p_context, type, ret);
-        }
-        else
-        {
-            output_condition_success_beg(p_context, type);
+        if(cmd.cmd == CPI_CMD_CHAL) { cmd.rand_data = p_batch->rand_data[cur]; }
 
-            strncat(p_context->out_xml_str, "\n", max_size);
-            strncat(p_context->out_xml_str, "      <enc_owner_key>", max_size);
-
-            /*! convert result1 to string format */
-            {
-                char buff[8];
-
-                int v;
-                for(v=0;v<CPI_RESULT1_SIZE;v++)
-                {
-                    sprintf(buff, "%.02X", (uint32_t)result1[v]);
-                    strncat(p_context->out_xml_str, buff, max_size);
-
-                    if(v == (CPI_RESULT1_ENC_OK_SIZE-1)) 
-                    { 
-                        strncat(p_context->out_xml_str, "</enc_owner_key>\n", max_size);
-                        strncat(p_context->out_xml_str, "      <rand_data>", max_size);
-                    }
-                    else if(v == (CPI_RESULT1_ENC_OK_SIZE+CPI_RESULT1_RAND_SIZE-1))
-                    {
-                        strncat(p_context->out_xml_str, "</rand_data>\n", max_size);
-                        strncat(p_context->out_xml_str, "      <vers>", max_size);
-                    }
-                    else if(v == (CPI_RESULT1_SIZE-1))
-                    {
-                        strncat(p_context->out_xml_str, "</vers>\n", max_size);
-                    }
-                }
-            }
+        p_batch->cmds[cur] = cmd;
+    }
 
-            strncat(p_context->out_xml_str, "      <signature>", max_size);
+    return CPI_OK;
+}
 
-            /*! convert result2 to string format */
-            {
-                char buff[8];
+static void execute_batch(parser_context *p_context)
+{
+    xml_batch *p_batch = p_context->p_batch;
 
-                int v;
-                for(v=0;v<CPI_RESULT2_SIZE;v++)
-                {
-                    sprintf(buff, "%.02X", (uint32_t)result2[v]);
-                    strncat(p_context->out_xml_str, buff, max_size);
-                }
-            }
-#if defined(CNPLATFORM_falconwing)
-	    {
-                char buff[8];
+    int v;
 
-                int v;
-                for(v=0;v<CPI_RESULT3_SIZE;v++)
-                {
-                    sprintf(buff, "%.02X", (uint32_t)result3[v]);
-                    strncat(p_context->out_xml_str, buff, max_size);
-                }
-	    }
-#endif
+    if(p_batch->count == 0) { return; }
 
-            strncat(p_context->out_xml_str, "</signature>\n", max_size);
-            strncat(p_context->out_xml_str, "    ", max_size);
+    /*! execute known queries in a single CP session (unknown ones are rejected per entry) */
+    cpi_execute_batch(p_context->p_cpi, p_batch->cmds, p_batch->count);
 
-            output_condition_success_end(p_context);
-        }
-    }
-    /*! handle unknown query */
-    else
+    /*! report results in the requested format, in document order */
+    for(v=0;v<p_batch->count;v++)
     {
-        strncat(p_context->out_xml_str, "    <response result=\"failure\">Unknown \"type\" value</response>\n", max_size);
-    }
+        query_result result;
 
-    return CPI_OK;
-}
+        cpi_format_result(&p_batch->cmds[v], p_batch->types[v], &result);
 
-static void output_condition_failure(parser_context *p_context, const char *type, int ret)
-{
-    strncat(p_context->out_xml_str, "    <response type=\"", max_size);
-    strncat(p_context->out_xml_str, type, max_size);
-    strncat(p_context->out_xml_str, "\"", max_size);
-    strncat(p_context->out_xml_str, " result=\"failure\">", max_size);
-    strncat(p_context->out_xml_str, CPI_RETURN_CODE_LOOKUP[ret], max_size);
-    strncat(p_context->out_xml_str, "</response>\n", max_size);
-    return;
-}
+        p_context->p_writer->result(p_context->p_out, &result);
+    }
 
-static void output_condition_success_beg(parser_context *p_context, const char *type)
-{
-    strncat(p_context->out_xml_str, "    <response type=\"", max_size);
-    strncat(p_context->out_xml_str, type, max_size);
-    strncat(p_context->out_xml_str, "\"", max_size);
-    strncat(p_context->out_xml_str, " result=\"success\">", max_size);
-    return;
-}
+    p_batch->count = 0;
+    p_batch->arena_used = 0;
 
-static void output_condition_success_end(parser_context *p_context)
-{
-    strncat(p_context->out_xml_str, "</response>\n", max_size);
     return;
 }
 
@@ -582,3 +549,85 @@ static int get_attr_uint16(const char **attr, const char *attr_str, uint16_t *p_
     return CPI_OK;
 }
 
+
+static void *expat_malloc(size_t size)
+{
+    xml_block_hdr *p_hdr = 0;
+
+    /*! attempt to recycle a cached small block */
+    if(size <= XML_BLOCK_SIZE)
+    {
+        pthread_mutex_lock(&xml_block_cache.lock);
+
+        p_hdr = xml_block_cache.head;
+
+        if(p_hdr != 0)
+        {
+            xml_block_cache.head = p_hdr->next;
+            xml_block_cache.count--;
+        }
+
+        pthread_mutex_unlock(&xml_block_cache.lock);
+
+        if(p_hdr != 0) { p_hdr->size = XML_BLOCK_SIZE; return &p_hdr[1]; }
+
+        /*! small blocks are always allocated at full size, so they can be recycled */
+        size = XML_BLOCK_SIZE;
+    }
+
+    p_hdr = (xml_block_hdr*)cpi_util_malloc(sizeof(xml_block_hdr) + size);
+
+    if(p_hdr == 0) { return 0; }
+
+    p_hdr->size = size;
+
+    return &p_hdr[1];
+}
+
+static void *expat_realloc(void *ptr, size_t size)
+{
+    if(ptr == 0) { return expat_malloc(size); }
+
+    xml_block_hdr *p_hdr = &((xml_block_hdr*)ptr)[-1];
+
+    /*! existing block is already large enough */
+    if(size <= p_hdr->size) { return ptr; }
+
+    /*! grow via a fresh block, so that recycled blocks keep a uniform size */
+    void *p_new = expat_malloc(size);
+
+    if(p_new == 0) { return 0; }
+
+    memcpy(p_new, ptr, p_hdr->size);
+
+    expat_free(ptr);
+
+    return p_new;
+}
+
+static void expat_free(void *ptr)
+{
+    if(ptr == 0) { return; }
+
+    xml_block_hdr *p_hdr = &((xml_block_hdr*)ptr)[-1];
+
+    /*! cache small blocks for reuse, up to a limit */
+    if(p_hdr->size == XML_BLOCK_SIZE)
+    {
+        pthread_mutex_lock(&xml_block_cache.lock);
+
+        if(xml_block_cache.count < XML_BLOCK_CACHE_MAX)
+        {
+            p_hdr->next = xml_block_cache.head;
+            xml_block_cache.head = p_hdr;
+            xml_block_cache.count++;
+            p_hdr = 0;
+        }
+
+        pthread_mutex_unlock(&xml_block_cache.lock);
+
+        if(p_hdr == 0) { return; }
+    }
+
+    cpi_util_free(p_hdr);
+}
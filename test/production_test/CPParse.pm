@@ -12,7 +12,7 @@ require Exporter;
 
 
 our @ISA = qw(Exporter);
-our @EXPORT = qw(load_key_file  parse_cpi_xml_response parse_cpi_xml_request);
+our @EXPORT = qw(load_key_file  parse_cpi_xml_response parse_cpi_tlv_response parse_cpi_xml_request);
 
 
 sub batch_hex_to_bn($)
@@ -131,4 +131,54 @@ sub parse_cpi_xml_response($)
 }
 
 
+#
+# Parses the output of "cpi -f tlv" into the same record as parse_cpi_xml_response.
+# Layout is described in cp_interface.h (CPI_FORMAT_TLV): a 'CPI' + version header,
+# then records of tag(1) result(1) length(2, little endian) value.
+#
+sub parse_cpi_tlv_response($)
+{
+    my $file = shift;
+    my $rec = {};
+
+    my $data = load_file($file);
+
+    my ($magic, $version) = unpack('a3 C', $data);
+    error("not a cpi tlv stream: $file") if( !defined($magic) || $magic ne 'CPI' || $version != 1 );
+
+    my $offs = 4;
+    while( $offs + 4 <= length($data) )
+    {
+        my ($tag, $result, $len) = unpack("x$offs C C v", $data);
+        my $value = substr($data, $offs + 4, $len);
+        $offs += 4 + $len;
+
+        last if( $tag == 0xFF );
+        next if( $result != 0 );
+
+        if( $tag == 0x01 )
+        {
+            $rec->{pid} = uc(unpack('H*', $value)) if( !defined($rec->{pid}) );
+        }
+        elsif( $tag == 0x02 )
+        {
+            $rec->{pkey} = $value;
+        }
+        elsif( $tag == 0x08 )
+        {
+            my ($enc, $rm, $vers, $sig) = unpack('a256 a16 a4 a128', $value);
+
+            $rec->{ok} = uc(unpack('H*', $enc));
+            $rec->{rm} = uc(unpack('H*', $rm));
+            $rec->{version} = uc(unpack('H*', $vers));
+            $rec->{s} = uc(unpack('H*', $sig));
+        }
+    }
+
+    batch_hex_to_bn($rec);
+
+    return $rec;
+}
+
+
 1;
\ No newline at end of file
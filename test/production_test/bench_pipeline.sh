@@ -0,0 +1,42 @@
+#!/bin/sh
+
+
+# times back to back processing of query_all.xml, with and without pipelined
+# exchanges (cpi -x), in ms per document, and checks that both modes write
+# the same response.
+#
+# usage: bench_pipeline.sh [count] [device]
+#
+# with no device, runs against the fake CP of cpi-unit ("make check TARGET="
+# in build/), which answers at once, so only the library's own gaps show.
+# the query set has a challenge, so on a real CP each document spends an
+# authentication. $CPI and $CPI_UNIT override the binaries to run.
+
+count=${1:-20}
+device=$2
+query=$(dirname $0)/../data/query_all.xml
+CPI=${CPI:-cpi}
+CPI_UNIT=${CPI_UNIT:-cpi-unit}
+fake_pid=""
+
+if [ -z "$device" ]; then
+	device=/tmp/bench_pipeline.$$
+	$CPI_UNIT fakecp $device &
+	fake_pid=$!
+	sleep 1
+fi
+
+out=/tmp/bench_pipeline.$$.xml
+
+for mode in "" "-x"; do
+	echo "mode: ${mode:-(not pipelined)}"
+	$CPI -t $device -r $query -w $out$mode -b $count $mode
+done
+
+cmp -s $out $out-x || echo "responses differ between modes"
+rm -f $out $out-x
+
+if [ -n "$fake_pid" ]; then
+	kill $fake_pid
+	rm -f $device
+fi
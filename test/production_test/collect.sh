@@ -3,15 +3,16 @@
 
 # assume source data in current dir.
 
+# each challenge is issued as soon as the CP's authentication budget allows,
+# as learned from its AUTHCOUNT answers (see "cpi schedule --help"), and
+# queries which already have a response are skipped.
+
 index=0
+queries=""
 
 while [ $index -lt 24 ]; do
-	echo "loop: $index"
-	if [ ! -e response${index}.xml ]; then
-		cpi -r query${index}.xml -w response${index}.xml
-		echo "sleeping..."
-		sleep 300
-	fi
+	queries="$queries query${index}.xml"
 	index=$(expr $index + 1)
 done
 
+cpi schedule $queries
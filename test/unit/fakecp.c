@@ -0,0 +1,342 @@
+/*
+ * fakecp.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the fake Crypto Processor (see fakecp.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+/*! maximum size of a request's arguments, or of a response */
+#define FAKECP_LINE_SIZE    0x1000
+
+static const char b64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*! utility function to append base64 of data to a response, with a newline every wrap characters (0 for none) */
+static size_t fakecp_b64(char *p_out, const uint8_t *p_data, size_t size, int wrap)
+{
+    size_t v, len = 0;
+
+    for(v=0;v<size;v+=3)
+    {
+        uint32_t bits = (uint32_t)p_data[v] << 16;
+        int n = (size - v < 3) ? (int)(size - v) : 3, c;
+
+        if(n > 1) { bits |= (uint32_t)p_data[v+1] << 8; }
+        if(n > 2) { bits |= (uint32_t)p_data[v+2]; }
+
+        for(c=0;c<4;c++)
+        {
+            if(wrap && len && (len % (wrap + 1)) == (size_t)wrap) { p_out[len++] = '\n'; }
+
+            p_out[len++] = (c <= n) ? b64_chars[(bits >> (18 - 6*c)) & 0x3F] : '=';
+        }
+    }
+
+    return len;
+}
+
+/*! utility function to decode the leading 2 bytes of base64 (the key ID of a request) */
+static int fakecp_key_id(const char *args)
+{
+    uint32_t bits = 0;
+
+    int c;
+
+    for(c=0;c<3;c++)
+    {
+        const char *p = (args[c] != 0) ? strchr(b64_chars, args[c]) : 0;
+
+        if(p == 0) { return 0; }
+
+        bits = (bits << 6) | (uint32_t)(p - b64_chars);
+    }
+
+    /*! 18 bits hold the first two bytes, which are little endian */
+    bits >>= 2;
+
+    return (int)(((bits & 0xFF) << 8) | (bits >> 8));
+}
+
+void fakecp_pattern(uint8_t *p, size_t size, unsigned seed)
+{
+    size_t v;
+
+    for(v=0;v<size;v++) { p[v] = (uint8_t)((seed * 31) + (seed >> 8) + v * 7); }
+
+    return;
+}
+
+/*! utility function to build the response to a command (returns its size) */
+static size_t fakecp_respond(fakecp *p_fake, const char *name, const char *args, char *p_out)
+{
+    uint8_t data[CPI_RESULT3_SIZE];
+
+    size_t len = 0;
+
+    if( (p_fake->fail_every > 0) && ((p_fake->served % p_fake->fail_every) == 0) )
+    {
+        memcpy(p_out, "FAIL\r", 5);
+        return 5;
+    }
+
+    if(strcmp(name, "PIDX") == 0)
+    {
+        fakecp_pattern(data, 16, FAKECP_SEED_PIDX + fakecp_key_id(args));
+        memcpy(p_out, "PIDX", 4); len = 4;
+        len += fakecp_b64(&p_out[len], data, 16, 0);
+    }
+    else if(strcmp(name, "VERS") == 0)
+    {
+        fakecp_pattern(data, CPI_VERSION_SIZE, FAKECP_SEED_VERS);
+        memcpy(p_out, "VRSR", 4); len = 4;
+        len += fakecp_b64(&p_out[len], data, CPI_VERSION_SIZE, 0);
+    }
+    else if( (strcmp(name, "TIME") == 0) || (strcmp(name, "CKEY") == 0) )
+    {
+        uint32_t value = (name[0] == 'T') ? p_fake->time : FAKECP_CKEY;
+
+        data[0] = (uint8_t)value; data[1] = (uint8_t)(value >> 8); data[2] = (uint8_t)(value >> 16); data[3] = (uint8_t)(value >> 24);
+        memcpy(p_out, name, 4); len = 4;
+        len += fakecp_b64(&p_out[len], data, 4, 0);
+    }
+    else if(strcmp(name, "SNUM") == 0)
+    {
+        fakecp_pattern(data, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+        memcpy(p_out, "SNUM", 4); len = 4;
+        len += fakecp_b64(&p_out[len], data, CPI_SERIAL_NUMBER_SIZE, 0);
+    }
+    else if(strcmp(name, "HWVR") == 0)
+    {
+        fakecp_pattern(data, CPI_HARDWARE_VERSION_SIZE, FAKECP_SEED_HWVR);
+        memcpy(p_out, "HVRS", 4); len = 4;
+        len += fakecp_b64(&p_out[len], data, CPI_HARDWARE_VERSION_SIZE, 0);
+    }
+    else if(strcmp(name, "PKEY") == 0)
+    {
+        static const char head[] = "-----BEGIN PGP PUBLIC KEY BLOCK-----\n", tail[] = "\n-----END PGP PUBLIC KEY BLOCK-----\n\r\r";
+
+        /*! armored, with the size of a CP's key packet */
+        fakecp_pattern(data, FAKECP_PKEY_SIZE, FAKECP_SEED_PKEY + fakecp_key_id(args));
+
+        memcpy(p_out, head, sizeof(head) - 1); len = sizeof(head) - 1;
+        len += fakecp_b64(&p_out[len], data, FAKECP_PKEY_SIZE, 64);
+        memcpy(&p_out[len], tail, sizeof(tail) - 1);
+
+        return len + sizeof(tail) - 1;
+    }
+    else if( (strcmp(name, "CHAL") == 0) && p_fake->deny_chal )
+    {
+        memcpy(p_out, "AUTHCOUNT\r", 10);
+        return 10;
+    }
+    else if(strcmp(name, "CHAL") == 0)
+    {
+        static const size_t sizes[] = { CPI_RESULT1_SIZE, CPI_RESULT2_SIZE };
+
+        /*! one base64 line per result, wrapped as the CP does (result3 is not answered) */
+        static const int wraps[] = { 64, 128 };
+
+        int r;
+
+        memcpy(p_out, "RESP", 4); len = 4;
+
+        for(r=0;r<2;r++)
+        {
+            fakecp_pattern(data, sizes[r], FAKECP_SEED_CHAL + r + 1);
+
+            if(r > 0) { p_out[len++] = '\n'; }
+
+            len += fakecp_b64(&p_out[len], data, sizes[r], wraps[r]);
+        }
+    }
+    else if(strcmp(name, "ALRM") == 0)
+    {
+        memcpy(p_out, "ASET\r", 5);
+        return 5;
+    }
+    else if( (strcmp(name, "DOWN") == 0) || (strcmp(name, "RSET") == 0) )
+    {
+        p_out[0] = (char)0x0D;
+        return 1;
+    }
+    else
+    {
+        memcpy(p_out, "CMD?\r", 5);
+        return 5;
+    }
+
+    p_out[len++] = '\n';
+    p_out[len++] = (char)0x0D;
+
+    return len;
+}
+
+/*! fake CP thread: read requests and answer them, until told to stop */
+static void *fakecp_thread(void *p_arg)
+{
+    fakecp *p_fake = (fakecp*)p_arg;
+
+    char args[FAKECP_LINE_SIZE], out[FAKECP_LINE_SIZE], name[5] = { 0 };
+
+    int bangs = 0, name_len = 0, args_len = 0, in_args = 0;
+
+    for(;;)
+    {
+        struct pollfd fds[2] = { { p_fake->master, POLLIN, 0 }, { p_fake->stop[0], POLLIN, 0 } };
+
+        char c;
+
+        if(poll(fds, 2, -1) < 0) { continue; }
+
+        if(fds[1].revents) { break; }
+
+        if(read(p_fake->master, &c, 1) != 1) { continue; }
+
+        /*! every wake character is answered with a sync character, and starts over */
+        if(c == '!')
+        {
+            if(write(p_fake->master, "?", 1) != 1) { break; }
+
+            bangs++; name_len = 0; args_len = 0; in_args = 0;
+            continue;
+        }
+
+        if(in_args)
+        {
+            size_t len;
+
+            if(c != (char)0x0D)
+            {
+                if(args_len < FAKECP_LINE_SIZE - 1) { args[args_len++] = c; }
+                continue;
+            }
+
+            args[args_len] = 0;
+
+            /*! logged before the count is published, so that fakecp_key_log sees it */
+            if(p_fake->served < FAKECP_LOG_SIZE)
+            {
+                int keyed = (strcmp(name, "PIDX") == 0) || (strcmp(name, "PKEY") == 0) || (strcmp(name, "CHAL") == 0);
+
+                p_fake->key_log[p_fake->served] = keyed ? fakecp_key_id(args) : -1;
+            }
+
+            __atomic_add_fetch(&p_fake->served, 1, __ATOMIC_RELEASE);
+
+            len = fakecp_respond(p_fake, name, args, out);
+
+            if(p_fake->trickle_us > 0)
+            {
+                size_t v;
+
+                for(v=0;v<len;v++)
+                {
+                    if(write(p_fake->master, &out[v], 1) != 1) { break; }
+
+                    usleep(p_fake->trickle_us);
+                }
+
+                if(v < len) { break; }
+            }
+            else if(write(p_fake->master, out, len) != (ssize_t)len) { break; }
+
+            in_args = 0; args_len = 0;
+            continue;
+        }
+
+        /*! a command name follows "!!!!" */
+        if( (bangs >= 4) || (name_len > 0) )
+        {
+            name[name_len++] = c;
+            bangs = 0;
+
+            if(name_len == 4) { in_args = 1; name_len = 0; }
+        }
+    }
+
+    return 0;
+}
+
+int fakecp_served(fakecp *p_fake)
+{
+    return __atomic_load_n(&p_fake->served, __ATOMIC_ACQUIRE);
+}
+
+int fakecp_key_log(fakecp *p_fake, int index)
+{
+    if( (index < 0) || (index >= FAKECP_LOG_SIZE) || (index >= fakecp_served(p_fake)) ) { return -1; }
+
+    return p_fake->key_log[index];
+}
+
+int fakecp_start(fakecp *p_fake, const char *link)
+{
+    struct termios tio;
+
+    const char *slave_path = 0;
+
+    p_fake->served = 0;
+    p_fake->master = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if(p_fake->master < 0) { return -1; }
+
+    if( (grantpt(p_fake->master) != 0) || (unlockpt(p_fake->master) != 0) || ((slave_path = ptsname(p_fake->master)) == 0) )
+    {
+        close(p_fake->master);
+        return -1;
+    }
+
+    /*! the slave side is kept open, so that the master does not see a hangup between clients */
+    p_fake->slave = open(slave_path, O_RDWR | O_NOCTTY);
+
+    if(p_fake->slave < 0) { close(p_fake->master); return -1; }
+
+    tcgetattr(p_fake->master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(p_fake->master, TCSANOW, &tio);
+
+    snprintf(p_fake->link, sizeof(p_fake->link), "%s", link);
+    unlink(p_fake->link);
+
+    if( (symlink(slave_path, p_fake->link) != 0) || (pipe(p_fake->stop) != 0) )
+    {
+        close(p_fake->slave); close(p_fake->master);
+        return -1;
+    }
+
+    if(pthread_create(&p_fake->thread, 0, fakecp_thread, p_fake) != 0)
+    {
+        close(p_fake->stop[0]); close(p_fake->stop[1]);
+        close(p_fake->slave); close(p_fake->master);
+        unlink(p_fake->link);
+        return -1;
+    }
+
+    return 0;
+}
+
+void fakecp_stop(fakecp *p_fake)
+{
+    if(write(p_fake->stop[1], "x", 1) == 1) { pthread_join(p_fake->thread, 0); }
+
+    close(p_fake->stop[0]); close(p_fake->stop[1]);
+    close(p_fake->slave); close(p_fake->master);
+    unlink(p_fake->link);
+
+    return;
+}
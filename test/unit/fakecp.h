@@ -0,0 +1,139 @@
+/*
+ * fakecp.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API runs a fake Crypto Processor on a pseudo terminal, so that the
+ * library can be exercised on a host without the hardware. The fake speaks
+ * the CP's serial framing (a '?' for every '!', "!!!!" and a 4 character
+ * command name, base64 arguments, 0x0D terminated responses), and answers
+ * every command with data derived from fakecp_pattern. It does not check
+ * signatures or keep any state beyond what is described below, and answers
+ * CHAL with two results (not on falconwing, whose CP adds a third).
+ */
+
+#ifndef FAKECP_H
+#define FAKECP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*! number of commands whose key IDs are logged */
+#define FAKECP_LOG_SIZE     64
+
+/*! fake CP */
+typedef struct _fakecp
+{
+    /*! (INP) answer every fail_every'th command with "FAIL" (0 for never) */
+    int fail_every;
+    /*! (INP) value answered to TIME */
+    uint32_t time;
+    /*! (INP) answer CHAL with "AUTHCOUNT", as a CP whose auth budget is spent */
+    int deny_chal;
+    /*! (INP) write responses one character at a time, this many microseconds apart (0 to write them whole) */
+    int trickle_us;
+    /*! (OUT) commands answered so far (read with fakecp_served, while the fake CP runs) */
+    int served;
+    /*! (OUT) key ID of each of the first FAKECP_LOG_SIZE commands answered (read with fakecp_key_log) */
+    int key_log[FAKECP_LOG_SIZE];
+
+    /*! pseudo terminal (master and slave side) */
+    int master, slave;
+    /*! pipe waking the thread to stop */
+    int stop[2];
+    /*! path of the symlink to the slave side */
+    char link[256];
+    pthread_t thread;
+}
+fakecp;
+
+/*!
+
+ Start a fake CP serving on a new pseudo terminal, reachable through a symlink at
+ link (an existing file there is replaced). The (INP) fields may be set before
+ the call.
+
+  @param p_fake (INP/OUT) - Fake CP
+  @param link (INP) - Path of the symlink to create
+  @return 0 on success, -1 on error.
+
+*/
+
+int fakecp_start(fakecp *p_fake, const char *link);
+
+/*!
+
+ Stop a fake CP, and remove its symlink.
+
+  @param p_fake (INP) - Fake CP started by fakecp_start
+
+*/
+
+void fakecp_stop(fakecp *p_fake);
+
+/*!
+
+ Retrieve the number of commands a fake CP has answered so far.
+
+  @param p_fake (INP) - Fake CP started by fakecp_start
+  @return Number of commands answered
+
+*/
+
+int fakecp_served(fakecp *p_fake);
+
+/*!
+
+ Retrieve the key ID of a command the fake CP has answered, in the order they
+ were answered.
+
+  @param p_fake (INP) - Fake CP started by fakecp_start
+  @param index (INP) - Index of the command (0 for the first one answered)
+  @return Key ID of a PIDX, PKEY or CHAL command, -1 for any other command, or
+          if index is beyond the log or the commands answered so far
+
+*/
+
+int fakecp_key_log(fakecp *p_fake, int index);
+
+/*!
+
+ Fill a buffer with the data the fake CP answers for a command (seed is a
+ FAKECP_SEED_ value, plus the key ID where the command takes one).
+
+  @param p (OUT) - Buffer
+  @param size (INP) - Size of the buffer, in bytes
+  @param seed (INP) - Seed
+
+*/
+
+void fakecp_pattern(uint8_t *p, size_t size, unsigned seed);
+
+/*! \name fakecp_pattern seeds (CHAL results n = 1..2 are seeded FAKECP_SEED_CHAL + n) */
+/*! \{ */
+#define FAKECP_SEED_PIDX    0x0100
+#define FAKECP_SEED_PKEY    0x0200
+#define FAKECP_SEED_VERS    0x0300
+#define FAKECP_SEED_SNUM    0x0400
+#define FAKECP_SEED_HWVR    0x0500
+#define FAKECP_SEED_CHAL    0x0600
+/*! \} */
+
+/*! owner key index answered to CKEY */
+#define FAKECP_CKEY         3
+
+/*! size of the key packet armored in the answer to PKEY, as a CP's (version, time, algorithm, modulus and exponent) */
+#define FAKECP_PKEY_SIZE    (10 + CPI_RESULT2_SIZE + 2 + 4)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * main.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module defines the entry point for cpi-unit, which runs the unit and
+ * regression tests named on the command line (all of them by default), and
+ * exits with 0 only if every check passed.
+ *
+ * "cpi-unit fakecp <LINK>" instead serves a fake CP (see fakecp.h) on LINK
+ * until it is killed, so that cpi itself can be run against it, as
+ * test/production_test/bench_pipeline.sh does.
+ */
+
+#define _GNU_SOURCE
+
+#include "unit.h"
+#include "fakecp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+
+int unit_failures = 0;
+
+const char *unit_dir = 0;
+
+/*! test table */
+static const struct
+{
+    const char *name;
+    void (*test)();
+}
+unit_tests[] =
+{
+    { "xml",      test_xml },
+    { "format",   test_format },
+    { "async",    test_async },
+    { "pipeline", test_pipeline },
+    { "pacing",   test_pacing },
+    { "budget",   test_budget },
+    { "archive",  test_archive },
+    { "device",   test_device },
+    { "threads",  test_threads },
+    { "pool",     test_pool },
+    { "remote",   test_remote },
+    { "coalesce", test_coalesce },
+    { "priority", test_priority },
+    { "lock",     test_lock },
+};
+
+/*! utility callback to remove the test directory */
+static int unit_remove(const char *path, const struct stat *p_stat, int type, struct FTW *p_ftw)
+{
+    (void)p_stat; (void)type; (void)p_ftw;
+
+    return remove(path);
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/cpi-unit-XXXXXX";
+
+    int v, a, ran = 0;
+
+    if( (argc == 3) && (strcmp(argv[1], "fakecp") == 0) )
+    {
+        fakecp fake;
+
+        memset(&fake, 0, sizeof(fake));
+
+        if(fakecp_start(&fake, argv[2]) != 0) { fprintf(stderr, "Error: Could not start a fake CP at \"%s\"\n", argv[2]); return 1; }
+
+        for(;;) { pause(); }
+    }
+
+    if(mkdtemp(dir) == 0) { fprintf(stderr, "Error: Could not create a test directory\n"); return 1; }
+
+    unit_dir = dir;
+
+    for(v=0;v<(int)(sizeof(unit_tests)/sizeof(unit_tests[0]));v++)
+    {
+        int failures = unit_failures, selected = (argc <= 1);
+
+        for(a=1;a<argc;a++) { if(strcmp(argv[a], unit_tests[v].name) == 0) { selected = 1; } }
+
+        if(!selected) { continue; }
+
+        unit_tests[v].test();
+        ran++;
+
+        printf("%-12s %s\n", unit_tests[v].name, (unit_failures == failures) ? "ok" : "FAILED");
+
+        /*! tests may fork, and the children must not write out what is still buffered */
+        fflush(stdout);
+    }
+
+    nftw(dir, unit_remove, 8, FTW_DEPTH | FTW_PHYS);
+
+    if(ran == 0) { fprintf(stderr, "Error: No such test\n"); return 1; }
+
+    printf("%d test(s), %d failed check(s)\n", ran, unit_failures);
+
+    return (unit_failures == 0) ? 0 : 1;
+}
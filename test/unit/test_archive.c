@@ -0,0 +1,222 @@
+/*
+ * test_archive.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests archive appends (see cp_archive.h): records read back as
+ * written, segment after segment, and an archive survives what a crash can
+ * leave behind (a file cut off within its first header, a torn segment past
+ * the last committed one), while files which are not archives, or have lost
+ * committed segments, are refused. Appends from several processes at once
+ * must all land.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_archive.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*! processes appending at once, and appends each */
+#define ARCHIVE_WRITERS     4
+#define ARCHIVE_APPENDS     8
+
+/*! utility function to fill records with data derived from their archive record number */
+static void archive_fill(cpi_archive_record_t *records, uint32_t first, uint32_t count)
+{
+    uint32_t v;
+
+    for(v=0;v<count;v++) { fakecp_pattern((uint8_t*)&records[v], sizeof(cpi_archive_record_t), first + v); }
+
+    return;
+}
+
+/*! utility function to read a whole file (returns its size, -1 on failure; the caller frees *pp_image) */
+static long archive_load(const char *path, uint8_t **pp_image)
+{
+    struct stat st;
+
+    long size = -1;
+
+    int fd = open(path, O_RDONLY);
+
+    *pp_image = 0;
+
+    if(fd < 0) { return -1; }
+
+    if( (fstat(fd, &st) == 0) && ((*pp_image = (uint8_t*)malloc(st.st_size + 1)) != 0) && (read(fd, *pp_image, st.st_size) == st.st_size) ) { size = (long)st.st_size; }
+
+    close(fd);
+
+    return size;
+}
+
+/*! utility function to check an archive image: committed segments in a row, ending where the image does if exact, and
+ *  holding records as archive_fill wrote them if contents (returns the record count, -1 if broken) */
+static long archive_check(const char *path, int exact, int contents)
+{
+    cpi_archive_header_t header;
+
+    cpi_archive_record_t expect;
+
+    uint8_t *image = 0;
+
+    uint64_t offset = 0;
+
+    uint32_t seg = 0, records = 0, v;
+
+    int c;
+
+    long size = archive_load(path, &image), ret = -1;
+
+    if( (size < (long)sizeof(header)) ) { free(image); return -1; }
+
+    memcpy(&header, image, sizeof(header));
+
+    /*! after a cut off append, the image may run past the committed part */
+    if( (header.magic != CPI_ARCHIVE_MAGIC) || (header.file_size > (uint64_t)size) || (exact && (header.file_size != (uint64_t)size)) ) { free(image); return -1; }
+
+    offset = (sizeof(header) + CPI_ARCHIVE_ALIGN - 1) & ~(uint64_t)(CPI_ARCHIVE_ALIGN - 1);
+
+    for(seg=0;seg<header.segment_count;seg++)
+    {
+        const cpi_archive_segment_t *p_seg = (const cpi_archive_segment_t*)&image[offset];
+
+        if( (offset + sizeof(*p_seg) > header.file_size) || (p_seg->magic != CPI_ARCHIVE_SEGMENT_MAGIC) || (p_seg->first_record != records) || (offset + p_seg->size > header.file_size) ) { goto cleanup; }
+
+        for(v=0;contents && (v<p_seg->record_count);v++)
+        {
+            archive_fill(&expect, records + v, 1);
+
+            for(c=0;c<CPI_ARCHIVE_COL_COUNT;c++)
+            {
+                int width = cpi_archive_column_size(c);
+
+                if(memcmp(&image[offset + p_seg->column_offset[c] + (uint64_t)v*width], cpi_archive_column(&expect, c), width) != 0) { goto cleanup; }
+            }
+        }
+
+        records += p_seg->record_count;
+        offset += p_seg->size;
+    }
+
+    if( (records == header.record_count) && (offset == header.file_size) ) { ret = records; }
+
+cleanup:
+
+    free(image);
+
+    return ret;
+}
+
+/*! utility function to write a file with the given contents */
+static int archive_write_file(const char *path, const void *data, size_t size, int flags)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | flags, 0644), ok = 0;
+
+    if(fd < 0) { return 0; }
+
+    ok = (write(fd, data, size) == (ssize_t)size);
+
+    close(fd);
+
+    return ok;
+}
+
+void test_archive()
+{
+    static cpi_archive_record_t records[10];
+
+    cpi_archive_header_t header;
+
+    char path[256];
+
+    uint32_t count = 0;
+
+    int v;
+
+    snprintf(path, sizeof(path), "%s/a.cpa", unit_dir);
+
+    /*! no archive yet */
+    UNIT_CHECK(CPI_SUCCESS(cpi_archive_count(path, &count)) && (count == 0));
+
+    /*! segments in a row, read back as written */
+    archive_fill(records, 0, 10);
+    UNIT_CHECK(CPI_SUCCESS(cpi_archive_append(path, records, 3)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_archive_append(path, &records[3], 7)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_archive_append(path, records, 0)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_archive_count(path, &count)) && (count == 10));
+    UNIT_CHECK(archive_check(path, 1, 1) == 10);
+
+    /*! a torn segment past the committed ones is not counted, and the next append writes over it */
+    UNIT_CHECK(archive_write_file(path, records, 1000, O_APPEND));
+    UNIT_CHECK(CPI_SUCCESS(cpi_archive_count(path, &count)) && (count == 10));
+    UNIT_CHECK(archive_check(path, 0, 1) == 10);
+    archive_fill(records, 10, 2);
+    UNIT_CHECK(CPI_SUCCESS(cpi_archive_append(path, records, 2)));
+    UNIT_CHECK(archive_check(path, 1, 1) == 12);
+
+    /*! an image shorter than its header says has lost committed segments */
+    UNIT_CHECK(truncate(path, 200) == 0);
+    UNIT_CHECK(cpi_archive_count(path, &count) == CPI_INVALID_PARAM);
+    UNIT_CHECK(cpi_archive_append(path, records, 1) == CPI_INVALID_PARAM);
+
+    /*! a first append cut off within the header leaves a short (or empty) file, which is started over */
+    memset(&header, 0, sizeof(header));
+    header.magic = CPI_ARCHIVE_MAGIC;
+    header.version = CPI_ARCHIVE_VERSION;
+
+    for(v=0;v<2;v++)
+    {
+        UNIT_CHECK(archive_write_file(path, &header, (v == 0) ? 0 : sizeof(header) / 2, O_TRUNC));
+        UNIT_CHECK(CPI_SUCCESS(cpi_archive_count(path, &count)) && (count == 0));
+        archive_fill(records, 0, 4);
+        UNIT_CHECK(CPI_SUCCESS(cpi_archive_append(path, records, 4)));
+        UNIT_CHECK(archive_check(path, 1, 1) == 4);
+    }
+
+    /*! files which are not archives are left alone */
+    memset(records, 'x', sizeof(records[0]));
+    UNIT_CHECK(archive_write_file(path, records, sizeof(records[0]), O_TRUNC));
+    UNIT_CHECK(cpi_archive_count(path, &count) == CPI_INVALID_PARAM);
+    UNIT_CHECK(cpi_archive_append(path, records, 1) == CPI_INVALID_PARAM);
+
+    /*! appends from several processes at once all land, one segment each */
+    unlink(path);
+
+    for(v=0;v<ARCHIVE_WRITERS;v++)
+    {
+        pid_t pid = fork();
+
+        if(pid == 0)
+        {
+            int a, failed = 0;
+
+            /*! record numbers are only known once the append holds the archive, so every record is filled alike here */
+            for(a=0;a<ARCHIVE_APPENDS;a++) { failed |= CPI_FAILED(cpi_archive_append(path, records, 3)); }
+
+            _exit(failed);
+        }
+
+        UNIT_CHECK(pid > 0);
+    }
+
+    for(v=0;v<ARCHIVE_WRITERS;v++)
+    {
+        int status = 0;
+
+        UNIT_CHECK( (wait(&status) > 0) && WIFEXITED(status) && (WEXITSTATUS(status) == 0) );
+    }
+
+    UNIT_CHECK(CPI_SUCCESS(cpi_archive_count(path, &count)) && (count == ARCHIVE_WRITERS * ARCHIVE_APPENDS * 3));
+    UNIT_CHECK(archive_check(path, 1, 0) == ARCHIVE_WRITERS * ARCHIVE_APPENDS * 3);
+
+    return;
+}
@@ -0,0 +1,111 @@
+/*
+ * test_async.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests cpi_submit and cpi_process_events against the fake CP,
+ * with the responses trickling in one character at a time: a challenge the
+ * CP answers with AUTHCOUNT must complete with CPI_ACCESS_DENIED, and the
+ * commands around it must still get the CP's data.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <string.h>
+#include <poll.h>
+
+/*! pause between the characters of a response, in microseconds */
+#define ASYNC_TRICKLE_US    200
+
+/*! completion callback, counting finished commands */
+static void async_done(cpi_t *p_cpi, cpi_cmd_t *p_cmd)
+{
+    (void)p_cpi;
+
+    (*(int*)p_cmd->user_data)++;
+
+    return;
+}
+
+void test_async()
+{
+    cpi_t *p_cpi = 0;
+
+    fakecp fake;
+
+    cpi_cmd_t cmds[3];
+
+    char link[256];
+
+    uint8_t rand_data[CPI_RNDX_SIZE], pidx[16], snum[CPI_SERIAL_NUMBER_SIZE], result1[CPI_RESULT1_SIZE], result2[CPI_RESULT2_SIZE], expect[CPI_SERIAL_NUMBER_SIZE];
+
+    int done = 0, v;
+
+    memset(&fake, 0, sizeof(fake));
+    fake.deny_chal = 1;
+    fake.trickle_us = ASYNC_TRICKLE_US;
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(0, &p_cpi)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(p_cpi, link)));
+
+    memset(rand_data, 0x5A, sizeof(rand_data));
+    memset(cmds, 0, sizeof(cmds));
+
+    cmds[0].cmd = CPI_CMD_PIDX; cmds[0].out[0] = pidx; cmds[0].out_size[0] = sizeof(pidx);
+    cmds[1].cmd = CPI_CMD_CHAL; cmds[1].rand_data = rand_data;
+    cmds[1].out[0] = result1; cmds[1].out_size[0] = sizeof(result1);
+    cmds[1].out[1] = result2; cmds[1].out_size[1] = sizeof(result2);
+    cmds[2].cmd = CPI_CMD_SNUM; cmds[2].out[0] = snum; cmds[2].out_size[0] = sizeof(snum);
+
+    for(v=0;v<3;v++)
+    {
+        cmds[v].user_data = &done;
+
+        UNIT_CHECK(CPI_SUCCESS(cpi_submit(p_cpi, &cmds[v], async_done)));
+    }
+
+    /*! every response takes a few ms to trickle in, so a second of silence means we are stuck */
+    while(done < 3)
+    {
+        struct pollfd pfd = { cpi_get_fd(p_cpi), POLLIN, 0 };
+
+        if(poll(&pfd, 1, 1000) <= 0) { break; }
+
+        UNIT_CHECK(CPI_SUCCESS(cpi_process_events(p_cpi)));
+    }
+
+    UNIT_CHECK(done == 3);
+
+    UNIT_CHECK(cmds[0].status == CPI_OK);
+    fakecp_pattern(expect, 16, FAKECP_SEED_PIDX);
+    UNIT_CHECK(memcmp(pidx, expect, 16) == 0);
+
+    /*! AUTHCOUNT is read in full before it is told from a bad ack */
+    UNIT_CHECK(cmds[1].status == CPI_ACCESS_DENIED);
+
+    UNIT_CHECK(cmds[2].status == CPI_OK);
+    fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+    UNIT_CHECK(memcmp(snum, expect, CPI_SERIAL_NUMBER_SIZE) == 0);
+
+    /*! the blocking API sees the same */
+    UNIT_CHECK(cpi_issue_challenge(p_cpi, 0, rand_data, result1, result2, 0) == CPI_ACCESS_DENIED);
+
+    memset(snum, 0, sizeof(snum));
+    UNIT_CHECK(CPI_SUCCESS(cpi_get_serial_number(p_cpi, snum)));
+    UNIT_CHECK(memcmp(snum, expect, CPI_SERIAL_NUMBER_SIZE) == 0);
+
+    /*! a denial is not retried */
+    UNIT_CHECK(fakecp_served(&fake) == 5);
+
+    cpi_close(p_cpi);
+    fakecp_stop(&fake);
+
+    return;
+}
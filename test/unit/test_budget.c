@@ -0,0 +1,244 @@
+/*
+ * test_budget.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests the authentication budget model (see cpi_load_budget):
+ * its wait and update rules one by one, that it learns the limit of a
+ * simulated CP with few denials and then stops being denied, that it
+ * survives a CP reboot, and that its state file keeps one line per CP, even
+ * when several processes save to it at the same time.
+ */
+
+#include "unit.h"
+#include "cp_interface.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*! challenges issued against a simulated CP */
+#define BUDGET_CHALLENGES   400
+
+/*! processes saving their CP's state at the same time, and saves made by each */
+#define BUDGET_SAVERS       8
+#define BUDGET_SAVES        20
+
+/*! simulated CP: accepts a challenge while fewer than capacity were accepted in the last window seconds */
+typedef struct _budget_cp
+{
+    uint32_t capacity;
+    uint32_t window;
+    uint32_t count;
+    uint32_t accepted[BUDGET_CHALLENGES];
+}
+budget_cp;
+
+/*! utility function to count the lines of a state file (comments aside) */
+static int budget_lines(const char *path)
+{
+    FILE *file = fopen(path, "r");
+
+    char line[0x400];
+
+    int lines = 0;
+
+    while( (file != 0) && (fgets(line, sizeof(line), file) != 0) ) { if(line[0] != '#') { lines++; } }
+
+    if(file != 0) { fclose(file); }
+
+    return lines;
+}
+
+/*! utility function to issue a challenge to a simulated CP */
+static int budget_challenge(budget_cp *p_cp, uint32_t cur_time)
+{
+    uint32_t in_window = 0, v;
+
+    for(v=0;v<p_cp->count;v++) { if(cur_time - p_cp->accepted[v] < p_cp->window) { in_window++; } }
+
+    if(in_window >= p_cp->capacity) { return CPI_ACCESS_DENIED; }
+
+    p_cp->accepted[p_cp->count++] = cur_time;
+
+    return CPI_OK;
+}
+
+/*! utility function to run the model against a simulated CP, waiting as told (returns the denials among the last challenges) */
+static uint32_t budget_simulate(cpi_budget_t *p_budget, uint32_t capacity, uint32_t window)
+{
+    budget_cp cp;
+
+    uint32_t cur_time = 1000, late_denied = 0, v;
+
+    memset(&cp, 0, sizeof(cp));
+    cp.capacity = capacity;
+    cp.window = window;
+
+    for(v=0;v<BUDGET_CHALLENGES;v++)
+    {
+        int status = 0;
+
+        cur_time += cpi_budget_wait(p_budget, cur_time);
+
+        status = budget_challenge(&cp, cur_time);
+
+        cpi_budget_update(p_budget, cur_time, status);
+
+        if( (v >= BUDGET_CHALLENGES / 2) && (status != CPI_OK) ) { late_denied++; }
+
+        /*! issuing a challenge takes a second */
+        cur_time++;
+    }
+
+    return late_denied;
+}
+
+void test_budget()
+{
+    static const uint8_t serial[2][CPI_SERIAL_NUMBER_SIZE] = { { 0x01, 0x02, 0x03 }, { 0xA0, 0xB0, 0xC0 } };
+
+    cpi_budget_t budget, copy;
+
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/budget", unit_dir);
+
+    /*! no state, the defaults stand */
+    UNIT_CHECK(CPI_SUCCESS(cpi_load_budget(path, serial[0], &budget)));
+    UNIT_CHECK( (budget.capacity == 1) && !budget.capacity_known && (budget.window_lo == 0) && (budget.window_hi == CPI_BUDGET_WINDOW) );
+    UNIT_CHECK( (budget.log_count == 0) && (memcmp(budget.raw_serial, serial[0], CPI_SERIAL_NUMBER_SIZE) == 0) );
+
+    /*! while the capacity is unknown, one more than it is tried */
+    UNIT_CHECK(cpi_budget_wait(&budget, 1000) == 0);
+    cpi_budget_update(&budget, 1000, CPI_OK);
+    UNIT_CHECK(cpi_budget_wait(&budget, 1001) == 0);
+    cpi_budget_update(&budget, 1001, CPI_OK);
+    UNIT_CHECK( (budget.capacity == 2) && (budget.log_count == 2) && (budget.accepted == 2) );
+
+    /*! statuses other than accepted and denied are ignored */
+    copy = budget;
+    cpi_budget_update(&budget, 1002, CPI_FAIL);
+    cpi_budget_update(&budget, 1002, CPI_BUSY);
+    UNIT_CHECK(memcmp(&copy, &budget, sizeof(budget)) == 0);
+
+    /*! a denial with two in the window shows the capacity is two, after which the oldest must leave the window */
+    UNIT_CHECK(cpi_budget_wait(&budget, 1002) == 0);
+    cpi_budget_update(&budget, 1002, CPI_ACCESS_DENIED);
+    UNIT_CHECK( (budget.capacity == 2) && budget.capacity_known && (budget.denied == 1) && (budget.log_count == 2) );
+
+    /*! the window is now bisected: (0, 300] is probed at 150 */
+    UNIT_CHECK(cpi_budget_wait(&budget, 1002) == 1000 + CPI_BUDGET_WINDOW / 2 - 1002);
+
+    /*! accepted at the probe: the window is no longer than that */
+    cpi_budget_update(&budget, 1000 + CPI_BUDGET_WINDOW / 2, CPI_OK);
+    UNIT_CHECK( (budget.window_lo == 0) && (budget.window_hi == CPI_BUDGET_WINDOW / 2) );
+
+    /*! a CP reboot restarts its clock: the logged challenges are taken to be just now */
+    UNIT_CHECK(cpi_budget_wait(&budget, 10) == budget.window_hi / 2);
+    UNIT_CHECK( (budget.last_time == 10) && (budget.log[0] == 10) && (budget.log[budget.log_count - 1] == 10) );
+
+    /*! a denial with nothing in the safe window: the window is longer than was known */
+    UNIT_CHECK(CPI_SUCCESS(cpi_load_budget(path, serial[1], &budget)));
+    cpi_budget_update(&budget, 1000, CPI_OK);
+    cpi_budget_update(&budget, 1000 + CPI_BUDGET_WINDOW, CPI_ACCESS_DENIED);
+    UNIT_CHECK( (budget.window_lo == CPI_BUDGET_WINDOW) && (budget.window_hi == 2*CPI_BUDGET_WINDOW) && !budget.capacity_known );
+
+    /*! learned limits: once found, challenges stop being denied, and the waits are no longer than needed */
+    {
+        static const uint32_t limits[][2] = { { 1, 60 }, { 3, 100 }, { 5, 240 }, { 2, 500 } };
+
+        int v;
+
+        for(v=0;v<(int)(sizeof(limits)/sizeof(limits[0]));v++)
+        {
+            UNIT_CHECK(CPI_SUCCESS(cpi_load_budget(path, serial[0], &budget)));
+            UNIT_CHECK(budget_simulate(&budget, limits[v][0], limits[v][1]) == 0);
+            UNIT_CHECK( (budget.capacity == limits[v][0]) && budget.capacity_known );
+            UNIT_CHECK( (budget.window_hi == limits[v][1]) && (budget.window_lo == limits[v][1] - 1) );
+            /*! learning takes a denial per bisection step, two bisections' worth when the window is past the safe one */
+            UNIT_CHECK(budget.denied <= 24);
+        }
+    }
+
+    /*! the state file keeps one line per CP, replacing it on save */
+    copy = budget;
+    UNIT_CHECK(CPI_SUCCESS(cpi_load_budget(path, serial[1], &budget)));
+    budget.capacity = 7;
+    budget.window_hi = 42;
+    UNIT_CHECK(CPI_SUCCESS(cpi_save_budget(path, &budget)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_save_budget(path, &copy)));
+    copy.capacity_known = 1;
+    UNIT_CHECK(CPI_SUCCESS(cpi_save_budget(path, &copy)));
+
+    UNIT_CHECK(CPI_SUCCESS(cpi_load_budget(path, serial[0], &budget)));
+    UNIT_CHECK(memcmp(&copy, &budget, sizeof(budget)) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_load_budget(path, serial[1], &budget)));
+    UNIT_CHECK( (budget.capacity == 7) && (budget.window_hi == 42) && (budget.log_count == 0) );
+
+    UNIT_CHECK(budget_lines(path) == 2);
+
+    /*! processes saving at the same time each keep their own line, and leave no temporary file behind */
+    {
+        pid_t pids[BUDGET_SAVERS];
+
+        DIR *dir = 0;
+
+        struct dirent *p_entry = 0;
+
+        int status = 0, others = 0, v;
+
+        for(v=0;v<BUDGET_SAVERS;v++)
+        {
+            pids[v] = fork();
+
+            if(pids[v] == 0)
+            {
+                int ok = 1, w;
+
+                memset(&budget, 0, sizeof(budget));
+
+                budget.raw_serial[0] = (uint8_t)(0x10 + v);
+                budget.capacity = 1;
+                budget.window_hi = CPI_BUDGET_WINDOW;
+
+                for(w=0;w<BUDGET_SAVES;w++) { budget.accepted = (uint32_t)w; ok &= CPI_SUCCESS(cpi_save_budget(path, &budget)); }
+
+                _exit(ok ? 0 : 1);
+            }
+        }
+
+        for(v=0;v<BUDGET_SAVERS;v++)
+        {
+            UNIT_CHECK(waitpid(pids[v], &status, 0) == pids[v]);
+            UNIT_CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+        }
+
+        UNIT_CHECK(budget_lines(path) == 2 + BUDGET_SAVERS);
+
+        for(v=0;v<BUDGET_SAVERS;v++)
+        {
+            uint8_t raw_serial[CPI_SERIAL_NUMBER_SIZE] = { (uint8_t)(0x10 + v) };
+
+            UNIT_CHECK(CPI_SUCCESS(cpi_load_budget(path, raw_serial, &budget)));
+            UNIT_CHECK(budget.accepted == BUDGET_SAVES - 1);
+        }
+
+        dir = opendir(unit_dir);
+
+        while( (dir != 0) && ((p_entry = readdir(dir)) != 0) )
+        {
+            if( (strncmp(p_entry->d_name, "budget.", 7) == 0) && (strcmp(p_entry->d_name, "budget.lock") != 0) ) { others++; }
+        }
+
+        if(dir != 0) { closedir(dir); }
+
+        UNIT_CHECK(others == 0);
+    }
+
+    return;
+}
@@ -0,0 +1,129 @@
+/*
+ * test_coalesce.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests that identical read-only commands queued together share
+ * one exchange with the CP: the CP must see each distinct command once, and
+ * every one of the identical commands must complete once, with the result
+ * in its own output buffer.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <string.h>
+#include <poll.h>
+
+/*! queued command, with its output and the number of times it completed */
+typedef struct _coalesce_sub
+{
+    cpi_cmd_t cmd;
+    uint8_t out[CPI_SERIAL_NUMBER_SIZE];
+    int calls;
+}
+coalesce_sub;
+
+/*! completion callback */
+static void coalesce_done(cpi_t *p_cpi, cpi_cmd_t *p_cmd)
+{
+    (void)p_cpi;
+
+    ((coalesce_sub*)p_cmd->user_data)->calls++;
+
+    return;
+}
+
+void test_coalesce()
+{
+    /*! PIDX of key 5 three times, with key 6 in between, and SNUM twice: three exchanges */
+    static const struct { int cmd; uint16_t key_id; } seq[] =
+    {
+        { CPI_CMD_PIDX, 5 }, { CPI_CMD_PIDX, 5 }, { CPI_CMD_PIDX, 6 }, { CPI_CMD_SNUM, 0 }, { CPI_CMD_PIDX, 5 }, { CPI_CMD_SNUM, 0 }
+    };
+
+    cpi_info_t info = { 0, 0, "" };
+
+    coalesce_sub subs[sizeof(seq)/sizeof(seq[0])];
+
+    cpi_metrics_t metrics;
+
+    cpi_t *p_cpi = 0;
+
+    fakecp fake;
+
+    char link[256];
+
+    uint8_t expect[CPI_SERIAL_NUMBER_SIZE];
+
+    int n = sizeof(seq)/sizeof(seq[0]), wait, v;
+
+    memset(&fake, 0, sizeof(fake));
+    memset(subs, 0, sizeof(subs));
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(&info, &p_cpi)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(p_cpi, link)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_set_write_delay(p_cpi, 0)));
+
+    /*! nothing is sent before the first cpi_process_events, so all of them are queued together */
+    for(v=0;v<n;v++)
+    {
+        subs[v].cmd.cmd = seq[v].cmd;
+        subs[v].cmd.key_id = seq[v].key_id;
+        subs[v].cmd.out[0] = subs[v].out;
+        subs[v].cmd.out_size[0] = sizeof(subs[v].out);
+        subs[v].cmd.user_data = &subs[v];
+
+        UNIT_CHECK(CPI_SUCCESS(cpi_submit(p_cpi, &subs[v].cmd, coalesce_done)));
+    }
+
+    for(wait=0;wait<100;wait++)
+    {
+        struct pollfd pfd = { cpi_get_fd(p_cpi), POLLIN, 0 };
+
+        int done = 0;
+
+        for(v=0;v<n;v++) { done += (subs[v].calls > 0); }
+
+        if(done == n) { break; }
+
+        /*! the fake CP answers at once, so a second of silence means we are stuck */
+        if(poll(&pfd, 1, 1000) <= 0) { break; }
+
+        UNIT_CHECK(CPI_SUCCESS(cpi_process_events(p_cpi)));
+    }
+
+    UNIT_CHECK(fakecp_served(&fake) == 3);
+
+    memset(&metrics, 0, sizeof(metrics));
+    UNIT_CHECK(CPI_SUCCESS(cpi_get_metrics(p_cpi, &metrics)));
+    UNIT_CHECK(metrics.coalesced == 3);
+
+    for(v=0;v<n;v++)
+    {
+        UNIT_CHECK(subs[v].calls == 1);
+        UNIT_CHECK(subs[v].cmd.status == CPI_OK);
+
+        if(seq[v].cmd == CPI_CMD_PIDX)
+        {
+            fakecp_pattern(expect, 16, FAKECP_SEED_PIDX + seq[v].key_id);
+            UNIT_CHECK(memcmp(subs[v].out, expect, 16) == 0);
+        }
+        else
+        {
+            fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+            UNIT_CHECK(memcmp(subs[v].out, expect, CPI_SERIAL_NUMBER_SIZE) == 0);
+        }
+    }
+
+    cpi_close(p_cpi);
+    fakecp_stop(&fake);
+
+    return;
+}
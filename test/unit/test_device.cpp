@@ -0,0 +1,119 @@
+/*
+ * test_device.cpp
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests the C++20 coroutine wrapper (see cp_device.hpp) against
+ * the fake CP: two coroutines share one device, each awaiting every kind of
+ * operation in turn, and every result must carry the CP's data.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_device.hpp"
+
+#include <cstring>
+#include <exception>
+
+/*! coroutine which starts at once, and runs on as its awaited operations complete */
+struct DeviceTask
+{
+    struct promise_type
+    {
+        DeviceTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+/*! utility coroutine to await every operation once, with the specified key ID, counting itself done at the end */
+static DeviceTask device_run(cpi::Device<> &dev, uint16_t key_id, uint32_t time, int *p_done)
+{
+    uint8_t expect[CPI_RESULT1_SIZE];
+
+    cpi::RandomData rand_data;
+
+    rand_data.fill(0x5A);
+
+    auto pidx = co_await dev.putative_id(key_id);
+    fakecp_pattern(expect, 16, FAKECP_SEED_PIDX + key_id);
+    UNIT_CHECK(pidx.ok() && (std::memcmp(pidx.value.data(), expect, 16) == 0));
+
+    auto snum = co_await dev.serial_number();
+    fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+    UNIT_CHECK(snum.ok() && (std::memcmp(snum.value.data(), expect, CPI_SERIAL_NUMBER_SIZE) == 0));
+
+    auto vers = co_await dev.version_data();
+    fakecp_pattern(expect, CPI_VERSION_SIZE, FAKECP_SEED_VERS);
+    UNIT_CHECK(vers.ok() && (std::memcmp(vers.value.data(), expect, CPI_VERSION_SIZE) == 0));
+
+    auto hwvr = co_await dev.hardware_version();
+    fakecp_pattern(expect, CPI_HARDWARE_VERSION_SIZE, FAKECP_SEED_HWVR);
+    UNIT_CHECK(hwvr.ok() && (std::memcmp(hwvr.value.data(), expect, CPI_HARDWARE_VERSION_SIZE) == 0));
+
+    auto cur_time = co_await dev.time();
+    UNIT_CHECK(cur_time.ok() && (cur_time.value == time));
+
+    auto ckey = co_await dev.owner_key_index();
+    UNIT_CHECK(ckey.ok() && (ckey.value == FAKECP_CKEY));
+
+    auto pkey = co_await dev.public_key(key_id);
+    UNIT_CHECK(pkey.ok() && (pkey.value.view().find("-----BEGIN PGP PUBLIC KEY BLOCK-----") == 0));
+
+    auto chal = co_await dev.challenge(key_id, rand_data);
+    UNIT_CHECK(chal.ok() && !chal.value.has_result3);
+    fakecp_pattern(expect, CPI_RESULT1_SIZE, FAKECP_SEED_CHAL + 1);
+    UNIT_CHECK(std::memcmp(chal.value.result1.data(), expect, CPI_RESULT1_SIZE) == 0);
+    fakecp_pattern(expect, CPI_RESULT2_SIZE, FAKECP_SEED_CHAL + 2);
+    UNIT_CHECK(std::memcmp(chal.value.result2.data(), expect, CPI_RESULT2_SIZE) == 0);
+
+    UNIT_CHECK((co_await dev.set_alarm(60)).ok());
+    UNIT_CHECK((co_await dev.reset()).ok());
+    UNIT_CHECK((co_await dev.power_down()).ok());
+
+    (*p_done)++;
+}
+
+void test_device()
+{
+    cpi::Device<> dev;
+
+    fakecp fake;
+
+    char link[256];
+
+    int done = 0;
+
+    std::memset(&fake, 0, sizeof(fake));
+    fake.time = 0x12345678;
+
+    std::snprintf(link, sizeof(link), "%s/tty", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(dev.open(link)));
+
+    /*! both run up to their first operation here, and on from the callbacks of process_events */
+    device_run(dev, 1, fake.time, &done);
+    device_run(dev, 2, fake.time, &done);
+
+    while(done < 2)
+    {
+        struct pollfd pfd = { dev.fd(), POLLIN, 0 };
+
+        /*! the fake CP answers at once, so a second of silence means we are stuck */
+        if(::poll(&pfd, 1, 1000) <= 0) { break; }
+
+        UNIT_CHECK(CPI_SUCCESS(dev.process_events()));
+    }
+
+    UNIT_CHECK(done == 2);
+
+    dev.close();
+    fakecp_stop(&fake);
+
+    return;
+}
@@ -0,0 +1,292 @@
+/*
+ * test_format.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests the response formats of cpi_process_query: one query
+ * document, answered by the fake CP, must carry the CP's data in XML, JSON and
+ * TLV alike, and an unknown query must come back as a failed record. Once the
+ * scratch space is set up, processing the same document again must give the
+ * same output without a heap allocation.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+#include "cp_base64.h"
+
+#include <string.h>
+
+/*! size of the output buffer */
+#define FORMAT_OUT_SIZE     0x4000
+
+/*! expected data of a query, as the fake CP answers it */
+typedef struct _format_expect
+{
+    int cmd;
+    int size;
+    uint8_t data[CPI_RESULT1_SIZE + CPI_RESULT2_SIZE];
+}
+format_expect;
+
+/*! query document - the TIME answer is set by the test */
+static char format_query[] =
+    "<?xml version='1.0'?>\n"
+    "<cpi version='1.0'>\n"
+    "    <query_list>\n"
+    "        <query type=\"pidx\" key_id=\"0\"></query>\n"
+    "        <query type=\"pidx\" key_id=\"1024\"></query>\n"
+    "        <query type=\"pkey\" key_id=\"0\"></query>\n"
+    "        <query type=\"vers\"></query>\n"
+    "        <query type=\"time\"></query>\n"
+    "        <query type=\"ckey\"></query>\n"
+    "        <query type=\"snum\"></query>\n"
+    "        <query type=\"hwvr\"></query>\n"
+    "        <query type=\"bogus\"></query>\n"
+    "        <query type=\"chal\" key_id=\"0\" rand_data=\"0102030405060708090A0B0C0D0E0F10\"></query>\n"
+    "    </query_list>\n"
+    "</cpi>\n";
+
+/*! utility function to fill in the expected data of every query in format_query */
+static int format_fill(format_expect *p_expect, uint32_t time)
+{
+    int n = 0;
+
+    p_expect[n].cmd = CPI_CMD_PIDX; p_expect[n].size = 16; fakecp_pattern(p_expect[n].data, 16, FAKECP_SEED_PIDX + 0); n++;
+    p_expect[n].cmd = CPI_CMD_PIDX; p_expect[n].size = 16; fakecp_pattern(p_expect[n].data, 16, FAKECP_SEED_PIDX + 1024); n++;
+    p_expect[n].cmd = CPI_CMD_PKEY; p_expect[n].size = FAKECP_PKEY_SIZE; fakecp_pattern(p_expect[n].data, FAKECP_PKEY_SIZE, FAKECP_SEED_PKEY + 0); n++;
+    p_expect[n].cmd = CPI_CMD_VERS; p_expect[n].size = CPI_VERSION_SIZE; fakecp_pattern(p_expect[n].data, CPI_VERSION_SIZE, FAKECP_SEED_VERS); n++;
+
+    p_expect[n].cmd = CPI_CMD_TIME; p_expect[n].size = 4;
+    p_expect[n].data[0] = (uint8_t)time; p_expect[n].data[1] = (uint8_t)(time >> 8); p_expect[n].data[2] = (uint8_t)(time >> 16); p_expect[n].data[3] = (uint8_t)(time >> 24); n++;
+
+    p_expect[n].cmd = CPI_CMD_CKEY; p_expect[n].size = 4;
+    memset(p_expect[n].data, 0, 4); p_expect[n].data[0] = FAKECP_CKEY; n++;
+
+    p_expect[n].cmd = CPI_CMD_SNUM; p_expect[n].size = CPI_SERIAL_NUMBER_SIZE; fakecp_pattern(p_expect[n].data, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM); n++;
+    p_expect[n].cmd = CPI_CMD_HWVR; p_expect[n].size = CPI_HARDWARE_VERSION_SIZE; fakecp_pattern(p_expect[n].data, CPI_HARDWARE_VERSION_SIZE, FAKECP_SEED_HWVR); n++;
+    p_expect[n].cmd = CPI_CMD_UNKNOWN; p_expect[n].size = 0; n++;
+
+    p_expect[n].cmd = CPI_CMD_CHAL; p_expect[n].size = CPI_RESULT1_SIZE + CPI_RESULT2_SIZE;
+    fakecp_pattern(&p_expect[n].data[0], CPI_RESULT1_SIZE, FAKECP_SEED_CHAL + 1);
+    fakecp_pattern(&p_expect[n].data[CPI_RESULT1_SIZE], CPI_RESULT2_SIZE, FAKECP_SEED_CHAL + 2);
+    n++;
+
+    return n;
+}
+
+/*! utility function to hex encode data, as the XML format does */
+static const char *format_hex(const uint8_t *p_data, int size)
+{
+    static char str[2*(CPI_RESULT1_SIZE + CPI_RESULT2_SIZE) + 1];
+
+    int v;
+
+    for(v=0;v<size;v++) { sprintf(&str[v*2], "%.02X", p_data[v]); }
+
+    str[size*2] = 0;
+
+    return str;
+}
+
+/*! utility function to base64 encode data, as the JSON format does */
+static const char *format_b64(const uint8_t *p_data, int size)
+{
+    static char str[2*(CPI_RESULT1_SIZE + CPI_RESULT2_SIZE) + 1];
+
+    int len = sizeof(str);
+
+    if(CPI_FAILED(cpi_b64_encode(p_data, size, str, &len))) { return "(too long)"; }
+
+    return str;
+}
+
+/*! utility function to format a VERS answer as major.minor.fix */
+static const char *format_vers(const uint8_t *p_data)
+{
+    static char str[32];
+
+    sprintf(str, "%d.%d.%d", p_data[4] | (p_data[5] << 8), p_data[2] | (p_data[3] << 8), p_data[0] | (p_data[1] << 8));
+
+    return str;
+}
+
+/*! utility function to check a TLV stream against the expected data, record by record */
+static void format_check_tlv(const uint8_t *p_out, int size, const format_expect *p_expect, int n)
+{
+    int offset = 4, v;
+
+    UNIT_CHECK( (size >= 4) && (memcmp(p_out, "CPI", 3) == 0) && (p_out[3] == CPI_TLV_VERSION) );
+
+    for(v=0;v<=n;v++)
+    {
+        int len = 0;
+
+        if(offset + 4 > size) { UNIT_CHECK(offset + 4 <= size); return; }
+
+        len = p_out[offset + 2] | (p_out[offset + 3] << 8);
+
+        if(v == n)
+        {
+            UNIT_CHECK( (p_out[offset] == CPI_TLV_END) && (offset + 4 + len == size) );
+            return;
+        }
+
+        UNIT_CHECK(p_out[offset] == p_expect[v].cmd);
+        UNIT_CHECK(p_out[offset + 1] == ((p_expect[v].cmd == CPI_CMD_UNKNOWN) ? CPI_INVALID_PARAM : CPI_OK));
+        UNIT_CHECK( (len == p_expect[v].size) && (offset + 4 + len <= size) && (memcmp(&p_out[offset + 4], p_expect[v].data, len) == 0) );
+
+        offset += 4 + len;
+    }
+
+    return;
+}
+
+/*! utility function to check an XML or JSON response holds the expected data */
+static void format_check_text(const char *p_out, int json, const format_expect *p_expect, int n)
+{
+    const char *(*encode)(const uint8_t*, int) = json ? format_b64 : format_hex;
+
+    char buff[128];
+
+    int v;
+
+    for(v=0;v<n;v++)
+    {
+        const format_expect *p = &p_expect[v];
+
+        switch(p->cmd)
+        {
+            case CPI_CMD_PIDX:
+            {
+                /*! XML spells a PID out as a GUID */
+                if(json) { UNIT_CHECK(strstr(p_out, encode(p->data, p->size)) != 0); }
+                else
+                {
+                    const char *hex = format_hex(p->data, p->size);
+
+                    snprintf(buff, sizeof(buff), "%.8s-%.4s-%.4s-%.4s-%.12s", hex, &hex[8], &hex[12], &hex[16], &hex[20]);
+                    UNIT_CHECK(strstr(p_out, buff) != 0);
+                }
+            }
+            break;
+
+            case CPI_CMD_PKEY:
+            {
+                /*! both carry the armored key's body, in base64 (XML wrapped as the CP sent it) */
+                const char *b64 = format_b64(p->data, p->size);
+
+                if(json) { UNIT_CHECK(strstr(p_out, b64) != 0); }
+                else
+                {
+                    snprintf(buff, sizeof(buff), "%.64s\n", b64);
+                    UNIT_CHECK(strstr(p_out, buff) != 0);
+                }
+            }
+            break;
+
+            case CPI_CMD_VERS:
+                UNIT_CHECK(strstr(p_out, format_vers(p->data)) != 0);
+                break;
+
+            case CPI_CMD_TIME:
+            case CPI_CMD_CKEY:
+            {
+                uint32_t value = p->data[0] | (p->data[1] << 8) | (p->data[2] << 16) | ((uint32_t)p->data[3] << 24);
+
+                snprintf(buff, sizeof(buff), json ? ":%u}" : ">%u<", value);
+                UNIT_CHECK(strstr(p_out, buff) != 0);
+            }
+            break;
+
+            case CPI_CMD_SNUM:
+            case CPI_CMD_HWVR:
+                UNIT_CHECK(strstr(p_out, encode(p->data, p->size)) != 0);
+                break;
+
+            case CPI_CMD_UNKNOWN:
+                UNIT_CHECK(strstr(p_out, "\"failure\"") != 0);
+                break;
+
+            case CPI_CMD_CHAL:
+            {
+                /*! result 1 splits into the encrypted owner key, "Rm" and version data, result 2 is the signature */
+                UNIT_CHECK(strstr(p_out, encode(&p->data[0], CPI_RESULT1_ENC_OK_SIZE)) != 0);
+                UNIT_CHECK(strstr(p_out, encode(&p->data[CPI_RESULT1_ENC_OK_SIZE], CPI_RESULT1_RAND_SIZE)) != 0);
+                UNIT_CHECK(strstr(p_out, encode(&p->data[CPI_RESULT1_ENC_OK_SIZE + CPI_RESULT1_RAND_SIZE], CPI_RESULT1_VERS_SIZE)) != 0);
+                UNIT_CHECK(strstr(p_out, encode(&p->data[CPI_RESULT1_SIZE], CPI_RESULT2_SIZE)) != 0);
+            }
+            break;
+        }
+    }
+
+    return;
+}
+
+void test_format()
+{
+    static const int formats[] = { CPI_FORMAT_XML, CPI_FORMAT_JSON, CPI_FORMAT_TLV };
+
+    static format_expect expect[16];
+
+    static uint8_t out[2][FORMAT_OUT_SIZE];
+
+    cpi_t *p_cpi = 0;
+
+    fakecp fake;
+
+    char link[256];
+
+    int n = 0, f;
+
+    memset(&fake, 0, sizeof(fake));
+    fake.time = 0x12345678;
+
+    n = format_fill(expect, fake.time);
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(0, &p_cpi)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(p_cpi, link)));
+
+    for(f=0;f<(int)(sizeof(formats)/sizeof(formats[0]));f++)
+    {
+        int size[2] = { FORMAT_OUT_SIZE, FORMAT_OUT_SIZE }, p;
+
+        unsigned long allocs = 0;
+
+        /*! the second pass runs on the scratch space the first one left behind */
+        for(p=0;p<2;p++)
+        {
+            memset(out[p], 0, FORMAT_OUT_SIZE);
+
+            allocs = cpi_get_alloc_count();
+
+            UNIT_CHECK(CPI_SUCCESS(cpi_process_query(p_cpi, format_query, formats[f], out[p], &size[p])));
+        }
+
+        UNIT_CHECK(cpi_get_alloc_count() == allocs);
+        UNIT_CHECK( (size[0] == size[1]) && (memcmp(out[0], out[1], size[0]) == 0) );
+
+        if(formats[f] == CPI_FORMAT_TLV) { format_check_tlv(out[0], size[0], expect, n); }
+        else { UNIT_CHECK(strlen((char*)out[0]) == (size_t)size[0]); format_check_text((char*)out[0], (formats[f] == CPI_FORMAT_JSON), expect, n); }
+    }
+
+    /*! an output buffer too small is reported, not overrun */
+    {
+        int size = 64;
+
+        memset(out[0], 0x5A, FORMAT_OUT_SIZE);
+
+        UNIT_CHECK(cpi_process_query(p_cpi, format_query, CPI_FORMAT_JSON, out[0], &size) == CPI_OUT_OF_MEMORY);
+        UNIT_CHECK(out[0][64] == 0x5A);
+    }
+
+    cpi_close(p_cpi);
+    fakecp_stop(&fake);
+
+    return;
+}
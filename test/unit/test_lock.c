@@ -0,0 +1,213 @@
+/*
+ * test_lock.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests the cross-process CP lock (see cp_lock.c), with forked
+ * processes queueing for the fake CP: the device must be granted in arrival
+ * order, a waiter must give up once its timeout expires, an owner killed
+ * while holding the device must be dropped, and without a usable lock
+ * directory processes must still exclude each other by polling.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*! number of processes queued behind the owner */
+#define LOCK_WAITERS        3
+
+/*! time limit of the waiter which must give up, in milliseconds */
+#define LOCK_TIMEOUT_MS     300
+
+/*! utility function to read the monotonic clock, in ms */
+static long lock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/*! utility function to open the device, waiting up to timeout_ms for it (returns the CPI_ code, and the instance in *pp_cpi) */
+static int lock_open(const char *link, const char *lock_dir, int timeout_ms, cpi_t **pp_cpi)
+{
+    cpi_info_t info = { 0, timeout_ms, "", lock_dir };
+
+    int ret = cpi_create(&info, pp_cpi);
+
+    if(CPI_SUCCESS(ret)) { ret = cpi_init(*pp_cpi, (char*)link); }
+
+    return ret;
+}
+
+/*! utility function to read the lock metrics of an instance, or zeros */
+static cpi_lock_metrics_t lock_metrics(cpi_t *p_cpi)
+{
+    cpi_lock_metrics_t metrics;
+
+    memset(&metrics, 0, sizeof(metrics));
+
+    UNIT_CHECK(CPI_SUCCESS(cpi_get_lock_metrics(p_cpi, &metrics)));
+
+    return metrics;
+}
+
+/*! utility function to fork a process which opens the device and reports it on fd, then holds it for hold_ms (or until killed, if -1) */
+static pid_t lock_child(const char *link, const char *lock_dir, int fd, char tag, int hold_ms)
+{
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        cpi_t *p_cpi = 0;
+
+        int ok = CPI_SUCCESS(lock_open(link, lock_dir, -1, &p_cpi));
+
+        if(ok && (write(fd, &tag, 1) != 1)) { ok = 0; }
+
+        if(hold_ms < 0) { for(;;) { pause(); } }
+
+        usleep(hold_ms*1000);
+
+        cpi_close(p_cpi);
+
+        _exit(ok ? 0 : 1);
+    }
+
+    return pid;
+}
+
+/*! utility function to wait until the specified number of processes are queued */
+static void lock_queued(cpi_t *p_cpi, uint32_t waiting)
+{
+    int wait;
+
+    for(wait=0;(wait<1000) && (lock_metrics(p_cpi).waiting != waiting);wait++) { usleep(1000); }
+
+    UNIT_CHECK(lock_metrics(p_cpi).waiting == waiting);
+
+    return;
+}
+
+/*! utility function to reap a child, checking that it succeeded */
+static void lock_reap(pid_t pid)
+{
+    int status = 0;
+
+    UNIT_CHECK(waitpid(pid, &status, 0) == pid);
+    UNIT_CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+    return;
+}
+
+void test_lock()
+{
+    cpi_lock_metrics_t metrics;
+
+    cpi_t *p_owner = 0, *p_late = 0, *p_other = 0;
+
+    fakecp fake;
+
+    struct stat st;
+
+    pid_t pids[LOCK_WAITERS], holder = -1;
+
+    char link[256], lock_dir[256], no_dir[256], order[LOCK_WAITERS + 1];
+
+    int fds[2] = { -1, -1 }, status = 0, v;
+
+    long start = 0;
+
+    FILE *file = 0;
+
+    memset(&fake, 0, sizeof(fake));
+    memset(order, 0, sizeof(order));
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+    snprintf(lock_dir, sizeof(lock_dir), "%s/lock", unit_dir);
+    snprintf(no_dir, sizeof(no_dir), "%s/nolock", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(pipe(fds) == 0);
+
+    /*! the lock directory is shared with the device's group */
+    UNIT_CHECK(CPI_SUCCESS(lock_open(link, lock_dir, 0, &p_owner)));
+    UNIT_CHECK( (stat(lock_dir, &st) == 0) && ((st.st_mode & 07777) == (S_ISGID | 0770)) );
+
+    /*! processes queued behind the owner are granted the device in the order they arrived */
+    for(v=0;v<LOCK_WAITERS;v++)
+    {
+        pids[v] = lock_child(link, lock_dir, fds[1], (char)('a' + v), 20);
+
+        lock_queued(p_owner, (uint32_t)(v + 1));
+    }
+
+    cpi_close(p_owner);
+
+    for(v=0;v<LOCK_WAITERS;v++) { lock_reap(pids[v]); }
+
+    UNIT_CHECK(read(fds[0], order, LOCK_WAITERS) == LOCK_WAITERS);
+    UNIT_CHECK(strcmp(order, "abc") == 0);
+
+    /*! behind an owner which does not let go, a waiter gives up once its time is up */
+    holder = lock_child(link, lock_dir, fds[1], 'h', -1);
+
+    UNIT_CHECK(read(fds[0], order, 1) == 1);
+
+    start = lock_ms();
+
+    UNIT_CHECK(lock_open(link, lock_dir, LOCK_TIMEOUT_MS, &p_late) == CPI_ACCESS_DENIED);
+    UNIT_CHECK(lock_ms() - start >= LOCK_TIMEOUT_MS);
+
+    cpi_close(p_late);
+
+    /*! and once it is killed (and reaped, as zombies still exist), it is dropped */
+    kill(holder, SIGKILL);
+    UNIT_CHECK(waitpid(holder, &status, 0) == holder);
+
+    UNIT_CHECK(CPI_SUCCESS(lock_open(link, lock_dir, 1000, &p_owner)));
+
+    metrics = lock_metrics(p_owner);
+
+    UNIT_CHECK(metrics.acquired == 1 + LOCK_WAITERS + 2);
+    UNIT_CHECK(metrics.timeouts == 1);
+    UNIT_CHECK(metrics.recovered == 1);
+    UNIT_CHECK(metrics.waiting == 0);
+
+    cpi_close(p_owner);
+
+    /*! a lock directory which is not a directory leaves no queue, but the device is still only granted once */
+    file = fopen(no_dir, "w");
+    UNIT_CHECK(file != 0);
+    if(file != 0) { fclose(file); }
+
+    UNIT_CHECK(CPI_SUCCESS(lock_open(link, no_dir, 0, &p_owner)));
+    UNIT_CHECK(cpi_get_lock_metrics(p_owner, &metrics) == CPI_NOTIMPL);
+
+    UNIT_CHECK(lock_open(link, no_dir, LOCK_TIMEOUT_MS, &p_other) == CPI_ACCESS_DENIED);
+    cpi_close(p_other);
+
+    cpi_close(p_owner);
+
+    UNIT_CHECK(CPI_SUCCESS(lock_open(link, no_dir, LOCK_TIMEOUT_MS, &p_other)));
+    cpi_close(p_other);
+
+    close(fds[0]);
+    close(fds[1]);
+
+    fakecp_stop(&fake);
+
+    return;
+}
@@ -0,0 +1,135 @@
+/*
+ * test_pacing.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests the adaptive write delay: a FAIL answer from the CP fails
+ * its command, but is a complete exchange, so the delay is not raised, and the
+ * commands after it (in the same session or the next) go through. It also
+ * tests that pacing profiles keep one line per CP.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <string.h>
+
+/*! commands issued, every other one answered with FAIL */
+#define PACING_COMMANDS     8
+
+/*! utility function to run the test against a fake CP with the given CPI_INFO_ flags */
+static void pacing_run(int flags)
+{
+    cpi_info_t info = { flags, 0, "" };
+
+    cpi_t *p_cpi = 0;
+
+    cpi_metrics_t metrics;
+
+    fakecp fake;
+
+    char link[256];
+
+    uint32_t delay_us = 0;
+
+    int v;
+
+    memset(&fake, 0, sizeof(fake));
+    fake.fail_every = 2;
+    fake.time = 1000;
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(&info, &p_cpi)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(p_cpi, link)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_get_metrics(p_cpi, &metrics)));
+
+    delay_us = metrics.write_delay_us;
+
+    /*! one session per command, so the EOF character of a FAIL answer may come ahead of the next wake */
+    for(v=0;v<PACING_COMMANDS;v++)
+    {
+        uint32_t value = 0;
+
+        int ret = cpi_get_current_time(p_cpi, &value);
+
+        UNIT_CHECK( (v % 2 == 0) ? (CPI_SUCCESS(ret) && (value == 1000)) : (ret == CPI_FAIL) );
+    }
+
+    /*! and all in one session (with distinct key IDs, so that no command shares another's exchange) */
+    {
+        cpi_cmd_t cmds[PACING_COMMANDS];
+
+        uint8_t out[PACING_COMMANDS][16], expect[16];
+
+        memset(cmds, 0, sizeof(cmds));
+
+        for(v=0;v<PACING_COMMANDS;v++) { cmds[v].cmd = CPI_CMD_PIDX; cmds[v].key_id = v; cmds[v].out[0] = out[v]; cmds[v].out_size[0] = sizeof(out[v]); }
+
+        cpi_execute_batch(p_cpi, cmds, PACING_COMMANDS);
+
+        for(v=0;v<PACING_COMMANDS;v++)
+        {
+            fakecp_pattern(expect, 16, FAKECP_SEED_PIDX + v);
+
+            UNIT_CHECK( (v % 2 == 0) ? ((cmds[v].status == CPI_OK) && (memcmp(out[v], expect, 16) == 0)) : (cmds[v].status == CPI_FAIL) );
+        }
+    }
+
+    UNIT_CHECK(CPI_SUCCESS(cpi_get_metrics(p_cpi, &metrics)));
+    UNIT_CHECK(metrics.backoffs == 0);
+    UNIT_CHECK(metrics.write_delay_us == delay_us);
+
+    /*! every command reached the CP once: none was lost to a stale EOF character */
+    UNIT_CHECK(fakecp_served(&fake) == 2*PACING_COMMANDS);
+
+    cpi_close(p_cpi);
+    fakecp_stop(&fake);
+
+    return;
+}
+
+/*! utility function to count the lines of a file which hold the given text */
+static int pacing_count(const char *path, const char *text)
+{
+    char line[256];
+
+    int count = 0;
+
+    FILE *file = fopen(path, "r");
+
+    if(file == 0) { return -1; }
+
+    while(fgets(line, sizeof(line), file) != 0) { if(strstr(line, text) != 0) { count++; } }
+
+    fclose(file);
+
+    return count;
+}
+
+void test_pacing()
+{
+    static const uint8_t serial1[CPI_SERIAL_NUMBER_SIZE] = { 0x01, 0x23 }, serial2[CPI_SERIAL_NUMBER_SIZE] = { 0x45, 0x67 };
+
+    char path[256];
+
+    pacing_run(0);
+    pacing_run(CPI_INFO_PIPELINED);
+
+    snprintf(path, sizeof(path), "%s/pacing", unit_dir);
+
+    UNIT_CHECK(CPI_SUCCESS(cpi_save_pacing(path, serial1, 5000)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_save_pacing(path, serial2, 6000)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_save_pacing(path, serial1, 7000)));
+
+    UNIT_CHECK(pacing_count(path, "0123") == 1);
+    UNIT_CHECK(pacing_count(path, " 7000") == 1);
+    UNIT_CHECK(pacing_count(path, " 5000") == 0);
+    UNIT_CHECK(pacing_count(path, "4567") == 1);
+
+    return;
+}
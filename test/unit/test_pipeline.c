@@ -0,0 +1,99 @@
+/*
+ * test_pipeline.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests back to back exchanges, with and without
+ * CPI_INFO_PIPELINED: queries mixed with DOWN and RSET, which the CP answers
+ * with nothing but the EOF character, must all succeed and return the CP's
+ * data, in batches as well as one at a time.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <string.h>
+
+/*! rounds of the batch and the single commands */
+#define PIPELINE_ROUNDS     3
+
+/*! utility function to run the test rounds against a fake CP with the given CPI_INFO_ flags */
+static void pipeline_run(int flags)
+{
+    static const int seq[] = { CPI_CMD_PIDX, CPI_CMD_DOWN, CPI_CMD_TIME, CPI_CMD_RSET, CPI_CMD_CKEY, CPI_CMD_DOWN, CPI_CMD_RSET, CPI_CMD_SNUM, CPI_CMD_VERS, CPI_CMD_RSET };
+
+    cpi_info_t info = { flags, 0, "" };
+
+    cpi_t *p_cpi = 0;
+
+    fakecp fake;
+
+    char link[256];
+
+    uint8_t out[sizeof(seq)/sizeof(seq[0])][CPI_SERIAL_NUMBER_SIZE], expect[CPI_SERIAL_NUMBER_SIZE];
+
+    int n = sizeof(seq)/sizeof(seq[0]), r, v;
+
+    memset(&fake, 0, sizeof(fake));
+    fake.time = 0x12345678;
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(&info, &p_cpi)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(p_cpi, link)));
+
+    for(r=0;r<PIPELINE_ROUNDS;r++)
+    {
+        cpi_cmd_t cmds[sizeof(seq)/sizeof(seq[0])];
+
+        uint32_t value = 0;
+
+        memset(cmds, 0, sizeof(cmds));
+        memset(out, 0, sizeof(out));
+
+        for(v=0;v<n;v++) { cmds[v].cmd = seq[v]; cmds[v].out[0] = out[v]; cmds[v].out_size[0] = sizeof(out[v]); }
+
+        UNIT_CHECK(CPI_SUCCESS(cpi_execute_batch(p_cpi, cmds, n)));
+
+        for(v=0;v<n;v++) { UNIT_CHECK(cmds[v].status == CPI_OK); }
+
+        fakecp_pattern(expect, 16, FAKECP_SEED_PIDX);
+        UNIT_CHECK(memcmp(out[0], expect, 16) == 0);
+        UNIT_CHECK(cmds[2].value == 0x12345678);
+        UNIT_CHECK(cmds[4].value == FAKECP_CKEY);
+        fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+        UNIT_CHECK(memcmp(out[7], expect, CPI_SERIAL_NUMBER_SIZE) == 0);
+        fakecp_pattern(expect, CPI_VERSION_SIZE, FAKECP_SEED_VERS);
+        UNIT_CHECK(memcmp(out[8], expect, CPI_VERSION_SIZE) == 0);
+
+        /*! the same, one command at a time */
+        UNIT_CHECK(CPI_SUCCESS(cpi_trigger_reset(p_cpi)));
+        UNIT_CHECK(CPI_SUCCESS(cpi_get_current_time(p_cpi, &value)));
+        UNIT_CHECK(value == 0x12345678);
+        UNIT_CHECK(CPI_SUCCESS(cpi_trigger_power_down(p_cpi)));
+        memset(out[0], 0, CPI_SERIAL_NUMBER_SIZE);
+        UNIT_CHECK(CPI_SUCCESS(cpi_get_serial_number(p_cpi, out[0])));
+        fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+        UNIT_CHECK(memcmp(out[0], expect, CPI_SERIAL_NUMBER_SIZE) == 0);
+    }
+
+    /*! every command reached the CP exactly once */
+    UNIT_CHECK(fakecp_served(&fake) == PIPELINE_ROUNDS * (n + 4));
+
+    cpi_close(p_cpi);
+    fakecp_stop(&fake);
+
+    return;
+}
+
+void test_pipeline()
+{
+    pipeline_run(0);
+    pipeline_run(CPI_INFO_PIPELINED);
+
+    return;
+}
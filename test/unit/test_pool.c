@@ -0,0 +1,163 @@
+/*
+ * test_pool.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests the CPI pool (see cp_pool.h) against several fake CPs:
+ * every device must run the whole plan and be reported exactly once with
+ * its CP's data, and a device which misses the time limit must fail its
+ * unfinished entries and be reopened, without holding back the others.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*! number of fake CPs, the last of which answers too slowly for the time limit */
+#define POOL_DEVICES        3
+
+/*! time limit of the slow round, in milliseconds */
+#define POOL_TIMEOUT_MS     1000
+
+/*! state of the test, passed to the completion callback */
+typedef struct _pool_ctx
+{
+    /*! number of times each device was reported */
+    int reported[POOL_DEVICES];
+    /*! number of reported plan entries which failed, for each device */
+    int failed[POOL_DEVICES];
+}
+pool_ctx;
+
+/*! completion callback, checking each device's results */
+static void pool_done(cpi_pool_t *p_pool, int index, cpi_cmd_t *cmds, size_t n, void *user_data)
+{
+    pool_ctx *p_ctx = (pool_ctx*)user_data;
+
+    uint8_t expect[CPI_RESULT1_SIZE];
+
+    size_t v;
+
+    (void)p_pool;
+
+    if( (index < 0) || (index >= POOL_DEVICES) ) { UNIT_CHECK(0); return; }
+
+    p_ctx->reported[index]++;
+
+    for(v=0;v<n;v++)
+    {
+        if(cmds[v].status != CPI_OK) { p_ctx->failed[index]++; continue; }
+
+        switch(cmds[v].cmd)
+        {
+            case CPI_CMD_SNUM:
+                fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+                UNIT_CHECK(memcmp(cmds[v].out[0], expect, CPI_SERIAL_NUMBER_SIZE) == 0);
+                break;
+            case CPI_CMD_PIDX:
+                fakecp_pattern(expect, 16, FAKECP_SEED_PIDX + cmds[v].key_id);
+                UNIT_CHECK(memcmp(cmds[v].out[0], expect, 16) == 0);
+                break;
+            case CPI_CMD_TIME:
+                UNIT_CHECK(cmds[v].value == 0x12345678);
+                break;
+            case CPI_CMD_CHAL:
+                fakecp_pattern(expect, CPI_RESULT1_SIZE, FAKECP_SEED_CHAL + 1);
+                UNIT_CHECK(memcmp(cmds[v].out[0], expect, CPI_RESULT1_SIZE) == 0);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return;
+}
+
+void test_pool()
+{
+    cpi_cmd_t plan[4];
+
+    cpi_pool_t *p_pool = 0;
+
+    fakecp fake[POOL_DEVICES];
+
+    pool_ctx ctx;
+
+    char link[POOL_DEVICES][256], doc[4096];
+
+    int size = 0, d, index = -1;
+
+    memset(plan, 0, sizeof(plan));
+    memset(fake, 0, sizeof(fake));
+    memset(&ctx, 0, sizeof(ctx));
+
+    plan[0].cmd = CPI_CMD_SNUM;
+    plan[1].cmd = CPI_CMD_PIDX;
+    plan[1].key_id = 2;
+    plan[2].cmd = CPI_CMD_TIME;
+    plan[3].cmd = CPI_CMD_CHAL;
+    plan[3].key_id = 2;
+
+    for(d=0;d<POOL_DEVICES;d++)
+    {
+        fake[d].time = 0x12345678;
+
+        /*! the last CP answers far too slowly for the time limit */
+        if(d == POOL_DEVICES - 1) { fake[d].trickle_us = 100000; }
+
+        snprintf(link[d], sizeof(link[d]), "%s/tty%d", unit_dir, d);
+
+        UNIT_CHECK(fakecp_start(&fake[d], link[d]) == 0);
+    }
+
+    /*! every device but the slow one runs the plan */
+    UNIT_CHECK(CPI_SUCCESS(cpi_pool_create(&p_pool)));
+
+    for(d=0;d<POOL_DEVICES - 1;d++)
+    {
+        UNIT_CHECK(CPI_SUCCESS(cpi_pool_add(p_pool, link[d], &index)));
+        UNIT_CHECK(index == d);
+        UNIT_CHECK(strcmp(cpi_pool_get_path(p_pool, d), link[d]) == 0);
+    }
+
+    UNIT_CHECK(CPI_SUCCESS(cpi_pool_execute(p_pool, plan, 4, -1, pool_done, &ctx)));
+
+    for(d=0;d<POOL_DEVICES - 1;d++)
+    {
+        UNIT_CHECK(ctx.reported[d] == 1);
+        UNIT_CHECK(ctx.failed[d] == 0);
+        UNIT_CHECK(fakecp_served(&fake[d]) == 4);
+    }
+
+    size = sizeof(doc);
+    UNIT_CHECK(CPI_SUCCESS(cpi_pool_format(p_pool, 1, CPI_FORMAT_JSON, doc, &size)));
+    UNIT_CHECK( (size > 0) && (strstr(doc, "\"snum\"") != 0) && (strstr(doc, "\"chal\"") != 0) );
+
+    /*! with the slow one as well, only that device times out */
+    UNIT_CHECK(CPI_SUCCESS(cpi_pool_add(p_pool, link[POOL_DEVICES - 1], &index)));
+    UNIT_CHECK(index == POOL_DEVICES - 1);
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    UNIT_CHECK(cpi_pool_execute(p_pool, plan, 4, POOL_TIMEOUT_MS, pool_done, &ctx) == CPI_FAIL);
+
+    for(d=0;d<POOL_DEVICES;d++)
+    {
+        UNIT_CHECK(ctx.reported[d] == 1);
+        UNIT_CHECK(ctx.failed[d] == ((d == POOL_DEVICES - 1) ? 4 : 0));
+    }
+
+    /*! and is reopened, for the next plan */
+    UNIT_CHECK(cpi_pool_get_cpi(p_pool, POOL_DEVICES - 1) != 0);
+
+    cpi_pool_close(p_pool);
+
+    for(d=0;d<POOL_DEVICES;d++) { fakecp_stop(&fake[d]); }
+
+    return;
+}
@@ -0,0 +1,183 @@
+/*
+ * test_priority.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests the priority classes and deadlines of queued commands:
+ * an URGENT command must be sent ahead of waiting BULK ones, a command whose
+ * deadline cannot be met must be rejected with CPI_BUSY without a callback,
+ * and cpi_execute_batch must keep its entries in order, whatever their
+ * classes.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <string.h>
+#include <poll.h>
+
+/*! queued command, with its output and the order in which it completed */
+typedef struct _priority_sub
+{
+    cpi_cmd_t cmd;
+    uint8_t out[CPI_MAX_RESULT_SIZE];
+    int calls;
+    int rank;
+}
+priority_sub;
+
+/*! number of callbacks so far */
+static int priority_completed = 0;
+
+/*! completion callback */
+static void priority_done(cpi_t *p_cpi, cpi_cmd_t *p_cmd)
+{
+    priority_sub *p_sub = (priority_sub*)p_cmd->user_data;
+
+    (void)p_cpi;
+
+    p_sub->calls++;
+    p_sub->rank = priority_completed++;
+
+    return;
+}
+
+/*! utility function to describe a queued command */
+static void priority_set(priority_sub *p_sub, int cmd, uint16_t key_id, int priority, uint32_t deadline_ms)
+{
+    memset(p_sub, 0, sizeof(priority_sub));
+
+    p_sub->cmd.cmd = cmd;
+    p_sub->cmd.key_id = key_id;
+    p_sub->cmd.priority = priority;
+    p_sub->cmd.deadline_ms = deadline_ms;
+    p_sub->cmd.out[0] = p_sub->out;
+    p_sub->cmd.out_size[0] = sizeof(p_sub->out);
+    p_sub->cmd.user_data = p_sub;
+
+    return;
+}
+
+/*! utility function to process events until the specified number of callbacks have been called */
+static void priority_drain(cpi_t *p_cpi, int completed)
+{
+    int wait;
+
+    for(wait=0;(wait<1000) && (priority_completed < completed);wait++)
+    {
+        struct pollfd pfd = { cpi_get_fd(p_cpi), POLLIN, 0 };
+
+        /*! the fake CP answers at once, so a second of silence means we are stuck */
+        if(poll(&pfd, 1, 1000) <= 0) { break; }
+
+        UNIT_CHECK(CPI_SUCCESS(cpi_process_events(p_cpi)));
+    }
+
+    UNIT_CHECK(priority_completed == completed);
+
+    return;
+}
+
+void test_priority()
+{
+    cpi_info_t info = { 0, 0, "" };
+
+    priority_sub subs[6];
+
+    cpi_cmd_t batch[4];
+
+    uint8_t out[4][16];
+
+    cpi_metrics_t metrics;
+
+    cpi_t *p_cpi = 0;
+
+    fakecp fake;
+
+    char link[256];
+
+    int base, v;
+
+    memset(&fake, 0, sizeof(fake));
+
+    priority_completed = 0;
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(&info, &p_cpi)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(p_cpi, link)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_set_write_delay(p_cpi, 0)));
+
+    /*! an URGENT command queued behind BULK ones is sent first */
+    for(v=0;v<3;v++)
+    {
+        priority_set(&subs[v], CPI_CMD_PIDX, (uint16_t)(1 + v), CPI_PRIORITY_BULK, 0);
+        UNIT_CHECK(CPI_SUCCESS(cpi_submit(p_cpi, &subs[v].cmd, priority_done)));
+    }
+
+    priority_set(&subs[3], CPI_CMD_PIDX, 9, CPI_PRIORITY_URGENT, 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_submit(p_cpi, &subs[3].cmd, priority_done)));
+
+    priority_drain(p_cpi, 4);
+
+    UNIT_CHECK(fakecp_key_log(&fake, 0) == 9);
+
+    for(v=0;v<3;v++) { UNIT_CHECK(fakecp_key_log(&fake, 1 + v) == 1 + v); }
+
+    UNIT_CHECK( (subs[3].calls == 1) && (subs[3].rank == 0) && (subs[3].cmd.status == CPI_OK) );
+
+    for(v=0;v<3;v++) { UNIT_CHECK( (subs[v].calls == 1) && (subs[v].rank == 1 + v) && (subs[v].cmd.status == CPI_OK) ); }
+
+    /*! behind four public keys, a command due within a millisecond is rejected right away, and one due within ten seconds is not */
+    for(v=0;v<4;v++)
+    {
+        priority_set(&subs[v], CPI_CMD_PKEY, (uint16_t)(1 + v), CPI_PRIORITY_NORMAL, 0);
+        UNIT_CHECK(CPI_SUCCESS(cpi_submit(p_cpi, &subs[v].cmd, priority_done)));
+    }
+
+    priority_set(&subs[4], CPI_CMD_PIDX, 20, CPI_PRIORITY_NORMAL, 1);
+    UNIT_CHECK(cpi_submit(p_cpi, &subs[4].cmd, priority_done) == CPI_BUSY);
+    UNIT_CHECK(subs[4].cmd.status == CPI_BUSY);
+
+    priority_set(&subs[5], CPI_CMD_PIDX, 21, CPI_PRIORITY_NORMAL, 10000);
+    UNIT_CHECK(CPI_SUCCESS(cpi_submit(p_cpi, &subs[5].cmd, priority_done)));
+
+    priority_drain(p_cpi, 9);
+
+    UNIT_CHECK(subs[4].calls == 0);
+    UNIT_CHECK( (subs[5].calls == 1) && (subs[5].cmd.status == CPI_OK) );
+    UNIT_CHECK(fakecp_served(&fake) == 9);
+
+    memset(&metrics, 0, sizeof(metrics));
+    UNIT_CHECK(CPI_SUCCESS(cpi_get_metrics(p_cpi, &metrics)));
+    UNIT_CHECK(metrics.rejected[CPI_PRIORITY_NORMAL] == 1);
+
+    /*! a batch is executed in order, whatever the classes of its entries */
+    base = fakecp_served(&fake);
+
+    memset(batch, 0, sizeof(batch));
+
+    for(v=0;v<4;v++)
+    {
+        static const int classes[] = { CPI_PRIORITY_BULK, CPI_PRIORITY_URGENT, CPI_PRIORITY_NORMAL, CPI_PRIORITY_URGENT };
+
+        batch[v].cmd = CPI_CMD_PIDX;
+        batch[v].key_id = (uint16_t)(30 + v);
+        batch[v].priority = classes[v];
+        batch[v].out[0] = out[v];
+        batch[v].out_size[0] = sizeof(out[v]);
+    }
+
+    UNIT_CHECK(CPI_SUCCESS(cpi_execute_batch(p_cpi, batch, 4)));
+
+    for(v=0;v<4;v++) { UNIT_CHECK(fakecp_key_log(&fake, base + v) == 30 + v); }
+
+    cpi_close(p_cpi);
+    fakecp_stop(&fake);
+
+    return;
+}
@@ -0,0 +1,300 @@
+/*
+ * test_remote.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests the CPI daemon (see cpi_serve), serving the fake CP as
+ * "cpi --serve" does, to several clients at once: one making blocking calls,
+ * one queueing commands with cpi_submit and driving them from its event
+ * descriptor, and a shared (CPI_INFO_THREADED) one doing both. Every client
+ * must get the CP's data for each of its own commands, and a second daemon
+ * must refuse the socket while the first still answers on it.
+ */
+
+#define _GNU_SOURCE
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*! number of commands each asynchronous client queues */
+#define REMOTE_SUBMITS      6
+
+/*! daemon, run on its own thread */
+typedef struct _remote_daemon
+{
+    cpi_t *p_cpi;
+    const char *socket_path;
+    int ret;
+}
+remote_daemon;
+
+/*! set by SIGUSR1, on the daemon thread, to stop serving */
+static volatile int remote_stop = 0;
+
+/*! SIGUSR1 handler */
+static void remote_signal(int sig) { (void)sig; remote_stop = 1; }
+
+/*! queued command, with its output and the number of times it completed */
+typedef struct _remote_sub
+{
+    cpi_cmd_t cmd;
+    uint8_t out[CPI_SERIAL_NUMBER_SIZE];
+    int calls;
+}
+remote_sub;
+
+/*! daemon thread */
+static void *remote_serve(void *p_arg)
+{
+    remote_daemon *p_daemon = (remote_daemon*)p_arg;
+
+    p_daemon->ret = cpi_serve(p_daemon->p_cpi, p_daemon->socket_path, &remote_stop);
+
+    return 0;
+}
+
+/*! completion callback for queued commands */
+static void remote_done(cpi_t *p_cpi, cpi_cmd_t *p_cmd)
+{
+    (void)p_cpi;
+
+    __atomic_add_fetch(&((remote_sub*)p_cmd->user_data)->calls, 1, __ATOMIC_ACQ_REL);
+
+    return;
+}
+
+/*! utility function to queue SNUM, PIDX and TIME commands in turn, with key IDs from key_base */
+static void remote_queue(cpi_t *p_cpi, remote_sub *subs, int key_base)
+{
+    int v;
+
+    memset(subs, 0, REMOTE_SUBMITS*sizeof(remote_sub));
+
+    for(v=0;v<REMOTE_SUBMITS;v++)
+    {
+        subs[v].cmd.cmd = (v % 3 == 0) ? CPI_CMD_SNUM : (v % 3 == 1) ? CPI_CMD_PIDX : CPI_CMD_TIME;
+        subs[v].cmd.key_id = (uint16_t)(key_base + v);
+        subs[v].cmd.out[0] = subs[v].out;
+        subs[v].cmd.out_size[0] = sizeof(subs[v].out);
+        subs[v].cmd.user_data = &subs[v];
+
+        UNIT_CHECK(CPI_SUCCESS(cpi_submit(p_cpi, &subs[v].cmd, remote_done)));
+    }
+
+    return;
+}
+
+/*! utility function to check the results of queued commands, each of which must have completed once */
+static void remote_check(remote_sub *subs)
+{
+    uint8_t expect[CPI_SERIAL_NUMBER_SIZE];
+
+    int v;
+
+    for(v=0;v<REMOTE_SUBMITS;v++)
+    {
+        UNIT_CHECK(__atomic_load_n(&subs[v].calls, __ATOMIC_ACQUIRE) == 1);
+        UNIT_CHECK(subs[v].cmd.status == CPI_OK);
+
+        if(subs[v].cmd.cmd == CPI_CMD_SNUM)
+        {
+            fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+            UNIT_CHECK(memcmp(subs[v].out, expect, CPI_SERIAL_NUMBER_SIZE) == 0);
+        }
+        else if(subs[v].cmd.cmd == CPI_CMD_PIDX)
+        {
+            fakecp_pattern(expect, 16, FAKECP_SEED_PIDX + subs[v].cmd.key_id);
+            UNIT_CHECK(memcmp(subs[v].out, expect, 16) == 0);
+        }
+        else
+        {
+            UNIT_CHECK(subs[v].cmd.value == 0x12345678);
+        }
+    }
+
+    return;
+}
+
+/*! utility function to connect a client to the daemon, retrying while it starts up */
+static cpi_t *remote_connect(const char *socket_path, int flags)
+{
+    cpi_info_t info = { flags, 0, "" };
+
+    cpi_t *p_cpi = 0;
+
+    int tries;
+
+    for(tries=0;tries<1000;tries++)
+    {
+        if(CPI_FAILED(cpi_create(&info, &p_cpi))) { return 0; }
+
+        if(CPI_SUCCESS(cpi_init(p_cpi, (char*)socket_path))) { return p_cpi; }
+
+        cpi_close(p_cpi);
+
+        usleep(1000);
+    }
+
+    return 0;
+}
+
+void test_remote()
+{
+    cpi_info_t info = { 0, 0, "" };
+
+    remote_daemon daemon;
+
+    struct sigaction sa;
+
+    remote_sub subs_async[REMOTE_SUBMITS], subs_shared[REMOTE_SUBMITS];
+
+    cpi_cmd_t batch[2];
+
+    cpi_t *p_blocking = 0, *p_async = 0, *p_shared = 0, *p_second = 0;
+
+    fakecp fake, fake_second;
+
+    pthread_t thread;
+
+    struct stat st;
+
+    char link[256], link_second[256], socket_path[256];
+
+    uint8_t out[CPI_SERIAL_NUMBER_SIZE], expect[CPI_SERIAL_NUMBER_SIZE];
+
+    uint32_t value = 0;
+
+    int wait, v;
+
+    memset(&fake, 0, sizeof(fake));
+    memset(&fake_second, 0, sizeof(fake_second));
+    memset(&daemon, 0, sizeof(daemon));
+    fake.time = 0x12345678;
+
+    /*! no SA_RESTART, so that the signal interrupts the daemon's wait */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = remote_signal;
+    sigaction(SIGUSR1, &sa, 0);
+    remote_stop = 0;
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+    snprintf(link_second, sizeof(link_second), "%s/tty2", unit_dir);
+    snprintf(socket_path, sizeof(socket_path), "%s/cpi.sock", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(&info, &daemon.p_cpi)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(daemon.p_cpi, link)));
+
+    daemon.socket_path = socket_path;
+
+    UNIT_CHECK(pthread_create(&thread, 0, remote_serve, &daemon) == 0);
+
+    p_blocking = remote_connect(socket_path, 0);
+    p_async = remote_connect(socket_path, 0);
+    p_shared = remote_connect(socket_path, CPI_INFO_THREADED);
+
+    UNIT_CHECK( (p_blocking != 0) && (p_async != 0) && (p_shared != 0) );
+
+    if( (p_blocking == 0) || (p_async == 0) || (p_shared == 0) ) { goto cleanup; }
+
+    /*! the socket is open to the group, and a second daemon may not take it over */
+    UNIT_CHECK( (stat(socket_path, &st) == 0) && ((st.st_mode & 0777) == 0660) );
+    UNIT_CHECK(fakecp_start(&fake_second, link_second) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(&info, &p_second)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(p_second, link_second)));
+    UNIT_CHECK(cpi_serve(p_second, socket_path, &remote_stop) == CPI_BUSY);
+    cpi_close(p_second);
+    fakecp_stop(&fake_second);
+
+    /*! the fake CP keeps up with any rate, and the delay is the daemon's */
+    UNIT_CHECK(CPI_SUCCESS(cpi_set_write_delay(p_blocking, 0)));
+
+    /*! the event driven and the shared client queue commands, while the blocking client makes its calls */
+    UNIT_CHECK(cpi_get_fd(p_async) != -1);
+    UNIT_CHECK(cpi_get_fd(p_shared) == -1);
+
+    remote_queue(p_async, subs_async, 0x10);
+    remote_queue(p_shared, subs_shared, 0x20);
+
+    UNIT_CHECK(CPI_SUCCESS(cpi_get_serial_number(p_blocking, out)));
+    fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+    UNIT_CHECK(memcmp(out, expect, CPI_SERIAL_NUMBER_SIZE) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_get_current_time(p_blocking, &value)));
+    UNIT_CHECK(value == 0x12345678);
+
+    memset(batch, 0, sizeof(batch));
+    batch[0].cmd = CPI_CMD_PIDX;
+    batch[0].key_id = 7;
+    batch[0].out[0] = out;
+    batch[0].out_size[0] = sizeof(out);
+    batch[1].cmd = CPI_CMD_CKEY;
+
+    UNIT_CHECK(CPI_SUCCESS(cpi_execute_batch(p_blocking, batch, 2)));
+    UNIT_CHECK( (batch[0].status == CPI_OK) && (batch[1].status == CPI_OK) );
+    fakecp_pattern(expect, 16, FAKECP_SEED_PIDX + 7);
+    UNIT_CHECK(memcmp(out, expect, 16) == 0);
+    UNIT_CHECK(batch[1].value == FAKECP_CKEY);
+
+    /*! a blocking call of the shared client, with its own commands still in flight */
+    value = 0;
+    UNIT_CHECK(CPI_SUCCESS(cpi_get_current_time(p_shared, &value)));
+    UNIT_CHECK(value == 0x12345678);
+
+    /*! the event driven client completes its commands as their responses arrive */
+    for(wait=0;wait<100;wait++)
+    {
+        struct pollfd pfd = { cpi_get_fd(p_async), POLLIN, 0 };
+
+        int done = 0;
+
+        for(v=0;v<REMOTE_SUBMITS;v++) { done += (__atomic_load_n(&subs_async[v].calls, __ATOMIC_ACQUIRE) > 0); }
+
+        if(done == REMOTE_SUBMITS) { break; }
+
+        if(poll(&pfd, 1, 1000) <= 0) { break; }
+
+        UNIT_CHECK(CPI_SUCCESS(cpi_process_events(p_async)));
+    }
+
+    /*! the shared client's, on its reader thread */
+    for(wait=0;wait<1000;wait++)
+    {
+        int done = 0;
+
+        for(v=0;v<REMOTE_SUBMITS;v++) { done += (__atomic_load_n(&subs_shared[v].calls, __ATOMIC_ACQUIRE) > 0); }
+
+        if(done == REMOTE_SUBMITS) { break; }
+
+        usleep(1000);
+    }
+
+    remote_check(subs_async);
+    remote_check(subs_shared);
+
+cleanup:
+
+    if(p_blocking != 0) { cpi_close(p_blocking); }
+    if(p_async != 0) { cpi_close(p_async); }
+    if(p_shared != 0) { cpi_close(p_shared); }
+
+    /*! until the daemon has stopped, as a signal caught just before it waits is missed */
+    do { pthread_kill(thread, SIGUSR1); usleep(10000); } while(pthread_tryjoin_np(thread, 0) != 0);
+
+    UNIT_CHECK(daemon.ret == CPI_OK);
+
+    cpi_close(daemon.p_cpi);
+    fakecp_stop(&fake);
+
+    return;
+}
@@ -0,0 +1,189 @@
+/*
+ * test_threads.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests an instance created with CPI_INFO_THREADED, shared by
+ * several threads which submit commands and make blocking calls at the same
+ * time: every submitted command must complete exactly once, with the CP's
+ * data. It is meant to be run under ThreadSanitizer as well, by building
+ * with CC="gcc -fsanitize=thread" CXX="g++ -fsanitize=thread".
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*! \name test size */
+/*! \{ */
+#define THREADS_COUNT       4
+#define THREADS_COMMANDS    32
+/*! \} */
+
+/*! submitted command, with its output and the number of times it completed */
+typedef struct _threads_cmd
+{
+    cpi_cmd_t cmd;
+    uint8_t out[CPI_SERIAL_NUMBER_SIZE];
+    int calls;
+    int *p_completed;
+}
+threads_cmd;
+
+/*! submitting thread */
+typedef struct _threads_ctx
+{
+    cpi_t *p_cpi;
+    int index;
+    int completed;
+    int blocking_failures;
+    threads_cmd cmds[THREADS_COMMANDS];
+}
+threads_ctx;
+
+/*! completion callback, run on the I/O thread */
+static void threads_done(cpi_t *p_cpi, cpi_cmd_t *p_cmd)
+{
+    threads_cmd *p_rec = (threads_cmd*)p_cmd->user_data;
+
+    (void)p_cpi;
+
+    __atomic_add_fetch(&p_rec->calls, 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(p_rec->p_completed, 1, __ATOMIC_ACQ_REL);
+
+    return;
+}
+
+/*! utility thread to submit its commands, with a blocking call every few of them */
+static void *threads_submit(void *p_arg)
+{
+    threads_ctx *p_ctx = (threads_ctx*)p_arg;
+
+    int v;
+
+    for(v=0;v<THREADS_COMMANDS;v++)
+    {
+        threads_cmd *p_rec = &p_ctx->cmds[v];
+
+        int ret;
+
+        p_rec->p_completed = &p_ctx->completed;
+
+        /*! distinct key IDs, so that PIDX exchanges are not shared */
+        p_rec->cmd.cmd = (v % 3 == 0) ? CPI_CMD_SNUM : (v % 3 == 1) ? CPI_CMD_PIDX : CPI_CMD_TIME;
+        p_rec->cmd.key_id = (uint16_t)(p_ctx->index*THREADS_COMMANDS + v);
+        p_rec->cmd.out[0] = p_rec->out;
+        p_rec->cmd.out_size[0] = sizeof(p_rec->out);
+        p_rec->cmd.user_data = p_rec;
+
+        /*! a full queue clears as the I/O thread works through it */
+        while( (ret = cpi_submit(p_ctx->p_cpi, &p_rec->cmd, threads_done)) == CPI_OUT_OF_MEMORY ) { usleep(1000); }
+
+        if(CPI_FAILED(ret)) { __atomic_add_fetch(&p_rec->calls, 1000, __ATOMIC_ACQ_REL); }
+
+        if(v % 8 == 7)
+        {
+            uint32_t value = 0;
+
+            if(CPI_FAILED(cpi_get_current_time(p_ctx->p_cpi, &value)) || (value != 0x12345678)) { p_ctx->blocking_failures++; }
+        }
+    }
+
+    return 0;
+}
+
+void test_threads()
+{
+    static threads_ctx ctx[THREADS_COUNT];
+
+    cpi_info_t info = { CPI_INFO_THREADED, 0, "" };
+
+    cpi_t *p_cpi = 0;
+
+    fakecp fake;
+
+    pthread_t threads[THREADS_COUNT];
+
+    char link[256];
+
+    uint8_t expect[CPI_SERIAL_NUMBER_SIZE];
+
+    int t, v, wait;
+
+    memset(&fake, 0, sizeof(fake));
+    memset(ctx, 0, sizeof(ctx));
+    fake.time = 0x12345678;
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(&info, &p_cpi)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(p_cpi, link)));
+
+    /*! the fake CP keeps up with any rate */
+    UNIT_CHECK(CPI_SUCCESS(cpi_set_write_delay(p_cpi, 0)));
+
+    for(t=0;t<THREADS_COUNT;t++)
+    {
+        ctx[t].p_cpi = p_cpi;
+        ctx[t].index = t;
+
+        UNIT_CHECK(pthread_create(&threads[t], 0, threads_submit, &ctx[t]) == 0);
+    }
+
+    for(t=0;t<THREADS_COUNT;t++) { pthread_join(threads[t], 0); }
+
+    /*! wait for the stragglers, then a little longer, for any duplicate completion */
+    for(wait=0;wait<10000;wait++)
+    {
+        int completed = 0;
+
+        for(t=0;t<THREADS_COUNT;t++) { completed += __atomic_load_n(&ctx[t].completed, __ATOMIC_ACQUIRE); }
+
+        if(completed >= THREADS_COUNT*THREADS_COMMANDS) { break; }
+
+        usleep(1000);
+    }
+
+    usleep(50000);
+
+    for(t=0;t<THREADS_COUNT;t++)
+    {
+        UNIT_CHECK(ctx[t].blocking_failures == 0);
+        UNIT_CHECK(__atomic_load_n(&ctx[t].completed, __ATOMIC_ACQUIRE) == THREADS_COMMANDS);
+
+        for(v=0;v<THREADS_COMMANDS;v++)
+        {
+            threads_cmd *p_rec = &ctx[t].cmds[v];
+
+            UNIT_CHECK(__atomic_load_n(&p_rec->calls, __ATOMIC_ACQUIRE) == 1);
+            UNIT_CHECK(p_rec->cmd.status == CPI_OK);
+
+            if(p_rec->cmd.cmd == CPI_CMD_SNUM)
+            {
+                fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+                UNIT_CHECK(memcmp(p_rec->out, expect, CPI_SERIAL_NUMBER_SIZE) == 0);
+            }
+            else if(p_rec->cmd.cmd == CPI_CMD_PIDX)
+            {
+                fakecp_pattern(expect, 16, FAKECP_SEED_PIDX + p_rec->cmd.key_id);
+                UNIT_CHECK(memcmp(p_rec->out, expect, 16) == 0);
+            }
+            else
+            {
+                UNIT_CHECK(p_rec->cmd.value == 0x12345678);
+            }
+        }
+    }
+
+    cpi_close(p_cpi);
+    fakecp_stop(&fake);
+
+    return;
+}
@@ -0,0 +1,117 @@
+/*
+ * test_xml.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module tests cpi_process_xml against the fake CP: the responses must
+ * carry the CP's data, and once the parser and scratch buffers are set up,
+ * processing the same document again must give the same output without a
+ * heap allocation.
+ */
+
+#include "unit.h"
+#include "fakecp.h"
+#include "cp_interface.h"
+
+#include <string.h>
+
+/*! query document */
+static char xml_query[] =
+    "<?xml version='1.0'?>\n"
+    "<cpi version='1.0'>\n"
+    "    <query_list>\n"
+    "        <query type=\"pidx\" key_id=\"0\"></query>\n"
+    "        <query type=\"time\"></query>\n"
+    "        <query type=\"snum\"></query>\n"
+    "        <query type=\"bogus\"></query>\n"
+    "        <query type=\"chal\" key_id=\"0\" rand_data=\"0102030405060708090A0B0C0D0E0F10\"></query>\n"
+    "    </query_list>\n"
+    "</cpi>\n";
+
+/*! utility function to hex encode data, as the XML responses do */
+static const char *xml_hex(const uint8_t *p_data, int size)
+{
+    static char str[2*CPI_RESULT1_SIZE + 1];
+
+    int v;
+
+    for(v=0;v<size;v++) { sprintf(&str[v*2], "%.02X", p_data[v]); }
+
+    str[size*2] = 0;
+
+    return str;
+}
+
+void test_xml()
+{
+    static char out[2][CPI_MAX_RESULT_SIZE*4];
+
+    cpi_t *p_cpi = 0;
+
+    fakecp fake;
+
+    char link[256], buff[128];
+
+    uint8_t expect[CPI_RESULT1_SIZE];
+
+    unsigned long allocs = 0;
+
+    int p;
+
+    memset(&fake, 0, sizeof(fake));
+    fake.time = 0x12345678;
+
+    snprintf(link, sizeof(link), "%s/tty", unit_dir);
+
+    UNIT_CHECK(fakecp_start(&fake, link) == 0);
+    UNIT_CHECK(CPI_SUCCESS(cpi_create(0, &p_cpi)));
+    UNIT_CHECK(CPI_SUCCESS(cpi_init(p_cpi, link)));
+
+    /*! the second pass runs on the parser and scratch space the first one left behind */
+    for(p=0;p<2;p++)
+    {
+        memset(out[p], 0, sizeof(out[p]));
+
+        allocs = cpi_get_alloc_count();
+
+        UNIT_CHECK(CPI_SUCCESS(cpi_process_xml(p_cpi, xml_query, out[p])));
+    }
+
+    UNIT_CHECK(cpi_get_alloc_count() == allocs);
+    UNIT_CHECK(strcmp(out[0], out[1]) == 0);
+
+    /*! XML spells a PID out as a GUID */
+    {
+        const char *hex = 0;
+
+        fakecp_pattern(expect, 16, FAKECP_SEED_PIDX);
+        hex = xml_hex(expect, 16);
+
+        snprintf(buff, sizeof(buff), "\"pidx\" result=\"success\">%.8s-%.4s-%.4s-%.4s-%.12s<", hex, &hex[8], &hex[12], &hex[16], &hex[20]);
+        UNIT_CHECK(strstr(out[0], buff) != 0);
+    }
+
+    snprintf(buff, sizeof(buff), "\"time\" result=\"success\">%u<", fake.time);
+    UNIT_CHECK(strstr(out[0], buff) != 0);
+
+    fakecp_pattern(expect, CPI_SERIAL_NUMBER_SIZE, FAKECP_SEED_SNUM);
+    UNIT_CHECK(strstr(out[0], xml_hex(expect, CPI_SERIAL_NUMBER_SIZE)) != 0);
+
+    UNIT_CHECK(strstr(out[0], "<response result=\"failure\">Unknown \"type\" value</response>") != 0);
+
+    /*! result 1 starts with the encrypted owner key, result 2 is the signature */
+    fakecp_pattern(expect, CPI_RESULT1_SIZE, FAKECP_SEED_CHAL + 1);
+    UNIT_CHECK(strstr(out[0], xml_hex(expect, CPI_RESULT1_ENC_OK_SIZE)) != 0);
+    fakecp_pattern(expect, CPI_RESULT2_SIZE, FAKECP_SEED_CHAL + 2);
+    UNIT_CHECK(strstr(out[0], xml_hex(expect, CPI_RESULT2_SIZE)) != 0);
+
+    /*! every query but the unknown one reached the CP, twice */
+    UNIT_CHECK(fakecp_served(&fake) == 2*4);
+
+    cpi_close(p_cpi);
+    fakecp_stop(&fake);
+
+    return;
+}
@@ -0,0 +1,53 @@
+/*
+ * unit.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * Host-side unit and regression tests of the CPI library (make check). Each
+ * test is a function which reports failed checks through UNIT_CHECK; those
+ * which need a CP talk to a fake one (see fakecp.h).
+ */
+
+#ifndef UNIT_H
+#define UNIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+/*! number of failed checks so far */
+extern int unit_failures;
+
+/*! check a condition, reporting it and counting a failure if it does not hold */
+#define UNIT_CHECK(cond) do { if(!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); unit_failures++; } } while(0)
+
+/*! directory tests may create files in (a fresh directory, removed afterwards) */
+extern const char *unit_dir;
+
+/*! \name tests */
+/*! \{ */
+void test_xml();
+void test_format();
+void test_async();
+void test_pipeline();
+void test_pacing();
+void test_budget();
+void test_archive();
+void test_device();
+void test_threads();
+void test_pool();
+void test_remote();
+void test_coalesce();
+void test_priority();
+void test_lock();
+/*! \} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * archive.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements archives: mapping and searching them, and converting
+ * pairs from and to the XML written by cpi. Archives are written by the CPI
+ * library (see cp_archive.h).
+ */
+
+#include "archive.h"
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tomcrypt.h>
+
+int archive_probe(const char *path)
+{
+    uint32_t magic = 0;
+
+    int fd = open(path, O_RDONLY), is_archive = 0;
+
+    if(fd < 0) { return 0; }
+
+    is_archive = (read(fd, &magic, sizeof(magic)) == sizeof(magic)) && (magic == CPI_ARCHIVE_MAGIC);
+
+    close(fd);
+
+    return is_archive;
+}
+
+/*! utility function to check the segments of a mapped image, and list them (returns VERIFY_ result) */
+static int archive_attach(archive *p_archive)
+{
+    const cpi_archive_header_t *p_header = (const cpi_archive_header_t*)p_archive->image;
+
+    /*! the first segment follows the header, at the archive alignment */
+    uint64_t offset = (sizeof(cpi_archive_header_t) + CPI_ARCHIVE_ALIGN - 1) & ~(uint64_t)(CPI_ARCHIVE_ALIGN - 1);
+
+    uint32_t records = 0, v;
+
+    int c;
+
+    p_archive->header = p_header;
+
+    p_archive->segments = (const cpi_archive_segment_t**)calloc(p_header->segment_count + 1, sizeof(cpi_archive_segment_t*));
+
+    if(p_archive->segments == 0) { return VERIFY_E_READ; }
+
+    /*! segments are checked up front, index entries only as they are followed */
+    for(v=0;v<p_header->segment_count;v++)
+    {
+        const cpi_archive_segment_t *p_seg = (const cpi_archive_segment_t*)&p_archive->image[offset];
+
+        if(offset + sizeof(cpi_archive_segment_t) > p_header->file_size) { return VERIFY_E_PARSE; }
+
+        if( (p_seg->magic != CPI_ARCHIVE_SEGMENT_MAGIC) || (p_seg->first_record != records) || (p_seg->size < sizeof(cpi_archive_segment_t)) ||
+            (p_seg->size > p_header->file_size - offset) || ((p_seg->size % CPI_ARCHIVE_ALIGN) != 0) ) { return VERIFY_E_PARSE; }
+
+        for(c=0;c<CPI_ARCHIVE_COL_COUNT;c++)
+        {
+            if( ((p_seg->column_offset[c] % CPI_ARCHIVE_ALIGN) != 0) || (p_seg->column_offset[c] > p_seg->size) ||
+                ((uint64_t)p_seg->record_count * cpi_archive_column_size(c) > p_seg->size - p_seg->column_offset[c]) ) { return VERIFY_E_PARSE; }
+        }
+
+        if( ((p_seg->index_offset % CPI_ARCHIVE_ALIGN) != 0) || (p_seg->index_offset > p_seg->size) ||
+            ((uint64_t)p_seg->record_count * sizeof(uint32_t) > p_seg->size - p_seg->index_offset) ) { return VERIFY_E_PARSE; }
+
+        if(records + p_seg->record_count < records) { return VERIFY_E_PARSE; }
+
+        p_archive->segments[v] = p_seg;
+
+        records += p_seg->record_count;
+        offset += p_seg->size;
+    }
+
+    if( (records != p_header->record_count) || (offset != p_header->file_size) ) { return VERIFY_E_PARSE; }
+
+    return VERIFY_OK;
+}
+
+int archive_open(archive *p_archive, const char *path)
+{
+    cpi_archive_header_t header;
+
+    struct stat st;
+
+    int fd = open(path, O_RDONLY), ret = VERIFY_OK;
+
+    memset(p_archive, 0, sizeof(archive));
+
+    if(fd < 0) { return VERIFY_E_READ; }
+
+    if( (fstat(fd, &st) != 0) || (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) ) { close(fd); return VERIFY_E_PARSE; }
+
+    /*! anything past the end the header records is a segment cut off by a crash */
+    if( (header.magic != CPI_ARCHIVE_MAGIC) || (header.version != CPI_ARCHIVE_VERSION) || (header.file_size < sizeof(cpi_archive_header_t)) ||
+        (header.file_size > (uint64_t)st.st_size) || (header.file_size > SIZE_MAX) ) { close(fd); return VERIFY_E_PARSE; }
+
+    p_archive->image = (uint8_t*)mmap(0, (size_t)header.file_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if(p_archive->image == MAP_FAILED) { p_archive->image = 0; return VERIFY_E_READ; }
+
+    p_archive->size = (size_t)header.file_size;
+
+    ret = archive_attach(p_archive);
+
+    if(ret != VERIFY_OK) { archive_close(p_archive); }
+
+    return ret;
+}
+
+void archive_close(archive *p_archive)
+{
+    if(p_archive->image != 0) { munmap(p_archive->image, p_archive->size); }
+
+    free(p_archive->segments);
+
+    memset(p_archive, 0, sizeof(archive));
+
+    return;
+}
+
+uint32_t archive_count(const archive *p_archive)
+{
+    return p_archive->header->record_count;
+}
+
+/*! utility function to find the segment holding a record (returns 0 if there is no such record) */
+static const cpi_archive_segment_t *archive_segment_of(const archive *p_archive, uint32_t record)
+{
+    uint32_t lo = 0, hi = p_archive->header->segment_count;
+
+    if(record >= p_archive->header->record_count) { return 0; }
+
+    /*! last segment whose first record is at most record */
+    while(hi - lo > 1)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if(p_archive->segments[mid]->first_record <= record) { lo = mid; } else { hi = mid; }
+    }
+
+    return p_archive->segments[lo];
+}
+
+/*! utility function to find a value of a segment */
+static const uint8_t *archive_value(const cpi_archive_segment_t *p_seg, uint32_t local, int column)
+{
+    return (const uint8_t*)p_seg + p_seg->column_offset[column] + (uint64_t)local * cpi_archive_column_size(column);
+}
+
+const void *archive_field(const archive *p_archive, uint32_t record, int column)
+{
+    const cpi_archive_segment_t *p_seg = archive_segment_of(p_archive, record);
+
+    if( (p_seg == 0) || (column < 0) || (column >= CPI_ARCHIVE_COL_COUNT) ) { return 0; }
+
+    return archive_value(p_seg, record - p_seg->first_record, column);
+}
+
+int archive_get(const archive *p_archive, uint32_t record, cpi_archive_record_t *p_rec)
+{
+    const cpi_archive_segment_t *p_seg = archive_segment_of(p_archive, record);
+
+    int v;
+
+    if(p_seg == 0) { return VERIFY_E_PARSE; }
+
+    for(v=0;v<CPI_ARCHIVE_COL_COUNT;v++)
+    {
+        memcpy(cpi_archive_column(p_rec, v), archive_value(p_seg, record - p_seg->first_record, v), cpi_archive_column_size(v));
+    }
+
+    return VERIFY_OK;
+}
+
+/*! utility function to order a record of a segment against a putative ID and key ID */
+static int archive_compare_key(const cpi_archive_segment_t *p_seg, uint32_t local, const uint8_t *pid, uint16_t key_id)
+{
+    uint16_t rec_key_id = 0;
+
+    int diff = memcmp(archive_value(p_seg, local, CPI_ARCHIVE_COL_PID), pid, 0x10);
+
+    if(diff != 0) { return diff; }
+
+    memcpy(&rec_key_id, archive_value(p_seg, local, CPI_ARCHIVE_COL_KEY_ID), sizeof(rec_key_id));
+
+    return (rec_key_id > key_id) - (rec_key_id < key_id);
+}
+
+int archive_find(const archive *p_archive, const uint8_t *pid, uint16_t key_id, uint32_t *records, int max)
+{
+    uint32_t v;
+
+    int found = 0;
+
+    for(v=0;v<p_archive->header->segment_count;v++)
+    {
+        const cpi_archive_segment_t *p_seg = p_archive->segments[v];
+
+        const uint32_t *index = (const uint32_t*)((const uint8_t*)p_seg + p_seg->index_offset);
+
+        uint32_t lo = 0, hi = p_seg->record_count;
+
+        /*! first index entry not below the key; entries of one key are in record order */
+        while(lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+
+            if( (index[mid] < p_seg->record_count) && (archive_compare_key(p_seg, index[mid], pid, key_id) < 0) ) { lo = mid + 1; } else { hi = mid; }
+        }
+
+        for(;(lo < p_seg->record_count) && (index[lo] < p_seg->record_count) && (archive_compare_key(p_seg, index[lo], pid, key_id) == 0);lo++)
+        {
+            if(found < max) { records[found] = p_seg->first_record + index[lo]; }
+
+            found++;
+        }
+    }
+
+    return found;
+}
+
+int archive_parse(cpi_archive_record_t *p_rec, const char *req, const char *res, long res_size)
+{
+    respscan scan;
+
+    respscan_record rec;
+
+    int seen[CPI_CMD_CHAL + 1];
+
+    memset(p_rec, 0, sizeof(cpi_archive_record_t));
+    memset(seen, 0, sizeof(seen));
+
+    if(verify_parse_query(req, &p_rec->key_id, p_rec->rndx) != VERIFY_OK) { return VERIFY_E_PARSE; }
+
+    respscan_init(&scan, res, res_size);
+
+    /*! the first successful response of each type, in the first document */
+    while(respscan_next(&scan, &rec) == RESPSCAN_OK)
+    {
+        if( !rec.success || (rec.doc != 0) || (rec.cmd > CPI_CMD_CHAL) || (seen[rec.cmd]++ != 0) ) { continue; }
+
+        switch(rec.cmd)
+        {
+            case CPI_CMD_PKEY:
+            {
+                uint8_t raw[CPI_MAX_RESULT_SIZE];
+
+                unsigned long len = sizeof(raw);
+
+                if( !respscan_pkey(&rec.body, raw, &len) || (len != sizeof(p_rec->pkey)) ) { return VERIFY_E_PARSE; }
+
+                memcpy(p_rec->pkey, raw, sizeof(p_rec->pkey));
+
+                p_rec->flags |= CPI_ARCHIVE_HAS_PKEY;
+            }
+            break;
+
+            case CPI_CMD_CKEY:
+                if(!respscan_uint(&rec.body, &p_rec->ckey)) { return VERIFY_E_PARSE; }
+                p_rec->flags |= CPI_ARCHIVE_HAS_CKEY;
+                break;
+
+            case CPI_CMD_SNUM:
+                if(!respscan_hex(&rec.body, p_rec->serial, sizeof(p_rec->serial))) { return VERIFY_E_PARSE; }
+                p_rec->flags |= CPI_ARCHIVE_HAS_SERIAL;
+                break;
+
+            case CPI_CMD_PIDX:
+                if(!respscan_hex(&rec.body, p_rec->pid, sizeof(p_rec->pid))) { return VERIFY_E_PARSE; }
+                break;
+
+            case CPI_CMD_CHAL:
+                if( !respscan_hex(&rec.chal[RESPSCAN_CHAL_ENC_OK], p_rec->enc_ok, sizeof(p_rec->enc_ok)) ||
+                    !respscan_hex(&rec.chal[RESPSCAN_CHAL_RAND], p_rec->rm, sizeof(p_rec->rm)) ||
+                    !respscan_hex(&rec.chal[RESPSCAN_CHAL_VERS], p_rec->vers, sizeof(p_rec->vers)) ||
+                    !respscan_hex(&rec.chal[RESPSCAN_CHAL_SIG], p_rec->sig, sizeof(p_rec->sig)) ) { return VERIFY_E_PARSE; }
+                break;
+        }
+    }
+
+    return (seen[CPI_CMD_PIDX] && seen[CPI_CMD_CHAL]) ? VERIFY_OK : VERIFY_E_PARSE;
+}
+
+/*! utility function to write bytes as hex */
+static void archive_hex(FILE *file, const uint8_t *data, int size, const char *digits)
+{
+    int v;
+
+    for(v=0;v<size;v++) { fputc(digits[data[v] >> 4], file); fputc(digits[data[v] & 0x0F], file); }
+
+    return;
+}
+
+int archive_export(const cpi_archive_record_t *p_rec, const char *req_path, const char *res_path)
+{
+    static const char upper[] = "0123456789ABCDEF", lower[] = "0123456789abcdef";
+
+    FILE *req = fopen(req_path, "w"), *res = fopen(res_path, "w");
+
+    const uint8_t *pid = p_rec->pid;
+
+    int ret = VERIFY_OK, v;
+
+    if( (req == 0) || (res == 0) ) { if(req != 0) { fclose(req); } if(res != 0) { fclose(res); } return VERIFY_E_READ; }
+
+    /*! query, as create_queries writes it */
+    fprintf(req, "<?xml version='1.0'?>\n<cpi version='1.0'>\n    <query_list>\n");
+    fprintf(req, "        <query type=\"pidx\" key_id=\"%u\"></query>\n", p_rec->key_id);
+
+    if(p_rec->flags & CPI_ARCHIVE_HAS_PKEY) { fprintf(req, "        <query type=\"pkey\" key_id=\"%u\"></query>\n", p_rec->key_id); }
+    if(p_rec->flags & CPI_ARCHIVE_HAS_CKEY) { fprintf(req, "        <query type=\"ckey\"></query>\n"); }
+    if(p_rec->flags & CPI_ARCHIVE_HAS_SERIAL) { fprintf(req, "        <query type=\"snum\"></query>\n"); }
+
+    fprintf(req, "        <query type=\"chal\" key_id=\"%u\" rand_data=\"", p_rec->key_id);
+    archive_hex(req, p_rec->rndx, sizeof(p_rec->rndx), lower);
+    fprintf(req, "\"></query>\n    </query_list>\n</cpi>\n");
+
+    /*! response, as cpi_process_xml writes it */
+    fprintf(res, "<?xml version='1.0'?>\n<cpi version='1.0'>\n  <response_list>\n");
+    fprintf(res, "    <response type=\"pidx\" result=\"success\">%.02X%.02X%.02X%.02X-%.02X%.02X-%.02X%.02X-%.02X%.02X-%.02X%.02X%.02X%.02X%.02X%.02X</response>\n",
+        pid[0x00], pid[0x01], pid[0x02], pid[0x03], pid[0x04], pid[0x05], pid[0x06], pid[0x07],
+        pid[0x08], pid[0x09], pid[0x0A], pid[0x0B], pid[0x0C], pid[0x0D], pid[0x0E], pid[0x0F]);
+
+    if(p_rec->flags & CPI_ARCHIVE_HAS_PKEY)
+    {
+        char b64[2*CPI_ARCHIVE_PKEY_SIZE];
+
+        unsigned long len = sizeof(b64);
+
+        if(base64_encode(p_rec->pkey, sizeof(p_rec->pkey), (unsigned char*)b64, &len) != CRYPT_OK) { ret = VERIFY_E_MATH; }
+
+        fprintf(res, "    <response type=\"pkey\" result=\"success\">\n-----BEGIN PGP PUBLIC KEY BLOCK-----\n");
+
+        for(v=0;(ret == VERIFY_OK) && (v<(int)len);v+=64) { fprintf(res, "%.*s\n", ((int)len - v < 64) ? (int)len - v : 64, &b64[v]); }
+
+        fprintf(res, "-----END PGP PUBLIC KEY BLOCK-----\n    </response>\n");
+    }
+
+    if(p_rec->flags & CPI_ARCHIVE_HAS_CKEY) { fprintf(res, "    <response type=\"ckey\" result=\"success\">%u</response>\n", p_rec->ckey); }
+
+    if(p_rec->flags & CPI_ARCHIVE_HAS_SERIAL)
+    {
+        fprintf(res, "    <response type=\"snum\" result=\"success\">");
+        archive_hex(res, p_rec->serial, sizeof(p_rec->serial), upper);
+        fprintf(res, "</response>\n");
+    }
+
+    fprintf(res, "    <response type=\"chal\" result=\"success\">\n      <enc_owner_key>");
+    archive_hex(res, p_rec->enc_ok, sizeof(p_rec->enc_ok), upper);
+    fprintf(res, "</enc_owner_key>\n      <rand_data>");
+    archive_hex(res, p_rec->rm, sizeof(p_rec->rm), upper);
+    fprintf(res, "</rand_data>\n      <vers>");
+    archive_hex(res, p_rec->vers, sizeof(p_rec->vers), upper);
+    fprintf(res, "</vers>\n      <signature>");
+    archive_hex(res, p_rec->sig, sizeof(p_rec->sig), upper);
+    fprintf(res, "</signature>\n    </response>\n  </response_list>\n</cpi>\n");
+
+    if( (fclose(req) != 0) | (fclose(res) != 0) ) { ret = VERIFY_E_READ; }
+
+    return ret;
+}
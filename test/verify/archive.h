@@ -0,0 +1,58 @@
+/*
+ * archive.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API maps archives of collected challenge-response pairs (see
+ * cp_archive.h for the image layout) into memory as they are, finds pairs in
+ * them, and converts pairs from and to the XML written by cpi.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "cp_archive.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*! open archive */
+typedef struct _archive
+{
+    uint8_t                      *image;        /*!< mapped image */
+    size_t                        size;         /*!< size of the mapping */
+    const cpi_archive_header_t   *header;
+    const cpi_archive_segment_t **segments;     /*!< every segment, in order */
+}
+archive;
+
+/*! check whether the file at path is an archive (returns 1 if it is) */
+int archive_probe(const char *path);
+
+/*! map an archive, checking its header and segments (returns VERIFY_ result) */
+int archive_open(archive *p_archive, const char *path);
+
+/*! unmap an archive */
+void archive_close(archive *p_archive);
+
+/*! number of records of an archive */
+uint32_t archive_count(const archive *p_archive);
+
+/*! value of a record in a column, where it lies in the image (returns 0 if there is no such record) */
+const void *archive_field(const archive *p_archive, uint32_t record, int column);
+
+/*! copy every field of a record (returns VERIFY_ result) */
+int archive_get(const archive *p_archive, uint32_t record, cpi_archive_record_t *p_rec);
+
+/*! find up to max records of a putative ID and key ID, in record order (returns the number found, which may exceed max) */
+int archive_find(const archive *p_archive, const uint8_t *pid, uint16_t key_id, uint32_t *records, int max);
+
+/*! fill a record from a query and the response cpi wrote for it, both null terminated (returns VERIFY_ result) */
+int archive_parse(cpi_archive_record_t *p_rec, const char *req, const char *res, long res_size);
+
+/*! write a record back out as the query and response XML it came from (returns VERIFY_ result) */
+int archive_export(const cpi_archive_record_t *p_rec, const char *req_path, const char *res_path);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * bench.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the big number benchmark of cpi-verify, which times
+ * the big number work of the engine on random keys: undoing the blinding of a
+ * signature, the public key operation (through rsa_me, and through a cached
+ * Montgomery context), and the CRT private key operation.
+ */
+
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tomcrypt.h>
+
+/*! key sizes to benchmark, in bits */
+static const int verify_bench_bits[] = { 1024, 2048 };
+
+/*! number of big numbers in an rsa_key */
+#define VERIFY_BENCH_PARTS      8
+
+/*! a key, as big endian numbers */
+typedef struct _verify_bench_key
+{
+    uint8_t       part[VERIFY_BENCH_PARTS][VERIFY_MONT_MAX_SIZE];
+    unsigned long part_len[VERIFY_BENCH_PARTS];
+}
+verify_bench_key;
+
+/*! utility function to find a big number of an rsa_key: e, d, N, p, q, qP, dP, dQ */
+static void **verify_bench_part(rsa_key *p_key, int index)
+{
+    void **parts[VERIFY_BENCH_PARTS] = { &p_key->e, &p_key->d, &p_key->N, &p_key->p, &p_key->q, &p_key->qP, &p_key->dP, &p_key->dQ };
+
+    return parts[index];
+}
+
+/*! utility function to read the monotonic clock, in seconds */
+static double verify_bench_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*! utility function to make a key, and write it out (returns VERIFY_ result) */
+static int verify_bench_make_key(int bits, verify_bench_key *p_bench_key)
+{
+    prng_state prng;
+
+    rsa_key key;
+
+    int wprng = find_prng("sprng"), v;
+
+    if( (wprng == -1) || (rsa_make_key(&prng, wprng, bits / 8, 65537, &key) != CRYPT_OK) ) { return VERIFY_E_MATH; }
+
+    for(v=0;v<VERIFY_BENCH_PARTS;v++)
+    {
+        void *part = *verify_bench_part(&key, v);
+
+        p_bench_key->part_len[v] = ltc_mp.unsigned_size(part);
+
+        if( (p_bench_key->part_len[v] > VERIFY_MONT_MAX_SIZE) || (ltc_mp.unsigned_write(part, p_bench_key->part[v]) != CRYPT_OK) ) { rsa_free(&key); return VERIFY_E_MATH; }
+    }
+
+    rsa_free(&key);
+
+    return VERIFY_OK;
+}
+
+/*! utility function to read a key (returns VERIFY_ result) */
+static int verify_bench_load_key(const verify_bench_key *p_bench_key, rsa_key *p_key)
+{
+    int v;
+
+    memset(p_key, 0, sizeof(rsa_key));
+
+    p_key->type = PK_PRIVATE;
+
+    if(ltc_init_multi(&p_key->e, &p_key->d, &p_key->N, &p_key->p, &p_key->q, &p_key->qP, &p_key->dP, &p_key->dQ, NULL) != CRYPT_OK) { return VERIFY_E_MATH; }
+
+    for(v=0;v<VERIFY_BENCH_PARTS;v++)
+    {
+        if(ltc_mp.unsigned_read(*verify_bench_part(p_key, v), (unsigned char*)p_bench_key->part[v], p_bench_key->part_len[v]) != CRYPT_OK) { rsa_free(p_key); return VERIFY_E_MATH; }
+    }
+
+    return VERIFY_OK;
+}
+
+/*! utility function to time every operation on one key, and report (returns VERIFY_ result) */
+static int verify_bench_key_ops(const verify_bench_key *p_bench_key, int bits, int count)
+{
+    verify_context ctx;
+
+    const verify_mont *p_mont = 0;
+
+    rsa_key key;
+
+    /*! message and signature, less than the modulus; blinding value */
+    uint8_t msg[VERIFY_MONT_MAX_SIZE], sig[VERIFY_MONT_MAX_SIZE], out[VERIFY_MONT_MAX_SIZE], check[VERIFY_MONT_MAX_SIZE];
+
+    void *rm = 0, *rm_inv = 0, *val = 0, *tmp = 0;
+
+    double beg = 0, unblind = 0, public_rsa_me = 0, public_cached = 0, private_crt = 0;
+
+    int size = bits / 8, ret = VERIFY_OK, v;
+
+    if(verify_bench_load_key(p_bench_key, &key) != VERIFY_OK) { return VERIFY_E_MATH; }
+
+    if(ltc_init_multi(&rm, &rm_inv, &val, &tmp, NULL) != CRYPT_OK) { rsa_free(&key); return VERIFY_E_MATH; }
+
+    verify_init_context(&ctx);
+
+    if( (rng_get_bytes(msg, size, NULL) != (unsigned long)size) || (rng_get_bytes(sig, size, NULL) != (unsigned long)size) ||
+        (rng_get_bytes(out, CPI_RESULT1_RAND_SIZE, NULL) != CPI_RESULT1_RAND_SIZE) ) { ret = VERIFY_E_MATH; goto cleanup; }
+
+    msg[0] = sig[0] = 0;
+    out[0] |= 1;
+
+    if( (ltc_mp.unsigned_read(rm, out, CPI_RESULT1_RAND_SIZE) != CRYPT_OK) || (ltc_mp.unsigned_read(val, sig, size) != CRYPT_OK) ) { ret = VERIFY_E_MATH; goto cleanup; }
+
+    /*! unblind: invert rm, and multiply the signature by the inverse */
+    beg = verify_bench_now();
+
+    for(v=0;(v<count) && (ret == VERIFY_OK);v++)
+    {
+        if( (ltc_mp.invmod(rm, key.N, rm_inv) != CRYPT_OK) || (ltc_mp.mulmod(val, rm_inv, key.N, tmp) != CRYPT_OK) ) { ret = VERIFY_E_BLIND; }
+    }
+
+    unblind = verify_bench_now() - beg;
+
+    /*! public key operation, through rsa_me */
+    beg = verify_bench_now();
+
+    for(v=0;(v<count) && (ret == VERIFY_OK);v++)
+    {
+        unsigned long len = sizeof(check);
+
+        if(ltc_mp.rsa_me(msg, size, check, &len, PK_PUBLIC, &key) != CRYPT_OK) { ret = VERIFY_E_MATH; }
+    }
+
+    public_rsa_me = verify_bench_now() - beg;
+
+    /*! public key operation, with the Montgomery context of the key set up once, as the engine does */
+    p_mont = verify_get_mont(&ctx, p_bench_key->part[2], size);
+
+    if( (ret == VERIFY_OK) && (p_mont == 0) ) { ret = VERIFY_E_MATH; }
+
+    beg = verify_bench_now();
+
+    for(v=0;(v<count) && (ret == VERIFY_OK);v++)
+    {
+        if(verify_mont_exptmod(p_mont, msg, p_bench_key->part[0], p_bench_key->part_len[0], out) != CRYPT_OK) { ret = VERIFY_E_MATH; }
+    }
+
+    public_cached = verify_bench_now() - beg;
+
+    /*! both public key operations must agree */
+    if( (ret == VERIFY_OK) && (memcmp(out, check, size) != 0) ) { ret = VERIFY_E_MATH; }
+
+    /*! CRT private key operation, through rsa_me */
+    beg = verify_bench_now();
+
+    for(v=0;(v<count) && (ret == VERIFY_OK);v++)
+    {
+        unsigned long len = sizeof(out);
+
+        if(ltc_mp.rsa_me(msg, size, out, &len, PK_PRIVATE, &key) != CRYPT_OK) { ret = VERIFY_E_MATH; }
+    }
+
+    private_crt = verify_bench_now() - beg;
+
+    if(ret == VERIFY_OK)
+    {
+        fprintf(stderr, "Benchmark : %d bits, unblind %.1f us, public %.1f us (rsa_me) %.1f us (cached context), private %.1f us (CRT)\n", bits,
+            unblind * 1e6 / count, public_rsa_me * 1e6 / count, public_cached * 1e6 / count, private_crt * 1e6 / count);
+    }
+    else
+    {
+        fprintf(stderr, "Error: %d bits: %s\n", bits, VERIFY_RESULT_LOOKUP[ret]);
+    }
+
+cleanup:
+
+    verify_free_context(&ctx);
+
+    ltc_deinit_multi(rm, rm_inv, val, tmp, NULL);
+
+    rsa_free(&key);
+
+    return ret;
+}
+
+int verify_bench_math(int count)
+{
+    int ret = VERIFY_OK, bits;
+
+    if(register_prng(&sprng_desc) == -1) { fprintf(stderr, "Error: register_prng failed!\n"); return VERIFY_E_MATH; }
+
+    for(bits=0;bits<(int)(sizeof(verify_bench_bits)/sizeof(verify_bench_bits[0]));bits++)
+    {
+        verify_bench_key bench_key;
+
+        if(verify_bench_make_key(verify_bench_bits[bits], &bench_key) != VERIFY_OK)
+        {
+            fprintf(stderr, "Error: could not make a %d bit key\n", verify_bench_bits[bits]);
+            return VERIFY_E_MATH;
+        }
+
+        if(verify_bench_key_ops(&bench_key, verify_bench_bits[bits], count) != VERIFY_OK) { ret = VERIFY_E_MATH; }
+    }
+
+    return ret;
+}
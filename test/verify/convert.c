@@ -0,0 +1,134 @@
+/*
+ * convert.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module defines the entry point for cpi-keystore, which converts the
+ * key files of a lot (text key files, key_entry files, or other keystores)
+ * into one keystore image for cpi-verify.
+ */
+
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*! utility function to display usage */
+static void convert_usage(void)
+{
+    fprintf(stderr, "Usage: cpi-keystore -o <keystore> <key file | directory | keystore> ...\n");
+    fprintf(stderr, "       cpi-keystore -l <keystore>\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -o <path>   write the keys of every input to one keystore\n");
+    fprintf(stderr, "  -l <path>   list the CPs of a keystore\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "If several keys have the same PIDx, the first one given wins.\n");
+
+    return;
+}
+
+/*! utility function to list the CPs of a keystore */
+static int convert_list(const char *path)
+{
+    keystore store;
+
+    uint32_t unit, v;
+
+    int ret = keystore_open(&store, path);
+
+    if(ret != VERIFY_OK) { fprintf(stderr, "Error: keystore \"%s\": %s\n", path, VERIFY_RESULT_LOOKUP[ret]); return 1; }
+
+    for(unit=0;unit<store.header->unit_count;unit++)
+    {
+        int present = 0, private = 0;
+
+        for(v=0;v<store.units[unit].count;v++)
+        {
+            const keystore_key *p_key = keystore_find_id(&store, unit, (uint16_t)v);
+
+            if(p_key == 0) { continue; }
+
+            present++;
+
+            if(p_key->flags & KEYSTORE_KEY_PRIVATE) { private++; }
+        }
+
+        printf("%s %d keys%s\n", keystore_unit_name(&store, unit), present, (private == present) ? " (private)" : "");
+    }
+
+    fprintf(stderr, "%u CPs, %u key records, %u index slots, %u bytes\n", store.header->unit_count, store.header->key_count, store.header->index_size, store.header->file_size);
+
+    keystore_close(&store);
+
+    return 0;
+}
+
+/*! cpi-keystore entry point */
+int main(int argc, char **argv)
+{
+    keystore_builder builder;
+    keystore store;
+
+    const char *out_path = 0;
+
+    int cur_arg = 0, inputs = 0, ret = VERIFY_OK;
+
+    memset(&builder, 0, sizeof(builder));
+
+    if(verify_init() != VERIFY_OK) { fprintf(stderr, "Error: could not register SHA-1\n"); return 2; }
+
+    /*! parse command line */
+    for(cur_arg = 1; cur_arg < argc; cur_arg++)
+    {
+        if(argv[cur_arg][0] != '-')
+        {
+            ret = keystore_add_path(&builder, argv[cur_arg]);
+
+            if(ret != VERIFY_OK) { fprintf(stderr, "Error: keys \"%s\": %s\n", argv[cur_arg], VERIFY_RESULT_LOOKUP[ret]); keystore_free_builder(&builder); return 1; }
+
+            inputs++;
+            continue;
+        }
+
+        switch(argv[cur_arg][1])
+        {
+            case 'o':
+                if(++cur_arg < argc) { out_path = argv[cur_arg]; }
+                break;
+
+            case 'l':
+                if(++cur_arg < argc) { keystore_free_builder(&builder); return convert_list(argv[cur_arg]); }
+                break;
+
+            case '-':
+            case 'h':
+                convert_usage();
+                keystore_free_builder(&builder);
+                return 0;
+
+            default:
+                fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+                break;
+        }
+    }
+
+    if( (out_path == 0) || (inputs == 0) ) { convert_usage(); keystore_free_builder(&builder); return 2; }
+
+    ret = keystore_build(&builder, &store);
+
+    if(ret == VERIFY_OK)
+    {
+        ret = keystore_save(&store, out_path);
+
+        if(ret == VERIFY_OK) { fprintf(stderr, "%u CPs, %u key records, %u bytes written to %s\n", store.header->unit_count, store.header->key_count, store.header->file_size, out_path); }
+
+        keystore_close(&store);
+    }
+
+    if(ret != VERIFY_OK) { fprintf(stderr, "Error: keystore \"%s\": %s\n", out_path, VERIFY_RESULT_LOOKUP[ret]); return 1; }
+
+    return 0;
+}
@@ -0,0 +1,440 @@
+/*
+ * decrypt.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module defines the entry point for cpi-decrypt-ok, which decrypts the
+ * encrypted owner keys written by test/production_test/extract_ok.pl (one
+ * responseN.xml.ok file per CP) on every available core, in place of
+ * decrypt_test.pl. Response documents are also taken as they are, mapped and
+ * scanned with respscan, and their hex is decoded by the workers. Archives
+ * (see archive.h) are mapped, and their keys decrypted where they lie.
+ *
+ * The owner private key is loaded and checked once, its CRT parameters are
+ * computed once, and each worker thread sets up the Montgomery contexts of p
+ * and q on its first blob. Every decrypted block must hold PKCS#1 v1.5 type 2
+ * padding around the 16 byte owner key.
+ */
+
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*! maximum number of worker threads */
+#define VERIFY_MAX_THREADS  0x40
+
+/*! a file named on the command line, or found in a directory */
+typedef struct _verify_source
+{
+    char          *path;
+    respscan_file  file;            /*!< response documents, mapped; data is 0 for .ok files */
+    archive       *p_archive;       /*!< archive, mapped; 0 for other files */
+}
+verify_source;
+
+/*! one encrypted owner key */
+typedef struct _verify_blob
+{
+    int           source;           /*!< file holding the blob, index into the sources */
+    int           doc;              /*!< document within a corpus of responses, record within an archive, or -1 */
+    respscan_view enc;              /*!< hex encrypted owner key of a response, decoded by the worker; ptr is 0 for .ok files */
+    const uint8_t *raw;             /*!< encrypted owner key within an archive, or 0 */
+    uint8_t       owner_key[0x10];
+    int           result;
+}
+verify_blob;
+
+/*! blobs to decrypt, and the next one to claim */
+typedef struct _verify_blobs
+{
+    const verify_crt_key *p_key;
+    verify_source        *sources;
+    int                   source_count;
+    int                   source_size;
+    verify_blob          *blobs;
+    int                   count;
+    int                   size;
+    int                   next;
+}
+verify_blobs;
+
+/*! utility function to display usage */
+static void verify_usage(void)
+{
+    fprintf(stderr, "Usage: cpi-decrypt-ok -K <n:e:d:p:q> [options] <responseN.xml.ok | response XML | archive | directory> ...\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -K <n:e:d:p:q> owner private key, one file per part, as decrypt_test.pl --keys\n");
+    fprintf(stderr, "  -j <count>     worker threads (default: one per online CPU)\n");
+    fprintf(stderr, "  -q             only report failed blobs\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Files ending in .xml are scanned for the challenge response of every document\n");
+    fprintf(stderr, "they hold, so a corpus of responses concatenated into one file is read in one pass.\n");
+    fprintf(stderr, "Directories supply their .ok files. Exits with 0 only if every blob decrypts to\n");
+    fprintf(stderr, "a well padded owner key.\n");
+
+    return;
+}
+
+/*! utility function to add a source, taking ownership of path (aborts on allocation failure, like the rest of this tool's setup) */
+static int verify_add_source(verify_blobs *p_blobs, char *path)
+{
+    if(path == 0) { fprintf(stderr, "Error: out of memory\n"); exit(2); }
+
+    if(p_blobs->source_count == p_blobs->source_size)
+    {
+        int size = (p_blobs->source_size == 0) ? 0x100 : p_blobs->source_size * 2;
+
+        verify_source *sources = (verify_source*)realloc(p_blobs->sources, size * sizeof(verify_source));
+
+        if(sources == 0) { fprintf(stderr, "Error: out of memory\n"); exit(2); }
+
+        p_blobs->sources = sources;
+        p_blobs->source_size = size;
+    }
+
+    memset(&p_blobs->sources[p_blobs->source_count], 0, sizeof(verify_source));
+
+    p_blobs->sources[p_blobs->source_count].path = path;
+
+    return p_blobs->source_count++;
+}
+
+/*! utility function to add a blob of a source (aborts on allocation failure) */
+static verify_blob *verify_add_blob(verify_blobs *p_blobs, int source)
+{
+    if(p_blobs->count == p_blobs->size)
+    {
+        int size = (p_blobs->size == 0) ? 0x100 : p_blobs->size * 2;
+
+        verify_blob *blobs = (verify_blob*)realloc(p_blobs->blobs, size * sizeof(verify_blob));
+
+        if(blobs == 0) { fprintf(stderr, "Error: out of memory\n"); exit(2); }
+
+        p_blobs->blobs = blobs;
+        p_blobs->size = size;
+    }
+
+    memset(&p_blobs->blobs[p_blobs->count], 0, sizeof(verify_blob));
+
+    p_blobs->blobs[p_blobs->count].source = source;
+    p_blobs->blobs[p_blobs->count].doc = -1;
+
+    return &p_blobs->blobs[p_blobs->count++];
+}
+
+/*! utility function to add the encrypted owner key of every challenge response in a file of response documents (returns 0 on failure) */
+static int verify_add_responses(verify_blobs *p_blobs, const char *path)
+{
+    int source = verify_add_source(p_blobs, strdup(path)), first = p_blobs->count, ret = RESPSCAN_OK, v;
+
+    respscan_file *p_file = &p_blobs->sources[source].file;
+
+    respscan scan;
+
+    respscan_record rec;
+
+    if(!respscan_map(p_file, path)) { fprintf(stderr, "Error: cannot read \"%s\"\n", path); return 0; }
+
+    respscan_init(&scan, p_file->data, p_file->size);
+
+    while( (ret = respscan_next(&scan, &rec)) != RESPSCAN_END )
+    {
+        if(ret == RESPSCAN_MORE) { fprintf(stderr, "Warning: \"%s\" ends within a response\n", path); break; }
+
+        if( (ret == RESPSCAN_OK) && rec.success && (rec.cmd == CPI_CMD_CHAL) )
+        {
+            verify_blob *p_blob = verify_add_blob(p_blobs, source);
+
+            p_blob->enc = rec.chal[RESPSCAN_CHAL_ENC_OK];
+            p_blob->doc = (int)rec.doc;
+        }
+    }
+
+    /*! documents are only numbered within a corpus */
+    if(scan.doc_count < 2) { for(v=first;v<p_blobs->count;v++) { p_blobs->blobs[v].doc = -1; } }
+
+    return 1;
+}
+
+/*! utility function to add the encrypted owner key of every record of an archive (returns 0 on failure) */
+static int verify_add_archive(verify_blobs *p_blobs, const char *path)
+{
+    int source = verify_add_source(p_blobs, strdup(path)), ret = VERIFY_OK;
+
+    archive *p_archive = (archive*)malloc(sizeof(archive));
+
+    uint32_t v;
+
+    if(p_archive == 0) { fprintf(stderr, "Error: out of memory\n"); exit(2); }
+
+    ret = archive_open(p_archive, path);
+
+    if(ret != VERIFY_OK) { fprintf(stderr, "Error: archive \"%s\": %s\n", path, VERIFY_RESULT_LOOKUP[ret]); free(p_archive); return 0; }
+
+    p_blobs->sources[source].p_archive = p_archive;
+
+    for(v=0;v<archive_count(p_archive);v++)
+    {
+        verify_blob *p_blob = verify_add_blob(p_blobs, source);
+
+        p_blob->raw = (const uint8_t*)archive_field(p_archive, v, CPI_ARCHIVE_COL_ENC_OK);
+        p_blob->doc = (int)v;
+    }
+
+    return 1;
+}
+
+/*! utility function to add a blob, a file of responses, an archive, or every .ok file in a directory (returns 0 on failure) */
+static int verify_add_path(verify_blobs *p_blobs, const char *path)
+{
+    struct stat st;
+
+    size_t len = strlen(path);
+
+    if(stat(path, &st) != 0) { fprintf(stderr, "Error: cannot read \"%s\"\n", path); return 0; }
+
+    if(S_ISDIR(st.st_mode))
+    {
+        char **paths = 0;
+
+        int count = verify_list_dir(path, "", ".ok", &paths), v;
+
+        if(count < 0) { fprintf(stderr, "Error: cannot read \"%s\"\n", path); return 0; }
+
+        for(v=0;v<count;v++) { verify_add_blob(p_blobs, verify_add_source(p_blobs, paths[v])); }
+
+        free(paths);
+
+        return 1;
+    }
+
+    if( (len > 4) && (strcmp(&path[len - 4], ".xml") == 0) ) { return verify_add_responses(p_blobs, path); }
+
+    if(S_ISREG(st.st_mode) && archive_probe(path)) { return verify_add_archive(p_blobs, path); }
+
+    verify_add_blob(p_blobs, verify_add_source(p_blobs, strdup(path)));
+
+    return 1;
+}
+
+/*! utility function to decode or read, then decrypt one blob (returns VERIFY_ result) */
+static int verify_decrypt_blob(verify_context *p_ctx, const verify_blobs *p_blobs, verify_blob *p_blob)
+{
+    uint8_t enc[CPI_RESULT1_ENC_OK_SIZE];
+
+    long size = 0;
+
+    char *data = 0;
+
+    /*! from an archive, raw */
+    if(p_blob->raw != 0) { return verify_decrypt_owner(p_ctx, p_blobs->p_key, p_blob->raw, p_blob->owner_key); }
+
+    /*! from a response document */
+    if(p_blobs->sources[p_blob->source].file.data != 0)
+    {
+        if(!respscan_hex(&p_blob->enc, enc, sizeof(enc))) { return VERIFY_E_PARSE; }
+
+        return verify_decrypt_owner(p_ctx, p_blobs->p_key, enc, p_blob->owner_key);
+    }
+
+    /*! from a .ok file, which holds the raw encrypted owner key */
+    data = verify_read_file(p_blobs->sources[p_blob->source].path, &size);
+
+    if(data == 0) { return VERIFY_E_READ; }
+
+    if(size == CPI_RESULT1_ENC_OK_SIZE) { memcpy(enc, data, sizeof(enc)); }
+
+    free(data);
+
+    if(size != CPI_RESULT1_ENC_OK_SIZE) { return VERIFY_E_PARSE; }
+
+    return verify_decrypt_owner(p_ctx, p_blobs->p_key, enc, p_blob->owner_key);
+}
+
+/*! worker thread, decrypts blobs until none are left */
+static void *verify_decrypt_worker(void *arg)
+{
+    verify_blobs *p_blobs = (verify_blobs*)arg;
+
+    /*! Montgomery contexts of p and q, set up once for every blob this thread decrypts */
+    verify_context ctx;
+
+    verify_init_context(&ctx);
+
+    for(;;)
+    {
+        int cur = __atomic_fetch_add(&p_blobs->next, 1, __ATOMIC_RELAXED);
+
+        if(cur >= p_blobs->count) { break; }
+
+        p_blobs->blobs[cur].result = verify_decrypt_blob(&ctx, p_blobs, &p_blobs->blobs[cur]);
+    }
+
+    verify_free_context(&ctx);
+
+    return 0;
+}
+
+/*! utility function to run the worker on thread_count threads, the calling thread included */
+static void verify_run(verify_blobs *p_blobs, int thread_count)
+{
+    pthread_t threads[VERIFY_MAX_THREADS];
+
+    int v;
+
+    for(v=1;v<thread_count;v++)
+    {
+        if(pthread_create(&threads[v], 0, verify_decrypt_worker, p_blobs) != 0) { thread_count = v; break; }
+    }
+
+    verify_decrypt_worker(p_blobs);
+
+    for(v=1;v<thread_count;v++) { pthread_join(threads[v], 0); }
+
+    return;
+}
+
+/*! cpi-decrypt-ok entry point */
+int main(int argc, char **argv)
+{
+    verify_crt_key key;
+    verify_blobs blobs;
+
+    int thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN), have_key = 0, quiet = 0, failed = 0, v;
+
+    struct timespec beg, end;
+
+    double elapsed = 0;
+
+    int cur_arg = 0;
+
+    memset(&blobs, 0, sizeof(blobs));
+
+    if(verify_init() != VERIFY_OK) { fprintf(stderr, "Error: could not register SHA-1\n"); return 2; }
+
+    /*! parse command line */
+    for(cur_arg = 1; cur_arg < argc; cur_arg++)
+    {
+        if(argv[cur_arg][0] != '-')
+        {
+            if(!verify_add_path(&blobs, argv[cur_arg])) { return 2; }
+            continue;
+        }
+
+        switch(argv[cur_arg][1])
+        {
+            case 'K':
+                if(++cur_arg < argc)
+                {
+                    char *parts[5], *save = 0, *spec = strdup(argv[cur_arg]);
+
+                    int count = 0, ret = VERIFY_E_PARSE;
+
+                    if(spec == 0) { fprintf(stderr, "Error: out of memory\n"); return 2; }
+
+                    while( (count < 5) && ((parts[count] = strtok_r((count == 0) ? spec : 0, ":", &save)) != 0) ) { count++; }
+
+                    if( (count == 5) && (strtok_r(0, ":", &save) == 0) ) { ret = verify_load_crt_key(&key, parts[0], parts[1], parts[2], parts[3], parts[4]); }
+
+                    free(spec);
+
+                    if(ret != VERIFY_OK) { fprintf(stderr, "Error: owner key \"%s\": %s\n", argv[cur_arg], VERIFY_RESULT_LOOKUP[ret]); return 2; }
+
+                    have_key = 1;
+                }
+                break;
+
+            case 'j':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &thread_count); }
+                break;
+
+            case 'q':
+                quiet = 1;
+                break;
+
+            case '-':
+            case 'h':
+                verify_usage();
+                return 0;
+
+            default:
+                fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+                break;
+        }
+    }
+
+    if( !have_key || (blobs.count == 0) ) { verify_usage(); return 2; }
+
+    if(thread_count < 1) { thread_count = 1; }
+    if(thread_count > VERIFY_MAX_THREADS) { thread_count = VERIFY_MAX_THREADS; }
+    if(thread_count > blobs.count) { thread_count = blobs.count; }
+
+    blobs.p_key = &key;
+
+    /*! decrypt every blob */
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+
+    verify_run(&blobs, thread_count);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - beg.tv_sec) + (end.tv_nsec - beg.tv_nsec) / 1e9;
+
+    /*! report, in input order */
+    for(v=0;v<blobs.count;v++)
+    {
+        verify_blob *p_blob = &blobs.blobs[v];
+
+        int i;
+
+        if(p_blob->result != VERIFY_OK)
+        {
+            failed++;
+
+            printf("FAIL %s", blobs.sources[p_blob->source].path);
+
+            if(p_blob->doc >= 0) { printf("#%d", p_blob->doc); }
+
+            printf(" (%s)\n", VERIFY_RESULT_LOOKUP[p_blob->result]);
+
+            continue;
+        }
+
+        if(quiet) { continue; }
+
+        printf("PASS ");
+
+        for(i=0;i<0x10;i++) { printf("%.02X", p_blob->owner_key[i]); }
+
+        printf(" %s", blobs.sources[p_blob->source].path);
+
+        if(p_blob->doc >= 0) { printf("#%d", p_blob->doc); }
+
+        printf("\n");
+    }
+
+    fprintf(stderr, "%d blobs, %d passed, %d failed, %.3f s (%.0f decryptions/s, %d threads)\n",
+        blobs.count, blobs.count - failed, failed, elapsed, (elapsed > 0) ? blobs.count / elapsed : 0.0, thread_count);
+
+    for(v=0;v<blobs.source_count;v++)
+    {
+        if(blobs.sources[v].file.data != 0) { respscan_unmap(&blobs.sources[v].file); }
+
+        if(blobs.sources[v].p_archive != 0) { archive_close(blobs.sources[v].p_archive); free(blobs.sources[v].p_archive); }
+
+        free(blobs.sources[v].path);
+    }
+
+    free(blobs.sources);
+    free(blobs.blobs);
+
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,608 @@
+/*
+ * keystore.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements keystore images: mapping and searching them, and
+ * building them from key files.
+ */
+
+#include "keystore.h"
+#include "verify.h"
+#include "../src/main.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tomcrypt.h>
+
+/*! highest key ID accepted in text key files */
+#define KEYSTORE_MAX_KEY_ID     0xFF
+
+/*! smallest number of index slots */
+#define KEYSTORE_MIN_INDEX      0x40
+
+/*! utility function to hash a putative ID into the index */
+static uint32_t keystore_pid_hash(const uint8_t *pid)
+{
+    /*! putative IDs are random, so any four bytes will do */
+    return ((uint32_t)pid[0] << 24) | ((uint32_t)pid[1] << 16) | ((uint32_t)pid[2] << 8) | (uint32_t)pid[3];
+}
+
+/*! utility function to check that a region lies within the image */
+static int keystore_in_image(const keystore_header *p_header, uint32_t offset, uint32_t count, uint32_t size)
+{
+    return (uint64_t)offset + (uint64_t)count * size <= p_header->file_size;
+}
+
+int keystore_probe(const char *path)
+{
+    uint32_t magic = 0;
+
+    int fd = open(path, O_RDONLY), is_keystore = 0;
+
+    if(fd < 0) { return 0; }
+
+    is_keystore = (read(fd, &magic, sizeof(magic)) == sizeof(magic)) && (magic == KEYSTORE_MAGIC);
+
+    close(fd);
+
+    return is_keystore;
+}
+
+/*! utility function to point a keystore at the sections of its image (returns VERIFY_ result) */
+static int keystore_attach(keystore *p_store)
+{
+    const keystore_header *p_header = (const keystore_header*)p_store->image;
+
+    if(p_store->size < sizeof(keystore_header)) { return VERIFY_E_PARSE; }
+
+    /*! the whole image is checked up front, key records are only checked as they are found */
+    if( (p_header->magic != KEYSTORE_MAGIC) || (p_header->version != KEYSTORE_VERSION) || (p_header->file_size != p_store->size) ) { return VERIFY_E_PARSE; }
+
+    if( !keystore_in_image(p_header, p_header->unit_offset, p_header->unit_count, sizeof(keystore_unit)) ||
+        !keystore_in_image(p_header, p_header->key_offset, p_header->key_count, sizeof(keystore_key)) ||
+        !keystore_in_image(p_header, p_header->index_offset, p_header->index_size, sizeof(uint32_t)) ) { return VERIFY_E_PARSE; }
+
+    if( ((p_header->unit_offset | p_header->key_offset | p_header->index_offset) & 3) != 0 ) { return VERIFY_E_PARSE; }
+
+    if( (p_header->index_size == 0) || ((p_header->index_size & (p_header->index_size - 1)) != 0) ) { return VERIFY_E_PARSE; }
+
+    p_store->header = p_header;
+    p_store->units = (const keystore_unit*)&p_store->image[p_header->unit_offset];
+    p_store->keys = (const keystore_key*)&p_store->image[p_header->key_offset];
+    p_store->index = (const uint32_t*)&p_store->image[p_header->index_offset];
+
+    return VERIFY_OK;
+}
+
+int keystore_open(keystore *p_store, const char *path)
+{
+    struct stat st;
+
+    int fd = open(path, O_RDONLY), ret = VERIFY_OK;
+
+    memset(p_store, 0, sizeof(keystore));
+
+    if(fd < 0) { return VERIFY_E_READ; }
+
+    if( (fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(keystore_header)) || (st.st_size > (off_t)UINT32_MAX) ) { close(fd); return VERIFY_E_PARSE; }
+
+    p_store->image = (uint8_t*)mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if(p_store->image == MAP_FAILED) { p_store->image = 0; return VERIFY_E_READ; }
+
+    p_store->size = st.st_size;
+    p_store->mapped = 1;
+
+    ret = keystore_attach(p_store);
+
+    if(ret != VERIFY_OK) { keystore_close(p_store); }
+
+    return ret;
+}
+
+void keystore_close(keystore *p_store)
+{
+    if(p_store->image != 0)
+    {
+        if(p_store->mapped) { munmap(p_store->image, p_store->size); } else { free(p_store->image); }
+    }
+
+    memset(p_store, 0, sizeof(keystore));
+
+    return;
+}
+
+const keystore_key *keystore_find_pid(const keystore *p_store, const uint8_t *pid)
+{
+    uint32_t mask = 0, slot = 0, v;
+
+    if(p_store->header == 0) { return 0; }
+
+    mask = p_store->header->index_size - 1;
+
+    slot = keystore_pid_hash(pid) & mask;
+
+    for(v=0;v<=mask;v++)
+    {
+        uint32_t cur = p_store->index[slot];
+
+        if( (cur == KEYSTORE_INDEX_EMPTY) || (cur >= p_store->header->key_count) ) { return 0; }
+
+        if(memcmp(p_store->keys[cur].pid, pid, 0x10) == 0) { return &p_store->keys[cur]; }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return 0;
+}
+
+const keystore_key *keystore_find_id(const keystore *p_store, uint32_t unit, uint16_t key_id)
+{
+    const keystore_unit *p_unit = 0;
+
+    const keystore_key *p_key = 0;
+
+    if( (p_store->header == 0) || (unit >= p_store->header->unit_count) ) { return 0; }
+
+    p_unit = &p_store->units[unit];
+
+    if( (key_id >= p_unit->count) || ((uint64_t)p_unit->first + key_id >= p_store->header->key_count) ) { return 0; }
+
+    p_key = &p_store->keys[p_unit->first + key_id];
+
+    return (p_key->flags & KEYSTORE_KEY_PRESENT) ? p_key : 0;
+}
+
+const char *keystore_unit_name(const keystore *p_store, uint32_t unit)
+{
+    if( (p_store->header == 0) || (unit >= p_store->header->unit_count) ) { return "-"; }
+
+    if(memchr(p_store->units[unit].name, '\0', KEYSTORE_NAME_SIZE) == 0) { return "-"; }
+
+    return p_store->units[unit].name;
+}
+
+/*! utility function to start a CP with count key IDs, all unused (returns 0 on allocation failure) */
+static keystore_key *keystore_add_unit(keystore_builder *p_builder, const char *name, int name_len, uint32_t count)
+{
+    keystore_unit *units = (keystore_unit*)realloc(p_builder->units, (p_builder->unit_count + 1) * sizeof(keystore_unit));
+
+    keystore_key *keys = 0;
+
+    uint32_t v;
+
+    if(units == 0) { return 0; }
+
+    p_builder->units = units;
+
+    if(p_builder->key_count + count > p_builder->key_size)
+    {
+        uint32_t size = (p_builder->key_size == 0) ? 0x40 : p_builder->key_size;
+
+        while(size < p_builder->key_count + count) { size *= 2; }
+
+        keys = (keystore_key*)realloc(p_builder->keys, size * sizeof(keystore_key));
+
+        if(keys == 0) { return 0; }
+
+        p_builder->keys = keys;
+        p_builder->key_size = size;
+    }
+
+    if(name_len >= KEYSTORE_NAME_SIZE) { name_len = KEYSTORE_NAME_SIZE - 1; }
+
+    memset(&units[p_builder->unit_count], 0, sizeof(keystore_unit));
+    memcpy(units[p_builder->unit_count].name, name, name_len);
+
+    units[p_builder->unit_count].first = p_builder->key_count;
+    units[p_builder->unit_count].count = count;
+
+    keys = &p_builder->keys[p_builder->key_count];
+
+    memset(keys, 0, count * sizeof(keystore_key));
+
+    for(v=0;v<count;v++)
+    {
+        keys[v].key_id = (uint16_t)v;
+        keys[v].unit = p_builder->unit_count;
+    }
+
+    p_builder->unit_count++;
+    p_builder->key_count += count;
+
+    return keys;
+}
+
+/*! utility function to mark a key as used, once its putative ID is known */
+static void keystore_set_present(keystore_key *p_key)
+{
+    hash_state cur_hash_state;
+
+    sha1_desc.init(&cur_hash_state);
+    sha1_desc.process(&cur_hash_state, p_key->pid, 0x10);
+    sha1_desc.done(&cur_hash_state, p_key->pid_hash);
+
+    p_key->flags |= KEYSTORE_KEY_PRESENT;
+
+    return;
+}
+
+/*! utility function to get the file name of a path */
+static const char *keystore_base_name(const char *path)
+{
+    const char *base = strrchr(path, '/');
+
+    return (base == 0) ? path : base + 1;
+}
+
+/*! utility function to add a text key file (NAME:KEYID:HEX lines, see CPParse.pm) */
+static int keystore_add_text(keystore_builder *p_builder, const char *path, char *data)
+{
+    /*! keys of this file, by key ID, and the fields found for each */
+    keystore_key *keys = (keystore_key*)calloc(KEYSTORE_MAX_KEY_ID + 1, sizeof(keystore_key));
+    uint8_t *found = (uint8_t*)calloc(KEYSTORE_MAX_KEY_ID + 1, 1);
+
+    keystore_key *unit_keys = 0;
+
+    const char *name = keystore_base_name(path);
+
+    int name_len = (int)strlen(name), count = 0, ret = VERIFY_OK, v;
+
+    char *line = data, *next = 0;
+
+    if( (keys == 0) || (found == 0) ) { ret = VERIFY_E_READ; goto cleanup; }
+
+    for(line = data; line != 0; line = next)
+    {
+        char *sep1 = 0, *sep2 = 0, *end = 0;
+
+        unsigned key_id = 0;
+
+        next = strchr(line, '\n');
+
+        if(next != 0) { *next++ = '\0'; }
+
+        sep1 = strchr(line, ':');
+        sep2 = (sep1 != 0) ? strchr(sep1 + 1, ':') : 0;
+
+        /*! blank lines */
+        if(sep2 == 0) { continue; }
+
+        key_id = (unsigned)strtoul(sep1 + 1, &end, 10);
+
+        if( (end != sep2) || (key_id > KEYSTORE_MAX_KEY_ID) ) { ret = VERIFY_E_PARSE; goto cleanup; }
+
+        /*! trailing comments */
+        end = strchr(sep2 + 1, '#');
+
+        if(end == 0) { end = sep2 + 1 + strlen(sep2 + 1); }
+
+        *sep1 = '\0';
+
+        /*! CPs are named by GUID, or else by key file */
+        if(strcmp(line, "GUID") == 0)
+        {
+            name = sep2 + 1;
+
+            while(isspace((unsigned char)*name)) { name++; }
+
+            name_len = 0;
+
+            while( (&name[name_len] < end) && isxdigit((unsigned char)name[name_len]) ) { name_len++; }
+
+            if(name_len == 0) { name = keystore_base_name(path); name_len = (int)strlen(name); }
+        }
+        else if(strcmp(line, "PKEY_ID") == 0)
+        {
+            if(!verify_hex(sep2 + 1, (int)(end - sep2 - 1), keys[key_id].pid, 0x10)) { ret = VERIFY_E_PARSE; goto cleanup; }
+
+            found[key_id] |= 0x01;
+        }
+        else if(strcmp(line, "PKEY_N") == 0)
+        {
+            if(!verify_hex(sep2 + 1, (int)(end - sep2 - 1), keys[key_id].n, sizeof(keys[key_id].n))) { ret = VERIFY_E_PARSE; goto cleanup; }
+
+            found[key_id] |= 0x02;
+        }
+        else if(strcmp(line, "PKEY_E") == 0)
+        {
+            if(!verify_hex(sep2 + 1, (int)(end - sep2 - 1), keys[key_id].e, sizeof(keys[key_id].e))) { ret = VERIFY_E_PARSE; goto cleanup; }
+
+            found[key_id] |= 0x04;
+        }
+    }
+
+    for(v=0;v<=KEYSTORE_MAX_KEY_ID;v++) { if(found[v] == 0x07) { count = v + 1; } }
+
+    unit_keys = keystore_add_unit(p_builder, name, name_len, count);
+
+    if(unit_keys == 0) { ret = VERIFY_E_READ; goto cleanup; }
+
+    for(v=0;v<count;v++)
+    {
+        if(found[v] != 0x07) { continue; }
+
+        memcpy(unit_keys[v].pid, keys[v].pid, 0x10);
+        memcpy(unit_keys[v].n, keys[v].n, sizeof(keys[v].n));
+        memcpy(unit_keys[v].e, keys[v].e, sizeof(keys[v].e));
+
+        keystore_set_present(&unit_keys[v]);
+    }
+
+cleanup:
+
+    free(found);
+    free(keys);
+
+    return ret;
+}
+
+/*! utility function to check whether a key_entry record is in use (test/data/keyfile ends with a partial trailer, which must not pass) */
+static int keystore_entry_used(const key_entry *p_entry)
+{
+    static const uint8_t zero[sizeof(p_entry->padding)] = { 0 };
+
+    return (p_entry->n[0] != 0) && (memcmp(p_entry->padding, zero, sizeof(zero)) == 0);
+}
+
+/*! utility function to add key_entry records, indexed by key ID (see test/src/main.c) */
+static int keystore_add_entries(keystore_builder *p_builder, const char *path, const char *data, long size)
+{
+    const key_entry *entries = (const key_entry*)data;
+
+    uint32_t count = (uint32_t)(size / sizeof(key_entry)), v;
+
+    keystore_key *unit_keys = 0;
+
+    /*! key IDs end with the last record in use */
+    while( (count > 0) && !keystore_entry_used(&entries[count - 1]) ) { count--; }
+
+    unit_keys = keystore_add_unit(p_builder, keystore_base_name(path), (int)strlen(keystore_base_name(path)), count);
+
+    if(unit_keys == 0) { return VERIFY_E_READ; }
+
+    for(v=0;v<count;v++)
+    {
+        const key_entry *p_entry = &entries[v];
+
+        if(!keystore_entry_used(p_entry)) { continue; }
+
+        memcpy(unit_keys[v].pid, p_entry->i, 0x10);
+        memcpy(unit_keys[v].n, p_entry->n, sizeof(p_entry->n));
+        memcpy(unit_keys[v].e, p_entry->e, sizeof(p_entry->e));
+        memcpy(unit_keys[v].p, p_entry->p, sizeof(p_entry->p));
+        memcpy(unit_keys[v].q, p_entry->q, sizeof(p_entry->q));
+        memcpy(unit_keys[v].dp, p_entry->dp, sizeof(p_entry->dp));
+        memcpy(unit_keys[v].dq, p_entry->dq, sizeof(p_entry->dq));
+        memcpy(unit_keys[v].qi, p_entry->qi, sizeof(p_entry->qi));
+
+        unit_keys[v].flags |= KEYSTORE_KEY_PRIVATE;
+
+        keystore_set_present(&unit_keys[v]);
+    }
+
+    return VERIFY_OK;
+}
+
+/*! utility function to add every CP of a keystore */
+static int keystore_add_store(keystore_builder *p_builder, const keystore *p_store)
+{
+    uint32_t unit, v;
+
+    for(unit=0;unit<p_store->header->unit_count;unit++)
+    {
+        const keystore_unit *p_unit = &p_store->units[unit];
+
+        const char *name = keystore_unit_name(p_store, unit);
+
+        keystore_key *unit_keys = 0;
+
+        if((uint64_t)p_unit->first + p_unit->count > p_store->header->key_count) { return VERIFY_E_PARSE; }
+
+        unit_keys = keystore_add_unit(p_builder, name, (int)strlen(name), p_unit->count);
+
+        if(unit_keys == 0) { return VERIFY_E_READ; }
+
+        for(v=0;v<p_unit->count;v++)
+        {
+            uint32_t new_unit = unit_keys[v].unit;
+
+            unit_keys[v] = p_store->keys[p_unit->first + v];
+            unit_keys[v].key_id = (uint16_t)v;
+            unit_keys[v].unit = new_unit;
+        }
+    }
+
+    return VERIFY_OK;
+}
+
+/*! utility function to add one key file */
+static int keystore_add_file(keystore_builder *p_builder, const char *path)
+{
+    long size = 0;
+
+    char *data = 0;
+
+    int ret = VERIFY_OK, len = 0;
+
+    if(keystore_probe(path))
+    {
+        keystore store;
+
+        ret = keystore_open(&store, path);
+
+        if(ret == VERIFY_OK) { ret = keystore_add_store(p_builder, &store); keystore_close(&store); }
+
+        return ret;
+    }
+
+    data = verify_read_file(path, &size);
+
+    if(data == 0) { return VERIFY_E_READ; }
+
+    /*! text key files start with a NAME:KEYID: line */
+    while( (len < size) && (isupper((unsigned char)data[len]) || (data[len] == '_')) ) { len++; }
+
+    if( (len > 0) && (data[len] == ':') && isdigit((unsigned char)data[len + 1]) )
+    {
+        ret = keystore_add_text(p_builder, path, data);
+    }
+    else
+    {
+        ret = keystore_add_entries(p_builder, path, data, size);
+    }
+
+    free(data);
+
+    return ret;
+}
+
+int keystore_add_path(keystore_builder *p_builder, const char *path)
+{
+    struct stat st;
+
+    char **paths = 0;
+
+    int count = 0, ret = VERIFY_OK, v;
+
+    if(stat(path, &st) != 0) { return VERIFY_E_READ; }
+
+    if(!S_ISDIR(st.st_mode)) { return keystore_add_file(p_builder, path); }
+
+    count = verify_list_dir(path, "", "", &paths);
+
+    if(count < 0) { return VERIFY_E_READ; }
+
+    for(v=0;v<count;v++)
+    {
+        int len = (int)strlen(paths[v]);
+
+        /*! key files may sit next to the pairs they are for */
+        if( (ret == VERIFY_OK) && !((len > 4) && (strcmp(&paths[v][len - 4], ".xml") == 0)) ) { ret = keystore_add_file(p_builder, paths[v]); }
+
+        free(paths[v]);
+    }
+
+    free(paths);
+
+    return ret;
+}
+
+int keystore_build(keystore_builder *p_builder, keystore *p_store)
+{
+    keystore_header *p_header = 0;
+
+    uint32_t *index = 0, index_size = KEYSTORE_MIN_INDEX, v;
+
+    size_t size = 0;
+
+    int ret = VERIFY_OK;
+
+    memset(p_store, 0, sizeof(keystore));
+
+    /*! at most half full, so that probes stay short */
+    while(index_size < p_builder->key_count * 2) { index_size *= 2; }
+
+    size = sizeof(keystore_header) + p_builder->unit_count * sizeof(keystore_unit) + p_builder->key_count * sizeof(keystore_key) + index_size * sizeof(uint32_t);
+
+    if(size > UINT32_MAX) { ret = VERIFY_E_PARSE; goto cleanup; }
+
+    p_store->image = (uint8_t*)calloc(1, size);
+
+    if(p_store->image == 0) { ret = VERIFY_E_READ; goto cleanup; }
+
+    p_store->size = size;
+
+    p_header = (keystore_header*)p_store->image;
+
+    p_header->magic = KEYSTORE_MAGIC;
+    p_header->version = KEYSTORE_VERSION;
+    p_header->file_size = (uint32_t)size;
+    p_header->unit_count = p_builder->unit_count;
+    p_header->unit_offset = sizeof(keystore_header);
+    p_header->key_count = p_builder->key_count;
+    p_header->key_offset = p_header->unit_offset + p_builder->unit_count * sizeof(keystore_unit);
+    p_header->index_size = index_size;
+    p_header->index_offset = p_header->key_offset + p_builder->key_count * sizeof(keystore_key);
+
+    if(p_builder->unit_count > 0) { memcpy(&p_store->image[p_header->unit_offset], p_builder->units, p_builder->unit_count * sizeof(keystore_unit)); }
+    if(p_builder->key_count > 0) { memcpy(&p_store->image[p_header->key_offset], p_builder->keys, p_builder->key_count * sizeof(keystore_key)); }
+
+    index = (uint32_t*)&p_store->image[p_header->index_offset];
+
+    for(v=0;v<index_size;v++) { index[v] = KEYSTORE_INDEX_EMPTY; }
+
+    for(v=0;v<p_builder->key_count;v++)
+    {
+        const keystore_key *p_key = &p_builder->keys[v];
+
+        uint32_t slot = keystore_pid_hash(p_key->pid) & (index_size - 1);
+
+        if((p_key->flags & KEYSTORE_KEY_PRESENT) == 0) { continue; }
+
+        while(index[slot] != KEYSTORE_INDEX_EMPTY)
+        {
+            /*! the first key added for a putative ID wins */
+            if(memcmp(p_builder->keys[index[slot]].pid, p_key->pid, 0x10) == 0) { break; }
+
+            slot = (slot + 1) & (index_size - 1);
+        }
+
+        if(index[slot] == KEYSTORE_INDEX_EMPTY) { index[slot] = v; }
+    }
+
+    ret = keystore_attach(p_store);
+
+cleanup:
+
+    if(ret != VERIFY_OK) { keystore_close(p_store); }
+
+    keystore_free_builder(p_builder);
+
+    return ret;
+}
+
+void keystore_free_builder(keystore_builder *p_builder)
+{
+    free(p_builder->units);
+    free(p_builder->keys);
+
+    memset(p_builder, 0, sizeof(keystore_builder));
+
+    return;
+}
+
+int keystore_save(const keystore *p_store, const char *path)
+{
+    char tmp_path[PATH_MAX];
+
+    FILE *file = 0;
+
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) { return VERIFY_E_READ; }
+
+    /*! the image is replaced in one step, so verifiers never map half of it */
+    file = fopen(tmp_path, "wb");
+
+    if(file == 0) { return VERIFY_E_READ; }
+
+    if( (fwrite(p_store->image, 1, p_store->size, file) != p_store->size) | (fclose(file) != 0) || (rename(tmp_path, path) != 0) )
+    {
+        unlink(tmp_path);
+
+        return VERIFY_E_READ;
+    }
+
+    return VERIFY_OK;
+}
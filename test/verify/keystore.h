@@ -0,0 +1,145 @@
+/*
+ * keystore.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API defines the keystore, a binary image of the keys of a lot which
+ * verifiers map into memory as it is. Opening one costs the same for ten keys
+ * as for a million, and finding a key, by putative ID or by CP and key ID,
+ * costs one hash probe or one array index, with no parsing.
+ *
+ * Image layout (host byte order, every offset from the start of the file):
+ *
+ *   keystore_header
+ *   keystore_unit[unit_count]      one per CP, keys[first..first+count-1] by key ID
+ *   keystore_key[key_count]        KEYSTORE_KEY_PRESENT is clear for unused key IDs
+ *   uint32_t[index_size]           open addressed hash of keys by putative ID
+ *
+ * Keystores are built by cpi-keystore from the text key files of CPParse.pm and
+ * from key_entry records (see test/src/main.h).
+ */
+
+#ifndef KEYSTORE_H
+#define KEYSTORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*! "CPKS", as read on the host which built the image */
+#define KEYSTORE_MAGIC          0x534B5043
+/*! image layout version */
+#define KEYSTORE_VERSION        1
+
+/*! maximum length of a CP name, including null terminator */
+#define KEYSTORE_NAME_SIZE      0x40
+
+/*! empty index slot */
+#define KEYSTORE_INDEX_EMPTY    0xFFFFFFFF
+
+/*! \name key flags */
+/*! \{ */
+#define KEYSTORE_KEY_PRESENT    0x0001  /*!< Key ID is in use */
+#define KEYSTORE_KEY_PRIVATE    0x0002  /*!< p, q, dP, dQ and qInv are known */
+/*! \} */
+
+/*! keystore image header */
+typedef struct _keystore_header
+{
+    uint32_t magic;                 /*!< KEYSTORE_MAGIC */
+    uint32_t version;               /*!< KEYSTORE_VERSION */
+    uint32_t file_size;             /*!< size of the whole image */
+    uint32_t unit_count;            /*!< number of CPs */
+    uint32_t unit_offset;           /*!< offset of keystore_unit[unit_count] */
+    uint32_t key_count;             /*!< number of key records, including unused key IDs */
+    uint32_t key_offset;            /*!< offset of keystore_key[key_count] */
+    uint32_t index_size;            /*!< number of index slots, a power of two */
+    uint32_t index_offset;          /*!< offset of uint32_t[index_size] */
+    uint32_t reserved[7];
+}
+keystore_header;
+
+/*! keys of one CP */
+typedef struct _keystore_unit
+{
+    char     name[KEYSTORE_NAME_SIZE];  /*!< CP name, from the GUID line or the key file name */
+    uint32_t first;                     /*!< key record of key ID 0 */
+    uint32_t count;                     /*!< number of key IDs */
+}
+keystore_unit;
+
+/*! one key ID of one CP */
+typedef struct _keystore_key
+{
+    uint8_t  pid[0x10];             /*!< putative ID, which the CP reports for this key */
+    uint8_t  pid_hash[20];          /*!< SHA-1 of the putative ID, as covered by the full hash */
+    uint16_t key_id;                /*!< key ID */
+    uint16_t flags;                 /*!< KEYSTORE_KEY_ flags */
+    uint32_t unit;                  /*!< CP, index into the unit table */
+    uint8_t  n[128];                /*!< modulus, big endian */
+    uint8_t  e[4];                  /*!< public exponent, big endian */
+    uint8_t  p[64];                 /*!< first prime, big endian */
+    uint8_t  q[64];                 /*!< second prime, big endian */
+    uint8_t  dp[64];                /*!< d mod (p-1), big endian */
+    uint8_t  dq[64];                /*!< d mod (q-1), big endian */
+    uint8_t  qi[64];                /*!< q^-1 mod p, big endian */
+    uint8_t  reserved[16];
+}
+keystore_key;
+
+/*! open keystore: a mapped file, or an image built in memory */
+typedef struct _keystore
+{
+    uint8_t               *image;       /*!< whole image */
+    size_t                 size;        /*!< size of the image */
+    int                    mapped;      /*!< set if image is a file mapping, clear if it is on the heap */
+    const keystore_header *header;
+    const keystore_unit   *units;
+    const keystore_key    *keys;
+    const uint32_t        *index;
+}
+keystore;
+
+/*! keys being collected for a new image */
+typedef struct _keystore_builder
+{
+    keystore_unit *units;
+    uint32_t       unit_count;
+    keystore_key  *keys;
+    uint32_t       key_count;
+    uint32_t       key_size;            /*!< allocated number of keys */
+}
+keystore_builder;
+
+/*! check whether the file at path is a keystore image (returns 1 if it is) */
+int keystore_probe(const char *path);
+
+/*! map a keystore image, checking its header (returns VERIFY_ result) */
+int keystore_open(keystore *p_store, const char *path);
+
+/*! unmap or free a keystore */
+void keystore_close(keystore *p_store);
+
+/*! find the key with the specified putative ID (returns 0 if none) */
+const keystore_key *keystore_find_pid(const keystore *p_store, const uint8_t *pid);
+
+/*! find the key with the specified key ID of the specified CP (returns 0 if none) */
+const keystore_key *keystore_find_id(const keystore *p_store, uint32_t unit, uint16_t key_id);
+
+/*! name of the specified CP */
+const char *keystore_unit_name(const keystore *p_store, uint32_t unit);
+
+/*! add the keys of a text key file, key_entry file or keystore, or of every such file in a directory (returns VERIFY_ result) */
+int keystore_add_path(keystore_builder *p_builder, const char *path);
+
+/*! build an image in memory from the collected keys, and release them (returns VERIFY_ result) */
+int keystore_build(keystore_builder *p_builder, keystore *p_store);
+
+/*! release the collected keys */
+void keystore_free_builder(keystore_builder *p_builder);
+
+/*! write an image to a file, replacing it in one step (returns VERIFY_ result) */
+int keystore_save(const keystore *p_store, const char *path);
+
+#endif
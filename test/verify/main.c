@@ -0,0 +1,581 @@
+/*
+ * main.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module defines the entry point for cpi-verify, which checks the
+ * challenge-response pairs collected from a lot of CPs (see
+ * test/production_test/collect.sh) on every available core.
+ *
+ * Each pair is a query XML given to cpi and the response XML it wrote. Pairs
+ * are named on the command line as response files (queryN.xml is expected next
+ * to responseN.xml), as directories holding such files, or as list files with
+ * one "QUERY RESPONSE" line per pair, or as archives (see archive.h).
+ */
+
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*! maximum number of worker threads */
+#define VERIFY_MAX_THREADS  0x40
+
+/*! pairs a worker claims at once while preparing, to hash them together */
+#define VERIFY_PREPARE_CHUNK 0x20
+
+/*! pairs to verify, and the next one to claim */
+typedef struct _verify_lot
+{
+    const verify_options *p_options;
+    verify_item          *items;
+    int                   count;
+    int                   size;
+    int                   next;
+    verify_item         **order;            /*!< prepared items, grouped by modulus */
+    int                   order_count;
+    int                  *batches;          /*!< first item of each batch in order, then order_count */
+    int                   batch_count;
+    int                   next_batch;
+    archive             **archives;         /*!< archives holding pairs, open until exit */
+    int                   archive_count;
+}
+verify_lot;
+
+/*! utility function to display usage */
+static void verify_usage(void)
+{
+    fprintf(stderr, "Usage: cpi-verify [options] <response.xml | directory | archive | -L list> ...\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -k <path>   keystore, key file, or directory of key files (repeatable)\n");
+    fprintf(stderr, "  -n          no key files, trust the public key reported by each CP\n");
+    fprintf(stderr, "  -L <path>   list file, one \"QUERY RESPONSE\" line per pair\n");
+    fprintf(stderr, "  -V <hex>    expected version, e.g. 04030000\n");
+    fprintf(stderr, "  -O <n:d>    owner key modulus and private exponent files, to check the encrypted owner key\n");
+    fprintf(stderr, "  -j <count>  worker threads (default: one per online CPU)\n");
+    fprintf(stderr, "  -B <count>  pairs under one key to unblind together (default: %d, 1 to unblind each on its own)\n", VERIFY_BATCH_SIZE);
+    fprintf(stderr, "  -b <count>  benchmark: unblind every pair count more times, each on its own and in batches\n");
+    fprintf(stderr, "  -T <count>  benchmark the big number work on 1024 and 2048 bit keys, count operations each, then exit\n");
+    fprintf(stderr, "  -q          only report failed pairs\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Exits with 0 only if every pair passes.\n");
+
+    return;
+}
+
+/*! utility function to duplicate a string (aborts on allocation failure, like the rest of this tool's setup) */
+static char *verify_strdup(const char *str)
+{
+    char *dup = strdup(str);
+
+    if(dup == 0) { fprintf(stderr, "Error: out of memory\n"); exit(2); }
+
+    return dup;
+}
+
+/*! utility function to add a pair to the lot */
+static void verify_add_pair(verify_lot *p_lot, const char *req_path, const char *res_path)
+{
+    if(p_lot->count == p_lot->size)
+    {
+        int size = (p_lot->size == 0) ? 0x100 : p_lot->size * 2;
+
+        verify_item *items = (verify_item*)realloc(p_lot->items, size * sizeof(verify_item));
+
+        if(items == 0) { fprintf(stderr, "Error: out of memory\n"); exit(2); }
+
+        p_lot->items = items;
+        p_lot->size = size;
+    }
+
+    memset(&p_lot->items[p_lot->count], 0, sizeof(verify_item));
+
+    p_lot->items[p_lot->count].req_path = verify_strdup(req_path);
+    p_lot->items[p_lot->count].res_path = verify_strdup(res_path);
+
+    p_lot->count++;
+
+    return;
+}
+
+/*! utility function to add a response file, paired with the query file of the same number (returns 0 if the name does not fit) */
+static int verify_add_response(verify_lot *p_lot, const char *res_path)
+{
+    const char *base = strrchr(res_path, '/');
+
+    char req_path[PATH_MAX];
+
+    int dir_len = 0;
+
+    base = (base == 0) ? res_path : base + 1;
+
+    dir_len = (int)(base - res_path);
+
+    if(strncmp(base, "response", 8) != 0) { return 0; }
+
+    if(snprintf(req_path, sizeof(req_path), "%.*squery%s", dir_len, res_path, base + 8) >= (int)sizeof(req_path)) { return 0; }
+
+    verify_add_pair(p_lot, req_path, res_path);
+
+    return 1;
+}
+
+/*! utility function to add every pair of an archive, fetched from it in place of XML files (returns 0 on failure) */
+static int verify_add_archive(verify_lot *p_lot, const char *path)
+{
+    archive *p_archive = (archive*)malloc(sizeof(archive)), **archives = 0;
+
+    uint32_t v;
+
+    int ret = VERIFY_OK;
+
+    if(p_archive == 0) { fprintf(stderr, "Error: out of memory\n"); exit(2); }
+
+    ret = archive_open(p_archive, path);
+
+    if(ret != VERIFY_OK) { fprintf(stderr, "Error: archive \"%s\": %s\n", path, VERIFY_RESULT_LOOKUP[ret]); free(p_archive); return 0; }
+
+    archives = (archive**)realloc(p_lot->archives, (p_lot->archive_count + 1) * sizeof(archive*));
+
+    if(archives == 0) { fprintf(stderr, "Error: out of memory\n"); exit(2); }
+
+    p_lot->archives = archives;
+    p_lot->archives[p_lot->archive_count++] = p_archive;
+
+    for(v=0;v<archive_count(p_archive);v++)
+    {
+        verify_item *p_item = 0;
+
+        verify_add_pair(p_lot, "", path);
+
+        p_item = &p_lot->items[p_lot->count - 1];
+
+        p_item->p_archive = p_archive;
+        p_item->record = v;
+    }
+
+    return 1;
+}
+
+/*! utility function to add a response file, every response file in a directory, or an archive (returns 0 on failure) */
+static int verify_add_path(verify_lot *p_lot, const char *path)
+{
+    struct stat st;
+
+    if(stat(path, &st) != 0) { fprintf(stderr, "Error: cannot read \"%s\"\n", path); return 0; }
+
+    if(S_ISREG(st.st_mode) && archive_probe(path)) { return verify_add_archive(p_lot, path); }
+
+    if(S_ISDIR(st.st_mode))
+    {
+        char **paths = 0;
+
+        int count = verify_list_dir(path, "response", ".xml", &paths), v;
+
+        if(count < 0) { fprintf(stderr, "Error: cannot read \"%s\"\n", path); return 0; }
+
+        for(v=0;v<count;v++) { verify_add_response(p_lot, paths[v]); free(paths[v]); }
+
+        free(paths);
+
+        return 1;
+    }
+
+    if(!verify_add_response(p_lot, path)) { fprintf(stderr, "Error: \"%s\" is not named responseN.xml, use a list file\n", path); return 0; }
+
+    return 1;
+}
+
+/*! utility function to add every pair of a list file (returns 0 on failure) */
+static int verify_add_list(verify_lot *p_lot, const char *list_path)
+{
+    FILE *file = fopen(list_path, "r");
+
+    char line[2*PATH_MAX + 2];
+
+    int line_num = 0;
+
+    if(file == 0) { fprintf(stderr, "Error: cannot read \"%s\"\n", list_path); return 0; }
+
+    while(fgets(line, sizeof(line), file) != 0)
+    {
+        char *req_path = 0, *res_path = 0, *save = 0;
+
+        line_num++;
+
+        req_path = strtok_r(line, " \t\r\n", &save);
+
+        if( (req_path == 0) || (req_path[0] == '#') ) { continue; }
+
+        res_path = strtok_r(0, " \t\r\n", &save);
+
+        if(res_path == 0)
+        {
+            fprintf(stderr, "Error: %s:%d: expected \"QUERY RESPONSE\"\n", list_path, line_num);
+            fclose(file);
+            return 0;
+        }
+
+        verify_add_pair(p_lot, req_path, res_path);
+    }
+
+    fclose(file);
+
+    return 1;
+}
+
+/*! worker thread, parses, prepares and hashes pairs until none are left */
+static void *verify_prepare_worker(void *arg)
+{
+    verify_lot *p_lot = (verify_lot*)arg;
+
+    for(;;)
+    {
+        int cur = __atomic_fetch_add(&p_lot->next, VERIFY_PREPARE_CHUNK, __ATOMIC_RELAXED), end = cur + VERIFY_PREPARE_CHUNK, ready = 0, v;
+
+        verify_item *prepared[VERIFY_PREPARE_CHUNK];
+
+        if(cur >= p_lot->count) { break; }
+
+        if(end > p_lot->count) { end = p_lot->count; }
+
+        for(v=cur;v<end;v++)
+        {
+            verify_item *p_item = &p_lot->items[v];
+
+            p_item->result = verify_parse(p_item);
+
+            if(p_item->result == VERIFY_OK) { p_item->result = verify_prepare(p_lot->p_options, p_item); }
+
+            if(p_item->result == VERIFY_OK) { prepared[ready++] = p_item; }
+        }
+
+        verify_hash(prepared, ready);
+    }
+
+    return 0;
+}
+
+/*! worker thread, checks batches of prepared pairs until none are left */
+static void *verify_check_worker(void *arg)
+{
+    verify_lot *p_lot = (verify_lot*)arg;
+
+    /*! Montgomery contexts of the keys this thread saw, reused for every later batch under them */
+    verify_context ctx;
+
+    verify_init_context(&ctx);
+
+    for(;;)
+    {
+        int cur = __atomic_fetch_add(&p_lot->next_batch, 1, __ATOMIC_RELAXED);
+
+        if(cur >= p_lot->batch_count) { break; }
+
+        verify_check_batch(p_lot->p_options, &ctx, &p_lot->order[p_lot->batches[cur]], p_lot->batches[cur + 1] - p_lot->batches[cur]);
+    }
+
+    verify_free_context(&ctx);
+
+    return 0;
+}
+
+/*! utility function to run a worker on thread_count threads, the calling thread included */
+static void verify_run(void *(*worker)(void*), verify_lot *p_lot, int thread_count)
+{
+    pthread_t threads[VERIFY_MAX_THREADS];
+
+    int v;
+
+    for(v=1;v<thread_count;v++)
+    {
+        if(pthread_create(&threads[v], 0, worker, p_lot) != 0) { thread_count = v; break; }
+    }
+
+    worker(p_lot);
+
+    for(v=1;v<thread_count;v++) { pthread_join(threads[v], 0); }
+
+    return;
+}
+
+/*! utility function to order prepared items by modulus, then in input order */
+static int verify_compare_modulus(const void *a, const void *b)
+{
+    const verify_item *p_a = *(const verify_item**)a, *p_b = *(const verify_item**)b;
+
+    int diff = memcmp(p_a->n, p_b->n, VERIFY_N_SIZE);
+
+    if(diff != 0) { return diff; }
+
+    return (p_a < p_b) ? -1 : (p_a > p_b);
+}
+
+/*! utility function to group prepared items into batches, each under one modulus and at most batch_size long */
+static void verify_group(verify_lot *p_lot, int batch_size)
+{
+    int v, run = 0;
+
+    p_lot->order = (verify_item**)malloc((p_lot->count + 1) * sizeof(verify_item*));
+    p_lot->batches = (int*)malloc((p_lot->count + 1) * sizeof(int));
+
+    if( (p_lot->order == 0) || (p_lot->batches == 0) ) { fprintf(stderr, "Error: out of memory\n"); exit(2); }
+
+    for(v=0;v<p_lot->count;v++) { if(p_lot->items[v].result == VERIFY_OK) { p_lot->order[p_lot->order_count++] = &p_lot->items[v]; } }
+
+    qsort(p_lot->order, p_lot->order_count, sizeof(verify_item*), verify_compare_modulus);
+
+    for(v=0;v<p_lot->order_count;v++)
+    {
+        if( (v == 0) || (run == batch_size) || (memcmp(p_lot->order[v]->n, p_lot->order[v-1]->n, VERIFY_N_SIZE) != 0) )
+        {
+            p_lot->batches[p_lot->batch_count++] = v;
+
+            run = 0;
+        }
+
+        run++;
+    }
+
+    p_lot->batches[p_lot->batch_count] = p_lot->order_count;
+
+    return;
+}
+
+/*! utility function to time unblinding of every batch, count times (returns seconds) */
+static double verify_bench_unblind(verify_lot *p_lot, int count, int batched)
+{
+    struct timespec beg, end;
+
+    int v, i;
+
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+
+    for(v=0;v<count;v++)
+    {
+        for(i=0;i<p_lot->batch_count;i++) { verify_unblind(&p_lot->order[p_lot->batches[i]], p_lot->batches[i + 1] - p_lot->batches[i], batched); }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - beg.tv_sec) + (end.tv_nsec - beg.tv_nsec) / 1e9;
+}
+
+/*! cpi-verify entry point */
+int main(int argc, char **argv)
+{
+    verify_keys keys;
+    verify_owner owner;
+    verify_options options;
+    verify_lot lot;
+
+    uint8_t vers[CPI_RESULT1_VERS_SIZE];
+
+    int thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN), no_keys = 0, quiet = 0, failed = 0, bench_count = 0, math_count = 0, v;
+
+    struct timespec beg, end;
+
+    double elapsed = 0;
+
+    int cur_arg = 0;
+
+    memset(&keys, 0, sizeof(keys));
+    memset(&options, 0, sizeof(options));
+    memset(&lot, 0, sizeof(lot));
+
+    if(verify_init() != VERIFY_OK) { fprintf(stderr, "Error: could not register SHA-1\n"); return 2; }
+
+    /*! parse command line */
+    for(cur_arg = 1; cur_arg < argc; cur_arg++)
+    {
+        if(argv[cur_arg][0] != '-')
+        {
+            if(!verify_add_path(&lot, argv[cur_arg])) { return 2; }
+            continue;
+        }
+
+        switch(argv[cur_arg][1])
+        {
+            case 'k':
+                if(++cur_arg < argc)
+                {
+                    int ret = verify_add_keys(&keys, argv[cur_arg]);
+
+                    if(ret != VERIFY_OK) { fprintf(stderr, "Error: keys \"%s\": %s\n", argv[cur_arg], VERIFY_RESULT_LOOKUP[ret]); verify_free_keys(&keys); return 2; }
+                }
+                break;
+
+            case 'n':
+                no_keys = 1;
+                break;
+
+            case 'L':
+                if(++cur_arg < argc) { if(!verify_add_list(&lot, argv[cur_arg])) { return 2; } }
+                break;
+
+            case 'V':
+                if(++cur_arg < argc)
+                {
+                    unsigned val = 0;
+
+                    if( (strlen(argv[cur_arg]) != 2*CPI_RESULT1_VERS_SIZE) || (sscanf(argv[cur_arg], "%x", &val) != 1) )
+                    {
+                        fprintf(stderr, "Error: version \"%s\" is not 8 hex digits\n", argv[cur_arg]);
+                        return 2;
+                    }
+
+                    for(v=0;v<CPI_RESULT1_VERS_SIZE;v++) { vers[v] = (uint8_t)(val >> (8*(CPI_RESULT1_VERS_SIZE - 1 - v))); }
+
+                    options.vers = vers;
+                }
+                break;
+
+            case 'O':
+                if(++cur_arg < argc)
+                {
+                    char *n_path = verify_strdup(argv[cur_arg]), *d_path = strchr(n_path, ':');
+
+                    int ret = VERIFY_E_PARSE;
+
+                    if(d_path != 0) { *d_path++ = '\0'; ret = verify_load_owner(&owner, n_path, d_path); }
+
+                    free(n_path);
+
+                    if(ret != VERIFY_OK) { fprintf(stderr, "Error: owner key \"%s\": %s\n", argv[cur_arg], VERIFY_RESULT_LOOKUP[ret]); return 2; }
+
+                    options.p_owner = &owner;
+                }
+                break;
+
+            case 'j':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &thread_count); }
+                break;
+
+            case 'B':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &options.batch_size); }
+                break;
+
+            case 'b':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &bench_count); }
+                break;
+
+            case 'T':
+                if(++cur_arg < argc) { sscanf(argv[cur_arg], "%d", &math_count); }
+                break;
+
+            case 'q':
+                quiet = 1;
+                break;
+
+            case '-':
+            case 'h':
+                verify_usage();
+                return 0;
+
+            default:
+                fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+                break;
+        }
+    }
+
+    /*! the big number benchmark needs no pairs */
+    if(math_count > 0) { verify_free_keys(&keys); return (verify_bench_math(math_count) == VERIFY_OK) ? 0 : 2; }
+
+    if(lot.count == 0) { verify_usage(); return 2; }
+
+    /*! key files are indexed once all are loaded */
+    {
+        int ret = verify_finish_keys(&keys);
+
+        if(ret != VERIFY_OK) { fprintf(stderr, "Error: keys: %s\n", VERIFY_RESULT_LOOKUP[ret]); verify_free_keys(&keys); return 2; }
+    }
+
+    if( (keys.store_count == 0) && !no_keys )
+    {
+        fprintf(stderr, "Error: no keys loaded, use -k, or -n to trust the key reported by each CP\n");
+        return 2;
+    }
+
+    if(!no_keys) { options.p_keys = &keys; }
+
+    if(options.batch_size < 1) { options.batch_size = VERIFY_BATCH_SIZE; }
+
+    if(thread_count < 1) { thread_count = 1; }
+    if(thread_count > VERIFY_MAX_THREADS) { thread_count = VERIFY_MAX_THREADS; }
+    if(thread_count > lot.count) { thread_count = lot.count; }
+
+    lot.p_options = &options;
+
+    /*! verify every pair */
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+
+    verify_run(verify_prepare_worker, &lot, thread_count);
+
+    /*! pairs under one key are unblinded together */
+    verify_group(&lot, options.batch_size);
+
+    verify_run(verify_check_worker, &lot, thread_count);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - beg.tv_sec) + (end.tv_nsec - beg.tv_nsec) / 1e9;
+
+    /*! report, in input order */
+    for(v=0;v<lot.count;v++)
+    {
+        verify_item *p_item = &lot.items[v];
+
+        int i;
+
+        if(p_item->result != VERIFY_OK) { failed++; } else if(quiet) { continue; }
+
+        printf("%s %s ", (p_item->result == VERIFY_OK) ? "PASS" : "FAIL", (p_item->unit != 0) ? p_item->unit : "-");
+
+        for(i=0;i<0x10;i++) { printf("%.02X", p_item->pid[i]); }
+
+        printf(" %d %s", p_item->key_id, p_item->res_path);
+
+        if(p_item->p_archive != 0) { printf("#%u", p_item->record); }
+
+        if(p_item->result != VERIFY_OK) { printf(" (%s)", VERIFY_RESULT_LOOKUP[p_item->result]); }
+
+        printf("\n");
+    }
+
+    fprintf(stderr, "%d pairs, %d passed, %d failed, %.3f s (%.0f pairs/s, %d threads)\n",
+        lot.count, lot.count - failed, failed, elapsed, (elapsed > 0) ? lot.count / elapsed : 0.0, thread_count);
+
+    /*! optionally, benchmark unblinding on its own, one thread */
+    if( (bench_count > 0) && (lot.order_count > 0) )
+    {
+        double each = verify_bench_unblind(&lot, bench_count, 0), batched = verify_bench_unblind(&lot, bench_count, 1);
+
+        double pairs = (double)lot.order_count * bench_count;
+
+        /*! the timings only mean something along with the batching they were taken with */
+        fprintf(stderr, "Benchmark : unblinding %d pairs in %d batches of up to %d (%d times), %.2f us/pair on its own, %.2f us/pair batched (%.2fx)\n",
+            lot.order_count, lot.batch_count, options.batch_size, bench_count, each * 1e6 / pairs, batched * 1e6 / pairs, (batched > 0) ? each / batched : 0.0);
+    }
+
+    for(v=0;v<lot.count;v++) { free((char*)lot.items[v].req_path); free((char*)lot.items[v].res_path); }
+
+    for(v=0;v<lot.archive_count;v++) { archive_close(lot.archives[v]); free(lot.archives[v]); }
+
+    free(lot.items);
+    free(lot.order);
+    free(lot.batches);
+    free(lot.archives);
+
+    verify_free_keys(&keys);
+
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+/*
+ * mbsha1.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the multi-buffer SHA-1. One kernel is written with
+ * GCC vector extensions and instantiated for 1, 4 and 8 lanes; the compiler
+ * turns the 4 lane kernel into SSE2 and the 8 lane kernel, built for AVX2,
+ * into AVX2. The widest kernel the CPU runs is picked at runtime.
+ */
+
+#include "mbsha1.h"
+
+#include <string.h>
+
+/*! lane vectors */
+typedef uint32_t mbsha1_v1 __attribute__((vector_size(4)));
+typedef uint32_t mbsha1_v4 __attribute__((vector_size(16)));
+typedef uint32_t mbsha1_v8 __attribute__((vector_size(32)));
+
+#define MBSHA1_ROTL(x, n)       (((x) << (n)) | ((x) >> (32 - (n))))
+
+/*! utility function to read a big endian word */
+static inline uint32_t mbsha1_load(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/*! utility function to write a big endian word */
+static inline void mbsha1_store(uint8_t *p, uint32_t x)
+{
+    p[0] = (uint8_t)(x >> 24); p[1] = (uint8_t)(x >> 16); p[2] = (uint8_t)(x >> 8); p[3] = (uint8_t)x;
+}
+
+/*! one round: f is the round function of b, c and d */
+#define MBSHA1_ROUND(f, k) \
+    { \
+        tmp = MBSHA1_ROTL(a, 5) + (f) + e + (k) + w[t & 15]; \
+        e = d; d = c; c = MBSHA1_ROTL(b, 30); b = a; a = tmp; \
+    }
+
+/*! message schedule, for rounds 16 to 79 */
+#define MBSHA1_SCHEDULE() \
+    { \
+        tmp = w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15]; \
+        w[t & 15] = MBSHA1_ROTL(tmp, 1); \
+    }
+
+/*!
+  Kernel, hashing lanes messages at once: each vector holds one state word or schedule word
+  of every message. Message words are gathered a lane at a time, straight from the messages.
+*/
+#define MBSHA1_KERNEL(name, vec_t, lanes) \
+static void name(const uint8_t *const *msgs, uint8_t *const *digests, int blocks) \
+{ \
+    vec_t h0, h1, h2, h3, h4, a, b, c, d, e, tmp, w[16]; \
+    \
+    int blk, t, l; \
+    \
+    h0 = h1 = h2 = h3 = h4 = (vec_t){ 0 }; \
+    \
+    h0 += 0x67452301; h1 += 0xEFCDAB89; h2 += 0x98BADCFE; h3 += 0x10325476; h4 += 0xC3D2E1F0; \
+    \
+    for(blk=0;blk<blocks;blk++) \
+    { \
+        for(t=0;t<16;t++) { for(l=0;l<(lanes);l++) { w[t][l] = mbsha1_load(&msgs[l][blk*MBSHA1_BLOCK_SIZE + t*4]); } } \
+        \
+        a = h0; b = h1; c = h2; d = h3; e = h4; \
+        \
+        for(t=0;t<16;t++) { MBSHA1_ROUND((b & c) | (~b & d), 0x5A827999); } \
+        for(;t<20;t++) { MBSHA1_SCHEDULE(); MBSHA1_ROUND((b & c) | (~b & d), 0x5A827999); } \
+        for(;t<40;t++) { MBSHA1_SCHEDULE(); MBSHA1_ROUND(b ^ c ^ d, 0x6ED9EBA1); } \
+        for(;t<60;t++) { MBSHA1_SCHEDULE(); MBSHA1_ROUND((b & c) | (b & d) | (c & d), 0x8F1BBCDC); } \
+        for(;t<80;t++) { MBSHA1_SCHEDULE(); MBSHA1_ROUND(b ^ c ^ d, 0xCA62C1D6); } \
+        \
+        h0 += a; h1 += b; h2 += c; h3 += d; h4 += e; \
+    } \
+    \
+    for(l=0;l<(lanes);l++) \
+    { \
+        mbsha1_store(&digests[l][0], h0[l]); \
+        mbsha1_store(&digests[l][4], h1[l]); \
+        mbsha1_store(&digests[l][8], h2[l]); \
+        mbsha1_store(&digests[l][12], h3[l]); \
+        mbsha1_store(&digests[l][16], h4[l]); \
+    } \
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static void mbsha1_kernel8(const uint8_t *const *msgs, uint8_t *const *digests, int blocks) __attribute__((target("avx2")));
+#endif
+
+MBSHA1_KERNEL(mbsha1_kernel1, mbsha1_v1, 1)
+MBSHA1_KERNEL(mbsha1_kernel4, mbsha1_v4, 4)
+MBSHA1_KERNEL(mbsha1_kernel8, mbsha1_v8, 8)
+
+void mbsha1_pad(uint8_t *msg, size_t len)
+{
+    size_t end = MBSHA1_BLOCKS(len) * MBSHA1_BLOCK_SIZE;
+
+    uint64_t bits = (uint64_t)len * 8;
+
+    int v;
+
+    /*! 0x80, zeros, then the length in bits, big endian */
+    msg[len] = 0x80;
+
+    memset(&msg[len + 1], 0, end - 8 - (len + 1));
+
+    for(v=0;v<8;v++) { msg[end - 1 - v] = (uint8_t)(bits >> (8*v)); }
+
+    return;
+}
+
+int mbsha1_lanes(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if(__builtin_cpu_supports("avx2")) { return 8; }
+    if(__builtin_cpu_supports("sse2")) { return 4; }
+#endif
+
+    return 1;
+}
+
+void mbsha1_hash(const uint8_t *const *msgs, uint8_t *const *digests, int count, int blocks, int lanes)
+{
+    /*! short last group: filler lanes and their dropped digests */
+    const uint8_t *fill_msgs[MBSHA1_LANES_MAX];
+
+    uint8_t *fill_digests[MBSHA1_LANES_MAX], dropped[MBSHA1_DIGEST_SIZE];
+
+    int v, l;
+
+    if( (lanes <= 0) || (lanes > mbsha1_lanes()) ) { lanes = mbsha1_lanes(); }
+
+    /*! kernels come in 8, 4 and 1 lanes */
+    lanes = (lanes >= 8) ? 8 : (lanes >= 4) ? 4 : 1;
+
+    for(v=0;v<count;v+=lanes)
+    {
+        const uint8_t *const *cur_msgs = &msgs[v];
+
+        uint8_t *const *cur_digests = &digests[v];
+
+        if(count - v < lanes)
+        {
+            for(l=0;l<lanes;l++)
+            {
+                fill_msgs[l] = (v + l < count) ? msgs[v + l] : msgs[v];
+                fill_digests[l] = (v + l < count) ? digests[v + l] : dropped;
+            }
+
+            cur_msgs = fill_msgs;
+            cur_digests = fill_digests;
+        }
+
+        switch(lanes)
+        {
+            case 8:  mbsha1_kernel8(cur_msgs, cur_digests, blocks); break;
+            case 4:  mbsha1_kernel4(cur_msgs, cur_digests, blocks); break;
+            default: mbsha1_kernel1(cur_msgs, cur_digests, blocks); break;
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,45 @@
+/*
+ * mbsha1.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API defines a multi-buffer SHA-1: several messages of the same length
+ * are hashed at once, one per 32 bit lane of a vector register (8 with AVX2,
+ * 4 with SSE2, or 1 on other CPUs). Messages are hashed where they lie, and
+ * must already hold their SHA-1 padding (see mbsha1_pad).
+ */
+
+#ifndef MBSHA1_H
+#define MBSHA1_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*! most messages hashed at once */
+#define MBSHA1_LANES_MAX        8
+
+/*! size of a SHA-1 block, in bytes */
+#define MBSHA1_BLOCK_SIZE       0x40
+
+/*! size of a SHA-1 digest, in bytes */
+#define MBSHA1_DIGEST_SIZE      20
+
+/*! number of blocks of a message of len bytes, once padded */
+#define MBSHA1_BLOCKS(len)      (((len) + 8) / MBSHA1_BLOCK_SIZE + 1)
+
+/*! write the SHA-1 padding after a message of len bytes, which has room for MBSHA1_BLOCKS(len) blocks */
+void mbsha1_pad(uint8_t *msg, size_t len);
+
+/*! number of messages the widest kernel this CPU runs hashes at once: 8, 4 or 1 */
+int mbsha1_lanes(void);
+
+/*!
+  Hash count padded messages of blocks blocks each, lanes at a time (0 for mbsha1_lanes), writing
+  the digest of msgs[v] to digests[v]. A last group short of lanes messages is filled up with
+  copies of its first message, whose extra digests are dropped.
+*/
+void mbsha1_hash(const uint8_t *const *msgs, uint8_t *const *digests, int count, int blocks, int lanes);
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * pack.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module defines the entry point for cpi-archive, which packs the
+ * challenge-response pairs collected from a lot of CPs (queryN.xml and
+ * responseN.xml, see test/production_test/collect.sh) into an archive for
+ * cpi-verify and cpi-decrypt-ok, lists and searches archives, and writes
+ * their pairs back out as XML.
+ */
+
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/*! pairs appended to an archive as one segment */
+#define PACK_SEGMENT_SIZE   0x10000
+
+/*! pairs parsed, not yet appended */
+typedef struct _pack_state
+{
+    const char           *out_path;
+    cpi_archive_record_t *records;
+    uint32_t              count;
+    uint32_t              packed;
+    uint32_t              skipped;
+}
+pack_state;
+
+/*! utility function to display usage */
+static void pack_usage(void)
+{
+    fprintf(stderr, "Usage: cpi-archive -o <archive> <response.xml | directory> ...\n");
+    fprintf(stderr, "       cpi-archive -l <archive> [-f <pid>:<key_id>]\n");
+    fprintf(stderr, "       cpi-archive -x <directory> <archive>\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -o <path>          append the pairs of every input to an archive, creating it if need be\n");
+    fprintf(stderr, "  -l <path>          list the pairs of an archive\n");
+    fprintf(stderr, "  -f <pid>:<key_id>  only list the pairs of one putative ID and key ID\n");
+    fprintf(stderr, "  -x <path>          write every pair of an archive to a directory, as queryN.xml and responseN.xml\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "queryN.xml is expected next to responseN.xml. Pairs which do not parse are skipped.\n");
+
+    return;
+}
+
+/*! utility function to append the pairs parsed so far as one segment (returns VERIFY_ result) */
+static int pack_flush(pack_state *p_state)
+{
+    int ret = cpi_archive_append(p_state->out_path, p_state->records, p_state->count);
+
+    if(CPI_FAILED(ret)) { return (ret == CPI_INVALID_PARAM) ? VERIFY_E_PARSE : VERIFY_E_READ; }
+
+    p_state->packed += p_state->count;
+    p_state->count = 0;
+
+    return VERIFY_OK;
+}
+
+/*! utility function to parse a response file and its query, and queue the pair (returns VERIFY_ result of appending) */
+static int pack_response(pack_state *p_state, const char *res_path)
+{
+    const char *base = strrchr(res_path, '/');
+
+    char req_path[PATH_MAX], *req = 0, *res = 0;
+
+    long res_size = 0;
+
+    int ret = VERIFY_E_PARSE;
+
+    base = (base == 0) ? res_path : base + 1;
+
+    if( (strncmp(base, "response", 8) == 0) &&
+        (snprintf(req_path, sizeof(req_path), "%.*squery%s", (int)(base - res_path), res_path, base + 8) < (int)sizeof(req_path)) )
+    {
+        req = verify_read_file(req_path, 0);
+        res = verify_read_file(res_path, &res_size);
+
+        ret = ( (req != 0) && (res != 0) ) ? archive_parse(&p_state->records[p_state->count], req, res, res_size) : VERIFY_E_READ;
+
+        free(req);
+        free(res);
+    }
+
+    if(ret != VERIFY_OK)
+    {
+        fprintf(stderr, "Warning: skipping \"%s\": %s\n", res_path, VERIFY_RESULT_LOOKUP[ret]);
+
+        p_state->skipped++;
+
+        return VERIFY_OK;
+    }
+
+    if(++p_state->count < PACK_SEGMENT_SIZE) { return VERIFY_OK; }
+
+    return pack_flush(p_state);
+}
+
+/*! utility function to queue a response file, or every response file in a directory (returns VERIFY_ result of appending) */
+static int pack_path(pack_state *p_state, const char *path)
+{
+    struct stat st;
+
+    char **paths = 0;
+
+    int count = 0, ret = VERIFY_OK, v;
+
+    if(stat(path, &st) != 0) { count = -1; } else if(!S_ISDIR(st.st_mode)) { return pack_response(p_state, path); } else { count = verify_list_dir(path, "response", ".xml", &paths); }
+
+    /*! unreadable inputs are skipped, like pairs which do not parse */
+    if(count < 0) { fprintf(stderr, "Warning: skipping \"%s\": %s\n", path, VERIFY_RESULT_LOOKUP[VERIFY_E_READ]); return VERIFY_OK; }
+
+    for(v=0;v<count;v++)
+    {
+        if(ret == VERIFY_OK) { ret = pack_response(p_state, paths[v]); }
+
+        free(paths[v]);
+    }
+
+    free(paths);
+
+    return ret;
+}
+
+/*! utility function to print a record */
+static void pack_print(const archive *p_archive, uint32_t record)
+{
+    cpi_archive_record_t rec;
+
+    int v;
+
+    if(archive_get(p_archive, record, &rec) != VERIFY_OK) { return; }
+
+    printf("%u ", record);
+
+    for(v=0;v<0x10;v++) { printf("%.02X", rec.pid[v]); }
+
+    printf(" %u ", rec.key_id);
+
+    if(rec.flags & CPI_ARCHIVE_HAS_SERIAL) { for(v=0;v<CPI_SERIAL_NUMBER_SIZE;v++) { printf("%.02X", rec.serial[v]); } } else { printf("-"); }
+
+    if(rec.flags & CPI_ARCHIVE_HAS_CKEY) { printf(" %u", rec.ckey); } else { printf(" -"); }
+
+    printf("%s\n", (rec.flags & CPI_ARCHIVE_HAS_PKEY) ? " pkey" : "");
+
+    return;
+}
+
+/*! utility function to list the pairs of an archive, or those of one putative ID and key ID */
+static int pack_list(const char *path, const char *find)
+{
+    archive arc;
+
+    uint32_t v;
+
+    int ret = archive_open(&arc, path);
+
+    if(ret != VERIFY_OK) { fprintf(stderr, "Error: archive \"%s\": %s\n", path, VERIFY_RESULT_LOOKUP[ret]); return 1; }
+
+    if(find != 0)
+    {
+        const char *sep = strchr(find, ':');
+
+        uint8_t pid[0x10];
+
+        unsigned key_id = 0;
+
+        uint32_t *records = 0;
+
+        int count = 0, i;
+
+        respscan_view view;
+
+        view.ptr = find;
+        view.len = (sep == 0) ? 0 : (int)(sep - find);
+
+        if( (sep == 0) || !respscan_hex(&view, pid, sizeof(pid)) || (sscanf(sep + 1, "%u", &key_id) != 1) || (key_id > UINT16_MAX) )
+        {
+            fprintf(stderr, "Error: \"%s\" is not <pid>:<key_id>\n", find);
+            archive_close(&arc);
+            return 2;
+        }
+
+        count = archive_find(&arc, pid, (uint16_t)key_id, 0, 0);
+
+        records = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+
+        if(records == 0) { fprintf(stderr, "Error: out of memory\n"); archive_close(&arc); return 2; }
+
+        archive_find(&arc, pid, (uint16_t)key_id, records, count);
+
+        for(i=0;i<count;i++) { pack_print(&arc, records[i]); }
+
+        fprintf(stderr, "%d of %u records\n", count, archive_count(&arc));
+
+        free(records);
+        archive_close(&arc);
+
+        return (count > 0) ? 0 : 1;
+    }
+
+    for(v=0;v<archive_count(&arc);v++) { pack_print(&arc, v); }
+
+    fprintf(stderr, "%u records, %u segments, %lu bytes\n", archive_count(&arc), arc.header->segment_count, (unsigned long)arc.header->file_size);
+
+    archive_close(&arc);
+
+    return 0;
+}
+
+/*! utility function to write every pair of an archive to a directory */
+static int pack_export(const char *path, const char *dir)
+{
+    archive arc;
+
+    cpi_archive_record_t rec;
+
+    char req_path[PATH_MAX], res_path[PATH_MAX];
+
+    uint32_t v;
+
+    int ret = archive_open(&arc, path);
+
+    if(ret != VERIFY_OK) { fprintf(stderr, "Error: archive \"%s\": %s\n", path, VERIFY_RESULT_LOOKUP[ret]); return 1; }
+
+    for(v=0;(ret == VERIFY_OK) && (v<archive_count(&arc));v++)
+    {
+        snprintf(req_path, sizeof(req_path), "%s/query%u.xml", dir, v);
+        snprintf(res_path, sizeof(res_path), "%s/response%u.xml", dir, v);
+
+        ret = archive_get(&arc, v, &rec);
+
+        if(ret == VERIFY_OK) { ret = archive_export(&rec, req_path, res_path); }
+    }
+
+    if(ret != VERIFY_OK) { fprintf(stderr, "Error: writing \"%s\": %s\n", res_path, VERIFY_RESULT_LOOKUP[ret]); } else { fprintf(stderr, "%u pairs written to %s\n", v, dir); }
+
+    archive_close(&arc);
+
+    return (ret == VERIFY_OK) ? 0 : 1;
+}
+
+/*! cpi-archive entry point */
+int main(int argc, char **argv)
+{
+    pack_state state;
+
+    const char *list_path = 0, *export_dir = 0, *find = 0, **inputs = (const char**)calloc(argc, sizeof(char*));
+
+    int cur_arg = 0, input_count = 0, ret = VERIFY_OK, v;
+
+    memset(&state, 0, sizeof(state));
+
+    if(inputs == 0) { fprintf(stderr, "Error: out of memory\n"); return 2; }
+
+    if(verify_init() != VERIFY_OK) { fprintf(stderr, "Error: could not register SHA-1\n"); free(inputs); return 2; }
+
+    /*! parse command line */
+    for(cur_arg = 1; cur_arg < argc; cur_arg++)
+    {
+        if(argv[cur_arg][0] != '-') { inputs[input_count++] = argv[cur_arg]; continue; }
+
+        switch(argv[cur_arg][1])
+        {
+            case 'o':
+                if(++cur_arg < argc) { state.out_path = argv[cur_arg]; }
+                break;
+
+            case 'l':
+                if(++cur_arg < argc) { list_path = argv[cur_arg]; }
+                break;
+
+            case 'f':
+                if(++cur_arg < argc) { find = argv[cur_arg]; }
+                break;
+
+            case 'x':
+                if(++cur_arg < argc) { export_dir = argv[cur_arg]; }
+                break;
+
+            case '-':
+            case 'h':
+                pack_usage();
+                free(inputs);
+                return 0;
+
+            default:
+                fprintf(stderr, "Warning: Unrecognized option \"%s\"\n", argv[cur_arg]);
+                break;
+        }
+    }
+
+    if(list_path != 0) { free(inputs); return pack_list(list_path, find); }
+
+    if( (export_dir != 0) && (input_count == 1) ) { ret = pack_export(inputs[0], export_dir); free(inputs); return ret; }
+
+    if( (state.out_path == 0) || (input_count == 0) ) { pack_usage(); free(inputs); return 2; }
+
+    state.records = (cpi_archive_record_t*)malloc(PACK_SEGMENT_SIZE * sizeof(cpi_archive_record_t));
+
+    if(state.records == 0) { fprintf(stderr, "Error: out of memory\n"); free(inputs); return 2; }
+
+    for(v=0;(ret == VERIFY_OK) && (v<input_count);v++) { ret = pack_path(&state, inputs[v]); }
+
+    /*! whatever was parsed before a failure is still appended */
+    if(state.count > 0)
+    {
+        int flush = pack_flush(&state);
+
+        if(ret == VERIFY_OK) { ret = flush; }
+    }
+
+    if(ret == VERIFY_OK) { fprintf(stderr, "%u pairs appended to %s, %u skipped\n", state.packed, state.out_path, state.skipped); }
+    else { fprintf(stderr, "Error: archive \"%s\": %s (%u pairs appended)\n", state.out_path, VERIFY_RESULT_LOOKUP[ret], state.packed); }
+
+    free(state.records);
+    free(inputs);
+
+    return (ret == VERIFY_OK) ? 0 : 1;
+}
@@ -0,0 +1,383 @@
+/*
+ * respscan.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the response scanner. Every search is bounded by
+ * the end of the input, so that mapped files are scanned where they lie.
+ */
+
+#include "respscan.h"
+
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tomcrypt.h>
+
+/*! response types, as written by cpi_process_xml */
+static const struct
+{
+    const char *type;
+    int cmd;
+}
+respscan_types[] =
+{
+    { "pidx", CPI_CMD_PIDX },
+    { "pkey", CPI_CMD_PKEY },
+    { "vers", CPI_CMD_VERS },
+    { "time", CPI_CMD_TIME },
+    { "ckey", CPI_CMD_CKEY },
+    { "snum", CPI_CMD_SNUM },
+    { "hwvr", CPI_CMD_HWVR },
+    { "chal", CPI_CMD_CHAL }
+};
+
+/*! challenge response fields, by RESPSCAN_CHAL_ index */
+static const char *respscan_chal_tags[RESPSCAN_CHAL_COUNT][2] =
+{
+    { "<enc_owner_key>", "</enc_owner_key>" },
+    { "<rand_data>", "</rand_data>" },
+    { "<vers>", "</vers>" },
+    { "<signature>", "</signature>" }
+};
+
+/*! utility function to find str within [cur, end) (returns 0 if not found) */
+static const char *respscan_find(const char *cur, const char *end, const char *str)
+{
+    size_t len = strlen(str);
+
+    while((size_t)(end - cur) >= len)
+    {
+        const char *hit = (const char*)memchr(cur, str[0], (end - cur) - len + 1);
+
+        if(hit == 0) { return 0; }
+
+        if(memcmp(hit, str, len) == 0) { return hit; }
+
+        cur = hit + 1;
+    }
+
+    return 0;
+}
+
+/*! utility function to check if the tag [tag, tag_end) is named name (name includes the '<') */
+static int respscan_is_tag(const char *tag, const char *tag_end, const char *name)
+{
+    size_t len = strlen(name);
+
+    if( ((size_t)(tag_end - tag) < len) || (memcmp(tag, name, len) != 0) ) { return 0; }
+
+    return (tag + len == tag_end) || isspace((unsigned char)tag[len]) || (tag[len] == '/');
+}
+
+/*! utility function to find the value of an attribute within the tag [tag, tag_end) (returns 1 if found) */
+static int respscan_attribute(const char *tag, const char *tag_end, const char *name, respscan_view *p_view)
+{
+    const char *val = respscan_find(tag, tag_end, name), *end = 0;
+
+    if(val == 0) { return 0; }
+
+    val += strlen(name);
+
+    end = (const char*)memchr(val, '"', tag_end - val);
+
+    if(end == 0) { return 0; }
+
+    p_view->ptr = val;
+    p_view->len = (int)(end - val);
+
+    return 1;
+}
+
+/*! utility function to find the CPI_CMD_ code of a type attribute */
+static int respscan_cmd(const respscan_view *p_type)
+{
+    int v;
+
+    for(v=0;v<(int)(sizeof(respscan_types)/sizeof(respscan_types[0]));v++)
+    {
+        if( ((size_t)p_type->len == strlen(respscan_types[v].type)) && (memcmp(p_type->ptr, respscan_types[v].type, p_type->len) == 0) ) { return respscan_types[v].cmd; }
+    }
+
+    return CPI_CMD_UNKNOWN;
+}
+
+void respscan_init(respscan *p_scan, const char *data, size_t size)
+{
+    p_scan->doc_count = 0;
+
+    respscan_feed(p_scan, data, size);
+
+    return;
+}
+
+void respscan_feed(respscan *p_scan, const char *data, size_t size)
+{
+    p_scan->cur = data;
+    p_scan->end = data + size;
+
+    return;
+}
+
+size_t respscan_left(const respscan *p_scan)
+{
+    return p_scan->end - p_scan->cur;
+}
+
+int respscan_next(respscan *p_scan, respscan_record *p_rec)
+{
+    for(;;)
+    {
+        const char *tag = (const char*)memchr(p_scan->cur, '<', p_scan->end - p_scan->cur), *tag_end = 0, *body = 0, *close = 0, *field = 0;
+
+        int v;
+
+        if(tag == 0) { p_scan->cur = p_scan->end; return RESPSCAN_END; }
+
+        p_scan->cur = tag;
+
+        tag_end = (const char*)memchr(tag, '>', p_scan->end - tag);
+
+        if(tag_end == 0) { return RESPSCAN_MORE; }
+
+        /*! a stray '<' does not hide the tag which follows it */
+        {
+            const char *inner = (const char*)memchr(tag + 1, '<', tag_end - tag - 1);
+
+            if(inner != 0) { p_scan->cur = inner; continue; }
+        }
+
+        /*! each <response_list> begins a document; other tags than <response> are skipped */
+        if(respscan_is_tag(tag, tag_end, "<response_list")) { p_scan->doc_count++; }
+
+        if(!respscan_is_tag(tag, tag_end, "<response")) { p_scan->cur = tag_end + 1; continue; }
+
+        body = tag_end + 1;
+
+        close = respscan_find(body, p_scan->end, "</response>");
+
+        if(close == 0) { return RESPSCAN_MORE; }
+
+        p_scan->cur = close + strlen("</response>");
+
+        memset(p_rec, 0, sizeof(respscan_record));
+
+        p_rec->doc = (p_scan->doc_count > 0) ? p_scan->doc_count - 1 : 0;
+        p_rec->body.ptr = body;
+        p_rec->body.len = (int)(close - body);
+
+        /*! every response carries a result, unknown queries have no type */
+        {
+            respscan_view result;
+
+            if(!respscan_attribute(tag, tag_end, "result=\"", &result)) { return RESPSCAN_E_PARSE; }
+
+            p_rec->success = (result.len == 7) && (memcmp(result.ptr, "success", 7) == 0);
+        }
+
+        if(respscan_attribute(tag, tag_end, "type=\"", &p_rec->type)) { p_rec->cmd = respscan_cmd(&p_rec->type); }
+
+        if( !p_rec->success || (p_rec->cmd != CPI_CMD_CHAL) ) { return RESPSCAN_OK; }
+
+        /*! challenge result fields, in document order */
+        for(v=0,field=body;v<RESPSCAN_CHAL_COUNT;v++)
+        {
+            const char *beg = respscan_find(field, close, respscan_chal_tags[v][0]), *end = 0;
+
+            if(beg == 0) { continue; }
+
+            beg += strlen(respscan_chal_tags[v][0]);
+
+            end = respscan_find(beg, close, respscan_chal_tags[v][1]);
+
+            if(end == 0) { continue; }
+
+            p_rec->chal[v].ptr = beg;
+            p_rec->chal[v].len = (int)(end - beg);
+
+            field = end;
+        }
+
+        return RESPSCAN_OK;
+    }
+}
+
+int respscan_hex(const respscan_view *p_view, uint8_t *out, int size)
+{
+    int v, digits = 0;
+
+    if(p_view->ptr == 0) { return 0; }
+
+    for(v=0;v<p_view->len;v++)
+    {
+        int c = (unsigned char)p_view->ptr[v], nibble = 0;
+
+        if(isspace(c) || (c == '-')) { continue; }
+
+        if(!isxdigit(c) || (digits == size*2)) { return 0; }
+
+        nibble = isdigit(c) ? (c - '0') : (toupper(c) - 'A' + 10);
+
+        if(digits % 2 == 0) { out[digits/2] = (uint8_t)(nibble << 4); } else { out[digits/2] |= (uint8_t)nibble; }
+
+        digits++;
+    }
+
+    return digits == size*2;
+}
+
+/*! utility function to decode a decimal number at *p_cur, up to max (returns 1 on success, and advances *p_cur) */
+static int respscan_number(const char **p_cur, const char *end, uint32_t max, uint32_t *p_value)
+{
+    const char *cur = *p_cur;
+
+    uint32_t value = 0;
+
+    if( (cur == end) || !isdigit((unsigned char)*cur) ) { return 0; }
+
+    for(;(cur < end) && isdigit((unsigned char)*cur);cur++)
+    {
+        uint32_t digit = (uint32_t)(*cur - '0');
+
+        if(value > (max - digit) / 10) { return 0; }
+
+        value = value * 10 + digit;
+    }
+
+    *p_cur = cur;
+    *p_value = value;
+
+    return 1;
+}
+
+/*! utility function to trim whitespace off both ends of a view */
+static void respscan_trim(const respscan_view *p_view, const char **p_beg, const char **p_end)
+{
+    const char *beg = p_view->ptr, *end = p_view->ptr + p_view->len;
+
+    while( (beg < end) && isspace((unsigned char)beg[0]) ) { beg++; }
+    while( (end > beg) && isspace((unsigned char)end[-1]) ) { end--; }
+
+    *p_beg = beg;
+    *p_end = end;
+
+    return;
+}
+
+int respscan_uint(const respscan_view *p_view, uint32_t *p_value)
+{
+    const char *cur = 0, *end = 0;
+
+    if(p_view->ptr == 0) { return 0; }
+
+    respscan_trim(p_view, &cur, &end);
+
+    return respscan_number(&cur, end, UINT32_MAX, p_value) && (cur == end);
+}
+
+int respscan_version(const respscan_view *p_view, uint16_t *p_major, uint16_t *p_minor, uint16_t *p_fix)
+{
+    const char *cur = 0, *end = 0;
+
+    uint32_t part[3];
+
+    int v;
+
+    if(p_view->ptr == 0) { return 0; }
+
+    respscan_trim(p_view, &cur, &end);
+
+    for(v=0;v<3;v++)
+    {
+        if( (v > 0) && ((cur == end) || (*cur++ != '.')) ) { return 0; }
+
+        if(!respscan_number(&cur, end, UINT16_MAX, &part[v])) { return 0; }
+    }
+
+    if(cur != end) { return 0; }
+
+    *p_major = (uint16_t)part[0];
+    *p_minor = (uint16_t)part[1];
+    *p_fix = (uint16_t)part[2];
+
+    return 1;
+}
+
+int respscan_pkey(const respscan_view *p_view, uint8_t *raw, unsigned long *p_len)
+{
+    static const char begin[] = "-----BEGIN PGP PUBLIC KEY BLOCK-----", end[] = "-----END PGP PUBLIC KEY BLOCK-----";
+
+    unsigned char b64[CPI_MAX_RESULT_SIZE];
+
+    unsigned long b64_len = 0;
+
+    const char *beg = 0, *fin = 0, *cur = 0;
+
+    if(p_view->ptr == 0) { return 0; }
+
+    beg = respscan_find(p_view->ptr, p_view->ptr + p_view->len, begin);
+
+    if(beg == 0) { return 0; }
+
+    beg += sizeof(begin) - 1;
+
+    fin = respscan_find(beg, p_view->ptr + p_view->len, end);
+
+    if(fin == 0) { return 0; }
+
+    /*! keep the base64 alphabet only, up to the armor checksum line, if any */
+    for(cur=beg;(cur<fin) && (b64_len<sizeof(b64));cur++)
+    {
+        if( (cur[0] == '\n') && (cur + 1 < fin) && (cur[1] == '=') ) { break; }
+
+        if(isalnum((unsigned char)*cur) || (*cur == '+') || (*cur == '/') || (*cur == '=')) { b64[b64_len++] = (unsigned char)*cur; }
+    }
+
+    return base64_decode(b64, b64_len, raw, p_len) == CRYPT_OK;
+}
+
+int respscan_map(respscan_file *p_file, const char *path)
+{
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+
+    void *data = 0;
+
+    if(fd < 0) { return 0; }
+
+    if( (fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) ) { close(fd); return 0; }
+
+    p_file->size = (size_t)st.st_size;
+
+    /*! nothing to map */
+    if(p_file->size == 0) { close(fd); p_file->data = ""; return 1; }
+
+    data = mmap(0, p_file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if(data == MAP_FAILED) { return 0; }
+
+    /*! scanned once, front to back */
+    madvise(data, p_file->size, MADV_SEQUENTIAL);
+
+    p_file->data = (const char*)data;
+
+    return 1;
+}
+
+void respscan_unmap(respscan_file *p_file)
+{
+    if(p_file->size != 0) { munmap((void*)p_file->data, p_file->size); }
+
+    p_file->data = 0;
+    p_file->size = 0;
+
+    return;
+}
@@ -0,0 +1,112 @@
+/*
+ * respscan.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API defines the response scanner, which walks the <response_list>
+ * documents written by cpi_process_xml (see src/cp_format.c) in one pass,
+ * without copying them. Each response comes back as a typed record whose
+ * values are views into the input; hex, decimal and base64 values are only
+ * decoded when asked for.
+ *
+ * Input need not be null terminated, may hold any number of documents back
+ * to back (e.g. a mapped corpus of concatenated responseN.xml files), and may
+ * be fed in pieces: a response cut off by the end of the input is left for
+ * the next piece (see respscan_feed).
+ */
+
+#ifndef RESPSCAN_H
+#define RESPSCAN_H
+
+#include "cp_interface.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*! \name respscan_next results */
+/*! \{ */
+#define RESPSCAN_OK             0x00    /*!< A response was scanned */
+#define RESPSCAN_END            0x01    /*!< No more responses in the input */
+#define RESPSCAN_MORE           0x02    /*!< The input ends within a response, feed more (or the input is truncated) */
+#define RESPSCAN_E_PARSE        0x03    /*!< A response tag is malformed, the response is skipped */
+/*! \} */
+
+/*! \name challenge response fields, in document order */
+/*! \{ */
+#define RESPSCAN_CHAL_ENC_OK    0x00    /*!< <enc_owner_key>, hex */
+#define RESPSCAN_CHAL_RAND      0x01    /*!< <rand_data>, hex */
+#define RESPSCAN_CHAL_VERS      0x02    /*!< <vers>, hex */
+#define RESPSCAN_CHAL_SIG       0x03    /*!< <signature>, hex (result3, where present, is appended) */
+#define RESPSCAN_CHAL_COUNT     0x04
+/*! \} */
+
+/*! text within the input, not null terminated (ptr is 0 if absent) */
+typedef struct _respscan_view
+{
+    const char *ptr;
+    int         len;
+}
+respscan_view;
+
+/*! one response */
+typedef struct _respscan_record
+{
+    int           cmd;                          /*!< CPI_CMD_ code of the type attribute, CPI_CMD_UNKNOWN if absent or unknown */
+    int           success;                      /*!< 1 if result="success" */
+    uint32_t      doc;                          /*!< document holding the response, counted from 0 within the input */
+    respscan_view type;                         /*!< type attribute */
+    respscan_view body;                         /*!< text between the tags; the CPI return code string on failure */
+    respscan_view chal[RESPSCAN_CHAL_COUNT];    /*!< successful challenge responses: text of each field, by RESPSCAN_CHAL_ index */
+}
+respscan_record;
+
+/*! scanner state */
+typedef struct _respscan
+{
+    const char *cur;                /*!< first byte not consumed */
+    const char *end;                /*!< end of the input */
+    uint32_t    doc_count;          /*!< <response_list> tags seen so far */
+}
+respscan;
+
+/*! a file mapped into memory for scanning */
+typedef struct _respscan_file
+{
+    const char *data;
+    size_t      size;
+}
+respscan_file;
+
+/*! start scanning size bytes of input */
+void respscan_init(respscan *p_scan, const char *data, size_t size);
+
+/*! continue scanning on new input, which begins with the bytes left unconsumed by the last (see respscan_left) */
+void respscan_feed(respscan *p_scan, const char *data, size_t size);
+
+/*! number of bytes at the end of the input not consumed yet */
+size_t respscan_left(const respscan *p_scan);
+
+/*! scan the next response (returns RESPSCAN_ result; on RESPSCAN_MORE, nothing of the cut off response is consumed) */
+int respscan_next(respscan *p_scan, respscan_record *p_rec);
+
+/*! decode exactly size bytes of hex, ignoring whitespace and '-' separators (returns 1 on success) */
+int respscan_hex(const respscan_view *p_view, uint8_t *out, int size);
+
+/*! decode a decimal value, as written for time and ckey (returns 1 on success) */
+int respscan_uint(const respscan_view *p_view, uint32_t *p_value);
+
+/*! decode a major.minor.fix version string, as written for vers (returns 1 on success) */
+int respscan_version(const respscan_view *p_view, uint16_t *p_major, uint16_t *p_minor, uint16_t *p_fix);
+
+/*! decode the armored public key packet of a pkey response into raw, which holds *p_len bytes (returns 1 on success, and sets *p_len) */
+int respscan_pkey(const respscan_view *p_view, uint8_t *raw, unsigned long *p_len);
+
+/*! map a whole file read only (returns 1 on success) */
+int respscan_map(respscan_file *p_file, const char *path);
+
+/*! unmap a file mapped by respscan_map */
+void respscan_unmap(respscan_file *p_file);
+
+#endif
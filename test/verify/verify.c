@@ -0,0 +1,1009 @@
+/*
+ * verify.c
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This module implements the challenge-response verification engine. The
+ * checks follow test/src/main.c: the version is compared, rm is inverted mod N
+ * to unblind the signature, the public key operation must yield a PKCS#1 v1.5
+ * SHA-1 signature of the "full hash", and the owner key (if its private key is
+ * known) must decrypt to a PKCS#1 v1.5 encryption block.
+ *
+ * Items are independent, and keys are only read once loaded, so any number of
+ * threads may verify items at the same time, each with its own verify_context.
+ */
+
+#define _GNU_SOURCE
+
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <tomcrypt.h>
+
+/*! window size of verify_mont_exptmod for exponents longer than 32 bits, in bits */
+#define VERIFY_MONT_WINDOW      4
+
+/*! DER encoded DigestInfo header of a SHA-1 hash, which precedes the hash in a PKCS#1 v1.5 signature block */
+static const uint8_t verify_sha1_prefix[] = { 0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2B, 0x0E, 0x03, 0x02, 0x1A, 0x05, 0x00, 0x04, 0x14 };
+
+const char *VERIFY_RESULT_LOOKUP[VERIFY_RESULT_COUNT] =
+{
+    "ok",
+    "unreadable file",
+    "malformed file",
+    "unknown PIDx",
+    "key ID mismatch",
+    "public key mismatch",
+    "version mismatch",
+    "rm not invertible",
+    "bad signature padding",
+    "full hash mismatch",
+    "bad owner key padding",
+    "big number error",
+    "inconsistent private key"
+};
+
+char *verify_read_file(const char *path, long *p_size)
+{
+    FILE *file = fopen(path, "rb");
+
+    char *data = 0;
+
+    long size = 0;
+
+    if(file == 0) { return 0; }
+
+    if( (fseek(file, 0, SEEK_END) == 0) && ((size = ftell(file)) >= 0) && (fseek(file, 0, SEEK_SET) == 0) )
+    {
+        data = (char*)malloc(size + 1);
+
+        if( (data != 0) && (fread(data, 1, size, file) != (size_t)size) ) { free(data); data = 0; }
+    }
+
+    fclose(file);
+
+    if(data == 0) { return 0; }
+
+    data[size] = '\0';
+
+    if(p_size != 0) { *p_size = size; }
+
+    return data;
+}
+
+int verify_hex(const char *str, int len, uint8_t *out, int size)
+{
+    respscan_view view = { str, len };
+
+    return respscan_hex(&view, out, size);
+}
+
+/*! utility function to find the value of an attribute within the tag starting at tag (returns 0 if not found) */
+static const char *verify_attribute(const char *tag, const char *name, int *p_len)
+{
+    const char *tag_end = strchr(tag, '>'), *val = strstr(tag, name), *end = 0;
+
+    if( (tag_end == 0) || (val == 0) || (val > tag_end) ) { return 0; }
+
+    val += strlen(name);
+
+    end = strchr(val, '"');
+
+    if( (end == 0) || (end > tag_end) ) { return 0; }
+
+    *p_len = (int)(end - val);
+
+    return val;
+}
+
+int verify_init(void)
+{
+    /*! register sha-1 hash function */
+    if(register_hash(&sha1_desc) == -1) { return VERIFY_E_MATH; }
+
+    /*! register math library (see test/src/main.c, invmod is needed to undo blinding) */
+    ltc_mp = ltm_desc;
+
+    return VERIFY_OK;
+}
+
+/*! utility function to compute x = x - y mod N, for x and y in [0, N) */
+static int verify_sub_mod(void *x, void *y, void *N)
+{
+    int ret = CRYPT_OK;
+
+    if( (ltc_mp.compare(x, y) == LTC_MP_LT) && ((ret = ltc_mp.add(x, N, x)) != CRYPT_OK) ) { return ret; }
+
+    return ltc_mp.sub(x, y, x);
+}
+
+void verify_init_context(verify_context *p_ctx)
+{
+    memset(p_ctx, 0, sizeof(verify_context));
+
+    return;
+}
+
+/*! utility function to release one Montgomery context */
+static void verify_free_mont(verify_mont *p_mont)
+{
+    if(p_mont->size == 0) { return; }
+
+    ltc_mp.montgomery_deinit(p_mont->rho);
+
+    ltc_deinit_multi(p_mont->N, p_mont->R, p_mont->R2, NULL);
+
+    memset(p_mont, 0, sizeof(verify_mont));
+
+    return;
+}
+
+void verify_free_context(verify_context *p_ctx)
+{
+    int v;
+
+    for(v=0;v<VERIFY_MONT_CACHE;v++) { verify_free_mont(&p_ctx->mont[v]); }
+
+    return;
+}
+
+/*! utility function to set up the Montgomery context of a modulus (returns 0 on failure, leaving p_mont unused) */
+static int verify_setup_mont(verify_mont *p_mont, const uint8_t *n, int size)
+{
+    if(ltc_init_multi(&p_mont->N, &p_mont->R, &p_mont->R2, NULL) != CRYPT_OK) { return 0; }
+
+    /*! Montgomery reduction needs an odd modulus */
+    if( (ltc_mp.unsigned_read(p_mont->N, (unsigned char*)n, size) != CRYPT_OK) || ((ltc_mp.get_digit(p_mont->N, 0) & 1) == 0) ||
+        (ltc_mp.compare_d(p_mont->N, 1) != LTC_MP_GT) || (ltc_mp.montgomery_setup(p_mont->N, &p_mont->rho) != CRYPT_OK) )
+    {
+        ltc_deinit_multi(p_mont->N, p_mont->R, p_mont->R2, NULL);
+        return 0;
+    }
+
+    if( (ltc_mp.montgomery_normalization(p_mont->R, p_mont->N) != CRYPT_OK) || (ltc_mp.mulmod(p_mont->R, p_mont->R, p_mont->N, p_mont->R2) != CRYPT_OK) )
+    {
+        ltc_mp.montgomery_deinit(p_mont->rho);
+        ltc_deinit_multi(p_mont->N, p_mont->R, p_mont->R2, NULL);
+        return 0;
+    }
+
+    memcpy(p_mont->n, n, size);
+
+    p_mont->size = size;
+
+    return 1;
+}
+
+const verify_mont *verify_get_mont(verify_context *p_ctx, const uint8_t *n, int size)
+{
+    verify_mont *p_mont = &p_ctx->mont[0];
+
+    int v;
+
+    if( (size <= 0) || (size > VERIFY_MONT_MAX_SIZE) ) { return 0; }
+
+    p_ctx->clock++;
+
+    for(v=0;v<VERIFY_MONT_CACHE;v++)
+    {
+        verify_mont *p_cur = &p_ctx->mont[v];
+
+        if( (p_cur->size == size) && (memcmp(p_cur->n, n, size) == 0) ) { p_cur->last_use = p_ctx->clock; return p_cur; }
+
+        /*! an unused slot, or else the least recently used one, is replaced */
+        if( (p_mont->size != 0) && ((p_cur->size == 0) || (p_cur->last_use < p_mont->last_use)) ) { p_mont = p_cur; }
+    }
+
+    verify_free_mont(p_mont);
+
+    if(!verify_setup_mont(p_mont, n, size)) { return 0; }
+
+    p_mont->last_use = p_ctx->clock;
+
+    return p_mont;
+}
+
+/*! utility function to multiply in Montgomery form: a = a * b / R mod N */
+static int verify_mont_mul(const verify_mont *p_mont, void *a, void *b)
+{
+    int ret = (a == b) ? ltc_mp.sqr(a, a) : ltc_mp.mul(a, b, a);
+
+    if(ret != CRYPT_OK) { return ret; }
+
+    return ltc_mp.montgomery_reduce(a, p_mont->N, p_mont->rho);
+}
+
+int verify_mont_power(const verify_mont *p_mont, void *a, const uint8_t *exp, int exp_size, void *c)
+{
+    /*! a^v * R mod N, for every window value v; accumulator */
+    void *table[1 << VERIFY_MONT_WINDOW], *acc = 0;
+
+    /*! short (public) exponents are done a bit at a time, where a table would cost more than it saves */
+    int window = (exp_size > 4) ? VERIFY_MONT_WINDOW : 1, entries = 1 << window, ready = 0, started = 0, ret = CRYPT_OK, v, bit;
+
+    if(ltc_mp.init(&acc) != CRYPT_OK) { return CRYPT_MEM; }
+
+    for(ready=1;ready<entries;ready++)
+    {
+        if(ltc_mp.init(&table[ready]) != CRYPT_OK) { ret = CRYPT_MEM; goto cleanup; }
+    }
+
+    if( ((ret = ltc_mp.copy(a, table[1])) != CRYPT_OK) || ((ret = verify_mont_mul(p_mont, table[1], p_mont->R2)) != CRYPT_OK) ) { goto cleanup; }
+
+    for(v=2;v<entries;v++)
+    {
+        if( ((ret = ltc_mp.copy(table[v-1], table[v])) != CRYPT_OK) || ((ret = verify_mont_mul(p_mont, table[v], table[1])) != CRYPT_OK) ) { goto cleanup; }
+    }
+
+    /*! fixed window exponentiation, from the most significant end of the exponent */
+    if((ret = ltc_mp.copy(p_mont->R, acc)) != CRYPT_OK) { goto cleanup; }
+
+    for(bit=exp_size*8-window;bit>=0;bit-=window)
+    {
+        int digit = (exp[exp_size - 1 - bit/8] >> (bit%8)) & (entries - 1);
+
+        for(v=0;started && (v<window);v++) { if((ret = verify_mont_mul(p_mont, acc, acc)) != CRYPT_OK) { goto cleanup; } }
+
+        if(digit == 0) { continue; }
+
+        if((ret = verify_mont_mul(p_mont, acc, table[digit])) != CRYPT_OK) { goto cleanup; }
+
+        started = 1;
+    }
+
+    /*! leave Montgomery form */
+    if((ret = ltc_mp.montgomery_reduce(acc, p_mont->N, p_mont->rho)) != CRYPT_OK) { goto cleanup; }
+
+    ret = ltc_mp.copy(acc, c);
+
+cleanup:
+
+    /*! cleanup big numbers */
+    for(v=1;v<ready;v++) { ltc_mp.deinit(table[v]); }
+
+    ltc_mp.deinit(acc);
+
+    return ret;
+}
+
+int verify_mont_exptmod(const verify_mont *p_mont, const uint8_t *in, const uint8_t *exp, int exp_size, uint8_t *out)
+{
+    void *val = 0;
+
+    unsigned long size = 0;
+
+    int ret = CRYPT_OK;
+
+    if(ltc_mp.init(&val) != CRYPT_OK) { return CRYPT_MEM; }
+
+    /*! refuse input not less than the modulus, as rsa_me does */
+    if((ret = ltc_mp.unsigned_read(val, (unsigned char*)in, p_mont->size)) != CRYPT_OK) { goto cleanup; }
+
+    if(ltc_mp.compare(val, p_mont->N) != LTC_MP_LT) { ret = CRYPT_PK_INVALID_SIZE; goto cleanup; }
+
+    if((ret = verify_mont_power(p_mont, val, exp, exp_size, val)) != CRYPT_OK) { goto cleanup; }
+
+    size = ltc_mp.unsigned_size(val);
+
+    if(size > (unsigned long)p_mont->size) { ret = CRYPT_ERROR; goto cleanup; }
+
+    memset(out, 0, p_mont->size);
+
+    ret = ltc_mp.unsigned_write(val, &out[p_mont->size - size]);
+
+cleanup:
+
+    ltc_mp.deinit(val);
+
+    return ret;
+}
+
+/*! utility function to order directory entries the way collect.sh numbers them */
+static int verify_compare_names(const void *a, const void *b)
+{
+    return strverscmp(*(const char**)a, *(const char**)b);
+}
+
+int verify_list_dir(const char *dir_path, const char *prefix, const char *suffix, char ***p_paths)
+{
+    DIR *dir = opendir(dir_path);
+
+    struct dirent *entry = 0;
+
+    char **paths = 0;
+
+    int count = 0;
+
+    if(dir == 0) { return -1; }
+
+    while((entry = readdir(dir)) != 0)
+    {
+        char path[PATH_MAX];
+
+        struct stat st;
+
+        int len = (int)strlen(entry->d_name), suffix_len = (int)strlen(suffix);
+
+        if( (entry->d_name[0] == '.') || (strncmp(entry->d_name, prefix, strlen(prefix)) != 0) ) { continue; }
+
+        if( (len < suffix_len) || (strcmp(&entry->d_name[len - suffix_len], suffix) != 0) ) { continue; }
+
+        if(snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name) >= (int)sizeof(path)) { continue; }
+
+        if( (stat(path, &st) != 0) || !S_ISREG(st.st_mode) ) { continue; }
+
+        paths = (char**)realloc(paths, (count + 1) * sizeof(char*));
+
+        if(paths == 0) { closedir(dir); return -1; }
+
+        paths[count] = strdup(path);
+
+        if(paths[count++] == 0) { closedir(dir); return -1; }
+    }
+
+    closedir(dir);
+
+    qsort(paths, count, sizeof(char*), verify_compare_names);
+
+    *p_paths = paths;
+
+    return count;
+}
+
+int verify_add_keys(verify_keys *p_keys, const char *path)
+{
+    keystore *stores = 0;
+
+    int ret = VERIFY_OK;
+
+    /*! key files are collected, and built into one image later */
+    if(!keystore_probe(path)) { return keystore_add_path(&p_keys->builder, path); }
+
+    stores = (keystore*)realloc(p_keys->stores, (p_keys->store_count + 1) * sizeof(keystore));
+
+    if(stores == 0) { return VERIFY_E_READ; }
+
+    p_keys->stores = stores;
+
+    ret = keystore_open(&stores[p_keys->store_count], path);
+
+    if(ret == VERIFY_OK) { p_keys->store_count++; }
+
+    return ret;
+}
+
+int verify_finish_keys(verify_keys *p_keys)
+{
+    keystore *stores = 0;
+
+    int ret = VERIFY_OK;
+
+    if(p_keys->builder.unit_count == 0) { return VERIFY_OK; }
+
+    stores = (keystore*)realloc(p_keys->stores, (p_keys->store_count + 1) * sizeof(keystore));
+
+    if(stores == 0) { keystore_free_builder(&p_keys->builder); return VERIFY_E_READ; }
+
+    p_keys->stores = stores;
+
+    ret = keystore_build(&p_keys->builder, &stores[p_keys->store_count]);
+
+    if(ret == VERIFY_OK) { p_keys->store_count++; }
+
+    return ret;
+}
+
+void verify_free_keys(verify_keys *p_keys)
+{
+    int v;
+
+    for(v=0;v<p_keys->store_count;v++) { keystore_close(&p_keys->stores[v]); }
+
+    free(p_keys->stores);
+
+    keystore_free_builder(&p_keys->builder);
+
+    memset(p_keys, 0, sizeof(verify_keys));
+
+    return;
+}
+
+const keystore_key *verify_find_key(const verify_keys *p_keys, const uint8_t *pid, const char **p_unit)
+{
+    int v;
+
+    for(v=0;v<p_keys->store_count;v++)
+    {
+        const keystore_key *p_key = keystore_find_pid(&p_keys->stores[v], pid);
+
+        if(p_key != 0)
+        {
+            if(p_unit != 0) { *p_unit = keystore_unit_name(&p_keys->stores[v], p_key->unit); }
+
+            return p_key;
+        }
+    }
+
+    return 0;
+}
+
+/*! utility function to read a raw big endian number into a fixed size buffer, right aligned */
+static int verify_load_number(const char *path, uint8_t *out, int size)
+{
+    long len = 0;
+
+    char *data = verify_read_file(path, &len);
+
+    if(data == 0) { return VERIFY_E_READ; }
+
+    if( (len == 0) || (len > size) ) { free(data); return VERIFY_E_PARSE; }
+
+    memset(out, 0, size);
+    memcpy(&out[size - len], data, len);
+
+    free(data);
+
+    return VERIFY_OK;
+}
+
+int verify_load_owner(verify_owner *p_owner, const char *n_path, const char *d_path)
+{
+    int ret = verify_load_number(n_path, p_owner->n, sizeof(p_owner->n));
+
+    if(ret != VERIFY_OK) { return ret; }
+
+    return verify_load_number(d_path, p_owner->d, sizeof(p_owner->d));
+}
+
+/*! utility function to write a big number into a fixed size buffer, big endian, right aligned (returns 0 if it does not fit) */
+static int verify_store_number(void *a, uint8_t *out, int size)
+{
+    unsigned long len = ltc_mp.unsigned_size(a);
+
+    if(len > (unsigned long)size) { return 0; }
+
+    memset(out, 0, size);
+
+    return ltc_mp.unsigned_write(a, &out[size - len]) == CRYPT_OK;
+}
+
+int verify_load_crt_key(verify_crt_key *p_key, const char *n_path, const char *e_path, const char *d_path, const char *p_path, const char *q_path)
+{
+    uint8_t e[CPI_RESULT1_ENC_OK_SIZE], d[CPI_RESULT1_ENC_OK_SIZE];
+
+    /*! n, e, d, p, q, p-1, q-1, CRT parameters, temporary */
+    void *N = 0, *E = 0, *D = 0, *P = 0, *Q = 0, *P1 = 0, *Q1 = 0, *DP = 0, *DQ = 0, *QI = 0, *tmp = 0;
+
+    int ret = VERIFY_OK;
+
+    if( ((ret = verify_load_number(n_path, p_key->n, sizeof(p_key->n))) != VERIFY_OK) ||
+        ((ret = verify_load_number(e_path, e, sizeof(e))) != VERIFY_OK) ||
+        ((ret = verify_load_number(d_path, d, sizeof(d))) != VERIFY_OK) ||
+        ((ret = verify_load_number(p_path, p_key->p, sizeof(p_key->p))) != VERIFY_OK) ||
+        ((ret = verify_load_number(q_path, p_key->q, sizeof(p_key->q))) != VERIFY_OK) ) { return ret; }
+
+    /*! initialize big numbers */
+    if(ltc_init_multi(&N, &E, &D, &P, &Q, &P1, &Q1, &DP, &DQ, &QI, &tmp, NULL) != CRYPT_OK) { return VERIFY_E_MATH; }
+
+    if( (ltc_mp.unsigned_read(N, p_key->n, sizeof(p_key->n)) != CRYPT_OK) || (ltc_mp.unsigned_read(E, e, sizeof(e)) != CRYPT_OK) ||
+        (ltc_mp.unsigned_read(D, d, sizeof(d)) != CRYPT_OK) || (ltc_mp.unsigned_read(P, p_key->p, sizeof(p_key->p)) != CRYPT_OK) ||
+        (ltc_mp.unsigned_read(Q, p_key->q, sizeof(p_key->q)) != CRYPT_OK) || (ltc_mp.set_int(tmp, 1) != CRYPT_OK) ||
+        (ltc_mp.sub(P, tmp, P1) != CRYPT_OK) || (ltc_mp.sub(Q, tmp, Q1) != CRYPT_OK) ) { ret = VERIFY_E_MATH; goto cleanup; }
+
+    /*! odd primes, n = p * q, and e * d = 1 mod (p-1) and mod (q-1), as decrypt_test.pl and check_key would have it */
+    if( ((ltc_mp.get_digit(P, 0) & 1) == 0) || ((ltc_mp.get_digit(Q, 0) & 1) == 0) || (ltc_mp.compare_d(P1, 1) != LTC_MP_GT) || (ltc_mp.compare_d(Q1, 1) != LTC_MP_GT) ||
+        (ltc_mp.mul(P, Q, tmp) != CRYPT_OK) || (ltc_mp.compare(tmp, N) != LTC_MP_EQ) ||
+        (ltc_mp.mulmod(E, D, P1, tmp) != CRYPT_OK) || (ltc_mp.compare_d(tmp, 1) != LTC_MP_EQ) ||
+        (ltc_mp.mulmod(E, D, Q1, tmp) != CRYPT_OK) || (ltc_mp.compare_d(tmp, 1) != LTC_MP_EQ) ) { ret = VERIFY_E_PRIV_KEY; goto cleanup; }
+
+    /*! dP = d mod (p-1), dQ = d mod (q-1), qInv = q^-1 mod p */
+    if( (ltc_mp.mpdiv(D, P1, NULL, DP) != CRYPT_OK) || (ltc_mp.mpdiv(D, Q1, NULL, DQ) != CRYPT_OK) || (ltc_mp.invmod(Q, P, QI) != CRYPT_OK) ) { ret = VERIFY_E_PRIV_KEY; goto cleanup; }
+
+    if( !verify_store_number(DP, p_key->dp, sizeof(p_key->dp)) || !verify_store_number(DQ, p_key->dq, sizeof(p_key->dq)) ||
+        !verify_store_number(QI, p_key->qi, sizeof(p_key->qi)) ) { ret = VERIFY_E_MATH; }
+
+cleanup:
+
+    /*! cleanup big numbers */
+    ltc_deinit_multi(N, E, D, P, Q, P1, Q1, DP, DQ, QI, tmp, NULL);
+
+    return ret;
+}
+
+int verify_parse_query(const char *doc, uint16_t *p_key_id, uint8_t *rndx)
+{
+    const char *tag = strstr(doc, "<query type=\"chal\""), *val = 0;
+
+    char *end = 0;
+
+    int len = 0;
+
+    if(tag == 0) { return VERIFY_E_PARSE; }
+
+    val = verify_attribute(tag, "key_id=\"", &len);
+
+    if(val == 0) { return VERIFY_E_PARSE; }
+
+    *p_key_id = (uint16_t)strtoul(val, &end, 10);
+
+    if(end != val + len) { return VERIFY_E_PARSE; }
+
+    val = verify_attribute(tag, "rand_data=\"", &len);
+
+    if( (val == 0) || !verify_hex(val, len, rndx, CPI_RNDX_SIZE) ) { return VERIFY_E_PARSE; }
+
+    return VERIFY_OK;
+}
+
+/*! utility function to lay out the challenged key ID of an item in its message */
+static void verify_set_key_id(verify_item *p_item)
+{
+    p_item->msg[VERIFY_MSG_KEY_ID + 0] = 0;
+    p_item->msg[VERIFY_MSG_KEY_ID + 1] = 0;
+    p_item->msg[VERIFY_MSG_KEY_ID + 2] = (uint8_t)((p_item->key_id >> 8) & 0xFF);
+    p_item->msg[VERIFY_MSG_KEY_ID + 3] = (uint8_t)((p_item->key_id >> 0) & 0xFF);
+
+    return;
+}
+
+/*! utility function to parse the request of an item */
+static int verify_parse_request(verify_item *p_item, const char *doc)
+{
+    int ret = verify_parse_query(doc, &p_item->key_id, &p_item->msg[VERIFY_MSG_RNDX]);
+
+    if(ret == VERIFY_OK) { verify_set_key_id(p_item); }
+
+    return ret;
+}
+
+/*! utility function to parse the response of an item, from the first pidx, chal and pkey responses of the document */
+static int verify_parse_response(verify_item *p_item, const char *doc, long size)
+{
+    respscan scan;
+
+    respscan_record rec;
+
+    int has_pid = 0, has_chal = 0, has_pkey = 0;
+
+    respscan_init(&scan, doc, size);
+
+    while(respscan_next(&scan, &rec) == RESPSCAN_OK)
+    {
+        if( !rec.success || (rec.doc != 0) ) { continue; }
+
+        switch(rec.cmd)
+        {
+            /*! putative ID, in GUID format */
+            case CPI_CMD_PIDX:
+                if(has_pid++ == 0) { if(!respscan_hex(&rec.body, p_item->pid, 0x10)) { return VERIFY_E_PARSE; } }
+                break;
+
+            /*! challenge result */
+            case CPI_CMD_CHAL:
+                if(has_chal++ == 0)
+                {
+                    if( !respscan_hex(&rec.chal[RESPSCAN_CHAL_ENC_OK], &p_item->msg[VERIFY_MSG_ENC_OK], CPI_RESULT1_ENC_OK_SIZE) ||
+                        !respscan_hex(&rec.chal[RESPSCAN_CHAL_RAND], &p_item->msg[VERIFY_MSG_RAND], CPI_RESULT1_RAND_SIZE) ||
+                        !respscan_hex(&rec.chal[RESPSCAN_CHAL_VERS], &p_item->msg[VERIFY_MSG_VERS], CPI_RESULT1_VERS_SIZE) ||
+                        !respscan_hex(&rec.chal[RESPSCAN_CHAL_SIG], p_item->result2, CPI_RESULT2_SIZE) ) { return VERIFY_E_PARSE; }
+                }
+                break;
+
+            /*! public key, if queried: 10 bytes of header, the modulus, 2 bytes, and the exponent (see check_cp.pl) */
+            case CPI_CMD_PKEY:
+                if(has_pkey++ == 0)
+                {
+                    uint8_t raw[CPI_MAX_RESULT_SIZE];
+
+                    unsigned long raw_len = sizeof(raw);
+
+                    if( respscan_pkey(&rec.body, raw, &raw_len) && (raw_len >= 10 + VERIFY_N_SIZE + 2 + 4) )
+                    {
+                        memcpy(p_item->pkey_n, &raw[10], VERIFY_N_SIZE);
+                        memcpy(p_item->pkey_e, &raw[10 + VERIFY_N_SIZE + 2], 4);
+
+                        p_item->has_pkey = 1;
+                    }
+                }
+                break;
+        }
+    }
+
+    return (has_pid && has_chal) ? VERIFY_OK : VERIFY_E_PARSE;
+}
+
+/*! utility function to fill an item from its archive record, which needs no parsing */
+static int verify_parse_record(verify_item *p_item)
+{
+    cpi_archive_record_t rec;
+
+    if(archive_get(p_item->p_archive, p_item->record, &rec) != VERIFY_OK) { return VERIFY_E_PARSE; }
+
+    p_item->key_id = rec.key_id;
+
+    memcpy(p_item->pid, rec.pid, sizeof(p_item->pid));
+    memcpy(&p_item->msg[VERIFY_MSG_ENC_OK], rec.enc_ok, CPI_RESULT1_ENC_OK_SIZE);
+    memcpy(&p_item->msg[VERIFY_MSG_RNDX], rec.rndx, CPI_RNDX_SIZE);
+    memcpy(&p_item->msg[VERIFY_MSG_RAND], rec.rm, CPI_RESULT1_RAND_SIZE);
+    memcpy(&p_item->msg[VERIFY_MSG_VERS], rec.vers, CPI_RESULT1_VERS_SIZE);
+    memcpy(p_item->result2, rec.sig, CPI_RESULT2_SIZE);
+
+    verify_set_key_id(p_item);
+
+    /*! public key packet: 10 bytes of header, the modulus, 2 bytes, and the exponent */
+    if(rec.flags & CPI_ARCHIVE_HAS_PKEY)
+    {
+        memcpy(p_item->pkey_n, &rec.pkey[10], VERIFY_N_SIZE);
+        memcpy(p_item->pkey_e, &rec.pkey[10 + VERIFY_N_SIZE + 2], 4);
+
+        p_item->has_pkey = 1;
+    }
+
+    return VERIFY_OK;
+}
+
+int verify_parse(verify_item *p_item)
+{
+    long res_size = 0;
+
+    char *req = 0, *res = 0;
+
+    int ret = VERIFY_E_READ;
+
+    if(p_item->p_archive != 0) { return verify_parse_record(p_item); }
+
+    req = verify_read_file(p_item->req_path, 0);
+    res = verify_read_file(p_item->res_path, &res_size);
+
+    if( (req != 0) && (res != 0) )
+    {
+        ret = verify_parse_request(p_item, req);
+
+        if(ret == VERIFY_OK) { ret = verify_parse_response(p_item, res, res_size); }
+    }
+
+    free(req);
+    free(res);
+
+    return ret;
+}
+
+/*! utility function to check a PKCS#1 v1.5 signature block (type 1) holding the specified SHA-1 hash */
+static int verify_signature_block(const uint8_t *block, int size, const uint8_t *hash)
+{
+    int pad_end = size - 20 - (int)sizeof(verify_sha1_prefix) - 1, v;
+
+    /*! at least 8 bytes of padding */
+    if( (block[0] != 0x00) || (block[1] != 0x01) || (pad_end < 2 + 8) ) { return VERIFY_E_PADDING; }
+
+    for(v=2;v<pad_end;v++) { if(block[v] != 0xFF) { return VERIFY_E_PADDING; } }
+
+    if( (block[pad_end] != 0x00) || (memcmp(&block[pad_end + 1], verify_sha1_prefix, sizeof(verify_sha1_prefix)) != 0) ) { return VERIFY_E_PADDING; }
+
+    if(memcmp(&block[size - 20], hash, 20) != 0) { return VERIFY_E_HASH; }
+
+    return VERIFY_OK;
+}
+
+/*! utility function to check the owner key block: 00 02, non-zero padding, 00, then the 16 byte owner key */
+static int verify_owner_block(const uint8_t *block)
+{
+    int v;
+
+    if( (block[0] != 0x00) || (block[1] != 0x02) ) { return VERIFY_E_OWNER_KEY; }
+
+    for(v=2;v<CPI_RESULT1_ENC_OK_SIZE-16-1;v++) { if(block[v] == 0x00) { return VERIFY_E_OWNER_KEY; } }
+
+    if(block[CPI_RESULT1_ENC_OK_SIZE-16-1] != 0x00) { return VERIFY_E_OWNER_KEY; }
+
+    return VERIFY_OK;
+}
+
+int verify_prepare(const verify_options *p_options, verify_item *p_item)
+{
+    /*! find the public key: from the key files of the lot, or as reported by the CP */
+    if(p_options->p_keys != 0)
+    {
+        const keystore_key *p_key = verify_find_key(p_options->p_keys, p_item->pid, &p_item->unit);
+
+        if(p_key == 0) { return VERIFY_E_KEY; }
+
+        if(p_key->key_id != p_item->key_id) { return VERIFY_E_KEY_ID; }
+
+        if( p_item->has_pkey && ((memcmp(p_key->n, p_item->pkey_n, VERIFY_N_SIZE) != 0) || (memcmp(p_key->e, p_item->pkey_e, 4) != 0)) ) { return VERIFY_E_PKEY; }
+
+        p_item->n = p_key->n;
+        p_item->e = p_key->e;
+
+        /*! hash of PIDx, as computed when the keystore was built */
+        memcpy(&p_item->msg[VERIFY_MSG_PID_HASH], p_key->pid_hash, 20);
+    }
+    else
+    {
+        hash_state cur_hash_state;
+
+        if(!p_item->has_pkey) { return VERIFY_E_KEY; }
+
+        p_item->n = p_item->pkey_n;
+        p_item->e = p_item->pkey_e;
+
+        /*! calculate hash of PIDx */
+        sha1_desc.init(&cur_hash_state);
+        sha1_desc.process(&cur_hash_state, p_item->pid, 0x10);
+        sha1_desc.done(&cur_hash_state, &p_item->msg[VERIFY_MSG_PID_HASH]);
+    }
+
+    /*! validate that returned version is equal to expected version */
+    if( (p_options->vers != 0) && (memcmp(p_options->vers, &p_item->msg[VERIFY_MSG_VERS], CPI_RESULT1_VERS_SIZE) != 0) ) { return VERIFY_E_VERS; }
+
+    /*! the message is complete, and is hashed as it is (see verify_hash) */
+    mbsha1_pad(p_item->msg, VERIFY_MSG_SIZE);
+
+    return VERIFY_OK;
+}
+
+void verify_hash(verify_item **items, int count)
+{
+    const uint8_t *msgs[VERIFY_BATCH_SIZE];
+
+    uint8_t *digests[VERIFY_BATCH_SIZE];
+
+    int v, i;
+
+    /*! calculate full hash (x, H(PIDx), rn) with (rm, Paqs(OK), vers), of several items at once */
+    for(v=0;v<count;v+=VERIFY_BATCH_SIZE)
+    {
+        int cur_count = (count - v < VERIFY_BATCH_SIZE) ? count - v : VERIFY_BATCH_SIZE;
+
+        for(i=0;i<cur_count;i++)
+        {
+            msgs[i] = items[v + i]->msg;
+            digests[i] = items[v + i]->full_hash;
+        }
+
+        mbsha1_hash(msgs, digests, cur_count, MBSHA1_BLOCKS(VERIFY_MSG_SIZE), 0);
+    }
+
+    return;
+}
+
+/*! utility function to invert each value mod N on its own, and validate rm_inv * rm mod N (failures are set in the items) */
+static void verify_invert_each(verify_item **items, int count, void *N, void **rm, void **binv, void *tmp)
+{
+    int v;
+
+    for(v=0;v<count;v++)
+    {
+        if(items[v]->result != VERIFY_OK) { continue; }
+
+        if( (ltc_mp.invmod(rm[v], N, binv[v]) != CRYPT_OK) ||
+            (ltc_mp.mulmod(binv[v], rm[v], N, tmp) != CRYPT_OK) ||
+            (ltc_mp.compare_d(tmp, 1) != LTC_MP_EQ) ) { items[v]->result = VERIFY_E_BLIND; }
+    }
+
+    return;
+}
+
+/*!
+  Utility function to invert every value mod N at once, with Montgomery's trick: the running
+  products rm[0]*..*rm[v] are inverted once, and each inverse is peeled off that with two
+  multiplications. That is one inversion and 3(count-1) multiplications instead of count inversions.
+
+  Returns 0 if the product is not invertible, in which case at least one value is not, and
+  binv holds nothing useful.
+*/
+static int verify_invert_batch(int count, void *N, void **rm, void **binv, void *acc, void *tmp)
+{
+    int v;
+
+    /*! binv[v] = rm[0] * .. * rm[v] */
+    if(ltc_mp.copy(rm[0], binv[0]) != CRYPT_OK) { return 0; }
+
+    for(v=1;v<count;v++) { if(ltc_mp.mulmod(binv[v-1], rm[v], N, binv[v]) != CRYPT_OK) { return 0; } }
+
+    /*! acc = (rm[0] * .. * rm[count-1])^-1, validated once for the whole batch */
+    if( (ltc_mp.invmod(binv[count-1], N, acc) != CRYPT_OK) ||
+        (ltc_mp.mulmod(acc, binv[count-1], N, tmp) != CRYPT_OK) ||
+        (ltc_mp.compare_d(tmp, 1) != LTC_MP_EQ) ) { return 0; }
+
+    /*! rm[v]^-1 = (rm[0] * .. * rm[v])^-1 * (rm[0] * .. * rm[v-1]), then drop rm[v] from acc */
+    for(v=count-1;v>0;v--)
+    {
+        if( (ltc_mp.mulmod(acc, binv[v-1], N, binv[v]) != CRYPT_OK) ||
+            (ltc_mp.mulmod(acc, rm[v], N, acc) != CRYPT_OK) ) { return 0; }
+    }
+
+    return ltc_mp.copy(acc, binv[0]) == CRYPT_OK;
+}
+
+int verify_unblind(verify_item **items, int count, int batched)
+{
+    /*! modulus, blinded random output data, blinding factor inverses, accumulator, temporary */
+    void *N = 0, *rm[VERIFY_BATCH_MAX], *binv[VERIFY_BATCH_MAX], *acc = 0, *tmp = 0;
+
+    int ret = VERIFY_OK, have_tmp = 0, ready = 0, v;
+
+    /*! larger batches are done in slices, to bound the number of live big numbers */
+    if(count > VERIFY_BATCH_MAX)
+    {
+        for(v=0;v<count;v+=VERIFY_BATCH_MAX)
+        {
+            int cur_ret = verify_unblind(&items[v], (count - v < VERIFY_BATCH_MAX) ? count - v : VERIFY_BATCH_MAX, batched);
+
+            if(cur_ret != VERIFY_OK) { ret = cur_ret; }
+        }
+
+        return ret;
+    }
+
+    if(count <= 0) { return VERIFY_OK; }
+
+    /*! initialize big numbers */
+    if(ltc_init_multi(&N, &acc, &tmp, NULL) != CRYPT_OK) { ret = VERIFY_E_MATH; goto cleanup; }
+
+    have_tmp = 1;
+
+    for(ready=0;ready<count;ready++)
+    {
+        if(ltc_init_multi(&rm[ready], &binv[ready], NULL) != CRYPT_OK) { ret = VERIFY_E_MATH; goto cleanup; }
+    }
+
+    if(ltc_mp.unsigned_read(N, (unsigned char*)items[0]->n, VERIFY_N_SIZE) != CRYPT_OK) { ret = VERIFY_E_MATH; goto cleanup; }
+
+    for(v=0;v<count;v++)
+    {
+        if(ltc_mp.unsigned_read(rm[v], &items[v]->msg[VERIFY_MSG_RAND], CPI_RESULT1_RAND_SIZE) != CRYPT_OK) { ret = VERIFY_E_MATH; goto cleanup; }
+
+        /*! zero is never invertible (and sends some inversion routines into a loop), it stands in as one for the batch */
+        if(ltc_mp.compare_d(rm[v], 0) == LTC_MP_EQ) { items[v]->result = VERIFY_E_BLIND; ltc_mp.unsigned_read(rm[v], (unsigned char*)"\x01", 1); }
+    }
+
+    /*! perform extended euclidean algorithm to undo blinding values, one by one if any of them is not invertible */
+    if( !batched || (count == 1) || !verify_invert_batch(count, N, rm, binv, acc, tmp) ) { verify_invert_each(items, count, N, rm, binv, tmp); }
+
+    /*! unblind messages */
+    for(v=0;v<count;v++)
+    {
+        unsigned long size = 0;
+
+        if(items[v]->result != VERIFY_OK) { continue; }
+
+        if( (ltc_mp.unsigned_read(acc, items[v]->result2, CPI_RESULT2_SIZE) != CRYPT_OK) ||
+            (ltc_mp.mulmod(binv[v], acc, N, tmp) != CRYPT_OK) ) { items[v]->result = VERIFY_E_MATH; continue; }
+
+        size = ltc_mp.unsigned_size(tmp);
+
+        if(size > VERIFY_N_SIZE) { items[v]->result = VERIFY_E_MATH; continue; }
+
+        memset(items[v]->sig_unblind, 0, VERIFY_N_SIZE);
+
+        ltc_mp.unsigned_write(tmp, &items[v]->sig_unblind[VERIFY_N_SIZE - size]);
+    }
+
+cleanup:
+
+    /*! cleanup big numbers */
+    for(v=0;v<ready;v++) { ltc_deinit_multi(rm[v], binv[v], NULL); }
+
+    if(have_tmp) { ltc_deinit_multi(N, acc, tmp, NULL); }
+
+    if(ret != VERIFY_OK) { for(v=0;v<count;v++) { if(items[v]->result == VERIFY_OK) { items[v]->result = ret; } } }
+
+    return ret;
+}
+
+/*! utility function to finish checking an unblinded item */
+static int verify_finish(const verify_options *p_options, verify_context *p_ctx, verify_item *p_item)
+{
+    uint8_t *enc_owner_key = &p_item->msg[VERIFY_MSG_ENC_OK];
+
+    uint8_t block[CPI_RESULT1_ENC_OK_SIZE];
+
+    const verify_mont *p_mont = verify_get_mont(p_ctx, p_item->n, VERIFY_N_SIZE);
+
+    int ret = VERIFY_OK;
+
+    /*! perform RSA Pubkey Op on signature, using appropriate public key */
+    if( (p_mont == 0) || (verify_mont_exptmod(p_mont, p_item->sig_unblind, p_item->e, 4, block) != CRYPT_OK) ) { return VERIFY_E_MATH; }
+
+    ret = verify_signature_block(block, VERIFY_N_SIZE, p_item->full_hash);
+
+    if(ret != VERIFY_OK) { return ret; }
+
+    /*! perform RSA Privkey Op on owner key, using the owner's private exponent in place of the public one */
+    if(p_options->p_owner != 0)
+    {
+        p_mont = verify_get_mont(p_ctx, p_options->p_owner->n, CPI_RESULT1_ENC_OK_SIZE);
+
+        /*! fails if the owner modulus is even, or the encrypted owner key is not less than it */
+        if( (p_mont == 0) || (verify_mont_exptmod(p_mont, enc_owner_key, p_options->p_owner->d, CPI_RESULT1_ENC_OK_SIZE, block) != CRYPT_OK) ) { return VERIFY_E_OWNER_KEY; }
+
+        ret = verify_owner_block(block);
+    }
+
+    return ret;
+}
+
+void verify_check_batch(const verify_options *p_options, verify_context *p_ctx, verify_item **items, int count)
+{
+    int v;
+
+    verify_unblind(items, count, p_options->batch_size != 1);
+
+    for(v=0;v<count;v++) { if(items[v]->result == VERIFY_OK) { items[v]->result = verify_finish(p_options, p_ctx, items[v]); } }
+
+    return;
+}
+
+int verify_check(const verify_options *p_options, verify_item *p_item)
+{
+    p_item->result = verify_prepare(p_options, p_item);
+
+    if(p_item->result == VERIFY_OK)
+    {
+        verify_context ctx;
+
+        verify_hash(&p_item, 1);
+
+        verify_init_context(&ctx);
+
+        verify_check_batch(p_options, &ctx, &p_item, 1);
+
+        verify_free_context(&ctx);
+    }
+
+    return p_item->result;
+}
+
+int verify_decrypt_owner(verify_context *p_ctx, const verify_crt_key *p_key, const uint8_t *enc_owner_key, uint8_t *owner_key)
+{
+    /*! Montgomery contexts of q and p, set up by the first decryption of each thread */
+    const verify_mont *p_mont_q = verify_get_mont(p_ctx, p_key->q, VERIFY_CRT_SIZE), *p_mont_p = verify_get_mont(p_ctx, p_key->p, VERIFY_CRT_SIZE);
+
+    uint8_t block[CPI_RESULT1_ENC_OK_SIZE];
+
+    /*! ciphertext, modulus, c^dP mod p, c^dQ mod q, q^-1 mod p, temporary */
+    void *c = 0, *N = 0, *m1 = 0, *m2 = 0, *QI = 0, *tmp = 0;
+
+    int ret = VERIFY_OK;
+
+    if( (p_mont_p == 0) || (p_mont_q == 0) ) { return VERIFY_E_MATH; }
+
+    /*! initialize big numbers */
+    if(ltc_init_multi(&c, &N, &m1, &m2, &QI, &tmp, NULL) != CRYPT_OK) { return VERIFY_E_MATH; }
+
+    if( (ltc_mp.unsigned_read(c, (unsigned char*)enc_owner_key, CPI_RESULT1_ENC_OK_SIZE) != CRYPT_OK) ||
+        (ltc_mp.unsigned_read(N, (unsigned char*)p_key->n, CPI_RESULT1_ENC_OK_SIZE) != CRYPT_OK) ||
+        (ltc_mp.unsigned_read(QI, (unsigned char*)p_key->qi, VERIFY_CRT_SIZE) != CRYPT_OK) ) { ret = VERIFY_E_MATH; goto cleanup; }
+
+    /*! fails if the encrypted owner key is not less than the owner modulus */
+    if(ltc_mp.compare(c, N) != LTC_MP_LT) { ret = VERIFY_E_OWNER_KEY; goto cleanup; }
+
+    /*! m1 = c^dP mod p, m2 = c^dQ mod q */
+    if( (ltc_mp.mpdiv(c, p_mont_p->N, NULL, m1) != CRYPT_OK) || (verify_mont_power(p_mont_p, m1, p_key->dp, VERIFY_CRT_SIZE, m1) != CRYPT_OK) ||
+        (ltc_mp.mpdiv(c, p_mont_q->N, NULL, m2) != CRYPT_OK) || (verify_mont_power(p_mont_q, m2, p_key->dq, VERIFY_CRT_SIZE, m2) != CRYPT_OK) ) { ret = VERIFY_E_MATH; goto cleanup; }
+
+    /*! m = m2 + q * ((m1 - m2) * qInv mod p), keeping every number positive */
+    if( (ltc_mp.mpdiv(m2, p_mont_p->N, NULL, tmp) != CRYPT_OK) || (verify_sub_mod(m1, tmp, p_mont_p->N) != CRYPT_OK) ||
+        (ltc_mp.mulmod(m1, QI, p_mont_p->N, m1) != CRYPT_OK) || (ltc_mp.mul(m1, p_mont_q->N, m1) != CRYPT_OK) ||
+        (ltc_mp.add(m1, m2, m1) != CRYPT_OK) || !verify_store_number(m1, block, CPI_RESULT1_ENC_OK_SIZE) ) { ret = VERIFY_E_MATH; goto cleanup; }
+
+    /*! 00 02, non-zero padding, 00, then the owner key */
+    ret = verify_owner_block(block);
+
+    if(ret == VERIFY_OK) { memcpy(owner_key, &block[CPI_RESULT1_ENC_OK_SIZE - 16], 16); }
+
+cleanup:
+
+    /*! cleanup big numbers */
+    ltc_deinit_multi(c, N, m1, m2, QI, tmp, NULL);
+
+    return ret;
+}
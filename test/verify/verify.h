@@ -0,0 +1,239 @@
+/*
+ * verify.h
+ *
+ * agent <agent@local>
+ * (c) Copyright 2026
+ * All rights reserved
+ *
+ * This API defines the challenge-response verification engine used by
+ * cpi-verify. It checks CHAL results the same way as test/src/main.c does for
+ * a single live challenge, and test/production_test/check_cp.pl does for
+ * collected response files.
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "cp_interface.h"
+#include "keystore.h"
+#include "mbsha1.h"
+#include "respscan.h"
+#include "archive.h"
+
+#include <stdint.h>
+
+/*! \name verification results */
+/*! \{ */
+#define VERIFY_OK               0x00    /*!< Every check passed */
+#define VERIFY_E_READ           0x01    /*!< Request or response file could not be read */
+#define VERIFY_E_PARSE          0x02    /*!< File is malformed, e.g. a response without pidx or chal data, or a truncated keystore */
+#define VERIFY_E_KEY            0x03    /*!< No public key for the reported PIDx */
+#define VERIFY_E_KEY_ID         0x04    /*!< Key was found under a different key ID than the one challenged */
+#define VERIFY_E_PKEY           0x05    /*!< Public key reported by the CP differs from the key file */
+#define VERIFY_E_VERS           0x06    /*!< Version in the challenge result is not the expected one */
+#define VERIFY_E_BLIND          0x07    /*!< rm is not invertible mod N */
+#define VERIFY_E_PADDING        0x08    /*!< Unblinded signature is not a PKCS#1 v1.5 SHA-1 signature block */
+#define VERIFY_E_HASH           0x09    /*!< Signed hash differs from the full hash */
+#define VERIFY_E_OWNER_KEY      0x0A    /*!< Owner key does not decrypt to a PKCS#1 v1.5 encryption block */
+#define VERIFY_E_MATH           0x0B    /*!< Big number operation failed */
+#define VERIFY_E_PRIV_KEY       0x0C    /*!< Parts of a private key do not belong together */
+#define VERIFY_RESULT_COUNT     0x0D
+/*! \} */
+
+/*! verification result strings, indexed by VERIFY_ result */
+extern const char *VERIFY_RESULT_LOOKUP[VERIFY_RESULT_COUNT];
+
+/*! size of a CP public key modulus, in bytes */
+#define VERIFY_N_SIZE           CPI_RESULT2_SIZE
+
+/*! \name layout of the message covered by the full hash: (x, H(PIDx), rn) with (rm, Paqs(OK), vers) */
+/*! \{ */
+#define VERIFY_MSG_ENC_OK       0                                               /*!< encrypted owner key */
+#define VERIFY_MSG_RNDX         (VERIFY_MSG_ENC_OK + CPI_RESULT1_ENC_OK_SIZE)   /*!< challenge random data (rn) */
+#define VERIFY_MSG_RAND         (VERIFY_MSG_RNDX + CPI_RNDX_SIZE)               /*!< blinding value (rm) */
+#define VERIFY_MSG_KEY_ID       (VERIFY_MSG_RAND + CPI_RESULT1_RAND_SIZE)       /*!< 00 00, then the key ID, big endian */
+#define VERIFY_MSG_PID_HASH     (VERIFY_MSG_KEY_ID + 4)                         /*!< SHA-1 of the putative ID */
+#define VERIFY_MSG_VERS         (VERIFY_MSG_PID_HASH + 20)                      /*!< version */
+#define VERIFY_MSG_SIZE         (VERIFY_MSG_VERS + CPI_RESULT1_VERS_SIZE)
+/*! \} */
+
+/*! size of the message buffer of an item, SHA-1 padding included */
+#define VERIFY_MSG_BUFFER_SIZE  (MBSHA1_BLOCKS(VERIFY_MSG_SIZE) * MBSHA1_BLOCK_SIZE)
+
+/*! default number of items sharing a modulus which are unblinded together */
+#define VERIFY_BATCH_SIZE       0x40
+/*! maximum number of items unblinded together (larger batches are sliced) */
+#define VERIFY_BATCH_MAX        0x100
+
+/*! number of Montgomery contexts kept by each verify_context */
+#define VERIFY_MONT_CACHE       0x08
+/*! largest modulus of a Montgomery context, in bytes (the owner key) */
+#define VERIFY_MONT_MAX_SIZE    CPI_RESULT1_ENC_OK_SIZE
+
+/*! public keys of every CP in a lot: mapped keystores, then one image built from key files */
+typedef struct _verify_keys
+{
+    keystore        *stores;            /*!< open keystores, searched in order */
+    int              store_count;       /*!< number of open keystores */
+    keystore_builder builder;           /*!< keys of key files, until verify_finish_keys */
+}
+verify_keys;
+
+/*! owner key, for checking the encrypted owner key (optional) */
+typedef struct _verify_owner
+{
+    uint8_t n[CPI_RESULT1_ENC_OK_SIZE];     /*!< modulus, big endian */
+    uint8_t d[CPI_RESULT1_ENC_OK_SIZE];     /*!< private exponent, big endian */
+}
+verify_owner;
+
+/*! size of each prime of the owner key, and of its CRT exponents, in bytes */
+#define VERIFY_CRT_SIZE         (CPI_RESULT1_ENC_OK_SIZE / 2)
+
+/*! owner private key, with its CRT parameters computed once (see verify_load_crt_key) */
+typedef struct _verify_crt_key
+{
+    uint8_t n[CPI_RESULT1_ENC_OK_SIZE];     /*!< modulus, big endian */
+    uint8_t p[VERIFY_CRT_SIZE];             /*!< first prime, big endian */
+    uint8_t q[VERIFY_CRT_SIZE];             /*!< second prime, big endian */
+    uint8_t dp[VERIFY_CRT_SIZE];            /*!< d mod (p-1), big endian */
+    uint8_t dq[VERIFY_CRT_SIZE];            /*!< d mod (q-1), big endian */
+    uint8_t qi[VERIFY_CRT_SIZE];            /*!< q^-1 mod p, big endian */
+}
+verify_crt_key;
+
+/*! verification settings, shared by every item */
+typedef struct _verify_options
+{
+    const verify_keys  *p_keys;         /*!< key files of the lot, or null to trust the key reported by the CP */
+    const verify_owner *p_owner;        /*!< owner key, or null to skip the owner key check */
+    const uint8_t      *vers;           /*!< CPI_RESULT1_VERS_SIZE bytes of expected version, or null for any */
+    int                 batch_size;     /*!< items per unblinding batch (0 for VERIFY_BATCH_SIZE, 1 to invert each rm on its own) */
+}
+verify_options;
+
+/*! Montgomery context of one modulus, set up once and reused for every response under that key */
+typedef struct _verify_mont
+{
+    uint8_t  n[VERIFY_MONT_MAX_SIZE];       /*!< modulus, big endian */
+    int      size;                          /*!< size of the modulus in bytes, 0 if unused */
+    uint32_t last_use;                      /*!< verify_context clock at the last lookup */
+    void    *N;                             /*!< modulus */
+    void    *rho;                           /*!< reduction constant, from montgomery_setup */
+    void    *R;                             /*!< R mod N, one in Montgomery form */
+    void    *R2;                            /*!< R^2 mod N, to bring numbers into Montgomery form */
+}
+verify_mont;
+
+/*! per thread state of the engine */
+typedef struct _verify_context
+{
+    verify_mont mont[VERIFY_MONT_CACHE];    /*!< cached Montgomery contexts, least recently used evicted first */
+    uint32_t    clock;                      /*!< lookup counter */
+}
+verify_context;
+
+/*! one request/response pair, and its verification result */
+typedef struct _verify_item
+{
+    const char *req_path;                   /*!< (INP) query XML given to cpi */
+    const char *res_path;                   /*!< (INP) response XML written by cpi */
+    const archive *p_archive;               /*!< (INP) archive holding the pair in place of the XML files, or null */
+    uint32_t    record;                     /*!< (INP) record of the pair in the archive */
+
+    uint16_t key_id;                        /*!< challenged key ID */
+    uint8_t  pid[0x10];                     /*!< putative ID reported by the CP */
+    uint8_t  msg[VERIFY_MSG_BUFFER_SIZE];   /*!< request and result 1, parsed in place as VERIFY_MSG_ lays them out */
+    uint8_t  result2[CPI_RESULT2_SIZE];     /*!< blinded signature */
+    int      has_pkey;                      /*!< set if the response has a public key */
+    uint8_t  pkey_n[VERIFY_N_SIZE];         /*!< public key modulus reported by the CP */
+    uint8_t  pkey_e[4];                     /*!< public key exponent reported by the CP */
+
+    const uint8_t *n;                       /*!< modulus of the key, once prepared */
+    const uint8_t *e;                       /*!< exponent of the key, once prepared */
+    uint8_t  full_hash[20];                 /*!< expected signed hash, once hashed */
+    uint8_t  sig_unblind[VERIFY_N_SIZE];    /*!< signature with blinding undone, once unblinded */
+
+    int         result;                     /*!< (OUT) VERIFY_ result */
+    const char *unit;                       /*!< (OUT) name of the CP, if its key was found */
+}
+verify_item;
+
+/*! register the hash and math descriptors used by the engine (call once, before any other thread starts) */
+int verify_init(void);
+
+/*! prepare an empty per thread context */
+void verify_init_context(verify_context *p_ctx);
+
+/*! release the Montgomery contexts of a per thread context */
+void verify_free_context(verify_context *p_ctx);
+
+/*! find the Montgomery context of an odd modulus of size bytes, setting it up on first use (returns 0 on failure) */
+const verify_mont *verify_get_mont(verify_context *p_ctx, const uint8_t *n, int size);
+
+/*! out = in^exp mod N, with in and out p_mont->size bytes (returns CRYPT_ result, CRYPT_PK_INVALID_SIZE if in is not less than N) */
+int verify_mont_exptmod(const verify_mont *p_mont, const uint8_t *in, const uint8_t *exp, int exp_size, uint8_t *out);
+
+/*! c = a^exp mod N, for big numbers a less than N and c (returns CRYPT_ result) */
+int verify_mont_power(const verify_mont *p_mont, void *a, const uint8_t *exp, int exp_size, void *c);
+
+/*! add keys to the lot: keystore images are mapped, and other key files or directories are collected (returns VERIFY_ result) */
+int verify_add_keys(verify_keys *p_keys, const char *path);
+
+/*! build the collected key files into a keystore, once every path was added (returns VERIFY_ result) */
+int verify_finish_keys(verify_keys *p_keys);
+
+/*! release the keys of a lot */
+void verify_free_keys(verify_keys *p_keys);
+
+/*! find the key with the specified putative ID, and the name of its CP (returns 0 if none) */
+const keystore_key *verify_find_key(const verify_keys *p_keys, const uint8_t *pid, const char **p_unit);
+
+/*! load an owner key from two files holding the raw modulus and private exponent, as written by find_numbers */
+int verify_load_owner(verify_owner *p_owner, const char *n_path, const char *d_path);
+
+/*! load an owner private key from files holding the raw n, e, d, p and q (as decrypt_test.pl takes them), check it, and compute its CRT parameters (returns VERIFY_ result) */
+int verify_load_crt_key(verify_crt_key *p_key, const char *n_path, const char *e_path, const char *d_path, const char *p_path, const char *q_path);
+
+/*! decrypt an encrypted owner key with the CRT and check its PKCS#1 v1.5 type 2 padding, writing the 16 byte owner key (returns VERIFY_ result) */
+int verify_decrypt_owner(verify_context *p_ctx, const verify_crt_key *p_key, const uint8_t *enc_owner_key, uint8_t *owner_key);
+
+/*! parse the key ID and random data of the challenge in a query document (returns VERIFY_ result) */
+int verify_parse_query(const char *doc, uint16_t *p_key_id, uint8_t *rndx);
+
+/*! read and parse the request and response of an item, or fetch them from its archive (returns VERIFY_ result) */
+int verify_parse(verify_item *p_item);
+
+/*! find the key of a parsed item, and complete the message its signature covers (returns VERIFY_ result) */
+int verify_prepare(const verify_options *p_options, verify_item *p_item);
+
+/*! compute the full hash of prepared items, as many at a time as the CPU allows */
+void verify_hash(verify_item **items, int count);
+
+/*!
+  Undo the blinding of the signatures of prepared items which share one modulus. If batched,
+  all blinding values are inverted together (see verify_invert_batch), falling back to one
+  inversion per item if any of them is not invertible. Items which fail get their result set.
+  Returns VERIFY_E_MATH if big numbers could not be allocated, VERIFY_OK otherwise.
+*/
+int verify_unblind(verify_item **items, int count, int batched);
+
+/*! check prepared items which share one modulus, setting their results */
+void verify_check_batch(const verify_options *p_options, verify_context *p_ctx, verify_item **items, int count);
+
+/*! prepare, hash and check one parsed item on its own (returns VERIFY_ result) */
+int verify_check(const verify_options *p_options, verify_item *p_item);
+
+/*! read a whole file, null terminated (returns 0 on failure; free the result) */
+char *verify_read_file(const char *path, long *p_size);
+
+/*! parse exactly size bytes of hex, ignoring whitespace and '-' separators (returns 1 on success) */
+int verify_hex(const char *str, int len, uint8_t *out, int size);
+
+/*! list the regular files of a directory whose names have the specified prefix and suffix, in version order (returns the count, or -1; free each path and the list) */
+int verify_list_dir(const char *dir_path, const char *prefix, const char *suffix, char ***p_paths);
+
+/*! benchmark the big number work of the engine on 1024 and 2048 bit keys, count operations of each kind (returns VERIFY_ result) */
+int verify_bench_math(int count);
+
+#endif